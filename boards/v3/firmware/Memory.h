@@ -0,0 +1,38 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_MEMORY__
+#define __H_MEMORY__
+
+#include <Arduino.h>
+
+// Tracks how close the stack has come to the heap. Free RAM between them is
+// painted with a known pattern at boot and later scans count how much of it
+// has never been touched.
+namespace Memory {
+const uint32_t PAINT = 0xA5A5A5A5;
+
+// fills [start, end) with the paint pattern. both are rounded inwards to
+// whole words.
+void paint(void *start, void *end);
+
+// number of bytes from start up to the first word in [start, end) which
+// doesn't hold the paint pattern.
+unsigned int paintedBytes(const void *start, const void *end);
+
+// paints free RAM below the current stack. call this as early as possible.
+void paintStack();
+
+// rescans painted RAM and updates the high-water marks.
+void update();
+
+// smallest number of free bytes seen between the heap and the stack.
+unsigned int getMinFreeStack();
+
+// bytes allocated by the heap. the heap never shrinks, so this is also its
+// high-water mark.
+unsigned int getHeapUsed();
+};  // namespace Memory
+
+#endif
@@ -0,0 +1,104 @@
+// This file is part of the Waggle Platform.  Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.  For more details on the Waggle project, visit:
+//          http://www.wa8.gl
+#include <benchmark/benchmark.h>
+
+#include "commands.h"
+
+// the commands only need to exist for the table to link.
+#define COMMAND_STUB(name, func, ...) \
+    byte func(byte argc, const char **argv) { return 0; }
+
+COMMANDS(COMMAND_STUB)
+
+// the lookup the firmware used before the hashed switch: a RAM table of name
+// pointers, searched in order with strcmp.
+struct LinearCommand {
+    const char *name;
+    byte (*func)(byte, const char **);
+};
+
+#define LINEAR_ENTRY(name, func, ...) {#name, func},
+
+static LinearCommand linearCommands[] = {COMMANDS(LINEAR_ENTRY){NULL, NULL}};
+
+static byte (*findLinear(const char *name))(byte, const char **) {
+    for (byte i = 0; linearCommands[i].name != NULL; i++) {
+        if (strcmp(linearCommands[i].name, name) == 0) {
+            return linearCommands[i].func;
+        }
+    }
+
+    return NULL;
+}
+
+// every command name, copied out to buffers like the ones the serial parser
+// fills, so the lookups can't be folded at compile time.
+#define NAME_ENTRY(name, ...) #name,
+
+static const char *const NAMES[] = {COMMANDS(NAME_ENTRY)};
+
+struct Names {
+    Names() {
+        for (byte i = 0; i < COMMAND_COUNT; i++) {
+            strcpy(names[i], NAMES[i]);
+        }
+
+        strcpy(unknown, "nope");
+    }
+
+    char names[COMMAND_COUNT][COMMAND_NAME_SIZE];
+    char unknown[COMMAND_NAME_SIZE];
+};
+
+static Names names;
+
+// each benchmark looks up every command in turn, so the times are per lookup
+// averaged over the whole command set.
+static void BM_FindCommandLinear(benchmark::State &state) {
+    byte i = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findLinear(names.names[i]));
+        i = (i + 1) % COMMAND_COUNT;
+    }
+}
+BENCHMARK(BM_FindCommandLinear);
+
+static void BM_FindCommandHashed(benchmark::State &state) {
+    Command command;
+    byte i = 0;
+
+    for (byte n = 0; n < COMMAND_COUNT; n++) {
+        if (!findCommand(names.names[n], command) ||
+            command.func != linearCommands[n].func) {
+            state.SkipWithError("findCommand didn't find a command");
+            return;
+        }
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findCommand(names.names[i], command));
+        benchmark::DoNotOptimize(command);
+        i = (i + 1) % COMMAND_COUNT;
+    }
+}
+BENCHMARK(BM_FindCommandHashed);
+
+// a name which isn't a command scans the whole table with the old lookup.
+static void BM_FindCommandLinearUnknown(benchmark::State &state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findLinear(names.unknown));
+    }
+}
+BENCHMARK(BM_FindCommandLinearUnknown);
+
+static void BM_FindCommandHashedUnknown(benchmark::State &state) {
+    Command command;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findCommand(names.unknown, command));
+    }
+}
+BENCHMARK(BM_FindCommandHashedUnknown);
@@ -0,0 +1,16 @@
+// This file is part of the Waggle Platform.  Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.  For more details on the Waggle project, visit:
+//          http://www.wa8.gl
+#ifndef __H_ARDUINO__
+#define __H_ARDUINO__
+
+// just enough of the Arduino core to build the command table on the host.
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#endif
@@ -0,0 +1,14 @@
+// This file is part of the Waggle Platform.  Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.  For more details on the Waggle project, visit:
+//          http://www.wa8.gl
+#ifndef __H_PGMSPACE__
+#define __H_PGMSPACE__
+
+#include <string.h>
+
+// the host has one address space, so flash reads are plain copies.
+#define PROGMEM
+#define memcpy_P memcpy
+
+#endif
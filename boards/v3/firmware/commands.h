@@ -1,10 +1,29 @@
 #include <Arduino.h>
+#include <avr/pgmspace.h>
 
+// Commands are looked up by a hash of their name. The same function is used at
+// compile time to generate the dispatch switch, so any collision between two
+// command names is a duplicate case error instead of a runtime bug.
+constexpr uint16_t commandHash(const char *s, uint16_t h = 5381) {
+    return *s == '\0' ? h : commandHash(s + 1, (h * 33) ^ (byte)*s);
+}
+
+static const byte COMMAND_NAME_SIZE = 8;
+static const byte ANY_ARGS = 255;
+
+// Command table entries live in flash. Argument counts don't include the
+// command name and bit i of numericArgs requires argument i to be a number.
 struct Command {
-    const char *name;
+    char name[COMMAND_NAME_SIZE];
     byte (*func)(byte, const char **);
+    byte minArgs;
+    byte maxArgs;
+    byte numericArgs;
 };
 
+// checks argc and argv, which include the command name, against the schema.
+bool validCommandArgs(const Command &command, byte argc, const char **argv);
+
 byte commandRTC(byte argc, const char **argv);
 byte commandStart(byte argc, const char **argv);
 byte commandStop(byte argc, const char **argv);
@@ -31,3 +50,44 @@ byte commandWatch(byte argc, const char **argv);
 byte commandBoots(byte argc, const char **argv);
 byte commandVersion(byte argc, const char **argv);
 byte commandBLFlag(byte argc, const char **argv);
+
+// name, function, min args, max args, numeric args mask. names are at most 7
+// characters. the schema only bounds the argument count, so handlers taking
+// one of a few counts, like date with 0 or 6, check it themselves and return
+// ERROR_INVALID_ARGC.
+#define COMMANDS(X)                              \
+  X(rtc, commandRTC, 0, ANY_ARGS, 0)             \
+  X(ping, commandPing, 1, 1, 0x01)               \
+  X(start, commandStart, 1, 1, 0x01)             \
+  X(stop, commandStop, 1, 2, 0x03)               \
+  X(reset, commandReset, 0, 1, 0x01)             \
+  X(id, commandID, 0, ANY_ARGS, 0)               \
+  X(cu, commandCurrent, 0, ANY_ARGS, 0)          \
+  X(hb, commandHeartbeat, 0, ANY_ARGS, 0)        \
+  X(env, commandEnvironment, 0, ANY_ARGS, 0)     \
+  X(bs, commandBootMedia, 1, 2, 0x01)            \
+  X(th, commandThermistor, 0, ANY_ARGS, 0)       \
+  X(date, commandDate, 0, 6, 0x3f)               \
+  X(bf, commandBootFlags, 0, ANY_ARGS, 0)        \
+  X(fc, commandFailCount, 0, ANY_ARGS, 0)        \
+  X(up, commandUptime, 0, ANY_ARGS, 0)           \
+  X(enable, commandEnable, 0, ANY_ARGS, 0xff)    \
+  X(disable, commandDisable, 0, ANY_ARGS, 0xff)  \
+  X(watch, commandWatch, 3, 3, 0x01)             \
+  X(log, commandLog, 0, 1, 0)                    \
+  X(eereset, commandResetEEPROM, 0, ANY_ARGS, 0) \
+  X(boots, commandBoots, 0, ANY_ARGS, 0)         \
+  X(ver, commandVersion, 0, ANY_ARGS, 0)         \
+  X(blf, commandBLFlag, 0, 1, 0)
+
+#define COMMAND_INDEX(name, ...) COMMAND_##name,
+
+enum { COMMANDS(COMMAND_INDEX) COMMAND_COUNT };
+
+// returns the index of the only command which could have this name or
+// COMMAND_COUNT if there's none.
+byte commandIndex(const char *name);
+
+// copies the command with this name out of flash. returns false if there's
+// none.
+bool findCommand(const char *name, Command &command);
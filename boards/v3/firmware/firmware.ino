@@ -5,6 +5,7 @@
 #include "Error.h"
 #include "Logger.h"
 #include "MCP79412RTC.h"
+#include "Memory.h"
 #include "Record.h"
 #include "Timer.h"
 #include "Wagman.h"
@@ -42,34 +43,6 @@ static byte bufferSize = 0;
 
 static time_t setupTime;
 
-Command commands[] = {
-    {"rtc", commandRTC},
-    {"ping", commandPing},
-    {"start", commandStart},
-    {"stop", commandStop},
-    // { "stop!", commandKill },
-    {"reset", commandReset},
-    {"id", commandID},
-    {"cu", commandCurrent},
-    {"hb", commandHeartbeat},
-    {"env", commandEnvironment},
-    {"bs", commandBootMedia},
-    {"th", commandThermistor},
-    {"date", commandDate},
-    {"bf", commandBootFlags},
-    {"fc", commandFailCount},
-    {"up", commandUptime},
-    {"enable", commandEnable},
-    {"disable", commandDisable},
-    {"watch", commandWatch},
-    {"log", commandLog},
-    {"eereset", commandResetEEPROM},
-    {"boots", commandBoots},
-    {"ver", commandVersion},
-    {"blf", commandBLFlag},
-    {NULL, NULL},
-};
-
 void printDate(const DateTime &dt) {
   Serial.print(dt.year);
   Serial.print(' ');
@@ -684,15 +657,8 @@ byte commandResetEEPROM(byte argc, const char **argv) {
 }
 
 void executeCommand(const char *sid, byte argc, const char **argv) {
-  byte (*func)(byte, const char **) = NULL;
-
-  // search for command and execute if found
-  for (byte i = 0; commands[i].name != NULL; i++) {
-    if (strcmp(commands[i].name, argv[0]) == 0) {
-      func = commands[i].func;
-      break;
-    }
-  }
+  Command command;
+  bool found = findCommand(argv[0], command);
 
   // marks the beginning of a response packet.
   Serial.print("<<<- sid=");
@@ -700,10 +666,12 @@ void executeCommand(const char *sid, byte argc, const char **argv) {
   Serial.print(' ');
   Serial.println(argv[0]);
 
-  if (func != NULL) {
-    func(argc, argv);
-  } else {
+  if (!found) {
     Serial.println("invalid command");
+  } else if (!validCommandArgs(command, argc, argv)) {
+    Serial.println("invalid args");
+  } else if (command.func(argc, argv) == ERROR_INVALID_ARGC) {
+    Serial.println("invalid args");
   }
 
   // marks the end of a response packet.
@@ -793,6 +761,7 @@ void deviceKilled(Device &device) {
 void setup() {
   MCUSR = 0;
   wdt_disable();
+  Memory::paintStack();
   bootflags = EEPROM.read(0x41);
   delay(4000);
   wdt_enable(WDTO_8S);
@@ -1214,4 +1183,14 @@ void logStatus() {
   }
 
   Logger::end();
+
+  delay(50);
+
+  Memory::update();
+
+  Logger::begin("mem");
+  Logger::log(Memory::getMinFreeStack());
+  Logger::log(' ');
+  Logger::log(Memory::getHeapUsed());
+  Logger::end();
 }
@@ -0,0 +1,651 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Archive.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+#include "Encoding.h"
+
+static const char BLOCK_MAGIC[4] = {'W', 'G', 'A', 'B'};
+static const size_t INDEX_ENTRY_SIZE = 32;
+
+// magic, size, first, last, rows, column count, time size.
+static const size_t BLOCK_FIXED_SIZE = 4 + 4 + 8 + 8 + 4 + 2 + 4;
+static const size_t CRC_SIZE = 4;
+
+// larger than any block this writes, so a corrupt size is caught early.
+static const uint32_t MAX_BLOCK_SIZE = 64 << 20;
+
+static uint32_t crc32(const uint8_t *data, size_t size) {
+  static uint32_t table[256];
+
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      }
+
+      table[i] = c;
+    }
+  }
+
+  uint32_t crc = 0xffffffff;
+
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc ^ 0xffffffff;
+}
+
+// everything on disk is little endian.
+static void putLE(std::string &out, uint64_t n, int size) {
+  for (int i = 0; i < size; i++) {
+    out += (char)((n >> (8 * i)) & 0xff);
+  }
+}
+
+static uint64_t getLE(const uint8_t *p, int size) {
+  uint64_t n = 0;
+
+  for (int i = size - 1; i >= 0; i--) {
+    n = (n << 8) | p[i];
+  }
+
+  return n;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+  size_t done = 0;
+
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return false;
+    }
+
+    done += n;
+  }
+
+  return true;
+}
+
+static std::string indexEntry(const BlockInfo &block) {
+  std::string entry;
+  putLE(entry, block.first, 8);
+  putLE(entry, block.last, 8);
+  putLE(entry, block.offset, 8);
+  putLE(entry, block.size, 4);
+  putLE(entry, block.rows, 4);
+  return entry;
+}
+
+static BlockInfo readIndexEntry(const uint8_t *p) {
+  BlockInfo block;
+  block.first = getLE(p, 8);
+  block.last = getLE(p + 8, 8);
+  block.offset = getLE(p + 16, 8);
+  block.size = getLE(p + 24, 4);
+  block.rows = getLE(p + 28, 4);
+  return block;
+}
+
+bool parseBlock(const uint8_t *data, size_t size, BlockHeader &header) {
+  if (size < BLOCK_FIXED_SIZE + CRC_SIZE ||
+      memcmp(data, BLOCK_MAGIC, 4) != 0 || getLE(data + 4, 4) != size) {
+    return false;
+  }
+
+  header.first = getLE(data + 8, 8);
+  header.last = getLE(data + 16, 8);
+  header.rows = getLE(data + 24, 4);
+  unsigned int count = getLE(data + 28, 2);
+  header.timeSize = getLE(data + 30, 4);
+  header.columns.resize(count);
+
+  size_t pos = BLOCK_FIXED_SIZE;
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (pos + 1 > size) {
+      return false;
+    }
+
+    size_t length = data[pos++];
+
+    if (pos + length + 4 > size) {
+      return false;
+    }
+
+    header.columns[i].name.assign((const char *)data + pos, length);
+    header.columns[i].size = getLE(data + pos + length, 4);
+    pos += length + 4;
+  }
+
+  header.timeOffset = pos;
+  pos += header.timeSize;
+
+  for (unsigned int i = 0; i < count; i++) {
+    header.columns[i].offset = pos;
+    pos += header.columns[i].size;
+  }
+
+  return pos + CRC_SIZE == size;
+}
+
+static bool checkBlock(const uint8_t *data, size_t size) {
+  return crc32(data, size - CRC_SIZE) == getLE(data + size - CRC_SIZE, 4);
+}
+
+// finds the whole, valid blocks in data, which starts at offset in the file.
+// returns how many bytes of data they cover.
+static size_t findBlocks(const uint8_t *data, size_t size, uint64_t offset,
+                         std::vector<BlockInfo> &blocks) {
+  size_t pos = 0;
+
+  while (pos + 8 <= size) {
+    uint32_t blockSize = getLE(data + pos + 4, 4);
+    BlockHeader header;
+
+    if (blockSize > MAX_BLOCK_SIZE || pos + blockSize > size ||
+        !parseBlock(data + pos, blockSize, header) ||
+        !checkBlock(data + pos, blockSize)) {
+      break;
+    }
+
+    BlockInfo block;
+    block.first = header.first;
+    block.last = header.last;
+    block.offset = offset + pos;
+    block.size = blockSize;
+    block.rows = header.rows;
+    blocks.push_back(block);
+    pos += blockSize;
+  }
+
+  return pos;
+}
+
+bool validNodeName(const std::string &name) {
+  if (name.empty() || name.size() > 64 || name[0] == '.') {
+    return false;
+  }
+
+  for (size_t i = 0; i < name.size(); i++) {
+    char c = name[i];
+
+    if (!isalnum((unsigned char)c) && c != '-' && c != '_' && c != '.') {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static std::string dataPath(const std::string &dir, const std::string &node) {
+  return dir + "/" + node + ".wga";
+}
+
+static std::string indexPath(const std::string &dir, const std::string &node) {
+  return dir + "/" + node + ".wgi";
+}
+
+static bool readFile(int fd, uint64_t offset, uint64_t size,
+                     std::string &data) {
+  data.resize(size);
+
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = pread(fd, &data[done], size - done, offset + done);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      return false;
+    }
+
+    done += n;
+  }
+
+  return true;
+}
+
+ArchiveWriter::ArchiveWriter()
+    : dataFd(-1), indexFd(-1), dataSize(0), last(INT64_MIN) {}
+
+ArchiveWriter::~ArchiveWriter() {
+  flush();
+  close();
+}
+
+void ArchiveWriter::close() {
+  if (dataFd >= 0) {
+    ::close(dataFd);
+    dataFd = -1;
+  }
+
+  if (indexFd >= 0) {
+    ::close(indexFd);
+    indexFd = -1;
+  }
+}
+
+bool ArchiveWriter::open(const std::string &dir, const std::string &node,
+                         std::string &error) {
+  if (!validNodeName(node)) {
+    error = "invalid node name: " + node;
+    return false;
+  }
+
+  std::string path = dataPath(dir, node);
+  dataFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if (dataFd < 0) {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+
+  path = indexPath(dir, node);
+  indexFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+  if (indexFd < 0) {
+    error = path + ": " + strerror(errno);
+    close();
+    return false;
+  }
+
+  // only one writer at a time. readers don't lock.
+  if (lockf(dataFd, F_TLOCK, 0) < 0) {
+    error = dataPath(dir, node) + ": already being written";
+    close();
+    return false;
+  }
+
+  if (!recover()) {
+    error = this->error;
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+bool ArchiveWriter::recover() {
+  struct stat st;
+
+  if (fstat(dataFd, &st) < 0) {
+    error = strerror(errno);
+    return false;
+  }
+
+  dataSize = st.st_size;
+
+  if (fstat(indexFd, &st) < 0) {
+    error = strerror(errno);
+    return false;
+  }
+
+  std::string data;
+
+  if (!readFile(indexFd, 0, st.st_size - st.st_size % INDEX_ENTRY_SIZE,
+                data)) {
+    error = strerror(errno);
+    return false;
+  }
+
+  // the index is written after its block, so it can only be behind the data
+  // file. keep the entries which agree with it.
+  uint64_t end = 0;
+  size_t entries = 0;
+
+  for (size_t pos = 0; pos < data.size(); pos += INDEX_ENTRY_SIZE) {
+    BlockInfo block = readIndexEntry((const uint8_t *)data.data() + pos);
+
+    if (block.offset != end || block.offset + block.size > dataSize) {
+      break;
+    }
+
+    end += block.size;
+    last = block.last;
+    entries++;
+  }
+
+  if (ftruncate(indexFd, entries * INDEX_ENTRY_SIZE) < 0) {
+    error = strerror(errno);
+    return false;
+  }
+
+  // index any whole blocks after that, and cut off what's left.
+  if (!readFile(dataFd, end, dataSize - end, data)) {
+    error = strerror(errno);
+    return false;
+  }
+
+  std::vector<BlockInfo> blocks;
+  size_t valid = findBlocks((const uint8_t *)data.data(), data.size(), end,
+                            blocks);
+
+  std::string entriesData;
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    entriesData += indexEntry(blocks[i]);
+    last = blocks[i].last;
+  }
+
+  if (lseek(indexFd, 0, SEEK_END) < 0 || !writeAll(indexFd, entriesData)) {
+    error = strerror(errno);
+    return false;
+  }
+
+  if (end + valid < dataSize) {
+    dataSize = end + valid;
+
+    if (ftruncate(dataFd, dataSize) < 0) {
+      error = strerror(errno);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool ArchiveWriter::add(int64_t time,
+                        const std::map<std::string, double> &values) {
+  if (time <= last || values.empty()) {
+    return false;
+  }
+
+  for (std::map<std::string, double>::const_iterator it = values.begin();
+       it != values.end(); ++it) {
+    if (it->first.empty() || it->first.size() > 255) {
+      return false;
+    }
+  }
+
+  times.push_back(time);
+  rows.push_back(values);
+  last = time;
+
+  if (times.size() >= BLOCK_ROWS) {
+    return flush();
+  }
+
+  return true;
+}
+
+bool ArchiveWriter::flush() {
+  if (times.empty() || dataFd < 0) {
+    return true;
+  }
+
+  std::set<std::string> names;
+
+  for (size_t i = 0; i < rows.size(); i++) {
+    for (std::map<std::string, double>::const_iterator it = rows[i].begin();
+         it != rows[i].end(); ++it) {
+      names.insert(it->first);
+    }
+  }
+
+  std::string timeData;
+  encodeTimes(times, timeData);
+
+  std::vector<std::string> columnData;
+  std::vector<double> values(rows.size());
+
+  for (std::set<std::string>::const_iterator name = names.begin();
+       name != names.end(); ++name) {
+    for (size_t i = 0; i < rows.size(); i++) {
+      std::map<std::string, double>::const_iterator it = rows[i].find(*name);
+      values[i] = (it != rows[i].end()) ? it->second : NAN;
+    }
+
+    columnData.push_back(std::string());
+    encodeValues(values, columnData.back());
+  }
+
+  std::string block(BLOCK_MAGIC, 4);
+  putLE(block, 0, 4);
+  putLE(block, times.front(), 8);
+  putLE(block, times.back(), 8);
+  putLE(block, times.size(), 4);
+  putLE(block, names.size(), 2);
+  putLE(block, timeData.size(), 4);
+
+  size_t i = 0;
+
+  for (std::set<std::string>::const_iterator name = names.begin();
+       name != names.end(); ++name, ++i) {
+    block += (char)name->size();
+    block += *name;
+    putLE(block, columnData[i].size(), 4);
+  }
+
+  block += timeData;
+
+  for (i = 0; i < columnData.size(); i++) {
+    block += columnData[i];
+  }
+
+  std::string size;
+  putLE(size, block.size() + CRC_SIZE, 4);
+  block.replace(4, 4, size);
+  putLE(block, crc32((const uint8_t *)block.data(), block.size()), 4);
+
+  BlockInfo info;
+  info.first = times.front();
+  info.last = times.back();
+  info.offset = dataSize;
+  info.size = block.size();
+  info.rows = times.size();
+
+  // the block has to be on disk before the index points at it.
+  if (lseek(dataFd, dataSize, SEEK_SET) < 0 || !writeAll(dataFd, block) ||
+      fdatasync(dataFd) < 0 || lseek(indexFd, 0, SEEK_END) < 0 ||
+      !writeAll(indexFd, indexEntry(info))) {
+    error = strerror(errno);
+    return false;
+  }
+
+  dataSize += block.size();
+  times.clear();
+  rows.clear();
+  return true;
+}
+
+ArchiveReader::ArchiveReader() : map(NULL), mapSize(0), read(0) {}
+
+ArchiveReader::~ArchiveReader() {
+  if (map != NULL) {
+    munmap((void *)map, mapSize);
+  }
+}
+
+bool ArchiveReader::open(const std::string &dir, const std::string &node,
+                         std::string &error) {
+  if (!validNodeName(node)) {
+    error = "invalid node name: " + node;
+    return false;
+  }
+
+  std::string path = dataPath(dir, node);
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+
+  if (fstat(fd, &st) < 0) {
+    error = path + ": " + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+
+  mapSize = st.st_size;
+
+  if (mapSize > 0) {
+    void *p = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+      error = path + ": " + strerror(errno);
+      ::close(fd);
+      return false;
+    }
+
+    map = (const uint8_t *)p;
+  }
+
+  ::close(fd);
+
+  // a missing or short index is rebuilt in memory from the blocks. the
+  // writer fixes it on disk the next time it opens the archive.
+  std::string data;
+  uint64_t end = 0;
+  fd = ::open(indexPath(dir, node).c_str(), O_RDONLY | O_CLOEXEC);
+
+  if (fd >= 0 && fstat(fd, &st) == 0 &&
+      readFile(fd, 0, st.st_size - st.st_size % INDEX_ENTRY_SIZE, data)) {
+    for (size_t pos = 0; pos < data.size(); pos += INDEX_ENTRY_SIZE) {
+      BlockInfo block = readIndexEntry((const uint8_t *)data.data() + pos);
+
+      if (block.offset != end || block.offset + block.size > mapSize) {
+        break;
+      }
+
+      index.push_back(block);
+      end += block.size;
+    }
+  }
+
+  if (fd >= 0) {
+    ::close(fd);
+  }
+
+  findBlocks(map + end, mapSize - end, end, index);
+  return true;
+}
+
+static bool compareLast(const BlockInfo &block, int64_t time) {
+  return block.last < time;
+}
+
+bool ArchiveReader::scan(int64_t from, int64_t to,
+                         const std::vector<std::string> &columns,
+                         RowVisitor &visitor, std::string &error) {
+  std::vector<int64_t> times;
+  std::vector<std::vector<double> > values(columns.size());
+  std::vector<const std::vector<double> *> sources(columns.size());
+  std::vector<double> missing;
+  std::vector<double> row(columns.size());
+
+  std::vector<BlockInfo>::const_iterator it =
+      std::lower_bound(index.begin(), index.end(), from, compareLast);
+
+  for (; it != index.end() && it->first <= to; ++it) {
+    const uint8_t *data = map + it->offset;
+    BlockHeader header;
+
+    if (!parseBlock(data, it->size, header)) {
+      error = "corrupt block";
+      return false;
+    }
+
+    read++;
+
+    if (!decodeTimes(data + header.timeOffset, header.timeSize, header.rows,
+                     times)) {
+      error = "corrupt block";
+      return false;
+    }
+
+    size_t start =
+        std::lower_bound(times.begin(), times.end(), from) - times.begin();
+    size_t end =
+        std::upper_bound(times.begin(), times.end(), to) - times.begin();
+
+    missing.assign(header.rows, NAN);
+
+    for (size_t c = 0; c < columns.size(); c++) {
+      sources[c] = &missing;
+
+      for (size_t k = 0; k < header.columns.size(); k++) {
+        const ColumnInfo &column = header.columns[k];
+
+        if (column.name != columns[c]) {
+          continue;
+        }
+
+        if (!decodeValues(data + column.offset, column.size, header.rows,
+                          values[c])) {
+          error = "corrupt block";
+          return false;
+        }
+
+        sources[c] = &values[c];
+        break;
+      }
+    }
+
+    for (size_t i = start; i < end; i++) {
+      for (size_t c = 0; c < columns.size(); c++) {
+        row[c] = (*sources[c])[i];
+      }
+
+      visitor.row(times[i], row.empty() ? NULL : &row[0]);
+    }
+  }
+
+  return true;
+}
+
+std::vector<std::string> ArchiveReader::columns() const {
+  std::set<std::string> names;
+
+  for (size_t i = 0; i < index.size(); i++) {
+    BlockHeader header;
+
+    if (parseBlock(map + index[i].offset, index[i].size, header)) {
+      for (size_t k = 0; k < header.columns.size(); k++) {
+        names.insert(header.columns[k].name);
+      }
+    }
+  }
+
+  return std::vector<std::string>(names.begin(), names.end());
+}
+
+size_t ArchiveReader::verify() const {
+  size_t bad = 0;
+
+  for (size_t i = 0; i < index.size(); i++) {
+    BlockHeader header;
+
+    if (!parseBlock(map + index[i].offset, index[i].size, header) ||
+        !checkBlock(map + index[i].offset, index[i].size)) {
+      bad++;
+    }
+  }
+
+  return bad;
+}
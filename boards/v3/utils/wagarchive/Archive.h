@@ -0,0 +1,128 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_WAGARCHIVE_ARCHIVE__
+#define __H_WAGARCHIVE_ARCHIVE__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// An archive keeps each node's telemetry in two append-only files:
+//
+//   <node>.wga  blocks of rows, stored a column at a time
+//   <node>.wgi  the time index: one fixed size entry per block
+//
+// Rows are a time in unix seconds and any set of named values. A block's
+// columns are whichever names appear in its rows, and rows without a value
+// for one of them read back as NaN. See README.md for the byte layout.
+
+struct BlockInfo {
+  int64_t first;
+  int64_t last;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t rows;
+};
+
+struct ColumnInfo {
+  std::string name;
+  uint32_t offset;
+  uint32_t size;
+};
+
+struct BlockHeader {
+  int64_t first;
+  int64_t last;
+  uint32_t rows;
+  uint32_t timeOffset;
+  uint32_t timeSize;
+  std::vector<ColumnInfo> columns;
+};
+
+// reads the header of a block. false if it's malformed or cut short.
+bool parseBlock(const uint8_t *data, size_t size, BlockHeader &header);
+
+// true if name is usable as a node name, and so as a file name.
+bool validNodeName(const std::string &name);
+
+class ArchiveWriter {
+ public:
+  // rows per block. a day of one minute polls.
+  static const size_t BLOCK_ROWS = 1440;
+
+  ArchiveWriter();
+  ~ArchiveWriter();
+
+  // opens or creates a node's archive. a block left half written by a crash
+  // is cut off, and the index is brought up to date with the blocks.
+  bool open(const std::string &dir, const std::string &node,
+            std::string &error);
+
+  // buffers a row, and writes a block once there are BLOCK_ROWS of them.
+  // rows must be later than the last one. false if the row was dropped.
+  bool add(int64_t time, const std::map<std::string, double> &values);
+
+  // writes the buffered rows as a block.
+  bool flush();
+
+  size_t buffered() const { return times.size(); }
+  int64_t lastTime() const { return last; }
+  const std::string &lastError() const { return error; }
+
+ private:
+  bool recover();
+  void close();
+
+  int dataFd;
+  int indexFd;
+  uint64_t dataSize;
+  int64_t last;
+  std::string error;
+
+  std::vector<int64_t> times;
+  std::vector<std::map<std::string, double> > rows;
+};
+
+// Receives the rows of a scan. values are in the order the columns were
+// asked for.
+class RowVisitor {
+ public:
+  virtual ~RowVisitor() {}
+  virtual void row(int64_t time, const double *values) = 0;
+};
+
+class ArchiveReader {
+ public:
+  ArchiveReader();
+  ~ArchiveReader();
+
+  bool open(const std::string &dir, const std::string &node,
+            std::string &error);
+
+  const std::vector<BlockInfo> &blocks() const { return index; }
+
+  // visits the rows from from to to, inclusive. only the blocks in range are
+  // read, and only the columns asked for are decoded.
+  bool scan(int64_t from, int64_t to, const std::vector<std::string> &columns,
+            RowVisitor &visitor, std::string &error);
+
+  // every column name in the archive, sorted.
+  std::vector<std::string> columns() const;
+
+  // checks every block's checksum. returns the number which fail.
+  size_t verify() const;
+
+  size_t fileSize() const { return mapSize; }
+  size_t blocksRead() const { return read; }
+
+ private:
+  const uint8_t *map;
+  size_t mapSize;
+  std::vector<BlockInfo> index;
+  size_t read;
+};
+
+#endif
@@ -0,0 +1,333 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Encoding.h"
+#include <math.h>
+#include <string.h>
+
+enum {
+  VALUES_DELTA = 1,
+  VALUES_XOR = 2,
+};
+
+class BitWriter {
+ public:
+  BitWriter(std::string &out) : out(out), buffer(0), used(0) {}
+
+  // writes the low count bits of bits, most significant first.
+  void write(uint64_t bits, int count) {
+    while (count > 0) {
+      int n = count < 8 - used ? count : 8 - used;
+      uint8_t chunk = (bits >> (count - n)) & ((1u << n) - 1);
+      buffer |= chunk << (8 - used - n);
+      used += n;
+      count -= n;
+
+      if (used == 8) {
+        out += (char)buffer;
+        buffer = 0;
+        used = 0;
+      }
+    }
+  }
+
+  void flush() {
+    if (used > 0) {
+      out += (char)buffer;
+      buffer = 0;
+      used = 0;
+    }
+  }
+
+ private:
+  std::string &out;
+  uint8_t buffer;
+  int used;
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t *data, size_t size)
+      : data(data), size(size), pos(0), overrun(false) {}
+
+  uint64_t read(int count) {
+    uint64_t bits = 0;
+
+    if (pos + count > size * 8) {
+      overrun = true;
+      return 0;
+    }
+
+    while (count > 0) {
+      int offset = pos & 7;
+      int n = count < 8 - offset ? count : 8 - offset;
+      uint8_t byte = data[pos >> 3];
+      bits = (bits << n) | ((byte >> (8 - offset - n)) & ((1u << n) - 1));
+      pos += n;
+      count -= n;
+    }
+
+    return bits;
+  }
+
+  bool bit() { return read(1) != 0; }
+
+ private:
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+
+ public:
+  // set once a read runs past the end of the data.
+  bool overrun;
+};
+
+static uint64_t zigzag(int64_t n) { return ((uint64_t)n << 1) ^ (n >> 63); }
+
+static int64_t unzigzag(uint64_t n) { return (n >> 1) ^ -(int64_t)(n & 1); }
+
+static void putVarint(std::string &out, uint64_t n) {
+  while (n >= 0x80) {
+    out += (char)(n | 0x80);
+    n >>= 7;
+  }
+
+  out += (char)n;
+}
+
+static bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &n) {
+  n = 0;
+
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    uint8_t byte = *p++;
+    n |= (uint64_t)(byte & 0x7f) << shift;
+
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static uint64_t doubleBits(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+static double bitsDouble(uint64_t bits) {
+  double x;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+void encodeTimes(const std::vector<int64_t> &times, std::string &out) {
+  if (times.empty()) {
+    return;
+  }
+
+  BitWriter w(out);
+  w.write((uint64_t)times[0], 64);
+
+  int64_t lastDelta = 0;
+
+  for (size_t i = 1; i < times.size(); i++) {
+    int64_t delta = times[i] - times[i - 1];
+    int64_t dod = delta - lastDelta;
+    lastDelta = delta;
+
+    // the same buckets as Gorilla, which were picked for regular polling.
+    if (dod == 0) {
+      w.write(0, 1);
+    } else if (-63 <= dod && dod <= 64) {
+      w.write(2, 2);
+      w.write(dod + 63, 7);
+    } else if (-255 <= dod && dod <= 256) {
+      w.write(6, 3);
+      w.write(dod + 255, 9);
+    } else if (-2047 <= dod && dod <= 2048) {
+      w.write(14, 4);
+      w.write(dod + 2047, 12);
+    } else {
+      w.write(15, 4);
+      w.write(zigzag(dod), 64);
+    }
+  }
+
+  w.flush();
+}
+
+bool decodeTimes(const uint8_t *data, size_t size, size_t count,
+                 std::vector<int64_t> &times) {
+  times.resize(count);
+
+  if (count == 0) {
+    return true;
+  }
+
+  BitReader r(data, size);
+  times[0] = (int64_t)r.read(64);
+
+  int64_t delta = 0;
+
+  for (size_t i = 1; i < count; i++) {
+    int64_t dod;
+
+    if (!r.bit()) {
+      dod = 0;
+    } else if (!r.bit()) {
+      dod = (int64_t)r.read(7) - 63;
+    } else if (!r.bit()) {
+      dod = (int64_t)r.read(9) - 255;
+    } else if (!r.bit()) {
+      dod = (int64_t)r.read(12) - 2047;
+    } else {
+      dod = unzigzag(r.read(64));
+    }
+
+    delta += dod;
+    times[i] = times[i - 1] + delta;
+  }
+
+  return !r.overrun;
+}
+
+static bool wholeNumbers(const std::vector<double> &values) {
+  for (size_t i = 0; i < values.size(); i++) {
+    double x = values[i];
+
+    // 2^52, so deltas between any two of them fit in an int64.
+    if (!(fabs(x) < 4503599627370496.0) || x != floor(x) ||
+        (x == 0 && signbit(x))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void encodeValues(const std::vector<double> &values, std::string &out) {
+  if (wholeNumbers(values)) {
+    out += (char)VALUES_DELTA;
+
+    int64_t last = 0;
+
+    for (size_t i = 0; i < values.size(); i++) {
+      int64_t n = (int64_t)values[i];
+      putVarint(out, zigzag(n - last));
+      last = n;
+    }
+
+    return;
+  }
+
+  out += (char)VALUES_XOR;
+
+  if (values.empty()) {
+    return;
+  }
+
+  BitWriter w(out);
+  uint64_t last = doubleBits(values[0]);
+  int lastLeading = -1;
+  int lastTrailing = 0;
+
+  w.write(last, 64);
+
+  for (size_t i = 1; i < values.size(); i++) {
+    uint64_t bits = doubleBits(values[i]);
+    uint64_t x = bits ^ last;
+    last = bits;
+
+    if (x == 0) {
+      w.write(0, 1);
+      continue;
+    }
+
+    int leading = __builtin_clzll(x);
+    int trailing = __builtin_ctzll(x);
+
+    // the leading count is stored in 5 bits.
+    if (leading > 31) {
+      leading = 31;
+    }
+
+    if (lastLeading >= 0 && leading >= lastLeading &&
+        trailing >= lastTrailing) {
+      // fits in the previous value's window of meaningful bits.
+      w.write(2, 2);
+      w.write(x >> lastTrailing, 64 - lastLeading - lastTrailing);
+    } else {
+      int meaningful = 64 - leading - trailing;
+      w.write(3, 2);
+      w.write(leading, 5);
+      w.write(meaningful - 1, 6);
+      w.write(x >> trailing, meaningful);
+      lastLeading = leading;
+      lastTrailing = trailing;
+    }
+  }
+
+  w.flush();
+}
+
+bool decodeValues(const uint8_t *data, size_t size, size_t count,
+                  std::vector<double> &values) {
+  values.resize(count);
+
+  if (size == 0) {
+    return count == 0;
+  }
+
+  const uint8_t *p = data + 1;
+  const uint8_t *end = data + size;
+
+  if (data[0] == VALUES_DELTA) {
+    int64_t last = 0;
+
+    for (size_t i = 0; i < count; i++) {
+      uint64_t n;
+
+      if (!getVarint(p, end, n)) {
+        return false;
+      }
+
+      last += unzigzag(n);
+      values[i] = (double)last;
+    }
+
+    return true;
+  }
+
+  if (data[0] != VALUES_XOR) {
+    return false;
+  }
+
+  if (count == 0) {
+    return true;
+  }
+
+  BitReader r(p, end - p);
+  uint64_t last = r.read(64);
+  int leading = 0;
+  int trailing = 0;
+
+  values[0] = bitsDouble(last);
+
+  for (size_t i = 1; i < count; i++) {
+    if (r.bit()) {
+      if (r.bit()) {
+        leading = r.read(5);
+        trailing = 64 - leading - ((int)r.read(6) + 1);
+      }
+
+      last ^= r.read(64 - leading - trailing) << trailing;
+    }
+
+    values[i] = bitsDouble(last);
+  }
+
+  return !r.overrun;
+}
@@ -0,0 +1,34 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_WAGARCHIVE_ENCODING__
+#define __H_WAGARCHIVE_ENCODING__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Column encodings for archive blocks.
+//
+// Times are stored as in Facebook's Gorilla: the first time in full, then the
+// first delta, then each change in delta in a variable width bit field. A
+// Wagman polled every minute mostly costs one bit per row.
+//
+// Values are stored one of two ways, picked per block and column. Columns of
+// whole numbers, like currents in mA and fail counts, are delta encoded as
+// varints. Anything else is XORed with the previous value and only the bits
+// which changed are kept, as in Gorilla.
+
+void encodeTimes(const std::vector<int64_t> &times, std::string &out);
+
+// decodes count times. returns false if the data is cut short.
+bool decodeTimes(const uint8_t *data, size_t size, size_t count,
+                 std::vector<int64_t> &times);
+
+void encodeValues(const std::vector<double> &values, std::string &out);
+
+bool decodeValues(const uint8_t *data, size_t size, size_t count,
+                  std::vector<double> &values);
+
+#endif
@@ -0,0 +1,167 @@
+#!/bin/bash
+# This file is part of the Waggle Platform.  Please see the file
+# LICENSE.waggle.txt for the legal details of the copyright and software
+# license.  For more details on the Waggle project, visit:
+#          http://www.wa8.gl
+
+# Archives generated telemetry and checks that queries return it unchanged.
+# Also polls wagmand's standin, if ../wagmand has been built.
+
+cd "$(dirname "$0")"
+
+dir=$(mktemp -d)
+failures=0
+pids=()
+
+cleanup() {
+  kill "${pids[@]}" 2>/dev/null
+  wait 2>/dev/null
+  rm -rf "$dir"
+}
+
+trap cleanup EXIT
+
+fail() {
+  echo "FAIL: $*"
+  failures=$((failures + 1))
+}
+
+pass() {
+  echo "ok: $*"
+}
+
+# generate <node> <start> <rows> prints one minute rows, with a few polls a
+# second early or late.
+generate() {
+  awk -v node="$1" -v t="$2" -v rows="$3" 'BEGIN {
+    srand(1)
+    for (i = 0; i < rows; i++) {
+      t += 60 + (rand() < 0.05 ? int(rand() * 3) - 1 : 0)
+      line = t " " node " cu=" int(300 + 40 * sin(i / 700) + rand() * 10)
+      for (d = 0; d < 5; d++) {
+        line = line " cu." d "=" int(d * 50 + rand() * 8)
+        line = line " th." d "=" int(500 + 30 * sin(i / 1440 + d) + rand() * 3)
+        line = line " hb." d "=" int(rand() * 30)
+        line = line " fc." d "=" int(i / 50000)
+      }
+      line = line sprintf(" env.temperature=%.2f env.humidity=%.2f",
+                          20 + 5 * sin(i / 1440) + rand() * 0.2, 40 + rand())
+      print line
+    }
+  }'
+}
+
+# same <text file> <query output> checks every value came back unchanged.
+same() {
+  python3 -c '
+import sys
+rows = {}
+for line in open(sys.argv[1]):
+    f = line.split()
+    rows[int(f[0])] = dict((k, float(v)) for k, v in
+                           (x.split("=") for x in f[2:]))
+lines = open(sys.argv[2]).read().splitlines()
+columns = lines[0].split("\t")[1:]
+for line in lines[1:]:
+    f = line.split("\t")
+    want = rows.pop(int(f[0]))
+    for c, v in zip(columns, f[1:]):
+        if float(v) != want[c]:
+            sys.exit(1)
+sys.exit(1 if rows else 0)
+' "$1" "$2"
+}
+
+# 90 days of one minute polls.
+generate n1 1500000000 129600 > "$dir/n1.txt"
+./wagarchive ingest -d "$dir" < "$dir/n1.txt" 2>/dev/null
+
+./wagarchive query -d "$dir" -n n1 > "$dir/out"
+same "$dir/n1.txt" "$dir/out" && pass "round trip" || fail "round trip"
+
+size=$(stat -c %s "$dir/n1.wga")
+text=$(stat -c %s "$dir/n1.txt")
+pass "$text bytes of text stored in $size"
+
+stats=$(./wagarchive query -d "$dir" -n n1 -c th.0 -S -q 2>&1)
+pass "90 days of one column: $stats"
+stats=$(./wagarchive query -d "$dir" -n n1 -S -q 2>&1)
+pass "90 days of every column: $stats"
+
+# one day out of the middle reads only the blocks it overlaps.
+from=1504000000
+to=$((from + 86400))
+stats=$(./wagarchive query -d "$dir" -n n1 -f $from -t $to -S -q 2>&1)
+[[ "$stats" == *" 2 of 90 blocks"* ]] && pass "time index: $stats" ||
+  fail "time index: $stats"
+
+./wagarchive query -d "$dir" -n n1 -f $from -t $to -c cu | tail -n +2 |
+  cut -f 1 > "$dir/times"
+awk -v from=$from -v to=$to '$1 >= from && $1 <= to {print $1}' \
+  "$dir/n1.txt" > "$dir/want"
+cmp -s "$dir/times" "$dir/want" && pass "range is inclusive" ||
+  fail "range is inclusive"
+
+./wagarchive query -d "$dir" -n n1 -t 1500086400 -c fc.0 -s 3600 -a count |
+  tail -n +2 > "$dir/out"
+awk '$1 <= 1500086400 {n[$1 - $1 % 3600]++}
+  END {for (b in n) print b "\t" n[b]}' "$dir/n1.txt" | sort > "$dir/want"
+cmp -s "$dir/out" "$dir/want" && pass "buckets" || fail "buckets"
+
+# rows with different columns.
+printf '%s\n' "100 n2 a=1" "160 n2 b=2.5" "160 n2 a=3" "220 n2 a=4" |
+  ./wagarchive ingest -d "$dir" 2>/dev/null
+out=$(./wagarchive query -d "$dir" -n n2 | tr '\t' ' ')
+[ "$out" = $'time a b\n100 1 -\n160 3 2.5\n220 4 -' ] &&
+  pass "missing values" || fail "missing values: $out"
+
+out=$(echo "200 n2 a=5" | ./wagarchive ingest -d "$dir" 2>&1)
+[[ "$out" == "0 rows, 1 out of order"* ]] && pass "out of order rows dropped" ||
+  fail "out of order rows dropped: $out"
+
+# a block cut short by a crash is dropped, and the next write replaces it.
+generate n3 1500000000 3000 > "$dir/n3.txt"
+head -2000 "$dir/n3.txt" | ./wagarchive ingest -d "$dir" 2>/dev/null
+truncate -s -100 "$dir/n3.wga"
+rows=$(./wagarchive info -d "$dir" -n n3 | awk '$1 == "rows" {print $2}')
+[ "$rows" = 1440 ] && pass "partial block ignored" ||
+  fail "partial block ignored: $rows rows"
+
+tail -n +1441 "$dir/n3.txt" | ./wagarchive ingest -d "$dir" 2>/dev/null
+./wagarchive query -d "$dir" -n n3 > "$dir/out"
+./wagarchive info -d "$dir" -n n3 -v > /dev/null &&
+  same "$dir/n3.txt" "$dir/out" && pass "recovered after crash" ||
+  fail "recovered after crash"
+
+# the index can be rebuilt from the blocks.
+rm "$dir/n1.wgi"
+./wagarchive query -d "$dir" -n n1 > "$dir/out"
+same "$dir/n1.txt" "$dir/out" && pass "missing index" || fail "missing index"
+
+# polling a v3 Wagman through wagmand.
+if [ -x ../wagmand/wagmand ] && [ -x ../wagmand/standin ]; then
+  ../wagmand/standin -p v3 -d 10 -l 0 > "$dir/pty" &
+  pids+=($!)
+
+  for i in $(seq 50); do
+    [ -s "$dir/pty" ] && break
+    sleep 0.1
+  done
+
+  ../wagmand/wagmand -p v3 -d "$(cat "$dir/pty")" -s "$dir/sock" 2>/dev/null &
+  pids+=($!)
+  sleep 0.5
+
+  timeout -s INT 3.5 ./wagarchive poll -d "$dir" -n n4 -s "$dir/sock" -i 1
+  columns=cu,cu.0,th.4,hb.1,fc.0,env.humidity
+  out=$(./wagarchive query -d "$dir" -n n4 -c $columns | tail -n +2 |
+    cut -f 2- | sort -u | tr '\t' ' ')
+  [ "$out" = "310 120 504 11 0 40.25" ] && pass "poll" || fail "poll: $out"
+else
+  echo "skipped poll: build ../wagmand first"
+fi
+
+if [ $failures != 0 ]; then
+  echo "$failures failed"
+  exit 1
+fi
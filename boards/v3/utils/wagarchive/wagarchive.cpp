@@ -0,0 +1,864 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Archive.h"
+
+// wagarchive stores Wagman telemetry in a columnar archive and queries it.
+// See README.md.
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handleStop(int) { stopping = 1; }
+
+static double monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// accepts unix seconds, or a UTC date as YYYY-MM-DD[THH:MM[:SS]].
+static bool parseTime(const char *s, int64_t &t) {
+  char *end;
+  long long n = strtoll(s, &end, 10);
+
+  if (*end == '\0' && end != s) {
+    t = n;
+    return true;
+  }
+
+  static const char *FORMATS[] = {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M",
+                                  "%Y-%m-%d"};
+
+  for (size_t i = 0; i < sizeof(FORMATS) / sizeof(FORMATS[0]); i++) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, FORMATS[i], &tm);
+
+    if (end != NULL && *end == '\0') {
+      t = timegm(&tm);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static std::string formatTime(int64_t t, bool iso) {
+  char s[32];
+
+  if (iso) {
+    time_t tt = t;
+    struct tm tm;
+    gmtime_r(&tt, &tm);
+    strftime(s, sizeof(s), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  } else {
+    snprintf(s, sizeof(s), "%lld", (long long)t);
+  }
+
+  return s;
+}
+
+static std::vector<std::string> split(const std::string &s, char sep) {
+  std::vector<std::string> parts;
+  std::string part;
+  std::istringstream in(s);
+
+  while (std::getline(in, part, sep)) {
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+  }
+
+  return parts;
+}
+
+/*
+Command:
+Ingest
+
+Description:
+Reads decoded telemetry from stdin, one line per row:
+
+<unix time> <node> <name>=<value> ...
+
+Lines for the same node and time are merged into one row. Rows which aren't
+later than the node's last row are dropped.
+
+Examples:
+$ echo "1500000000 0001e0610b9b cu=310 cu.0=120 th.0=512" | wagarchive ingest
+*/
+static int commandIngest(const std::string &dir) {
+  std::map<std::string, ArchiveWriter *> writers;
+  std::map<std::string, std::pair<int64_t, std::map<std::string, double> > >
+      pending;
+  unsigned long rows = 0;
+  unsigned long dropped = 0;
+  unsigned long invalid = 0;
+  int status = 0;
+  std::string line;
+
+  while (std::getline(std::cin, line)) {
+    std::istringstream in(line);
+    std::string timeField;
+    std::string node;
+
+    if (!(in >> timeField >> node)) {
+      continue;
+    }
+
+    int64_t t;
+    std::map<std::string, double> values;
+
+    if (!parseTime(timeField.c_str(), t) || !validNodeName(node)) {
+      invalid++;
+      continue;
+    }
+
+    std::string field;
+
+    while (in >> field) {
+      size_t eq = field.find('=');
+      char *end;
+
+      if (eq == std::string::npos || eq == 0) {
+        continue;
+      }
+
+      double x = strtod(field.c_str() + eq + 1, &end);
+
+      if (*end == '\0' && end != field.c_str() + eq + 1) {
+        values[field.substr(0, eq)] = x;
+      }
+    }
+
+    if (values.empty()) {
+      invalid++;
+      continue;
+    }
+
+    if (writers.count(node) == 0) {
+      ArchiveWriter *writer = new ArchiveWriter();
+      std::string error;
+
+      if (!writer->open(dir, node, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        delete writer;
+        return 1;
+      }
+
+      writers[node] = writer;
+    }
+
+    std::pair<int64_t, std::map<std::string, double> > &row = pending[node];
+
+    if (!row.second.empty() && row.first == t) {
+      for (std::map<std::string, double>::iterator it = values.begin();
+           it != values.end(); ++it) {
+        row.second[it->first] = it->second;
+      }
+
+      continue;
+    }
+
+    if (!row.second.empty()) {
+      if (writers[node]->add(row.first, row.second)) {
+        rows++;
+      } else {
+        dropped++;
+      }
+    }
+
+    row.first = t;
+    row.second = values;
+  }
+
+  for (std::map<std::string, ArchiveWriter *>::iterator it = writers.begin();
+       it != writers.end(); ++it) {
+    std::pair<int64_t, std::map<std::string, double> > &row =
+        pending[it->first];
+
+    if (!row.second.empty()) {
+      if (it->second->add(row.first, row.second)) {
+        rows++;
+      } else {
+        dropped++;
+      }
+    }
+
+    if (!it->second->flush()) {
+      fprintf(stderr, "%s: %s\n", it->first.c_str(),
+              it->second->lastError().c_str());
+      status = 1;
+    }
+
+    delete it->second;
+  }
+
+  fprintf(stderr, "%lu rows, %lu out of order, %lu invalid\n", rows, dropped,
+          invalid);
+  return status;
+}
+
+static int connectDaemon(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  return fd;
+}
+
+// the v3 commands polled, and how their responses map to columns.
+static const char *POLL_COMMANDS[] = {"cu", "th", "hb", "fc", "env"};
+static const size_t POLL_COMMAND_COUNT =
+    sizeof(POLL_COMMANDS) / sizeof(POLL_COMMANDS[0]);
+
+static void parsePollResponse(const std::string &command,
+                              const std::vector<std::string> &lines,
+                              std::map<std::string, double> &values) {
+  char name[32];
+
+  if (command == "cu") {
+    // the Wagman's current, then each device's.
+    if (lines.empty()) {
+      return;
+    }
+
+    std::vector<std::string> fields = split(lines[0], ' ');
+
+    for (size_t i = 0; i < fields.size(); i++) {
+      if (i == 0) {
+        snprintf(name, sizeof(name), "cu");
+      } else {
+        snprintf(name, sizeof(name), "cu.%u", (unsigned int)i - 1);
+      }
+
+      values[name] = atof(fields[i].c_str());
+    }
+  } else if (command == "env") {
+    // name=value lines.
+    for (size_t i = 0; i < lines.size(); i++) {
+      size_t eq = lines[i].find('=');
+
+      if (eq != std::string::npos) {
+        values["env." + lines[i].substr(0, eq)] =
+            atof(lines[i].c_str() + eq + 1);
+      }
+    }
+  } else {
+    // one line per device.
+    for (size_t i = 0; i < lines.size(); i++) {
+      snprintf(name, sizeof(name), "%s.%u", command.c_str(), (unsigned int)i);
+      values[name] = atof(lines[i].c_str());
+    }
+  }
+}
+
+// sends the poll commands down one connection, pipelined, and waits for all
+// of their responses.
+static bool pollOnce(int fd, double timeout,
+                     std::map<std::string, double> &values) {
+  std::string requests;
+
+  for (size_t i = 0; i < POLL_COMMAND_COUNT; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "%u %s\n", (unsigned int)i,
+             POLL_COMMANDS[i]);
+    requests += line;
+  }
+
+  if (write(fd, requests.data(), requests.size()) !=
+      (ssize_t)requests.size()) {
+    return false;
+  }
+
+  std::vector<std::vector<std::string> > responses(POLL_COMMAND_COUNT);
+  size_t pending = POLL_COMMAND_COUNT;
+  std::string in;
+  double deadline = monotonic() + timeout;
+
+  while (pending > 0) {
+    double now = monotonic();
+
+    if (now >= deadline || stopping) {
+      return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, (int)((deadline - now) * 1000) + 1) <= 0) {
+      continue;
+    }
+
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n <= 0) {
+      return false;
+    }
+
+    in.append(buf, n);
+
+    size_t start = 0;
+    size_t end;
+
+    while ((end = in.find('\n', start)) != std::string::npos) {
+      std::string line = in.substr(start, end - start);
+      start = end + 1;
+
+      size_t space = line.find(' ');
+      unsigned int id = atoi(line.c_str());
+
+      if (space == std::string::npos || line[0] == '*' ||
+          id >= POLL_COMMAND_COUNT) {
+        continue;
+      }
+
+      std::string rest = line.substr(space + 1);
+
+      if (rest == "." || rest.compare(0, 2, "! ") == 0) {
+        // a failed command leaves its columns out of this row.
+        if (rest == ".") {
+          parsePollResponse(POLL_COMMANDS[id], responses[id], values);
+        }
+
+        pending--;
+      } else {
+        responses[id].push_back(rest);
+      }
+    }
+
+    in.erase(0, start);
+  }
+
+  return true;
+}
+
+/*
+Command:
+Poll
+
+Description:
+Polls a v3 Wagman through wagmand every interval and archives cu, th, hb, fc
+and env as one row. Rows are synced to disk as a block every flush count
+polls, 5 by default, and on exit, so a crash loses at most that many polls.
+Bigger blocks compress better.
+
+Examples:
+$ wagarchive poll -d /var/lib/wagarchive -n 0001e0610b9b -s /run/wagmand.sock
+*/
+static int commandPoll(const std::string &dir, const std::string &node,
+                       const char *socketPath, int interval,
+                       unsigned int flushEvery) {
+  ArchiveWriter writer;
+  std::string error;
+
+  if (!writer.open(dir, node, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handleStop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  int fd = -1;
+
+  while (!stopping) {
+    int64_t t = time(NULL);
+
+    if (fd < 0) {
+      fd = connectDaemon(socketPath);
+
+      if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", socketPath, strerror(errno));
+      }
+    }
+
+    std::map<std::string, double> values;
+
+    if (fd >= 0 && !pollOnce(fd, interval, values)) {
+      close(fd);
+      fd = -1;
+    }
+
+    if (!values.empty()) {
+      writer.add(t, values);
+    }
+
+    if (writer.buffered() >= flushEvery && !writer.flush()) {
+      fprintf(stderr, "%s\n", writer.lastError().c_str());
+      return 1;
+    }
+
+    // polls are kept on interval boundaries, so rows line up across nodes.
+    int64_t next = (t / interval + 1) * interval;
+
+    while (!stopping && time(NULL) < next) {
+      sleep(next - time(NULL));
+    }
+  }
+
+  if (!writer.flush()) {
+    fprintf(stderr, "%s\n", writer.lastError().c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+enum Aggregate {
+  AGGREGATE_MEAN,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_LAST,
+  AGGREGATE_COUNT,
+};
+
+static void printValue(double x) {
+  if (isnan(x)) {
+    fputs("\t-", stdout);
+  } else {
+    printf("\t%.15g", x);
+  }
+}
+
+class RowPrinter : public RowVisitor {
+ public:
+  RowPrinter(size_t columns, bool iso, bool quiet)
+      : columns(columns), iso(iso), quiet(quiet), rows(0) {}
+
+  void row(int64_t time, const double *values) {
+    rows++;
+
+    if (quiet) {
+      return;
+    }
+
+    fputs(formatTime(time, iso).c_str(), stdout);
+
+    for (size_t c = 0; c < columns; c++) {
+      printValue(values[c]);
+    }
+
+    putchar('\n');
+  }
+
+  size_t columns;
+  bool iso;
+  bool quiet;
+  unsigned long rows;
+};
+
+// aggregates rows into step second buckets, ignoring missing values.
+class BucketPrinter : public RowVisitor {
+ public:
+  BucketPrinter(size_t columns, int64_t step, Aggregate aggregate, bool iso,
+                bool quiet)
+      : columns(columns),
+        step(step),
+        aggregate(aggregate),
+        iso(iso),
+        quiet(quiet),
+        rows(0),
+        bucket(INT64_MIN),
+        counts(columns),
+        sums(columns) {}
+
+  void row(int64_t time, const double *values) {
+    int64_t b = time - ((time % step) + step) % step;
+
+    rows++;
+
+    if (b != bucket) {
+      print();
+      bucket = b;
+      counts.assign(columns, 0);
+      sums.assign(columns, NAN);
+    }
+
+    for (size_t c = 0; c < columns; c++) {
+      double x = values[c];
+
+      if (isnan(x)) {
+        continue;
+      }
+
+      if (counts[c]++ == 0) {
+        sums[c] = x;
+      } else if (aggregate == AGGREGATE_MEAN) {
+        sums[c] += x;
+      } else if (aggregate == AGGREGATE_MIN) {
+        sums[c] = fmin(sums[c], x);
+      } else if (aggregate == AGGREGATE_MAX) {
+        sums[c] = fmax(sums[c], x);
+      } else if (aggregate == AGGREGATE_LAST) {
+        sums[c] = x;
+      }
+    }
+  }
+
+  void print() {
+    if (bucket == INT64_MIN || quiet) {
+      return;
+    }
+
+    fputs(formatTime(bucket, iso).c_str(), stdout);
+
+    for (size_t c = 0; c < columns; c++) {
+      if (aggregate == AGGREGATE_COUNT) {
+        printf("\t%lu", counts[c]);
+      } else if (aggregate == AGGREGATE_MEAN && counts[c] > 0) {
+        printValue(sums[c] / counts[c]);
+      } else {
+        printValue(sums[c]);
+      }
+    }
+
+    putchar('\n');
+  }
+
+  size_t columns;
+  int64_t step;
+  Aggregate aggregate;
+  bool iso;
+  bool quiet;
+  unsigned long rows;
+
+ private:
+  int64_t bucket;
+  std::vector<unsigned long> counts;
+  std::vector<double> sums;
+};
+
+/*
+Command:
+Query
+
+Description:
+Prints a node's rows between two times, inclusive, as tab separated columns.
+With -s, rows are aggregated into buckets of that many seconds instead. Missing
+values are printed as -.
+
+Examples:
+# thermistors over January, as hourly maximums
+$ wagarchive query -n 0001e0610b9b -f 2017-01-01 -t 2017-02-01 \
+    -c th.0,th.1 -s 3600 -a max
+*/
+static int commandQuery(const std::string &dir, const std::string &node,
+                        int64_t from, int64_t to,
+                        std::vector<std::string> columns, int64_t step,
+                        Aggregate aggregate, bool iso, bool stats,
+                        bool quiet) {
+  double start = monotonic();
+  ArchiveReader reader;
+  std::string error;
+
+  if (!reader.open(dir, node, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  if (columns.empty()) {
+    columns = reader.columns();
+  }
+
+  if (!quiet) {
+    fputs("time", stdout);
+
+    for (size_t c = 0; c < columns.size(); c++) {
+      printf("\t%s", columns[c].c_str());
+    }
+
+    putchar('\n');
+  }
+
+  unsigned long rows;
+  bool ok;
+
+  if (step > 0) {
+    BucketPrinter printer(columns.size(), step, aggregate, iso, quiet);
+    ok = reader.scan(from, to, columns, printer, error);
+    printer.print();
+    rows = printer.rows;
+  } else {
+    RowPrinter printer(columns.size(), iso, quiet);
+    ok = reader.scan(from, to, columns, printer, error);
+    rows = printer.rows;
+  }
+
+  if (!ok) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  if (stats) {
+    fprintf(stderr, "%lu rows, %lu of %lu blocks, %.2f ms\n", rows,
+            (unsigned long)reader.blocksRead(),
+            (unsigned long)reader.blocks().size(),
+            (monotonic() - start) * 1000);
+  }
+
+  return 0;
+}
+
+/*
+Command:
+Info
+
+Description:
+Lists the nodes in an archive or, with -n, describes one node's archive. With
+-v, every block's checksum is also checked.
+
+Examples:
+$ wagarchive info
+$ wagarchive info -n 0001e0610b9b -v
+*/
+static int commandInfo(const std::string &dir, const std::string &node,
+                       bool verify) {
+  if (node.empty()) {
+    DIR *d = opendir(dir.c_str());
+
+    if (d == NULL) {
+      fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+      return 1;
+    }
+
+    struct dirent *entry;
+
+    while ((entry = readdir(d)) != NULL) {
+      std::string name = entry->d_name;
+
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".wga") == 0) {
+        printf("%s\n", name.substr(0, name.size() - 4).c_str());
+      }
+    }
+
+    closedir(d);
+    return 0;
+  }
+
+  ArchiveReader reader;
+  std::string error;
+
+  if (!reader.open(dir, node, error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  const std::vector<BlockInfo> &blocks = reader.blocks();
+  unsigned long rows = 0;
+
+  for (size_t i = 0; i < blocks.size(); i++) {
+    rows += blocks[i].rows;
+  }
+
+  std::vector<std::string> columns = reader.columns();
+
+  printf("blocks   %lu\n", (unsigned long)blocks.size());
+  printf("rows     %lu\n", rows);
+
+  if (!blocks.empty()) {
+    printf("first    %s\n", formatTime(blocks.front().first, true).c_str());
+    printf("last     %s\n", formatTime(blocks.back().last, true).c_str());
+  }
+
+  printf("bytes    %lu\n", (unsigned long)reader.fileSize());
+
+  if (rows > 0 && !columns.empty()) {
+    printf("per row  %.2f bytes, %.2f per value\n",
+           (double)reader.fileSize() / rows,
+           (double)reader.fileSize() / rows / columns.size());
+  }
+
+  printf("columns ");
+
+  for (size_t c = 0; c < columns.size(); c++) {
+    printf(" %s", columns[c].c_str());
+  }
+
+  printf("\n");
+
+  if (verify) {
+    size_t bad = reader.verify();
+    printf("corrupt  %lu\n", (unsigned long)bad);
+    return bad == 0 ? 0 : 1;
+  }
+
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s ingest [-d dir]\n"
+          "       %s poll [-d dir] -n node [-s socket] [-i seconds] "
+          "[-F rows]\n"
+          "       %s query [-d dir] -n node [-f from] [-t to] [-c cols]\n"
+          "                [-s step] [-a mean|min|max|last|count] [-I] [-S] "
+          "[-q]\n"
+          "       %s info [-d dir] [-n node] [-v]\n",
+          name, name, name, name);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::string command = argv[1];
+  std::string dir = ".";
+  std::string node;
+  const char *socketPath = "/run/wagmand.sock";
+  int interval = 60;
+  unsigned int flushEvery = 5;
+  int64_t from = INT64_MIN;
+  int64_t to = INT64_MAX;
+  std::vector<std::string> columns;
+  int64_t step = 0;
+  Aggregate aggregate = AGGREGATE_MEAN;
+  bool iso = false;
+  bool stats = false;
+  bool quiet = false;
+  bool verify = false;
+  int opt;
+
+  optind = 2;
+
+  while ((opt = getopt(argc, argv, "d:n:s:i:F:f:t:c:a:ISqv")) != -1) {
+    switch (opt) {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'n':
+        node = optarg;
+        break;
+      case 's':
+        // the socket for poll, the bucket size for query.
+        if (command == "poll") {
+          socketPath = optarg;
+        } else {
+          step = atoll(optarg);
+        }
+        break;
+      case 'i':
+        interval = atoi(optarg);
+        break;
+      case 'F':
+        flushEvery = atoi(optarg);
+        break;
+      case 'f':
+        if (!parseTime(optarg, from)) {
+          fprintf(stderr, "invalid time: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        if (!parseTime(optarg, to)) {
+          fprintf(stderr, "invalid time: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'c':
+        columns = split(optarg, ',');
+        break;
+      case 'a':
+        if (strcmp(optarg, "mean") == 0) {
+          aggregate = AGGREGATE_MEAN;
+        } else if (strcmp(optarg, "min") == 0) {
+          aggregate = AGGREGATE_MIN;
+        } else if (strcmp(optarg, "max") == 0) {
+          aggregate = AGGREGATE_MAX;
+        } else if (strcmp(optarg, "last") == 0) {
+          aggregate = AGGREGATE_LAST;
+        } else if (strcmp(optarg, "count") == 0) {
+          aggregate = AGGREGATE_COUNT;
+        } else {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'I':
+        iso = true;
+        break;
+      case 'S':
+        stats = true;
+        break;
+      case 'q':
+        quiet = true;
+        break;
+      case 'v':
+        verify = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (command == "ingest") {
+    return commandIngest(dir);
+  }
+
+  if (command == "info") {
+    return commandInfo(dir, node, verify);
+  }
+
+  if (node.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (command == "poll") {
+    if (interval <= 0 || flushEvery == 0) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    return commandPoll(dir, node, socketPath, interval, flushEvery);
+  }
+
+  if (command == "query") {
+    return commandQuery(dir, node, from, to, columns, step, aggregate, iso,
+                        stats, quiet);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
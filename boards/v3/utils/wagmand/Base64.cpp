@@ -0,0 +1,86 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Base64.h"
+
+static const char ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64Encode(const std::string &data) {
+  std::string text;
+  size_t i = 0;
+
+  text.reserve((data.size() + 2) / 3 * 4);
+
+  for (; i + 2 < data.size(); i += 3) {
+    unsigned int n = ((unsigned char)data[i] << 16) |
+                     ((unsigned char)data[i + 1] << 8) |
+                     (unsigned char)data[i + 2];
+    text += ALPHABET[(n >> 18) & 63];
+    text += ALPHABET[(n >> 12) & 63];
+    text += ALPHABET[(n >> 6) & 63];
+    text += ALPHABET[n & 63];
+  }
+
+  if (i + 1 == data.size()) {
+    unsigned int n = (unsigned char)data[i] << 16;
+    text += ALPHABET[(n >> 18) & 63];
+    text += ALPHABET[(n >> 12) & 63];
+    text += "==";
+  } else if (i + 2 == data.size()) {
+    unsigned int n =
+        ((unsigned char)data[i] << 16) | ((unsigned char)data[i + 1] << 8);
+    text += ALPHABET[(n >> 18) & 63];
+    text += ALPHABET[(n >> 12) & 63];
+    text += ALPHABET[(n >> 6) & 63];
+    text += '=';
+  }
+
+  return text;
+}
+
+static int decodeChar(char c) {
+  if ('A' <= c && c <= 'Z') return c - 'A';
+  if ('a' <= c && c <= 'z') return c - 'a' + 26;
+  if ('0' <= c && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+bool base64Decode(const std::string &text, std::string &data) {
+  size_t end = text.size();
+
+  while (end > 0 && text[end - 1] == '=') {
+    end--;
+  }
+
+  if (text.size() - end > 2 || end % 4 == 1) {
+    return false;
+  }
+
+  data.clear();
+  data.reserve(end * 3 / 4);
+
+  unsigned int n = 0;
+  int bits = 0;
+
+  for (size_t i = 0; i < end; i++) {
+    int v = decodeChar(text[i]);
+
+    if (v < 0) {
+      return false;
+    }
+
+    n = (n << 6) | v;
+    bits += 6;
+
+    if (bits >= 8) {
+      bits -= 8;
+      data += (char)((n >> bits) & 0xff);
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,16 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_WAGMAND_BASE64__
+#define __H_WAGMAND_BASE64__
+
+#include <string>
+
+// Standard base64 with padding, as the firmware frames v4 command lines.
+std::string base64Encode(const std::string &data);
+
+// returns false if text isn't valid base64. padding is optional.
+bool base64Decode(const std::string &text, std::string &data);
+
+#endif
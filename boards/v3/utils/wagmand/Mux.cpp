@@ -0,0 +1,306 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Mux.h"
+#include <stdio.h>
+#include "Base64.h"
+#include "Sensorgram.h"
+
+// the v3 firmware reads commands into an 80 byte buffer, newline included.
+static const size_t V3_MAX_LINE = 79;
+
+Mux::Mux(Protocol protocol, MuxListener &listener, unsigned int window,
+         double timeout)
+    : protocol(protocol),
+      listener(listener),
+      window(window > 0 ? window : 1),
+      timeout(timeout),
+      up(true),
+      sequence(0),
+      lastInst(0),
+      responseKnown(false) {
+  // v4 tags are a single byte and 0 is taken by pushes, so no more than 255
+  // requests can be told apart.
+  if (protocol == PROTOCOL_V4 && this->window > 255) {
+    this->window = 255;
+  }
+}
+
+const char *Mux::submit(int client, const std::string &id,
+                        const std::string &text, double now) {
+  Request req;
+
+  req.client = client;
+  req.id = id;
+  req.inst = 0;
+  req.remaining = 1;
+  req.deadline = 0;
+
+  bool ok = (protocol == PROTOCOL_V3) ? prepareV3(req, text)
+                                      : prepareV4(req, text);
+
+  if (!ok) {
+    return "bad request";
+  }
+
+  waiting.push_back(req);
+  sendQueued(now);
+  return NULL;
+}
+
+bool Mux::prepareV3(Request &req, const std::string &text) {
+  if (text.empty() || text[0] == '@' ||
+      text.find_first_of("\r\n") != std::string::npos) {
+    return false;
+  }
+
+  char sid[16];
+  snprintf(sid, sizeof(sid), "d%lu", ++sequence);
+
+  req.sid = sid;
+  req.line = "@" + req.sid + " " + text;
+  return req.line.size() <= V3_MAX_LINE;
+}
+
+bool Mux::prepareV4(Request &req, const std::string &text) {
+  std::string data;
+
+  if (!base64Decode(text, data)) {
+    return false;
+  }
+
+  // tagged when it's sent, once a free inst is known. this only checks the
+  // sensorgrams are well formed.
+  int count = tagSensorgrams(data, 0);
+
+  if (count <= 0) {
+    return false;
+  }
+
+  req.line = data;
+  req.remaining = count;
+  return true;
+}
+
+uint8_t Mux::nextInst() {
+  // cycles through all 255 tags, rather than reusing the lowest free one, so a
+  // late response to a timed out request is unlikely to match a new one.
+  for (;;) {
+    lastInst = (lastInst == 255) ? 1 : lastInst + 1;
+
+    bool used = false;
+
+    for (size_t i = 0; i < sent.size(); i++) {
+      if (sent[i].inst == lastInst) {
+        used = true;
+        break;
+      }
+    }
+
+    if (!used) {
+      return lastInst;
+    }
+  }
+}
+
+void Mux::sendQueued(double now) {
+  while (up && !waiting.empty() && sent.size() < window) {
+    Request req = waiting.front();
+    waiting.pop_front();
+
+    if (protocol == PROTOCOL_V4) {
+      req.inst = nextInst();
+      tagSensorgrams(req.line, req.inst);
+      req.line = base64Encode(req.line);
+    }
+
+    req.deadline = now + timeout;
+    sent.push_back(req);
+    listener.sendLine(req.line);
+  }
+}
+
+void Mux::finish(std::deque<Request>::iterator it, const char *error) {
+  if (it->client >= 0) {
+    listener.onDone(it->client, it->id, error);
+  }
+
+  sent.erase(it);
+}
+
+void Mux::receive(const std::string &line, double now) {
+  if (protocol == PROTOCOL_V3) {
+    receiveV3(line);
+  } else {
+    receiveV4(line);
+  }
+
+  sendQueued(now);
+}
+
+void Mux::receiveV3(const std::string &line) {
+  static const std::string BEGIN = "<<<- sid=";
+  static const std::string END = "->>>";
+
+  if (line.compare(0, BEGIN.size(), BEGIN) == 0) {
+    size_t end = line.find(' ', BEGIN.size());
+    responseSID = line.substr(BEGIN.size(), end - BEGIN.size());
+    responseKnown = false;
+
+    for (size_t i = 0; i < sent.size(); i++) {
+      if (sent[i].sid == responseSID) {
+        responseKnown = true;
+        break;
+      }
+    }
+
+    if (!responseKnown) {
+      listener.onTelemetry(line);
+    }
+
+    return;
+  }
+
+  // log lines can be printed in the middle of a response.
+  if (responseSID.empty() || line.compare(0, 4, "log:") == 0) {
+    listener.onTelemetry(line);
+    return;
+  }
+
+  std::deque<Request>::iterator it = sent.begin();
+
+  while (it != sent.end() && it->sid != responseSID) {
+    ++it;
+  }
+
+  if (line == END) {
+    responseSID.clear();
+
+    if (it != sent.end()) {
+      finish(it, NULL);
+    } else {
+      listener.onTelemetry(line);
+    }
+  } else if (it != sent.end()) {
+    if (it->client >= 0) {
+      listener.onResponse(it->client, it->id, line);
+    }
+  } else {
+    // the rest of a response to a request which has timed out, or which
+    // someone else sent.
+    listener.onTelemetry(line);
+  }
+}
+
+void Mux::receiveV4(const std::string &line) {
+  std::deque<Request>::iterator it;
+
+  if (line.empty()) {
+    // a denied or unknown request. the firmware answers in order, so it's for
+    // the oldest one.
+    if (sent.empty()) {
+      return;
+    }
+
+    it = sent.begin();
+  } else {
+    std::string data;
+    SensorgramHeader header;
+
+    if (!base64Decode(line, data) || !readSensorgramHeader(data, 0, header) ||
+        header.inst == 0) {
+      listener.onTelemetry(line);
+      return;
+    }
+
+    size_t index = 0;
+
+    while (index < sent.size() && sent[index].inst != header.inst) {
+      index++;
+    }
+
+    if (index == sent.size()) {
+      listener.onTelemetry(line);
+      return;
+    }
+
+    // anything sent before this request should have been answered already.
+    // whatever was left of it was lost on the link.
+    for (; index > 0; index--) {
+      finish(sent.begin(), "lost");
+    }
+
+    it = sent.begin();
+  }
+
+  if (it->client >= 0) {
+    listener.onResponse(it->client, it->id, line);
+  }
+
+  if (--it->remaining == 0) {
+    finish(it, NULL);
+  }
+}
+
+void Mux::update(double now) {
+  std::deque<Request>::iterator it = sent.begin();
+
+  while (it != sent.end()) {
+    if (it->deadline <= now) {
+      if (it->client >= 0) {
+        listener.onDone(it->client, it->id, "timeout");
+      }
+
+      it = sent.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  sendQueued(now);
+}
+
+void Mux::linkDown() {
+  up = false;
+  responseSID.clear();
+
+  while (!sent.empty()) {
+    finish(sent.begin(), "link down");
+  }
+}
+
+void Mux::linkUp(double now) {
+  up = true;
+  sendQueued(now);
+}
+
+void Mux::dropClient(int client) {
+  std::deque<Request>::iterator it = waiting.begin();
+
+  while (it != waiting.end()) {
+    if (it->client == client) {
+      it = waiting.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  for (size_t i = 0; i < sent.size(); i++) {
+    if (sent[i].client == client) {
+      sent[i].client = -1;
+    }
+  }
+}
+
+double Mux::nextDeadline() const {
+  double deadline = 0;
+
+  for (size_t i = 0; i < sent.size(); i++) {
+    if (deadline == 0 || sent[i].deadline < deadline) {
+      deadline = sent[i].deadline;
+    }
+  }
+
+  return deadline;
+}
@@ -0,0 +1,115 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_WAGMAND_MUX__
+#define __H_WAGMAND_MUX__
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+enum Protocol {
+  PROTOCOL_V3,
+  PROTOCOL_V4,
+};
+
+// Where the mux sends its output. Kept separate from the mux so the matching
+// logic doesn't depend on sockets or ttys.
+class MuxListener {
+ public:
+  virtual ~MuxListener() {}
+
+  // writes a line to the Wagman. the newline is added by the listener.
+  virtual void sendLine(const std::string &line) = 0;
+
+  // a line of the response to a client's request.
+  virtual void onResponse(int client, const std::string &id,
+                          const std::string &line) = 0;
+
+  // the request is finished. error is NULL if all of its response arrived.
+  virtual void onDone(int client, const std::string &id,
+                      const char *error) = 0;
+
+  // a line which isn't part of any request's response.
+  virtual void onTelemetry(const std::string &line) = 0;
+};
+
+// Matches lines from the Wagman with the client requests they answer, and
+// keeps up to window requests on the wire at once.
+//
+// v3 requests are sent as "@<sid> <command>" with a sid the mux picks, and
+// their responses are matched by the sid in the "<<<- sid=" header.
+//
+// v4 requests are base64 sensorgram lines. The mux sets the inst of each of
+// the sensorgrams to a tag it picks. The firmware answers every sensorgram
+// with one line, in order, echoing the inst; lines with inst 0 are
+// subscription pushes. An empty line is the answer to a request the firmware
+// didn't know or allow.
+class Mux {
+ public:
+  Mux(Protocol protocol, MuxListener &listener, unsigned int window,
+      double timeout);
+
+  // queues a request from a client. returns NULL, or why it was refused.
+  const char *submit(int client, const std::string &id,
+                     const std::string &text, double now);
+
+  // handles a line from the Wagman, without its newline.
+  void receive(const std::string &line, double now);
+
+  // fails requests past their deadline and sends queued ones.
+  void update(double now);
+
+  // fails every request on the wire. queued requests are sent once the link
+  // is back.
+  void linkDown();
+  void linkUp(double now);
+
+  // forgets a client's requests. the ones on the wire still have their
+  // responses consumed, so they don't show up as telemetry.
+  void dropClient(int client);
+
+  // the earliest deadline of a request on the wire, or 0 if there are none.
+  double nextDeadline() const;
+
+  size_t queued() const { return waiting.size(); }
+  size_t inFlight() const { return sent.size(); }
+
+ private:
+  struct Request {
+    int client;
+    std::string id;
+    std::string line;
+    std::string sid;
+    uint8_t inst;
+    unsigned int remaining;
+    double deadline;
+  };
+
+  void sendQueued(double now);
+  void finish(std::deque<Request>::iterator it, const char *error);
+  void receiveV3(const std::string &line);
+  void receiveV4(const std::string &line);
+  bool prepareV3(Request &req, const std::string &text);
+  bool prepareV4(Request &req, const std::string &text);
+  uint8_t nextInst();
+
+  Protocol protocol;
+  MuxListener &listener;
+  unsigned int window;
+  double timeout;
+  bool up;
+
+  std::deque<Request> waiting;
+  std::deque<Request> sent;
+
+  unsigned long sequence;
+  uint8_t lastInst;
+
+  // sid of the v3 response being read, or empty between responses.
+  std::string responseSID;
+  bool responseKnown;
+};
+
+#endif
@@ -0,0 +1,80 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Sensorgram.h"
+
+static const size_t INST_OFFSET = 8;
+
+static unsigned long getUint(const std::string &data, size_t offset,
+                             size_t size) {
+  unsigned long n = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    n = (n << 8) | (unsigned char)data[offset + i];
+  }
+
+  return n;
+}
+
+static void putUint(std::string &data, unsigned long n, size_t size) {
+  for (size_t i = size; i > 0; i--) {
+    data += (char)((n >> (8 * (i - 1))) & 0xff);
+  }
+}
+
+bool readSensorgramHeader(const std::string &data, size_t offset,
+                          SensorgramHeader &header) {
+  if (offset + SENSORGRAM_HEADER_SIZE > data.size()) {
+    return false;
+  }
+
+  header.length = getUint(data, offset + 0, 2);
+  header.timestamp = getUint(data, offset + 2, 4);
+  header.id = getUint(data, offset + 6, 2);
+  header.inst = getUint(data, offset + 8, 1);
+  header.subID = getUint(data, offset + 9, 1);
+  header.sourceID = getUint(data, offset + 10, 2);
+  header.sourceInst = getUint(data, offset + 12, 1);
+  return true;
+}
+
+int tagSensorgrams(std::string &data, uint8_t inst) {
+  size_t offset = 0;
+  int count = 0;
+
+  while (offset < data.size()) {
+    SensorgramHeader header;
+
+    if (!readSensorgramHeader(data, offset, header)) {
+      return -1;
+    }
+
+    size_t next = offset + SENSORGRAM_HEADER_SIZE + header.length;
+
+    if (next > data.size()) {
+      return -1;
+    }
+
+    data[offset + INST_OFFSET] = (char)inst;
+    offset = next;
+    count++;
+  }
+
+  return count;
+}
+
+std::string encodeSensorgram(const SensorgramHeader &header,
+                             const std::string &body) {
+  std::string data;
+
+  putUint(data, body.size(), 2);
+  putUint(data, header.timestamp, 4);
+  putUint(data, header.id, 2);
+  putUint(data, header.inst, 1);
+  putUint(data, header.subID, 1);
+  putUint(data, header.sourceID, 2);
+  putUint(data, header.sourceInst, 1);
+  data += body;
+  return data;
+}
@@ -0,0 +1,39 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_WAGMAND_SENSORGRAM__
+#define __H_WAGMAND_SENSORGRAM__
+
+#include <stdint.h>
+#include <string>
+
+// Sensorgram headers, as sent by the v4 firmware. Bodies are passed through
+// untouched. Fields are big endian:
+//
+//   body length (2) timestamp (4) id (2) inst (1) sub id (1)
+//   source id (2) source inst (1)
+struct SensorgramHeader {
+  uint16_t length;
+  uint32_t timestamp;
+  uint16_t id;
+  uint8_t inst;
+  uint8_t subID;
+  uint16_t sourceID;
+  uint8_t sourceInst;
+};
+
+const size_t SENSORGRAM_HEADER_SIZE = 13;
+
+// reads the header of the sensorgram at offset. false if it's cut short.
+bool readSensorgramHeader(const std::string &data, size_t offset,
+                          SensorgramHeader &header);
+
+// sets the inst of every sensorgram in data. returns how many there are, or
+// -1 if data isn't a whole number of sensorgrams.
+int tagSensorgrams(std::string &data, uint8_t inst);
+
+std::string encodeSensorgram(const SensorgramHeader &header,
+                             const std::string &body);
+
+#endif
@@ -0,0 +1,11 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_WAGMAND_SERIAL__
+#define __H_WAGMAND_SERIAL__
+
+// opens a tty raw, 8N1 and nonblocking. returns the fd, or -1 with errno set.
+int openSerial(const char *path, int baud);
+
+#endif
@@ -0,0 +1,109 @@
+#!/bin/bash
+# This file is part of the Waggle Platform.  Please see the file
+# LICENSE.waggle.txt for the legal details of the copyright and software
+# license.  For more details on the Waggle project, visit:
+#          http://www.wa8.gl
+
+# Compares reading the v4 firmware's whole state with REQ_WAGMAN_SNAPSHOT
+# against polling each metric, through wagmand and standin in loop mode.
+#
+#   ./bench-snapshot.sh [runs]
+
+cd "$(dirname "$0")"
+
+runs=${1:-5}
+
+# the firmware's loop: six 80 ms current conversions in sampleSensors() and
+# the 50 ms LED wait, with commands read once in between.
+loop_ms=550
+
+dir=$(mktemp -d)
+sock=$dir/wagmand.sock
+pids=()
+
+cleanup() {
+  kill "${pids[@]}" 2>/dev/null
+  wait 2>/dev/null
+  rm -rf "$dir"
+}
+
+trap cleanup EXIT
+
+./standin -p v4 -m "$loop_ms" -d 1 -l 0 > "$dir/pty" &
+pids+=($!)
+
+for i in $(seq 50); do
+  [ -s "$dir/pty" ] && break
+  sleep 0.1
+done
+
+./wagmand -p v4 -d "$(cat "$dir/pty")" -s "$sock" -t 30 2> "$dir/wagmand.log" &
+pids+=($!)
+
+for i in $(seq 50); do
+  [ -S "$sock" ] && break
+  sleep 0.1
+done
+
+# sensorgram <id> <sub id> prints a base64 request line.
+sensorgram() {
+  python3 -c '
+import base64, struct, sys
+header = struct.pack(">HIHBBHB", 0, 0, int(sys.argv[1], 16), 0, int(sys.argv[2]), 0, 0)
+print(base64.b64encode(header).decode())
+' "$1" "$2"
+}
+
+# the requests which read what a snapshot holds: time, system and port
+# currents, heartbeats, thermistors, fail counts, states and boot media.
+{
+  sensorgram c023 0
+  for sub in 0 1 2 3 4 5; do sensorgram c001 $sub; done
+  for id in c002 c003 c006 c00b; do
+    for sub in 1 2 3 4 5; do sensorgram $id $sub; done
+  done
+  for sub in 1 2; do sensorgram c00d $sub; done
+} > "$dir/metrics"
+
+sensorgram c013 1 > "$dir/snapshot"
+
+# elapsed <command...> prints the seconds the command took.
+elapsed() {
+  local start=$EPOCHREALTIME
+  "$@" > /dev/null || echo "request failed" >&2
+  awk "BEGIN { print $EPOCHREALTIME - $start }"
+}
+
+sequential() {
+  while read -r line; do
+    timeout 60 ./wagmanctl -s "$sock" "$line" || return 1
+  done < "$dir/metrics"
+}
+
+pipelined() {
+  timeout 60 ./wagmanctl -s "$sock" < "$dir/metrics"
+}
+
+snapshot() {
+  timeout 60 ./wagmanctl -s "$sock" "$(cat "$dir/snapshot")"
+}
+
+# mean <name> <requests> <function> runs a way of reading the state.
+mean() {
+  local total=0
+
+  for run in $(seq "$runs"); do
+    # start at a different point of the loop each time.
+    sleep "$(awk "BEGIN { print $((RANDOM % loop_ms)) / 1000 }")"
+    total=$(awk "BEGIN { print $total + $(elapsed "$3") }")
+  done
+
+  printf "%-12s %8d %10.2f\n" "$1" "$2" "$(awk "BEGIN { print $total / $runs }")"
+}
+
+requests=$(wc -l < "$dir/metrics")
+
+printf "%-12s %8s %10s\n" "method" "requests" "seconds"
+mean "sequential" "$requests" sequential
+mean "pipelined" "$requests" pipelined
+mean "snapshot" 1 snapshot
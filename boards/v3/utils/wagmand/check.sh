@@ -0,0 +1,163 @@
+#!/bin/bash
+# This file is part of the Waggle Platform.  Please see the file
+# LICENSE.waggle.txt for the legal details of the copyright and software
+# license.  For more details on the Waggle project, visit:
+#          http://www.wa8.gl
+
+# Runs wagmand against standin on a pseudo-terminal, for both protocols.
+
+cd "$(dirname "$0")"
+
+dir=$(mktemp -d)
+sock=$dir/wagmand.sock
+failures=0
+pids=()
+
+cleanup() {
+  kill "${pids[@]}" 2>/dev/null
+  wait 2>/dev/null
+  rm -rf "$dir"
+}
+
+trap cleanup EXIT
+
+fail() {
+  echo "FAIL: $*"
+  failures=$((failures + 1))
+}
+
+pass() {
+  echo "ok: $*"
+}
+
+# start <protocol> <standin options...>
+start() {
+  local protocol=$1
+  shift
+
+  kill "${pids[@]}" 2>/dev/null
+  wait 2>/dev/null
+  pids=()
+
+  ./standin -p "$protocol" "$@" > "$dir/pty" &
+  pids+=($!)
+
+  for i in $(seq 50); do
+    [ -s "$dir/pty" ] && break
+    sleep 0.1
+  done
+
+  ./wagmand -p "$protocol" -d "$(cat "$dir/pty")" -s "$sock" -t 2 \
+    2> "$dir/wagmand.log" &
+  pids+=($!)
+
+  for i in $(seq 50); do
+    [ -S "$sock" ] && break
+    sleep 0.1
+  done
+}
+
+ctl() {
+  timeout 10 ./wagmanctl -s "$sock" "$@"
+}
+
+# sensorgram <id> <body> prints a base64 request line.
+sensorgram() {
+  python3 -c '
+import base64, struct, sys
+body = sys.argv[2].encode()
+header = struct.pack(">HIHBBHB", len(body), 0, int(sys.argv[1], 16), 0, 0, 0, 0)
+print(base64.b64encode(header + body).decode())
+' "$1" "$2"
+}
+
+# inst_body reads "<tag> <base64>" lines and prints "<tag> <inst> <body>".
+inst_body() {
+  python3 -c '
+import base64, struct, sys
+for line in sys.stdin:
+    tag, _, text = line.strip().partition(" ")
+    data = base64.b64decode(text)
+    print(tag, data[8], data[13:].decode())
+'
+}
+
+echo "== v3"
+start v3 -d 50 -l 100
+
+out=$(ctl hb)
+[ "$out" = $'10\n11\n12\n13\n14' ] && pass "single request" ||
+  fail "single request: $out"
+
+out=$(ctl logmid)
+[ "$out" = $'first\nsecond' ] && pass "log lines split from response" ||
+  fail "log lines split from response: $out"
+
+out=$(ctl bogus)
+[ "$out" = "invalid command" ] && pass "invalid command" ||
+  fail "invalid command: $out"
+
+seq 40 | sed 's/^/echo /' > "$dir/requests"
+start_time=$(date +%s%N)
+ctl < "$dir/requests" | sort -n > "$dir/out"
+elapsed=$((($(date +%s%N) - start_time) / 1000000))
+seq 40 | awk '{print $1, $1}' | sort -n > "$dir/want"
+cmp -s "$dir/out" "$dir/want" && pass "40 pipelined requests in ${elapsed}ms" ||
+  fail "pipelined requests: $(diff "$dir/want" "$dir/out" | head -5)"
+
+(seq 20 | sed 's/^/echo a/' | ctl > "$dir/a") &
+a=$!
+(seq 20 | sed 's/^/echo b/' | ctl > "$dir/b") &
+b=$!
+wait $a $b
+seq 20 | awk '{print $1, "a" $1}' > "$dir/want_a"
+seq 20 | awk '{print $1, "b" $1}' > "$dir/want_b"
+cmp -s <(sort -n "$dir/a") "$dir/want_a" &&
+  cmp -s <(sort -n "$dir/b") "$dir/want_b" && pass "two clients at once" ||
+  fail "two clients at once"
+
+timeout 1 ./wagmanctl -s "$sock" -f > "$dir/telemetry"
+grep -q '^log: tick' "$dir/telemetry" && pass "telemetry fan out" ||
+  fail "telemetry fan out"
+
+echo "== v4"
+start v4 -d 50 -l 100
+
+echo "$(sensorgram c026 hello)" | ctl | inst_body > "$dir/out"
+read -r tag inst body < "$dir/out"
+[ "$body" = "hello" ] && [ "$inst" != 0 ] && pass "tagged response" ||
+  fail "tagged response: $(cat "$dir/out")"
+
+out=$(ctl "$(sensorgram 1234 x)")
+[ $? = 0 ] && [ -z "$out" ] && pass "empty line for unknown request" ||
+  fail "empty line for unknown request: $out"
+
+for i in $(seq 40); do sensorgram c026 "r$i"; done > "$dir/requests"
+ctl < "$dir/requests" | inst_body | awk '{print $1, $3}' | sort -n > "$dir/out"
+seq 40 | awk '{print $1, "r" $1}' > "$dir/want"
+cmp -s "$dir/out" "$dir/want" && pass "40 pipelined sensorgrams" ||
+  fail "pipelined sensorgrams: $(diff "$dir/want" "$dir/out" | head -5)"
+
+timeout 1 ./wagmanctl -s "$sock" -f > "$dir/telemetry"
+grep -q '^log: tick' "$dir/telemetry" && grep -qv '^log:' "$dir/telemetry" &&
+  pass "telemetry fan out" || fail "telemetry fan out"
+
+# every 3rd response is lost. the rest must still match their requests.
+start v4 -d 50 -l 0 -x 3
+for i in $(seq 12); do sensorgram c026 "r$i"; done > "$dir/requests"
+ctl < "$dir/requests" > "$dir/out" 2> "$dir/err"
+lost=$(grep -c '! lost\|! timeout' "$dir/err")
+bad=$(inst_body < "$dir/out" | awk '"r" $1 != $3' | wc -l)
+[ "$lost" = 4 ] && [ "$bad" = 0 ] && pass "lost responses" ||
+  fail "lost responses: $lost lost, $bad mismatched"
+
+# the stand-in goes away with a request on the link.
+start v4 -d 3000 -l 0
+(sleep 0.5; kill "${pids[0]}") &
+out=$(ctl "$(sensorgram c026 x)" 2>&1)
+[[ "$out" == *"! link down" ]] && pass "link loss" || fail "link loss: $out"
+
+if [ $failures != 0 ]; then
+  echo "$failures failed"
+  exit 1
+fi
@@ -0,0 +1,354 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <string>
+#include "Base64.h"
+#include "Sensorgram.h"
+
+// standin pretends to be a Wagman on a pseudo-terminal, so wagmand can be
+// tested without a board. It prints the path of the pty, then answers
+// requests one at a time, the way the firmware does, and sends telemetry
+// in between.
+//
+// v3 commands:
+//   hb, th, fc   a line for each of five devices
+//   cu           the Wagman's current, then each device's
+//   env          temperature and humidity
+//   echo args    the args
+//   logmid       a response with a log line in the middle
+//   anything     "invalid command"
+//
+// v4 sensorgrams with an id of 0xc0xx are answered with a sensorgram with id
+// 0xffxx, the request's inst and sub id and the request's body. Anything else
+// gets an empty line, like a denied request.
+//
+// With -m, requests are only read once per loop of the given length, like the
+// v4 firmware's processCommands(), and each takes the response delay. A v4
+// current request (0xc001) also waits on an ADC conversion, like commandCurrent.
+
+struct Pending {
+  double due;
+  std::string line;
+};
+
+static bool v4 = false;
+static double delay = 0.02;
+static double telemetryInterval = 0.5;
+static unsigned int dropEvery = 0;
+static double loopPeriod = 0;
+
+static const uint16_t REQ_CURRENT = 0xc001;
+static const double CONVERSION_TIME = 0.08;
+
+static int master = -1;
+static std::deque<Pending> pending;
+static std::string output;
+static unsigned long responses = 0;
+static unsigned long ticks = 0;
+
+static double monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void emit(const std::string &line) {
+  // with -x, every nth response line is lost on the way out.
+  if (dropEvery != 0 && ++responses % dropEvery == 0) {
+    return;
+  }
+
+  output += line;
+  output += v4 ? "\n" : "\r\n";
+}
+
+static void answerV3(const std::string &line) {
+  std::string sid = "0";
+  std::string command = line;
+
+  if (!command.empty() && command[0] == '@') {
+    size_t space = command.find(' ');
+    sid = command.substr(1, space - 1);
+    command = (space == std::string::npos) ? "" : command.substr(space + 1);
+  }
+
+  size_t space = command.find(' ');
+  std::string name = command.substr(0, space);
+  std::string args =
+      (space == std::string::npos) ? "" : command.substr(space + 1);
+
+  std::string body = "<<<- sid=" + sid + " " + name + "\r\n";
+
+  if (name == "hb" || name == "th" || name == "fc") {
+    int base = (name == "hb") ? 10 : (name == "th") ? 500 : 0;
+
+    for (int i = 0; i < 5; i++) {
+      char line[16];
+      snprintf(line, sizeof(line), "%d\r\n", base + i);
+      body += line;
+    }
+  } else if (name == "cu") {
+    body += "310 120 80 60 0 0\r\n";
+  } else if (name == "env") {
+    body += "temperature=21.50\r\nhumidity=40.25\r\n";
+  } else if (name == "echo") {
+    body += args + "\r\n";
+  } else if (name == "logmid") {
+    body += "first\r\nlog: in the middle\r\nsecond\r\n";
+  } else {
+    body += "invalid command\r\n";
+  }
+
+  // a v3 response is one unit, so -x drops all of it.
+  if (dropEvery != 0 && ++responses % dropEvery == 0) {
+    return;
+  }
+
+  output += body + "->>>\r\n";
+}
+
+static void answerV4(const std::string &line) {
+  std::string data;
+
+  if (!base64Decode(line, data)) {
+    return;
+  }
+
+  size_t offset = 0;
+  SensorgramHeader header;
+
+  while (readSensorgramHeader(data, offset, header)) {
+    std::string body =
+        data.substr(offset + SENSORGRAM_HEADER_SIZE, header.length);
+    offset += SENSORGRAM_HEADER_SIZE + header.length;
+
+    if ((header.id & 0xff00) != 0xc000) {
+      emit("");
+      continue;
+    }
+
+    SensorgramHeader resp = header;
+    resp.id = 0xff00 | (header.id & 0xff);
+    resp.timestamp = time(NULL);
+    resp.sourceID = 0;
+    resp.sourceInst = 0;
+    emit(base64Encode(encodeSensorgram(resp, body)));
+  }
+}
+
+// how long the firmware takes to answer a request line.
+static double serviceTime(const std::string &line) {
+  std::string data;
+
+  if (!v4 || !base64Decode(line, data)) {
+    return delay;
+  }
+
+  double time = delay;
+  size_t offset = 0;
+  SensorgramHeader header;
+
+  while (readSensorgramHeader(data, offset, header)) {
+    offset += SENSORGRAM_HEADER_SIZE + header.length;
+
+    if (header.id == REQ_CURRENT) {
+      time += CONVERSION_TIME;
+    }
+  }
+
+  return time;
+}
+
+static void telemetry() {
+  char text[32];
+
+  ticks++;
+
+  if (!v4) {
+    snprintf(text, sizeof(text), "log: tick %lu", ticks);
+    output += std::string(text) + "\r\n";
+    return;
+  }
+
+  if (ticks % 4 == 0) {
+    snprintf(text, sizeof(text), "log: tick %lu", ticks);
+    output += std::string(text) + "\n";
+    return;
+  }
+
+  SensorgramHeader header;
+  memset(&header, 0, sizeof(header));
+  header.id = 0xff09;
+  header.timestamp = time(NULL);
+
+  std::string body;
+  body += (char)(ticks & 0xff);
+  output += base64Encode(encodeSensorgram(header, body)) + "\n";
+}
+
+static void handleStop(int) {
+  // leaving lets the pty close, which wagmand sees as a hangup.
+  _exit(0);
+}
+
+int main(int argc, char **argv) {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:d:l:x:m:")) != -1) {
+    switch (opt) {
+      case 'p':
+        v4 = (strcmp(optarg, "v4") == 0);
+        break;
+      case 'd':
+        delay = atof(optarg) / 1000.0;
+        break;
+      case 'l':
+        telemetryInterval = atof(optarg) / 1000.0;
+        break;
+      case 'x':
+        dropEvery = atoi(optarg);
+        break;
+      case 'm':
+        loopPeriod = atof(optarg) / 1000.0;
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-p v3|v4] [-d response ms] [-l telemetry ms] "
+                "[-x drop every n] [-m loop ms]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  signal(SIGTERM, handleStop);
+  signal(SIGINT, handleStop);
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+    perror("posix_openpt");
+    return 1;
+  }
+
+  const char *path = ptsname(master);
+
+  // held open so the pty stays up between wagmand's opens, and so it can be
+  // put in raw mode before wagmand gets to it.
+  int slave = open(path, O_RDWR | O_NOCTTY);
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  fcntl(master, F_SETFL, O_NONBLOCK);
+  printf("%s\n", path);
+  fflush(stdout);
+
+  std::string input;
+  double nextTick = monotonic() + telemetryInterval;
+  double busyUntil = 0;
+  double nextLoop = monotonic() + loopPeriod;
+  std::deque<std::string> arrived;  // lines waiting for the next loop
+
+  for (;;) {
+    double now = monotonic();
+
+    if (loopPeriod > 0 && nextLoop <= now) {
+      // the loop answers what had arrived when it got to the commands, then
+      // samples its sensors again.
+      double due = now;
+
+      while (!arrived.empty()) {
+        due += serviceTime(arrived.front());
+
+        Pending p;
+        p.due = due;
+        p.line = arrived.front();
+        pending.push_back(p);
+        arrived.pop_front();
+      }
+
+      nextLoop = due + loopPeriod;
+    }
+
+    while (!pending.empty() && pending.front().due <= now) {
+      if (v4) {
+        answerV4(pending.front().line);
+      } else {
+        answerV3(pending.front().line);
+      }
+
+      pending.pop_front();
+    }
+
+    if (telemetryInterval > 0 && nextTick <= now) {
+      telemetry();
+      nextTick = now + telemetryInterval;
+    }
+
+    double wake = telemetryInterval > 0 ? nextTick : now + 1;
+
+    if (!pending.empty() && pending.front().due < wake) {
+      wake = pending.front().due;
+    }
+
+    if (loopPeriod > 0 && nextLoop < wake) {
+      wake = nextLoop;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = master;
+    pfd.events = POLLIN | (output.empty() ? 0 : POLLOUT);
+
+    int timeoutMs = wake > now ? (int)((wake - now) * 1000) + 1 : 0;
+
+    if (poll(&pfd, 1, timeoutMs) < 0 && errno != EINTR) {
+      perror("poll");
+      return 1;
+    }
+
+    if (pfd.revents & POLLIN) {
+      char buf[1024];
+      ssize_t n = read(master, buf, sizeof(buf));
+
+      for (ssize_t i = 0; i < n; i++) {
+        if (buf[i] == '\n' && loopPeriod > 0) {
+          arrived.push_back(input);
+          input.clear();
+        } else if (buf[i] == '\n') {
+          // the firmware handles one command at a time.
+          now = monotonic();
+          busyUntil = (busyUntil > now ? busyUntil : now) + delay;
+
+          Pending p;
+          p.due = busyUntil;
+          p.line = input;
+          pending.push_back(p);
+          input.clear();
+        } else if (buf[i] != '\r') {
+          input += buf[i];
+        }
+      }
+    }
+
+    if (pfd.revents & POLLOUT) {
+      ssize_t n = write(master, output.data(), output.size());
+
+      if (n > 0) {
+        output.erase(0, n);
+      }
+    }
+  }
+}
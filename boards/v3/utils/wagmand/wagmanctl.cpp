@@ -0,0 +1,197 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string>
+
+// wagmanctl sends requests to the Wagman through wagmand.
+//
+//   wagmanctl hb                 one request, print its response
+//   wagmanctl < requests         every line of stdin, pipelined
+//   wagmanctl -f                 print telemetry until interrupted
+
+static int connectDaemon(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  return fd;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+  size_t done = 0;
+
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return false;
+    }
+
+    done += n;
+  }
+
+  return true;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-s socket] [command ...]\n"
+          "       %s [-s socket] -f\n"
+          "  with no command, sends each line of stdin as a request and\n"
+          "  prints the responses prefixed with the line number.\n"
+          "  -f  print telemetry until interrupted\n",
+          name, name);
+}
+
+int main(int argc, char **argv) {
+  const char *socketPath = "/run/wagmand.sock";
+  bool follow = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:f")) != -1) {
+    switch (opt) {
+      case 's':
+        socketPath = optarg;
+        break;
+      case 'f':
+        follow = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  int fd = connectDaemon(socketPath);
+
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s\n", socketPath, strerror(errno));
+    return 1;
+  }
+
+  std::string requests;
+  unsigned int pending = 0;
+  bool single = false;
+
+  if (follow) {
+    requests = "sub\n";
+  } else if (optind < argc) {
+    std::string command;
+
+    for (int i = optind; i < argc; i++) {
+      if (i > optind) {
+        command += ' ';
+      }
+
+      command += argv[i];
+    }
+
+    requests = "1 " + command + "\n";
+    pending = 1;
+    single = true;
+  } else {
+    char line[4096];
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+
+      if (line[0] == '\0') {
+        continue;
+      }
+
+      char tag[16];
+      snprintf(tag, sizeof(tag), "%u ", ++pending);
+      requests += tag;
+      requests += line;
+      requests += '\n';
+    }
+  }
+
+  // everything is sent up front. wagmand queues what doesn't fit in its
+  // window, so the link never waits on this end.
+  if (!writeAll(fd, requests)) {
+    perror("write");
+    return 1;
+  }
+
+  int status = 0;
+  std::string in;
+  char buf[4096];
+
+  while (follow || pending > 0) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      fprintf(stderr, "wagmand closed the connection\n");
+      return 1;
+    }
+
+    in.append(buf, n);
+
+    size_t start = 0;
+    size_t end;
+
+    while ((end = in.find('\n', start)) != std::string::npos) {
+      std::string line = in.substr(start, end - start);
+      start = end + 1;
+
+      size_t space = line.find(' ');
+      std::string rest =
+          (space == std::string::npos) ? "" : line.substr(space + 1);
+
+      if (follow) {
+        if (line.compare(0, 2, "* ") == 0) {
+          printf("%s\n", rest.c_str());
+        }
+      } else if (line.compare(0, 2, "* ") == 0) {
+        // not subscribed, but ignore it anyway.
+      } else if (rest == ".") {
+        pending--;
+      } else if (rest.compare(0, 2, "! ") == 0) {
+        fprintf(stderr, "%s\n", line.c_str());
+        status = 1;
+        pending--;
+      } else if (single) {
+        printf("%s\n", rest.c_str());
+      } else {
+        printf("%s\n", line.c_str());
+      }
+    }
+
+    in.erase(0, start);
+    fflush(stdout);
+  }
+
+  close(fd);
+  return status;
+}
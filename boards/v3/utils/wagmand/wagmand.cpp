@@ -0,0 +1,554 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "Mux.h"
+#include "Serial.h"
+
+// wagmand owns the Wagman's serial link and shares it between local clients
+// over a unix socket. See README.md for the client protocol.
+
+static const double REOPEN_INTERVAL = 5.0;
+static const size_t MAX_LINE = 4096;
+static const size_t MAX_CLIENT_BUFFER = 65536;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handleStop(int) { stopping = 1; }
+
+static double monotonic() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct Client {
+  int fd;
+  std::string in;
+  std::string out;
+  bool subscribed;
+  bool closing;
+};
+
+class Daemon : public MuxListener {
+ public:
+  Daemon(Protocol protocol, const char *device, int baud, unsigned int window,
+         double timeout, bool verbose)
+      : mux(protocol, *this, window, timeout),
+        device(device),
+        baud(baud),
+        verbose(verbose),
+        serialFd(-1),
+        listenFd(-1),
+        reopenAt(0),
+        nextClient(1) {}
+
+  bool listen(const char *path);
+  void run();
+  void shutdown();
+
+  void sendLine(const std::string &line);
+  void onResponse(int client, const std::string &id, const std::string &line);
+  void onDone(int client, const std::string &id, const char *error);
+  void onTelemetry(const std::string &line);
+
+ private:
+  void openLink(double now);
+  void closeLink(const char *why);
+  void readLink(double now);
+  void writeLink();
+  void acceptClient();
+  void readClient(int id, double now);
+  void writeClient(int id);
+  void handleClientLine(int id, const std::string &line, double now);
+  void queueClient(int id, const std::string &line);
+  void closeClient(int id);
+
+  Mux mux;
+  const char *device;
+  int baud;
+  bool verbose;
+
+  int serialFd;
+  std::string serialIn;
+  std::string serialOut;
+  bool discarding;
+
+  int listenFd;
+  std::string socketPath;
+
+  double reopenAt;
+  int nextClient;
+  std::map<int, Client> clients;
+};
+
+bool Daemon::listen(const char *path) {
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", path);
+    return false;
+  }
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (listenFd < 0) {
+    perror("socket");
+    return false;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  // a socket left behind by a daemon which didn't exit cleanly.
+  unlink(path);
+
+  if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      ::listen(listenFd, 16) < 0) {
+    perror(path);
+    return false;
+  }
+
+  socketPath = path;
+  return true;
+}
+
+void Daemon::shutdown() {
+  if (!socketPath.empty()) {
+    unlink(socketPath.c_str());
+  }
+}
+
+void Daemon::openLink(double now) {
+  serialFd = openSerial(device, baud);
+
+  if (serialFd < 0) {
+    if (reopenAt == 0) {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+    }
+
+    reopenAt = now + REOPEN_INTERVAL;
+    return;
+  }
+
+  fprintf(stderr, "link up: %s\n", device);
+  serialIn.clear();
+  serialOut.clear();
+  discarding = false;
+  reopenAt = 0;
+  mux.linkUp(now);
+}
+
+void Daemon::closeLink(const char *why) {
+  fprintf(stderr, "link down: %s\n", why);
+  close(serialFd);
+  serialFd = -1;
+  reopenAt = monotonic() + REOPEN_INTERVAL;
+  mux.linkDown();
+}
+
+void Daemon::readLink(double now) {
+  char buf[1024];
+  ssize_t n = read(serialFd, buf, sizeof(buf));
+
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+
+  // poll said there was input, so nothing at all means the tty hung up.
+  if (n <= 0) {
+    closeLink(n < 0 ? strerror(errno) : "hangup");
+    return;
+  }
+
+  for (ssize_t i = 0; i < n; i++) {
+    char c = buf[i];
+
+    if (c == '\n') {
+      if (!discarding) {
+        if (verbose) {
+          fprintf(stderr, "<< %s\n", serialIn.c_str());
+        }
+
+        mux.receive(serialIn, now);
+      }
+
+      serialIn.clear();
+      discarding = false;
+    } else if (c == '\r') {
+      // the v3 firmware ends lines with println.
+    } else if (serialIn.size() < MAX_LINE) {
+      serialIn += c;
+    } else {
+      // noise on the line. drop it rather than pass on half of it.
+      serialIn.clear();
+      discarding = true;
+    }
+  }
+}
+
+void Daemon::writeLink() {
+  ssize_t n = write(serialFd, serialOut.data(), serialOut.size());
+
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EINTR) {
+      closeLink(strerror(errno));
+    }
+
+    return;
+  }
+
+  serialOut.erase(0, n);
+}
+
+void Daemon::sendLine(const std::string &line) {
+  if (verbose) {
+    fprintf(stderr, ">> %s\n", line.c_str());
+  }
+
+  serialOut += line;
+  serialOut += '\n';
+}
+
+void Daemon::onResponse(int client, const std::string &id,
+                        const std::string &line) {
+  queueClient(client, id + " " + line);
+}
+
+void Daemon::onDone(int client, const std::string &id, const char *error) {
+  if (error == NULL) {
+    queueClient(client, id + " .");
+  } else {
+    queueClient(client, id + " ! " + error);
+  }
+}
+
+void Daemon::onTelemetry(const std::string &line) {
+  for (std::map<int, Client>::iterator it = clients.begin();
+       it != clients.end(); ++it) {
+    if (it->second.subscribed) {
+      queueClient(it->first, "* " + line);
+    }
+  }
+}
+
+void Daemon::queueClient(int id, const std::string &line) {
+  std::map<int, Client>::iterator it = clients.find(id);
+
+  if (it == clients.end() || it->second.closing) {
+    return;
+  }
+
+  Client &client = it->second;
+
+  // a client which stops reading mustn't hold up the link or everyone else.
+  if (client.out.size() + line.size() > MAX_CLIENT_BUFFER) {
+    fprintf(stderr, "client %d: not reading, dropped\n", id);
+    client.closing = true;
+    return;
+  }
+
+  client.out += line;
+  client.out += '\n';
+}
+
+void Daemon::acceptClient() {
+  int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (fd < 0) {
+    return;
+  }
+
+  Client &client = clients[nextClient++];
+  client.fd = fd;
+  client.subscribed = false;
+  client.closing = false;
+}
+
+void Daemon::readClient(int id, double now) {
+  char buf[1024];
+  Client &client = clients[id];
+  ssize_t n = read(client.fd, buf, sizeof(buf));
+
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+
+  if (n <= 0) {
+    client.closing = true;
+    return;
+  }
+
+  client.in.append(buf, n);
+
+  size_t start = 0;
+  size_t end;
+
+  while ((end = client.in.find('\n', start)) != std::string::npos) {
+    std::string line = client.in.substr(start, end - start);
+    start = end + 1;
+
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+
+    handleClientLine(id, line, now);
+  }
+
+  client.in.erase(0, start);
+
+  if (client.in.size() > MAX_LINE) {
+    client.closing = true;
+  }
+}
+
+void Daemon::handleClientLine(int id, const std::string &line, double now) {
+  if (line.empty()) {
+    return;
+  }
+
+  if (line == "sub") {
+    clients[id].subscribed = true;
+    return;
+  }
+
+  if (line == "unsub") {
+    clients[id].subscribed = false;
+    return;
+  }
+
+  size_t space = line.find(' ');
+
+  if (space == std::string::npos || space == 0) {
+    queueClient(id, "? ! bad request");
+    return;
+  }
+
+  std::string tag = line.substr(0, space);
+  const char *error = mux.submit(id, tag, line.substr(space + 1), now);
+
+  if (error != NULL) {
+    onDone(id, tag, error);
+  }
+}
+
+void Daemon::writeClient(int id) {
+  Client &client = clients[id];
+  ssize_t n = write(client.fd, client.out.data(), client.out.size());
+
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EINTR) {
+      client.closing = true;
+    }
+
+    return;
+  }
+
+  client.out.erase(0, n);
+}
+
+void Daemon::closeClient(int id) {
+  mux.dropClient(id);
+  close(clients[id].fd);
+  clients.erase(id);
+}
+
+void Daemon::run() {
+  std::vector<struct pollfd> fds;
+  std::vector<int> ids;
+
+  while (!stopping) {
+    double now = monotonic();
+
+    if (serialFd < 0 && now >= reopenAt) {
+      openLink(now);
+    }
+
+    mux.update(now);
+
+    // closed here, after everything which might still queue output for them.
+    std::vector<int> closing;
+
+    for (std::map<int, Client>::iterator it = clients.begin();
+         it != clients.end(); ++it) {
+      if (it->second.closing) {
+        closing.push_back(it->first);
+      }
+    }
+
+    for (size_t i = 0; i < closing.size(); i++) {
+      closeClient(closing[i]);
+    }
+
+    fds.clear();
+    ids.clear();
+
+    struct pollfd pfd;
+    pfd.revents = 0;
+
+    pfd.fd = listenFd;
+    pfd.events = POLLIN;
+    fds.push_back(pfd);
+
+    pfd.fd = serialFd;
+    pfd.events = POLLIN | (serialOut.empty() ? 0 : POLLOUT);
+    fds.push_back(pfd);
+
+    for (std::map<int, Client>::iterator it = clients.begin();
+         it != clients.end(); ++it) {
+      pfd.fd = it->second.fd;
+      pfd.events = POLLIN | (it->second.out.empty() ? 0 : POLLOUT);
+      fds.push_back(pfd);
+      ids.push_back(it->first);
+    }
+
+    double wake = mux.nextDeadline();
+
+    if (serialFd < 0 && (wake == 0 || reopenAt < wake)) {
+      wake = reopenAt;
+    }
+
+    int timeoutMs = -1;
+
+    if (wake != 0) {
+      timeoutMs = wake > now ? (int)((wake - now) * 1000) + 1 : 0;
+    }
+
+    if (poll(&fds[0], fds.size(), timeoutMs) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      perror("poll");
+      break;
+    }
+
+    now = monotonic();
+
+    if (fds[0].revents & POLLIN) {
+      acceptClient();
+    }
+
+    if (serialFd >= 0) {
+      if (fds[1].revents & POLLIN) {
+        readLink(now);
+      } else if (fds[1].revents & (POLLHUP | POLLERR)) {
+        closeLink("hangup");
+      }
+    }
+
+    if (serialFd >= 0 && (fds[1].revents & POLLOUT)) {
+      writeLink();
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+      short revents = fds[i + 2].revents;
+
+      if (revents & POLLIN) {
+        readClient(ids[i], now);
+      } else if (revents & (POLLHUP | POLLERR)) {
+        clients[ids[i]].closing = true;
+      }
+
+      if ((revents & POLLOUT) && !clients[ids[i]].closing) {
+        writeClient(ids[i]);
+      }
+    }
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -d device   serial device (default /dev/waggle_sysmon)\n"
+          "  -p v3|v4    firmware protocol (default v4)\n"
+          "  -b baud     baud rate (default 57600 for v3, 115200 for v4)\n"
+          "  -s path     client socket (default /run/wagmand.sock)\n"
+          "  -w n        requests on the link at once (default 4)\n"
+          "  -t seconds  request timeout (default 10)\n"
+          "  -v          print link traffic\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  const char *device = "/dev/waggle_sysmon";
+  const char *socketPath = "/run/wagmand.sock";
+  Protocol protocol = PROTOCOL_V4;
+  int baud = 0;
+  unsigned int window = 4;
+  double timeout = 10;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:p:b:s:w:t:v")) != -1) {
+    switch (opt) {
+      case 'd':
+        device = optarg;
+        break;
+      case 'p':
+        if (strcmp(optarg, "v3") == 0) {
+          protocol = PROTOCOL_V3;
+        } else if (strcmp(optarg, "v4") == 0) {
+          protocol = PROTOCOL_V4;
+        } else {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'b':
+        baud = atoi(optarg);
+        break;
+      case 's':
+        socketPath = optarg;
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      case 't':
+        timeout = atof(optarg);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (baud == 0) {
+    baud = (protocol == PROTOCOL_V3) ? 57600 : 115200;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handleStop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  Daemon daemon(protocol, device, baud, window, timeout, verbose);
+
+  if (!daemon.listen(socketPath)) {
+    return 1;
+  }
+
+  daemon.run();
+  daemon.shutdown();
+  return 0;
+}
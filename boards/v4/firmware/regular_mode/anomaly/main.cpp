@@ -0,0 +1,340 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <random>
+#include <vector>
+
+#include "Anomaly.h"
+#include "Wagman.h"
+
+// anomalysim - measures the port current change detector on traces.
+//
+// The firmware's Anomaly::Detector is fed one second averages, either
+// generated from a few current models or read from recorded traces, and its
+// false alarms and detection delays are reported. With -c it exits non-zero if
+// the detector misses the targets below.
+
+bool logging = false;
+bool logEvents = false;
+
+// the detector only needs these from the Wagman namespace when linked into
+// the firmware's update.
+static SensorSample sample;
+
+namespace Wagman {
+const SensorSample &getSample() { return sample; }
+};  // namespace Wagman
+
+static const unsigned long DAY = 86400L;
+static const unsigned long HOUR = 3600L;
+
+// targets checked by -c.
+static const double MAX_FALSE_ALARMS_PER_DAY = 0.05;
+static const unsigned long MAX_STEP_DELAY = 120;  // for a 25% step
+static const unsigned long MAX_DRIFT_DELAY = 2 * HOUR;
+
+typedef std::mt19937 Random;
+
+// a model of one port's current as one second averages in mA.
+struct Model {
+  const char *name;
+  double level;
+  double noise;      // white noise of the averages
+  double wander;     // standard deviation of a slow AR(1) wander
+  double burstRate;  // load bursts per hour
+  double burstSize;  // fraction of the level
+
+  // whether detection delays are checked. bursts which dominate a port's
+  // deviation hide small changes, so they're only reported for bursty.
+  bool checkDelays;
+};
+
+static const Model MODELS[] = {
+    {"quiet", 120, 0.3, 0, 0, 0, true},
+    {"white", 400, 3, 0, 0, 0, true},
+    {"workload", 600, 4, 6, 6, 0.15, true},
+    {"bursty", 900, 8, 10, 30, 0.3, false},
+};
+
+static const unsigned int MODEL_COUNT = sizeof(MODELS) / sizeof(MODELS[0]);
+
+struct Trace {
+  const Model &model;
+  Random random;
+  std::normal_distribution<double> normal;
+  std::uniform_real_distribution<double> uniform;
+  double wander;
+  unsigned long burstLeft;
+
+  Trace(const Model &model, unsigned long seed)
+      : model(model), random(seed), normal(0, 1), uniform(0, 1), wander(0),
+        burstLeft(0) {}
+
+  // next one second average for a device whose true level is scaled by gain.
+  long next(double gain) {
+    // AR(1) with a time constant of about 10 minutes.
+    const double phi = 0.998;
+    wander = phi * wander + model.wander * sqrt(1 - phi * phi) * normal(random);
+
+    double value = model.level * gain + wander + model.noise * normal(random);
+
+    if (burstLeft > 0) {
+      burstLeft--;
+      value += model.level * model.burstSize;
+    } else if (uniform(random) < model.burstRate / HOUR) {
+      burstLeft = 5 + (unsigned long)(uniform(random) * 25);
+    }
+
+    return lround(max(value, 1.0) * 256);
+  }
+};
+
+static unsigned long falseAlarms(const Model &model, unsigned long days,
+                                 unsigned long seed) {
+  Trace trace(model, seed);
+  Anomaly::Detector detector;
+  detector.reset();
+  unsigned long alarms = 0;
+
+  for (unsigned long t = 0; t < days * DAY; t++) {
+    if (detector.add(trace.next(1)) != Anomaly::CHANGE_NONE) {
+      alarms++;
+    }
+  }
+
+  return alarms;
+}
+
+// seconds from the start of a change to its detection, or 0 if it wasn't
+// detected within limit. the gain moves from 1 to 1 + change over ramp
+// seconds, after an hour without alarms to learn the baseline.
+static unsigned long delay(const Model &model, double change,
+                           unsigned long ramp, unsigned long limit,
+                           unsigned long seed, byte &direction) {
+  Trace trace(model, seed);
+  Anomaly::Detector detector;
+  detector.reset();
+
+  // a false alarm while learning starts the hour over.
+  for (unsigned long t = 0; t < HOUR; t++) {
+    if (detector.add(trace.next(1)) != Anomaly::CHANGE_NONE) {
+      t = 0;
+    }
+  }
+
+  for (unsigned long t = 1; t <= limit; t++) {
+    double gain = 1 + change * min(1.0, (double)t / max(ramp, 1UL));
+    direction = detector.add(trace.next(gain));
+
+    if (direction != Anomaly::CHANGE_NONE) {
+      return t;
+    }
+  }
+
+  return 0;
+}
+
+struct DelayStats {
+  unsigned long detected;
+  unsigned long wrong;
+  double mean;
+  unsigned long worst;
+};
+
+static DelayStats delays(const Model &model, double change, unsigned long ramp,
+                         unsigned long limit, unsigned int trials) {
+  DelayStats stats = {0, 0, 0, 0};
+  byte expected = change > 0 ? Anomaly::CHANGE_RISE : Anomaly::CHANGE_DROP;
+
+  for (unsigned int i = 0; i < trials; i++) {
+    byte direction = Anomaly::CHANGE_NONE;
+    unsigned long t = delay(model, change, ramp, limit, 1000 + i, direction);
+
+    if (t == 0) {
+      continue;
+    }
+
+    if (direction != expected) {
+      stats.wrong++;
+      continue;
+    }
+
+    stats.detected++;
+    stats.mean += t;
+    stats.worst = max(stats.worst, t);
+  }
+
+  if (stats.detected > 0) {
+    stats.mean /= stats.detected;
+  }
+
+  return stats;
+}
+
+static bool synthetic(unsigned long days, unsigned int trials, bool check) {
+  bool ok = true;
+
+  printf("%-10s %14s\n", "model", "false alarms/day");
+
+  for (unsigned int i = 0; i < MODEL_COUNT; i++) {
+    unsigned long alarms = falseAlarms(MODELS[i], days, i + 1);
+    double rate = (double)alarms / days;
+    printf("%-10s %14.3f  (%lu in %lu days)\n", MODELS[i].name, rate, alarms,
+           days);
+
+    if (rate > MAX_FALSE_ALARMS_PER_DAY) {
+      ok = false;
+    }
+  }
+
+  struct Case {
+    const char *name;
+    double change;
+    unsigned long ramp;
+    unsigned long limit;
+    unsigned long target;  // worst delay allowed, 0 if not checked
+  };
+
+  const Case cases[] = {
+      {"step +25%", 0.25, 0, HOUR, MAX_STEP_DELAY},
+      {"step -25%", -0.25, 0, HOUR, MAX_STEP_DELAY},
+      {"step +10%", 0.10, 0, HOUR, 0},
+      {"step -10%", -0.10, 0, HOUR, 0},
+      {"step +5%", 0.05, 0, HOUR, 0},
+      {"drift +10%/1h", 0.10, HOUR, 4 * HOUR, MAX_DRIFT_DELAY},
+      {"drift +25%/6h", 0.25, 6 * HOUR, 12 * HOUR, 0},
+      {"drift -20%/3h", -0.20, 3 * HOUR, 8 * HOUR, 0},
+  };
+
+  printf("\n%-10s %-15s %9s %10s %10s\n", "model", "change", "detected",
+         "mean (s)", "worst (s)");
+
+  for (unsigned int i = 0; i < MODEL_COUNT; i++) {
+    for (unsigned int j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+      const Case &c = cases[j];
+      DelayStats stats =
+          delays(MODELS[i], c.change, c.ramp, c.limit, trials);
+
+      printf("%-10s %-15s %4lu/%-4u %10.0f %10lu", MODELS[i].name, c.name,
+             stats.detected, trials, stats.mean, stats.worst);
+
+      if (stats.wrong > 0) {
+        printf("  %lu the wrong way", stats.wrong);
+      }
+
+      printf("\n");
+
+      if (MODELS[i].checkDelays && c.target != 0 &&
+          (stats.detected < trials || stats.worst > c.target)) {
+        ok = false;
+      }
+    }
+  }
+
+  if (check) {
+    printf("\n%s\n", ok ? "ok" : "FAIL: targets missed");
+  }
+
+  return ok;
+}
+
+// each line of a recorded trace is one second's average current in mA. only
+// the last field of a line is used, so timestamped lines work too.
+static void recorded(FILE *file, const char *name) {
+  Anomaly::Detector detector;
+  detector.reset();
+
+  char line[256];
+  unsigned long samples = 0;
+  unsigned long changes = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    const char *field = line;
+    const char *space;
+
+    while ((space = strpbrk(field, " \t")) != NULL && space[1] != '\0' &&
+           space[1] != '\n') {
+      field = space + 1;
+    }
+
+    char *end;
+    double value = strtod(field, &end);
+
+    if (end == field) {
+      continue;
+    }
+
+    samples++;
+    long before = detector.getBaseline();
+    byte direction = detector.add(lround(value * 256));
+
+    if (direction != Anomaly::CHANGE_NONE) {
+      changes++;
+      printf("%s:%lu %s from %.1f to %.1f mA\n", name, samples,
+             direction == Anomaly::CHANGE_RISE ? "rise" : "drop",
+             before / 256.0, value);
+    }
+  }
+
+  printf("%s: %lu changes in %lu samples\n", name, changes, samples);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: anomalysim [options] [trace ...]\n"
+          "  -d days       days of each model for false alarms (100)\n"
+          "  -n trials     trials of each change (100)\n"
+          "  -c            exit non-zero if the targets are missed\n"
+          "traces are replayed instead of running the models. - is stdin.\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  unsigned long days = 100;
+  unsigned int trials = 100;
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:n:c")) != -1) {
+    switch (opt) {
+      case 'd':
+        days = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        trials = strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        check = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  if (optind < argc) {
+    for (int i = optind; i < argc; i++) {
+      FILE *file = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+
+      if (file == NULL) {
+        perror(argv[i]);
+        return 1;
+      }
+
+      recorded(file, argv[i]);
+
+      if (file != stdin) {
+        fclose(file);
+      }
+    }
+
+    return 0;
+  }
+
+  return synthetic(days, trials, check) ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <benchmark/benchmark.h>
+
+#include "Time.h"
+
+// a spread of times from 2016 to 2036, so leap years and month lengths are all
+// exercised.
+static const unsigned int TIME_COUNT = 256;
+
+static time_t times[TIME_COUNT];
+
+static void initTimes() {
+  for (unsigned int i = 0; i < TIME_COUNT; i++) {
+    times[i] = 1451606400 + (time_t)i * 2467133;
+  }
+}
+
+static void BM_BreakTime(benchmark::State &state) {
+  tmElements_t tm;
+  unsigned int i = 0;
+
+  initTimes();
+
+  for (auto _ : state) {
+    breakTime(times[i], tm);
+    benchmark::DoNotOptimize(tm);
+    i = (i + 1) % TIME_COUNT;
+  }
+}
+BENCHMARK(BM_BreakTime);
+
+static void BM_MakeTime(benchmark::State &state) {
+  tmElements_t tms[TIME_COUNT];
+  unsigned int i = 0;
+
+  initTimes();
+
+  for (unsigned int n = 0; n < TIME_COUNT; n++) {
+    breakTime(times[n], tms[n]);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(makeTime(tms[i]));
+    i = (i + 1) % TIME_COUNT;
+  }
+}
+BENCHMARK(BM_MakeTime);
+
+static void BM_BreakMakeTime(benchmark::State &state) {
+  tmElements_t tm;
+  unsigned int i = 0;
+
+  initTimes();
+
+  for (auto _ : state) {
+    breakTime(times[i], tm);
+
+    if (makeTime(tm) != times[i]) {
+      state.SkipWithError("makeTime didn't invert breakTime");
+      break;
+    }
+
+    i = (i + 1) % TIME_COUNT;
+  }
+}
+BENCHMARK(BM_BreakMakeTime);
@@ -0,0 +1,74 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <benchmark/benchmark.h>
+
+#include "CommandStats.h"
+
+// fills the stats table with count distinct commands on link 0, ids 0 up.
+static void fillStats(byte count) {
+  CommandStats::reset();
+
+  for (byte i = 0; i < count; i++) {
+    CommandStats::record(0, i, 100, true);
+  }
+}
+
+// a repeated command whose entry is the given index into the table, so
+// record scans that many entries first. the last index of a full table is the
+// longest scan a recorded command can take.
+static void BM_CommandStatsRecordHit(benchmark::State &state) {
+  byte index = state.range(0);
+  unsigned long micros = 0;
+
+  fillStats(CommandStats::MAX_ENTRIES);
+
+  for (auto _ : state) {
+    CommandStats::record(0, index, micros++ & 0xff, true);
+  }
+
+  state.counters["scanned"] = index + 1;
+}
+BENCHMARK(BM_CommandStatsRecordHit)
+    ->Arg(0)
+    ->Arg(CommandStats::MAX_ENTRIES / 2)
+    ->Arg(CommandStats::MAX_ENTRIES - 1);
+
+// a command which isn't in a full table scans every entry and is dropped.
+// this is the most record can cost.
+static void BM_CommandStatsRecordFull(benchmark::State &state) {
+  fillStats(CommandStats::MAX_ENTRIES);
+
+  for (auto _ : state) {
+    CommandStats::record(1, 0xffff, 100, true);
+  }
+
+  if (CommandStats::getCount() != CommandStats::MAX_ENTRIES ||
+      CommandStats::getDropped() == 0) {
+    state.SkipWithError("record didn't drop a command from a full table");
+  }
+
+  state.counters["scanned"] = CommandStats::MAX_ENTRIES;
+}
+BENCHMARK(BM_CommandStatsRecordFull);
+
+// the first time a command is seen: the scan of the entries so far and the
+// append. the table is cleared every MAX_ENTRIES commands.
+static void BM_CommandStatsRecordNew(benchmark::State &state) {
+  byte next = 0;
+
+  CommandStats::reset();
+
+  for (auto _ : state) {
+    if (next == CommandStats::MAX_ENTRIES) {
+      state.PauseTiming();
+      CommandStats::reset();
+      next = 0;
+      state.ResumeTiming();
+    }
+
+    CommandStats::record(0, next++, 100, true);
+  }
+}
+BENCHMARK(BM_CommandStatsRecordNew);
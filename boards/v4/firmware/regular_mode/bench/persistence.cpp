@@ -0,0 +1,120 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <benchmark/benchmark.h>
+
+#include "EEPROM.h"
+#include "Record.h"
+#include "Wagman.h"
+
+// Record only needs this much of the board.
+namespace Wagman {
+bool validPort(byte port) { return port < 5; }
+};  // namespace Wagman
+
+static MockEEPROM<4096> mock;
+
+// hides an address from the optimizer. with a constant one, get and put fold
+// into a single load or store and no longer measure the byte loop.
+static int opaque(int addr) {
+  benchmark::DoNotOptimize(addr);
+  return addr;
+}
+
+static void BM_MockEEPROMGetULong(benchmark::State &state) {
+  unsigned long value;
+
+  mock.clear();
+
+  for (auto _ : state) {
+    mock.get(opaque(100), value);
+    benchmark::DoNotOptimize(value);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_MockEEPROMGetULong);
+
+static void BM_MockEEPROMPutULong(benchmark::State &state) {
+  unsigned long value = 0;
+
+  for (auto _ : state) {
+    mock.put(opaque(100), value++);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_MockEEPROMPutULong);
+
+static void BM_MockEEPROMGetPortConfig(benchmark::State &state) {
+  PortConfig config;
+
+  mock.clear();
+
+  for (auto _ : state) {
+    mock.get(opaque(256), config);
+    benchmark::DoNotOptimize(config);
+    benchmark::ClobberMemory();
+  }
+
+  state.SetBytesProcessed(state.iterations() * sizeof(config));
+}
+BENCHMARK(BM_MockEEPROMGetPortConfig);
+
+static void BM_MockEEPROMPutPortConfig(benchmark::State &state) {
+  PortConfig config;
+
+  memset(&config, 0, sizeof(config));
+
+  for (auto _ : state) {
+    config.faultTimeout++;
+    mock.put(opaque(256), config);
+    benchmark::ClobberMemory();
+  }
+
+  state.SetBytesProcessed(state.iterations() * sizeof(config));
+}
+BENCHMARK(BM_MockEEPROMPutPortConfig);
+
+// the boot logs go through the real ExternalEEPROM code over the host I2C
+// model, so the bus transactions per call are what to watch. on the Due each
+// one costs on the order of 100us at 400kHz.
+static void reportTransfers(benchmark::State &state, unsigned long start) {
+  state.counters["transfers"] = benchmark::Counter(
+      Wire.transfers - start, benchmark::Counter::kAvgIterations);
+}
+
+static void BM_BootLogAddEntry(benchmark::State &state) {
+  Record::BootLog &log = Record::bootLogs[0];
+  time_t t = 1767225600;
+
+  log.init();
+  unsigned long start = Wire.transfers;
+
+  for (auto _ : state) {
+    log.addEntry(t++);
+  }
+
+  reportTransfers(state, start);
+}
+BENCHMARK(BM_BootLogAddEntry);
+
+static void BM_BootLogGetEntry(benchmark::State &state) {
+  Record::BootLog &log = Record::bootLogs[0];
+  byte i = 0;
+
+  log.init();
+
+  for (byte n = 0; n < log.getCapacity(); n++) {
+    log.addEntry(1767225600 + n);
+  }
+
+  unsigned long start = Wire.transfers;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(log.getEntry(i));
+    i = (i + 1) % log.getCapacity();
+  }
+
+  reportTransfers(state, start);
+}
+BENCHMARK(BM_BootLogGetEntry);
@@ -0,0 +1,136 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <benchmark/benchmark.h>
+
+#include "waggle.h"
+
+// Command encoding and decoding, set up the way basicResp and processCommand
+// use the waggle library. Built when WAGGLE_DIR points at the library.
+
+static const int REQ_WAGMAN_STOP = 0xc008;
+static const int PUB_WAGMAN_STOP = 0xff08;
+
+// same as basicResp in firmware.ino.
+template <class T>
+static void basicResp(writer &w, int id, int sub_id, T value) {
+  sensorgram_encoder<64> e(w);
+  e.info.id = id;
+  e.info.sub_id = sub_id;
+  e.info.inst = 0;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(value);
+  e.encode();
+}
+
+// a request line, base64 encoded the way the client sends it.
+static int encodeRequest(bytebuffer<128> &buffer) {
+  buffer.reset();
+  base64_encoder b64e(buffer);
+  sensorgram_encoder<64> e(b64e);
+  e.info.id = REQ_WAGMAN_STOP;
+  e.info.sub_id = 1;
+  e.info.inst = 0;
+  e.info.source_id = 0;
+  e.info.source_inst = 0;
+  e.encode_uint(120);
+  e.encode();
+  b64e.close();
+  return buffer.size();
+}
+
+static void BM_Base64RoundTrip(benchmark::State &state) {
+  int size = state.range(0);
+  byte data[128];
+  byte out[128];
+  bytebuffer<256> buffer;
+
+  for (int i = 0; i < size; i++) {
+    data[i] = i * 7;
+  }
+
+  for (auto _ : state) {
+    buffer.reset();
+
+    base64_encoder b64e(buffer);
+    b64e.write(data, size);
+    b64e.close();
+
+    base64_decoder b64d(buffer);
+    benchmark::DoNotOptimize(b64d.read(out, size));
+  }
+
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_Base64RoundTrip)->Arg(8)->Arg(32)->Arg(96);
+
+static void BM_BasicResp(benchmark::State &state) {
+  bytebuffer<128> buffer;
+
+  for (auto _ : state) {
+    buffer.reset();
+    base64_encoder b64e(buffer);
+    basicResp(b64e, PUB_WAGMAN_STOP, 1, 0);
+    b64e.close();
+    benchmark::DoNotOptimize(buffer.size());
+  }
+}
+BENCHMARK(BM_BasicResp);
+
+static void BM_DecodeCommand(benchmark::State &state) {
+  bytebuffer<128> request;
+  bytebuffer<128> buffer;
+  byte line[128];
+
+  int n = encodeRequest(request);
+  request.read(line, n);
+
+  for (auto _ : state) {
+    buffer.reset();
+    buffer.write(line, n);
+
+    base64_decoder b64d(buffer);
+    sensorgram_decoder<64> d(b64d);
+
+    if (!d.decode() || d.info.id != REQ_WAGMAN_STOP) {
+      state.SkipWithError("request didn't decode");
+      break;
+    }
+
+    benchmark::DoNotOptimize(d.decode_uint());
+  }
+}
+BENCHMARK(BM_DecodeCommand);
+
+// request in, response out, as processCommand handles a stop.
+static void BM_CommandRoundTrip(benchmark::State &state) {
+  bytebuffer<128> request;
+  bytebuffer<128> buffer;
+  bytebuffer<128> response;
+  byte line[128];
+
+  int n = encodeRequest(request);
+  request.read(line, n);
+
+  for (auto _ : state) {
+    buffer.reset();
+    buffer.write(line, n);
+    response.reset();
+
+    base64_decoder b64d(buffer);
+    sensorgram_decoder<64> d(b64d);
+
+    while (d.decode()) {
+      base64_encoder b64e(response);
+      int after = d.decode_uint();
+      basicResp(b64e, PUB_WAGMAN_STOP, d.info.sub_id, d.err ? 0 : after);
+      b64e.close();
+      response.writebyte('\n');
+    }
+
+    benchmark::DoNotOptimize(response.size());
+  }
+}
+BENCHMARK(BM_CommandRoundTrip);
@@ -0,0 +1,29 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <benchmark/benchmark.h>
+
+#include "HTU21D.h"
+
+// test cases from the HTU21D datasheet. all check out to 0.
+static const uint16_t MESSAGES[] = {0x00DC, 0x683A, 0x4E85};
+static const uint8_t CHECKS[] = {0x79, 0x7C, 0x6B};
+
+static void BM_HTU21DCheckCRC(benchmark::State &state) {
+  HTU21D htu21d;
+  byte i = 0;
+
+  for (byte n = 0; n < 3; n++) {
+    if (htu21d.check_crc(MESSAGES[n], CHECKS[n]) != 0) {
+      state.SkipWithError("check_crc rejected a datasheet test case");
+      return;
+    }
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(htu21d.check_crc(MESSAGES[i], CHECKS[i]));
+    i = (i + 1) % 3;
+  }
+}
+BENCHMARK(BM_HTU21DCheckCRC);
@@ -0,0 +1,79 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_BENCH_WAGGLE_STUB__
+#define __H_BENCH_WAGGLE_STUB__
+
+#include <Arduino.h>
+
+// Declarations of the parts of the waggle Arduino library which the firmware
+// and protocol.cpp use. The library isn't part of this repo, so without it
+// protocol.cpp is compiled against these to check it still builds, but it
+// can't be linked or run.
+
+class writer {
+ public:
+  virtual int write(const byte *s, int n) = 0;
+  int writebyte(byte b);
+};
+
+class reader {
+ public:
+  virtual int read(byte *s, int n) = 0;
+  int readbyte();
+};
+
+template <int N>
+class bytebuffer : public writer, public reader {
+ public:
+  int write(const byte *s, int n);
+  int read(byte *s, int n);
+  void reset();
+  int size() const;
+};
+
+class base64_encoder : public writer {
+ public:
+  base64_encoder(writer &w);
+  int write(const byte *s, int n);
+  void close();
+};
+
+class base64_decoder : public reader {
+ public:
+  base64_decoder(reader &r);
+  int read(byte *s, int n);
+};
+
+struct sensorgram_info {
+  unsigned int id;
+  unsigned int sub_id;
+  unsigned int inst;
+  unsigned int source_id;
+  unsigned int source_inst;
+};
+
+template <int N>
+class sensorgram_encoder {
+ public:
+  sensorgram_encoder(writer &w);
+  void encode_uint(unsigned long value);
+  void encode_bytes(const byte *data, int size);
+  void encode();
+
+  sensorgram_info info;
+};
+
+template <int N>
+class sensorgram_decoder {
+ public:
+  sensorgram_decoder(reader &r);
+  bool decode();
+  unsigned long decode_uint();
+
+  sensorgram_info info;
+  bool err;
+};
+
+#endif
@@ -0,0 +1,367 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "ClockTrim.h"
+#include "MCP79412RTC.h"
+#include "Wagman.h"
+
+// clocktrimtest - checks the RTC trim estimate against synthetic drift.
+//
+// ClockTrim::estimate is given sync logs of an RTC with a known oscillator
+// error: free running, stepped back to the host time, already trimmed, and
+// with intervals it has to filter out. Then ClockTrim::sync is run against a
+// simulated RTC for 60 days of host time syncs, for oscillators across the
+// trim range, and must trim each of them to within one step. With -c it exits
+// non-zero if any case fails.
+
+bool logging = false;
+
+typedef std::mt19937 Random;
+
+static const time_t START = 1500000000L;
+static const unsigned long DAY = 86400L;
+
+// an RTC whose oscillator is off by drift ppb, less its trim, against host
+// time in seconds. it keeps its fraction of a second, but only whole seconds
+// can be read.
+struct SimRTC {
+  double host;
+  double offset;
+  long drift;
+  int trim;
+  unsigned long steps;
+
+  void reset(long drift) {
+    host = START;
+    offset = 0.5;
+    this->drift = drift;
+    trim = 0;
+    steps = 0;
+  }
+
+  void advance(double seconds) {
+    host += seconds;
+    offset += seconds * (drift - (double)trim * ClockTrim::TRIM_STEP_PPB) / 1e9;
+  }
+
+  time_t read() const { return (time_t)floor(host + offset); }
+};
+
+static SimRTC rtc;
+
+// ClockTrim only needs these outside of itself.
+namespace Wagman {
+MCP79412RTC Clock;
+
+bool getWireEnabled() { return true; }
+
+void setTime(const time_t &time) {
+  rtc.offset = time - rtc.host + 0.5;
+  rtc.steps++;
+}
+};  // namespace Wagman
+
+time_t MCP79412RTC::get() { return rtc.read(); }
+
+int MCP79412RTC::calibRead() { return rtc.trim; }
+
+void MCP79412RTC::calibWrite(int value) { rtc.trim = value; }
+
+// the sync log is kept in memory. its EEPROM layout assumes the board's 4
+// byte time_t.
+namespace Record {
+static std::deque<ClockSync> syncs;
+
+ClockSyncLog::ClockSyncLog(unsigned int addr) { address = addr; }
+
+void ClockSyncLog::init() { syncs.clear(); }
+
+void ClockSyncLog::addEntry(const ClockSync &sync) {
+  if (syncs.size() == capacity) {
+    syncs.pop_front();
+  }
+
+  syncs.push_back(sync);
+}
+
+bool ClockSyncLog::getEntry(byte i, ClockSync &sync) const {
+  if (i >= syncs.size()) {
+    return false;
+  }
+
+  sync = syncs[i];
+  return true;
+}
+
+byte ClockSyncLog::getCount() const { return syncs.size(); }
+
+byte ClockSyncLog::getCapacity() const { return capacity; }
+
+ClockSyncLog clockSyncLog(0);
+};  // namespace Record
+
+static unsigned int failures = 0;
+
+static void expect(bool ok, const char *name) {
+  printf("%-48s %s\n", name, ok ? "ok" : "FAIL");
+
+  if (!ok) {
+    failures++;
+  }
+}
+
+// builds a sync log the way ClockTrim::sync would, with syncs at the given
+// spacings in seconds. trims[i] is the trim in effect before sync i.
+static std::vector<ClockSync> driftLog(long drift,
+                                       const std::vector<unsigned long> &gaps,
+                                       const std::vector<int> &trims) {
+  std::vector<ClockSync> log;
+
+  rtc.reset(drift);
+
+  for (unsigned int i = 0; i <= gaps.size(); i++) {
+    if (i > 0) {
+      rtc.advance(gaps[i - 1]);
+    }
+
+    rtc.trim = trims[min(i, (unsigned int)trims.size() - 1)];
+
+    ClockSync sync;
+    sync.host = (time_t)rtc.host;
+    sync.rtc = rtc.read();
+    sync.trim = rtc.trim;
+
+    long offset = (long)(sync.rtc - sync.host);
+    sync.stepped = offset > ClockTrim::MAX_OFFSET ||
+                   offset < -ClockTrim::MAX_OFFSET;
+
+    if (sync.stepped) {
+      Wagman::setTime(sync.host);
+    }
+
+    log.push_back(sync);
+  }
+
+  return log;
+}
+
+struct Estimate {
+  bool ok;
+  long ppb;
+  unsigned long baseline;
+  long uncertainty;
+};
+
+static Estimate estimate(const std::vector<ClockSync> &log) {
+  Estimate e;
+  e.ok = ClockTrim::estimate(log.data(), log.size(), e.ppb, e.baseline,
+                             e.uncertainty);
+  return e;
+}
+
+// an estimate is close if it's within the error of reading whole seconds at
+// both ends of the baseline.
+static bool close(const Estimate &e, long drift) {
+  return e.ok && labs(e.ppb - drift) <= 2000000000LL / e.baseline;
+}
+
+static void testFreeRunning() {
+  // 10 ppm gains under a second a day, so it's never stepped.
+  std::vector<ClockSync> log =
+      driftLog(10000, std::vector<unsigned long>(7, DAY), {0});
+  Estimate e = estimate(log);
+
+  expect(close(e, 10000) && e.baseline == 7 * DAY,
+         "free running drift");
+  expect(e.uncertainty == (long)(1000000000LL * 2 / e.baseline),
+         "uncertainty over 7 intervals");
+
+  log = driftLog(-10000, std::vector<unsigned long>(7, DAY), {0});
+  expect(close(estimate(log), -10000), "free running slow drift");
+}
+
+static void testStepped() {
+  // 60 ppm gains 5 s a day, so every sync steps the RTC back. each interval
+  // has to start from zero offset.
+  std::vector<ClockSync> log =
+      driftLog(60000, std::vector<unsigned long>(7, DAY), {0});
+  bool allStepped = true;
+
+  for (unsigned int i = 1; i < log.size(); i++) {
+    allStepped = allStepped && log[i].stepped;
+  }
+
+  expect(allStepped && close(estimate(log), 60000), "stepped every interval");
+
+  // steps in only some intervals.
+  log = driftLog(-15000, {DAY, 3 * DAY, DAY / 2, 2 * DAY, DAY}, {0});
+  expect(close(estimate(log), -15000), "stepped some intervals");
+
+  // the same log read as if it had never been stepped is far off, so the
+  // flag is what makes the estimate right.
+  for (unsigned int i = 0; i < log.size(); i++) {
+    log[i].stepped = false;
+  }
+
+  expect(!close(estimate(log), -15000), "unstepped reading of a stepped log");
+}
+
+static void testTrimAddBack() {
+  // a 40 ppm oscillator already trimmed by 39 steps only drifts 0.3 ppm, but
+  // the estimate is of the untrimmed error.
+  std::vector<ClockSync> log =
+      driftLog(40000, std::vector<unsigned long>(7, DAY), {39});
+  expect(close(estimate(log), 40000), "trim in effect is added back");
+
+  // trim changing partway through, as it does once the first trim is set.
+  log = driftLog(-25000, std::vector<unsigned long>(7, DAY),
+                 {0, 0, 0, -25, -25, -25, -25, -25});
+  expect(close(estimate(log), -25000), "trim changed between syncs");
+
+  log = driftLog(200000, std::vector<unsigned long>(7, DAY), {127});
+  expect(close(estimate(log), 200000), "trim at its limit");
+}
+
+static void testFilter() {
+  // 60 ppm, so every sync steps the RTC back to the host time.
+  std::vector<ClockSync> clean =
+      driftLog(60000, std::vector<unsigned long>(7, DAY), {0});
+
+  // the RTC was set an hour off by something else between two syncs. the
+  // sync after it steps it back.
+  std::vector<ClockSync> log = clean;
+  log[4].rtc += 3600;
+  Estimate e = estimate(log);
+
+  expect(close(e, 60000) && e.baseline == 6 * DAY,
+         "interval with an outside RTC set is skipped");
+
+  // syncs too close together measure nothing.
+  log = driftLog(20000, {DAY, 30, DAY, 59, DAY}, {0});
+  e = estimate(log);
+  expect(close(e, 20000) && e.baseline == 3 * DAY,
+         "intervals under MIN_INTERVAL are skipped");
+
+  // a bad host time, earlier than the sync before it. the RTC is stepped to
+  // it, so the next sync finds the RTC a day behind and steps it again.
+  log = clean;
+  log[3].host = log[2].host - 10;
+  log[4].rtc -= clean[3].host - log[3].host;
+  e = estimate(log);
+  expect(close(e, 60000) && e.baseline == 5 * DAY,
+         "host time going back is skipped");
+
+  // a residual just under and just over the limit.
+  log = driftLog(0, {DAY}, {0});
+  log[1].rtc = log[1].host + ClockTrim::MAX_RESIDUAL_PPB * DAY / 1000000000L;
+  expect(estimate(log).ok, "residual at the limit is used");
+  log[1].rtc += 1;
+  expect(!estimate(log).ok, "residual over the limit is skipped");
+
+  // nothing usable.
+  expect(!estimate(std::vector<ClockSync>()).ok, "empty log");
+  expect(!estimate(driftLog(0, std::vector<unsigned long>(), {0})).ok,
+         "single sync");
+  expect(!estimate(driftLog(0, {10, 20}, {0})).ok, "only short intervals");
+}
+
+static void testTrimForError() {
+  expect(ClockTrim::trimForError(0) == 0 &&
+             ClockTrim::trimForError(508) == 0 &&
+             ClockTrim::trimForError(509) == 1 &&
+             ClockTrim::trimForError(-508) == 0 &&
+             ClockTrim::trimForError(-509) == -1,
+         "trim rounds to the nearest step");
+  expect(ClockTrim::trimForError(1000000000L) == ClockTrim::MAX_TRIM &&
+             ClockTrim::trimForError(-1000000000L) == -ClockTrim::MAX_TRIM,
+         "trim is clamped");
+}
+
+// runs ClockTrim::sync for 60 days on an oscillator with the given error,
+// with syncs 1 to 24 hours apart. returns false if it isn't trimmed to
+// within one step by the end.
+static bool converge(Random &random, long drift) {
+  std::uniform_real_distribution<double> gap(3600, DAY);
+  double firstTrim = -1;
+
+  rtc.reset(drift);
+  Record::clockSyncLog.init();
+
+  while (rtc.host < START + 60.0 * DAY) {
+    rtc.advance(gap(random));
+    ClockTrim::sync((time_t)rtc.host);
+
+    if (firstTrim < 0 && rtc.trim != 0) {
+      firstTrim = (rtc.host - START) / DAY;
+    }
+  }
+
+  long residual = drift - rtc.trim * ClockTrim::TRIM_STEP_PPB;
+  bool ok = labs(residual) <= ClockTrim::TRIM_STEP_PPB;
+
+  printf("%9ld %6d %10ld %9.1f %7lu  %s\n", drift, rtc.trim, residual,
+         firstTrim, rtc.steps, ok ? "ok" : "FAIL");
+
+  return ok;
+}
+
+static void testConvergence() {
+  Random random(1);
+  bool ok = true;
+
+  printf("\n%9s %6s %10s %9s %7s\n", "drift ppb", "trim", "residual",
+         "trim day", "steps");
+
+  const long DRIFTS[] = {0, 3000, -7000, 20000, -45000, 90000, -120000};
+
+  for (long drift : DRIFTS) {
+    ok = converge(random, drift) && ok;
+  }
+
+  printf("\n");
+  expect(ok, "sync trims each oscillator to within a step");
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: clocktrimtest [options]\n"
+          "  -c            exit non-zero if any case fails\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c")) != -1) {
+    switch (opt) {
+      case 'c':
+        check = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  testFreeRunning();
+  testStepped();
+  testTrimAddBack();
+  testFilter();
+  testTrimForError();
+  testConvergence();
+
+  if (check) {
+    printf("\n%s\n", failures == 0 ? "ok" : "FAIL");
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,297 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "EEPROM.h"
+#include "Energy.h"
+#include "Wagman.h"
+
+// energysim - measures the energy counters on known load profiles.
+//
+// The firmware's Energy module is fed sensor samples of load profiles whose
+// charge and energy are known, at the loop's sample rate and with the ADCs'
+// quantization, and the error of its totals is reported. Its lifetime totals
+// are then saved, restored across resets and interrupted saves. With -c it
+// exits non-zero if the targets below are missed.
+
+bool logging = false;
+bool logEvents = false;
+
+// Energy only needs these outside of itself.
+static SensorSample sample;
+
+namespace Wagman {
+const SensorSample &getSample() { return sample; }
+};  // namespace Wagman
+
+namespace SoftClock {
+time_t now() { return 1500000000L + millis() / 1000; }
+};  // namespace SoftClock
+
+ExternalEEPROM EEPROM;
+
+static const unsigned long HOUR = 3600000L;
+
+// port used for the profiles. its calibration is the board's.
+static const byte PORT = 0;
+static const Board::PortDescriptor &DESC = Board::BOARD.ports[PORT];
+
+// targets checked by -c, as fractions of the true totals.
+static const double MAX_SMOOTH_ERROR = 0.0005;
+static const double MAX_SWITCHING_ERROR = 0.001;
+
+typedef std::mt19937 Random;
+
+// a load on the port: current in mA and voltage in mV at a time in ms.
+struct Profile {
+  const char *name;
+  bool switching;  // whether the load has steps between samples
+  double (*current)(double t);
+  double (*voltage)(double t);
+};
+
+static double nominal(double t) { return 5000; }
+
+static double sagging(double t) {
+  return 5100 - 150 * (t / (24.0 * HOUR)) + 20 * sin(t / 45000.0);
+}
+
+static double constant(double t) { return 480; }
+
+static double step(double t) { return t < 12.0 * HOUR ? 150 : 950; }
+
+static double ramp(double t) { return 100 + 1000 * t / (24.0 * HOUR); }
+
+static double periodic(double t) {
+  return 600 + 300 * sin(2 * M_PI * t / 60000.0);
+}
+
+// a load switching between 250 and 1200 mA at random, every 1 to 30 s.
+static std::vector<double> switchTimes;
+
+static double switching(double t) {
+  size_t n = std::upper_bound(switchTimes.begin(), switchTimes.end(), t) -
+             switchTimes.begin();
+  return (n % 2 == 0) ? 250 : 1200;
+}
+
+static const Profile PROFILES[] = {
+    {"constant", false, constant, nominal},
+    {"step", true, step, nominal},
+    {"ramp", false, ramp, sagging},
+    {"periodic", false, periodic, sagging},
+    {"switching", true, switching, sagging},
+};
+
+static const unsigned int PROFILE_COUNT =
+    sizeof(PROFILES) / sizeof(PROFILES[0]);
+
+// ADC readings of a load, rounded to the nearest count like a centered ADC.
+static unsigned int currentCounts(double mA) {
+  return lround(mA * 1000 / DESC.currentScale) + DESC.currentZero;
+}
+
+static unsigned int voltageCounts(double mV) {
+  return lround(mV * 1000 / DESC.voltageScale);
+}
+
+static Random loopRandom(1);
+
+// runs the loop for duration ms starting at simMillis, sampling the profile
+// every 450 to 600 ms like the firmware's loop does.
+static void run(const Profile &profile, unsigned long start,
+                unsigned long duration) {
+  std::uniform_int_distribution<unsigned long> interval(450, 600);
+
+  while (simMillis - start < duration) {
+    double t = simMillis - start;
+    double mA = profile.current(t);
+
+    sample.systemCurrent = lround(mA / 16) * 16;
+    sample.ports[PORT].current = currentCounts(mA);
+    sample.ports[PORT].voltage = voltageCounts(profile.voltage(t));
+    sample.sampleMillis = simMillis;
+    Energy::update();
+
+    simMillis += interval(loopRandom);
+  }
+}
+
+// true charge in uC and energy in uJ over [0, duration), integrated every ms.
+static void exact(const Profile &profile, unsigned long duration,
+                  double &charge, double &energy) {
+  charge = 0;
+  energy = 0;
+
+  for (unsigned long t = 0; t < duration; t++) {
+    double mA = profile.current(t + 0.5);
+    charge += mA;
+    energy += mA * profile.voltage(t + 0.5) / 1000;
+  }
+}
+
+static double relative(double value, double expected) {
+  return (value - expected) / expected;
+}
+
+static void clearEEPROM() { memset(simEEPROM, 0xff, sizeof(simEEPROM)); }
+
+static bool integration() {
+  const unsigned long duration = 24 * HOUR;
+  bool ok = true;
+
+  printf("%-10s %12s %12s %12s %12s\n", "profile", "mAh", "charge err",
+         "mWh", "energy err");
+
+  for (unsigned int i = 0; i < PROFILE_COUNT; i++) {
+    const Profile &profile = PROFILES[i];
+
+    clearEEPROM();
+    simMillis = 0;
+    Energy::init();
+    run(profile, 0, duration);
+
+    // the totals end at the last sample.
+    double charge, energy;
+    exact(profile, sample.sampleMillis, charge, energy);
+
+    const Energy::Totals &totals = Energy::getBootTotals(1 + PORT);
+    double chargeError = relative(totals.charge, charge);
+    double energyError = relative(totals.energy, energy);
+
+    printf("%-10s %12.1f %+11.4f%% %12.1f %+11.4f%%\n", profile.name,
+           totals.charge / 3.6e6, chargeError * 100, totals.energy / 3.6e6,
+           energyError * 100);
+
+    double limit =
+        profile.switching ? MAX_SWITCHING_ERROR : MAX_SMOOTH_ERROR;
+
+    if (fabs(chargeError) > limit || fabs(energyError) > limit) {
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+// the lifetime totals after resets should be the sum of every boot's totals,
+// less at most SAVE_INTERVAL of each boot which ended without a save.
+static bool persistence() {
+  const Profile &profile = PROFILES[0];
+  const unsigned long boots = 20;
+  bool ok = true;
+
+  clearEEPROM();
+  simMillis = 0;
+  Energy::init();
+
+  std::uniform_int_distribution<unsigned long> uptime(HOUR / 4, 6 * HOUR);
+  unsigned long long total = 0;
+
+  for (unsigned long boot = 0; boot < boots; boot++) {
+    run(profile, simMillis, uptime(loopRandom));
+    unsigned long long charge = Energy::getBootTotals(1 + PORT).charge;
+    total += charge;
+
+    // every other boot ends with a power cut instead of a deliberate reset,
+    // and every fourth of those cuts a save short.
+    if (boot % 2 == 0) {
+      Energy::save();
+    } else if (boot % 4 == 1) {
+      byte image[SIM_EEPROM_SIZE];
+      memcpy(image, simEEPROM, sizeof(image));
+      Energy::save();
+
+      // only the first page of the save made it.
+      for (unsigned int j = 0; j < sizeof(image); j++) {
+        if (image[j] != simEEPROM[j] &&
+            (j - Energy::REGION_START) % Energy::SLOT_SIZE >=
+                EEPROMInterface::PAGE_SIZE) {
+          simEEPROM[j] = image[j];
+        }
+      }
+    }
+
+    simMillis += 5000;
+    Energy::init();
+
+    unsigned long long lifetime = Energy::getLifetimeTotals(1 + PORT).charge;
+
+    if (lifetime > total) {
+      ok = false;
+    }
+  }
+
+  unsigned long long lifetime = Energy::getLifetimeTotals(1 + PORT).charge;
+  double missing = relative(lifetime, total) * -1;
+
+  // a boot ended by a cut loses what it used since its last save, which is at
+  // most SAVE_INTERVAL at the profile's current.
+  double bound = (double)(boots / 2) * Energy::SAVE_INTERVAL *
+                 profile.current(0) / total;
+
+  printf("\n%lu boots: lifetime %.1f mAh of %.1f mAh, %.4f%% lost, at most "
+         "%.4f%%\n",
+         boots, lifetime / 3.6e6, total / 3.6e6, missing * 100, bound * 100);
+
+  if (missing < 0 || missing > bound) {
+    ok = false;
+  }
+
+  // each save writes the slot after the newest, so slots wear evenly. a part
+  // with 32 byte pages gets two page writes per save on each of a slot's pages.
+  unsigned long savesPerYear = 365UL * 24 * HOUR / Energy::SAVE_INTERVAL;
+  unsigned long cycles = savesPerYear / Energy::SLOT_COUNT * 2;
+
+  printf("%lu saves a year, %lu write cycles a year on each EEPROM page\n",
+         savesPerYear, cycles);
+
+  return ok;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: energysim [options]\n"
+          "  -c            exit non-zero if the targets are missed\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c")) != -1) {
+    switch (opt) {
+      case 'c':
+        check = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  Random random(2);
+  std::uniform_real_distribution<double> gap(1000, 30000);
+
+  for (double t = gap(random); t < 25.0 * HOUR; t += gap(random)) {
+    switchTimes.push_back(t);
+  }
+
+  bool ok = integration();
+  ok = persistence() && ok;
+
+  if (check) {
+    printf("\n%s\n", ok ? "ok" : "FAIL: targets missed");
+  }
+
+  return ok ? 0 : 1;
+}
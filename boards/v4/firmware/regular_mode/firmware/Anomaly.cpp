@@ -0,0 +1,172 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Anomaly.h"
+
+#include "Logger.h"
+#include "Wagman.h"
+
+namespace Anomaly {
+
+static Detector detectors[Board::PORT_COUNT];
+static Change lastChanges[Board::PORT_COUNT];
+static unsigned long changeCounts[Board::PORT_COUNT];
+
+// running sums of each port's current since the last average.
+static unsigned long sums[Board::PORT_COUNT];
+static unsigned int sumCounts[Board::PORT_COUNT];
+static unsigned long lastSampleMillis = 0;
+
+static unsigned long squareRoot(unsigned long long value) {
+  unsigned long long root = 0;
+  unsigned long long bit = 1ULL << 62;
+
+  while (bit > value) {
+    bit >>= 2;
+  }
+
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+
+    bit >>= 2;
+  }
+
+  return root;
+}
+
+void Detector::reset() {
+  samples = 0;
+  baselineSum = 0;
+  varianceSum = 0;
+  rise = 0;
+  drop = 0;
+}
+
+long Detector::getDeviation() const {
+  long deviation = squareRoot(varianceSum >> DEVIATION_SHIFT);
+  return max(deviation, max((long)MIN_DEVIATION * 256,
+                            getBaseline() >> RELATIVE_DEVIATION_SHIFT));
+}
+
+byte Detector::add(long average) {
+  long long scaled = (long long)average << BASELINE_SHIFT;
+
+  // learns the baseline as a plain mean and variance (Welford's method).
+  if (samples < WARMUP_SAMPLES) {
+    long long residual = scaled - baselineSum;
+    samples++;
+    baselineSum += residual / samples;
+
+    long long square = (residual >> BASELINE_SHIFT) *
+                       (average - getBaseline()) * (1LL << DEVIATION_SHIFT);
+    varianceSum += (square - (long long)varianceSum) / samples;
+    return CHANGE_NONE;
+  }
+
+  long residual = average - getBaseline();
+  long step = (long long)residual * 256 / getDeviation();
+  step = max(-MAX_STEP, min(step, MAX_STEP));
+
+  rise = max(0L, rise + step - SLACK);
+  drop = max(0L, drop - step - SLACK);
+
+  if (rise > THRESHOLD || drop > THRESHOLD) {
+    byte direction = (rise > THRESHOLD) ? CHANGE_RISE : CHANGE_DROP;
+    reset();
+    return direction;
+  }
+
+  // the baseline only follows the averages while neither sum is building up.
+  if (rise < THRESHOLD / 2 && drop < THRESHOLD / 2) {
+    baselineSum += average - getBaseline();
+    varianceSum += (long long)residual * residual -
+                   (long long)(varianceSum >> DEVIATION_SHIFT);
+  }
+
+  return CHANGE_NONE;
+}
+
+static void logChange(const Device &device, const Change &change) {
+  Logger::beginEvent("anomaly");
+  Logger::log(device.name);
+  Logger::log(change.direction == CHANGE_RISE ? " current rose from "
+                                              : " current dropped from ");
+  Logger::log(change.before);
+  Logger::log(" to ");
+  Logger::log(change.after);
+  Logger::log(" mA");
+  Logger::end();
+}
+
+void update(const Device *devices, byte count) {
+  const SensorSample &sample = Wagman::getSample();
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    unsigned int current = sample.ports[port].current;
+
+    // 0 is a current sensor error.
+    if (current != 0) {
+      sums[port] += current;
+      sumCounts[port]++;
+    }
+  }
+
+  if (millis() - lastSampleMillis < SAMPLE_INTERVAL) {
+    return;
+  }
+
+  lastSampleMillis = millis();
+
+  for (byte port = 0; port < Board::PORT_COUNT && port < count; port++) {
+    const Device &device = devices[port];
+    Detector &detector = detectors[port];
+
+    if (device.getState() != STATE_STARTED ||
+        device.timeInState() < BOOT_GRACE) {
+      detector.reset();
+    } else if (sumCounts[port] != 0) {
+      long average = ((unsigned long long)sums[port] * 256 +
+                      sumCounts[port] / 2) / sumCounts[port];
+      long baseline = detector.getBaseline();
+      byte direction = detector.add(average);
+
+      if (direction != CHANGE_NONE) {
+        Change &change = lastChanges[port];
+        change.direction = direction;
+        change.before = (baseline + 128) / 256;
+        change.after = (average + 128) / 256;
+        change.millis = millis();
+        changeCounts[port]++;
+        logChange(device, change);
+      }
+    }
+
+    sums[port] = 0;
+    sumCounts[port] = 0;
+  }
+}
+
+bool isWatching(byte port) { return detectors[port].isWatching(); }
+
+unsigned int getBaseline(byte port) {
+  return (detectors[port].getBaseline() + 128) / 256;
+}
+
+unsigned int getDeviation(byte port) {
+  return (detectors[port].getDeviation() + 128) / 256;
+}
+
+long getRiseSum(byte port) { return detectors[port].rise; }
+
+long getDropSum(byte port) { return detectors[port].drop; }
+
+unsigned long getChangeCount(byte port) { return changeCounts[port]; }
+
+const Change &getLastChange(byte port) { return lastChanges[port]; }
+};  // namespace Anomaly
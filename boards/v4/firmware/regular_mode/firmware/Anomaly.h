@@ -0,0 +1,108 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_ANOMALY__
+#define __H_ANOMALY__
+
+#include <Arduino.h>
+#include "Board.h"
+#include "Device.h"
+
+// Finds changes in each port's current which the fixed current levels miss,
+// like a fan slowly failing, without flagging the spikes of a normal boot.
+//
+// Each port's current is averaged over a second. The averages are compared to
+// a slowly moving baseline, scaled by their usual deviation from it, and
+// accumulated by a two-sided CUSUM. A change point is reported when either sum
+// passes THRESHOLD. The baseline stops moving while a sum is building up, so a
+// slow drift can't be absorbed into it. After a change, the baseline is learned
+// again from scratch.
+//
+// A port is only watched while its device is started and has been for
+// BOOT_GRACE.
+namespace Anomaly {
+const unsigned long SAMPLE_INTERVAL = 1000;
+const unsigned long BOOT_GRACE = 300000L;
+
+// averages used to learn a new baseline.
+const unsigned int WARMUP_SAMPLES = 300;
+
+// the baseline moves 1 / 2^BASELINE_SHIFT of the way to each average, about
+// 4.5 hours, so it doesn't follow a slow drift. the deviation from it is
+// tracked faster, about 17 minutes.
+const byte BASELINE_SHIFT = 14;
+const byte DEVIATION_SHIFT = 10;
+
+// deviations are at least MIN_DEVIATION mA and 1 / 2^RELATIVE_DEVIATION_SHIFT
+// of the baseline, so a very quiet port doesn't alarm on small changes.
+const unsigned int MIN_DEVIATION = 2;
+const byte RELATIVE_DEVIATION_SHIFT = 5;
+
+// CUSUM slack, threshold and largest step per average, in 1/256 deviations.
+// the step limit keeps load bursts shorter than THRESHOLD / (MAX_STEP - SLACK)
+// seconds from being a change.
+const long SLACK = 256;
+const long THRESHOLD = 80 * 256;
+const long MAX_STEP = 2 * 256;
+
+enum {
+  CHANGE_NONE,
+  CHANGE_RISE,
+  CHANGE_DROP,
+};
+
+// change point detector for one port's current.
+struct Detector {
+  unsigned int samples;  // averages since the baseline was reset
+
+  // baseline in 1/256 mA scaled up by 2^BASELINE_SHIFT and variance from it
+  // in 1/65536 mA^2 scaled up by 2^DEVIATION_SHIFT.
+  long long baselineSum;
+  unsigned long long varianceSum;
+
+  // CUSUMs in 1/256 deviations.
+  long rise;
+  long drop;
+
+  void reset();
+
+  // adds a one second average in 1/256 mA. returns the direction of a change
+  // point, or CHANGE_NONE.
+  byte add(long average);
+
+  bool isWatching() const { return samples >= WARMUP_SAMPLES; }
+
+  // baseline and deviation used to scale the averages, in 1/256 mA.
+  long getBaseline() const { return baselineSum >> BASELINE_SHIFT; }
+  long getDeviation() const;
+};
+
+struct Change {
+  byte direction;
+  unsigned int before;  // baseline in mA
+  unsigned int after;   // average which passed the threshold in mA
+  unsigned long millis;
+};
+
+// adds the current readings to each port's average and runs the detectors
+// once a second. call every loop, after the sensors are sampled.
+void update(const Device *devices, byte count);
+
+// whether a port's baseline has been learned and it's being watched.
+bool isWatching(byte port);
+
+// baseline and deviation in mA.
+unsigned int getBaseline(byte port);
+unsigned int getDeviation(byte port);
+
+// CUSUM of rises and of drops, in 1/256 deviations.
+long getRiseSum(byte port);
+long getDropSum(byte port);
+
+// number of change points seen on a port since boot and the last of them.
+unsigned long getChangeCount(byte port);
+const Change &getLastChange(byte port);
+};  // namespace Anomaly
+
+#endif
@@ -0,0 +1,133 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_BOARD__
+#define __H_BOARD__
+
+#include <Arduino.h>
+#include "MCP342X.h"
+#include "Wagman.h"
+
+// Board descriptor. Everything which depends on how the board is wired or
+// what's attached to each port lives in this table and the firmware derives
+// pins, ADC channels and device policy from it. A new board variant only needs
+// its own descriptor assigned to BOARD.
+namespace Board {
+
+const byte PORT_COUNT = 5;
+const byte BOOT_SELECTOR_COUNT = 2;
+const byte LED_COUNT = 9;
+const byte NO_BOOT_SELECTOR = 255;
+const byte NEVER_SHED = 255;
+
+struct PortDescriptor {
+  const char *name;
+
+  // latching relay pins
+  byte relayClk;
+  byte relayData;
+
+  // MCP3428 device and channel measuring the port current
+  byte currentADC;
+  byte currentChannel;
+  byte currentGain;
+
+  byte voltagePin;
+  byte thermistorPin;
+
+  // device policy. a device without a boot selector of its own must use
+  // NO_BOOT_SELECTOR, since starting it sets the media on its selector.
+  byte bootSelector;
+  byte primaryMedia;
+  byte secondaryMedia;
+  bool watchHeartbeat;
+  bool watchCurrent;
+  bool enabledByDefault;
+  bool keepEnabled;  // re-enable if left disabled for a minute
+
+  // current above which the power LED shows the port as on
+  unsigned int poweredCurrent;
+
+  // default bounds of the low, normal and stressed current levels, and the
+  // current at which a device is considered faulted
+  unsigned int currentLow;
+  unsigned int currentNormal;
+  unsigned int currentStressed;
+  unsigned int faultCurrent;
+
+  // calibration of the port's current and voltage readings, used for energy.
+  // a reading at or below currentZero is no current.
+  unsigned int currentZero;   // counts
+  unsigned int currentScale;  // uA per count
+  unsigned int voltageScale;  // uV per count
+
+  // ports with lower priorities are shed first when the supply sags or the
+  // system draws too much. NEVER_SHED keeps a port on.
+  byte shedPriority;
+};
+
+struct Descriptor {
+  PortDescriptor ports[PORT_COUNT];
+  byte bootSelectorPins[BOOT_SELECTOR_COUNT];
+  byte ledPins[LED_COUNT];
+  byte photoresistorPin;
+  byte ncAutoDisablePin;
+  byte masterResetPins[2];
+
+  // the system current is measured but its supply voltage isn't, so system
+  // energy uses this nominal voltage.
+  unsigned int supplyVoltage;  // mV
+};
+
+// the energy calibrations are nominal: port currents keep the 1 mA per count
+// the current levels assume and port voltages are 12 bit readings of a 1/2
+// divider on 3.3 V. boards measured against a meter should replace them.
+constexpr Descriptor WAGMAN_V4 = {
+    {
+        {"nc", 33, 34, 0, MCP342X::CHANNEL_3, MCP342X::GAIN_1, A1, A0, 0,
+         MEDIA_EMMC, MEDIA_SD, true, false, true, true, 200, 120, 300, 850,
+         122, 0, 1000, 1611, NEVER_SHED},
+        {"gn", 35, 36, 0, MCP342X::CHANNEL_1, MCP342X::GAIN_1, A3, A2, 1,
+         MEDIA_EMMC, MEDIA_SD, true, false, true, false, 200, 120, 300, 850,
+         122, 0, 1000, 1611, 3},
+        {"cs", 37, 38, 0, MCP342X::CHANNEL_2, MCP342X::GAIN_1, A5, A4,
+         NO_BOOT_SELECTOR, MEDIA_EMMC, MEDIA_SD, true, false, true, false, 150,
+         120, 300, 850, 112, 0, 1000, 1611, 2},
+        {"x1", 39, 40, 1, MCP342X::CHANNEL_0, MCP342X::GAIN_1, A7, A6,
+         NO_BOOT_SELECTOR, MEDIA_SD, MEDIA_SD, false, false, false, false, 200,
+         120, 300, 850, 10000, 0, 1000, 1611, 1},
+        {"x2", 45, 46, 1, MCP342X::CHANNEL_3, MCP342X::GAIN_1, A9, A8,
+         NO_BOOT_SELECTOR, MEDIA_SD, MEDIA_SD, false, false, false, false, 200,
+         120, 300, 850, 10000, 0, 1000, 1611, 1},
+    },
+    {41, 47},
+    {12, 11, 2, 3, 5, 6, 7, 8, 9},
+    A10,
+    48,
+    {30, 32},
+    5000,
+};
+
+static constexpr const Descriptor &BOARD = WAGMAN_V4;
+
+// compile time port lookup. an out of range port fails to build instead of
+// being checked at runtime.
+template <byte port>
+constexpr const PortDescriptor &portDescriptor() {
+  static_assert(port < PORT_COUNT, "invalid port");
+  return BOARD.ports[port];
+}
+
+constexpr bool validBootSelectors(byte port) {
+  return port == PORT_COUNT ||
+         ((BOARD.ports[port].bootSelector == NO_BOOT_SELECTOR ||
+           BOARD.ports[port].bootSelector < BOOT_SELECTOR_COUNT) &&
+          validBootSelectors(port + 1));
+}
+
+static_assert(validBootSelectors(0), "port has invalid boot selector");
+
+};  // namespace Board
+
+#endif
@@ -0,0 +1,40 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Bytes.h"
+
+namespace Bytes {
+
+byte crc8(const void *data, unsigned int size) {
+  const byte *p = (const byte *)data;
+  byte crc = 0;
+
+  for (unsigned int i = 0; i < size; i++) {
+    crc ^= p[i];
+
+    for (byte j = 0; j < 8; j++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+void putUint(byte *data, unsigned long long value, byte size) {
+  for (byte i = 0; i < size; i++) {
+    data[i] = value >> (8 * i);
+  }
+}
+
+unsigned long long getUint(const byte *data, byte size) {
+  unsigned long long value = 0;
+
+  for (byte i = 0; i < size; i++) {
+    value |= (unsigned long long)data[i] << (8 * i);
+  }
+
+  return value;
+}
+
+};  // namespace Bytes
@@ -0,0 +1,23 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_BYTES__
+#define __H_BYTES__
+
+#include <Arduino.h>
+
+// Helpers for the records the firmware keeps in EEPROM and RTC SRAM.
+namespace Bytes {
+
+// CRC-8 with polynomial 0x07 and an initial value of 0.
+byte crc8(const void *data, unsigned int size);
+
+// writes the low size bytes of value to data, least significant first.
+void putUint(byte *data, unsigned long long value, byte size);
+
+// reads a size byte unsigned integer written by putUint.
+unsigned long long getUint(const byte *data, byte size);
+};  // namespace Bytes
+
+#endif
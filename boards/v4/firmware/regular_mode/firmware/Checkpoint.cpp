@@ -0,0 +1,176 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Checkpoint.h"
+
+#include "Bytes.h"
+#include "MCP79412RTC.h"
+#include "SoftClock.h"
+#include "Timer.h"
+#include "Wagman.h"
+
+namespace Checkpoint {
+
+//
+// SRAM layout:
+//
+// 0 magic byte
+// 1 version byte
+// 2 device count byte
+// 3 saved at uint32 (unix time)
+// 7 device checkpoints [count][10]byte
+//   0 state byte
+//   1 flags byte
+//   2 state age uint32 (s)
+//   6 heartbeat age uint16 (s)
+//   8 start delay uint16 (s)
+// 7 + 10 * count crc-8 byte
+//
+static const byte MAGIC = 0xC7;
+static const byte VERSION = 1;
+static const byte HEADER_SIZE = 7;
+static const byte DEVICE_SIZE = 10;
+static const byte MAX_DEVICES = 5;
+static const byte MAX_SIZE = HEADER_SIZE + MAX_DEVICES * DEVICE_SIZE + 1;
+
+// the Wire buffer limits how much can be written at once.
+static const byte CHUNK_SIZE = 16;
+
+static_assert(MAX_SIZE <= SRAM_SIZE, "checkpoint must fit in RTC SRAM");
+
+static bool dirty = true;
+static bool urgent = false;
+static DurationTimer saveTimer;
+static unsigned long saveCount = 0;
+
+static void writeSRAM(byte *data, byte size) {
+  for (byte offset = 0; offset < size; offset += CHUNK_SIZE) {
+    Wagman::Clock.sramWrite(offset, data + offset,
+                            min(CHUNK_SIZE, size - offset));
+  }
+}
+
+static void readSRAM(byte *data, byte size) {
+  for (byte offset = 0; offset < size; offset += CHUNK_SIZE) {
+    Wagman::Clock.sramRead(offset, data + offset,
+                           min(CHUNK_SIZE, size - offset));
+  }
+}
+
+void markDirty(bool isUrgent) {
+  dirty = true;
+  urgent = urgent || isUrgent;
+}
+
+static void save(const Device *devices, byte count) {
+  byte data[MAX_SIZE];
+  byte *p = data;
+
+  count = min(count, MAX_DEVICES);
+
+  *p++ = MAGIC;
+  *p++ = VERSION;
+  *p++ = count;
+  Bytes::putUint(p, SoftClock::now(), 4);
+  p += 4;
+
+  for (byte i = 0; i < count; i++) {
+    DeviceCheckpoint cp;
+    devices[i].saveCheckpoint(cp);
+
+    p[0] = cp.state;
+    p[1] = cp.flags;
+    Bytes::putUint(p + 2, cp.stateAge, 4);
+    Bytes::putUint(p + 6, cp.heartbeatAge, 2);
+    Bytes::putUint(p + 8, cp.startDelay, 2);
+    p += DEVICE_SIZE;
+  }
+
+  *p = Bytes::crc8(data, p - data);
+  p++;
+
+  writeSRAM(data, p - data);
+  saveCount++;
+}
+
+void update(const Device *devices, byte count) {
+  // a checkpoint without a timestamp can't be aged on restore.
+  if (!Wagman::getWireEnabled() || !SoftClock::synced()) {
+    return;
+  }
+
+  if (urgent || (dirty && saveTimer.exceeds(SAVE_INTERVAL)) ||
+      saveTimer.exceeds(REFRESH_INTERVAL)) {
+    save(devices, count);
+    saveTimer.reset();
+    dirty = false;
+    urgent = false;
+  }
+}
+
+byte restore(Device *devices, byte count) {
+  byte data[MAX_SIZE];
+
+  if (!Wagman::getWireEnabled() || !SoftClock::synced()) {
+    return 0;
+  }
+
+  readSRAM(data, HEADER_SIZE);
+
+  if (data[0] != MAGIC || data[1] != VERSION || data[2] != count ||
+      count > MAX_DEVICES) {
+    return 0;
+  }
+
+  byte size = HEADER_SIZE + count * DEVICE_SIZE;
+  readSRAM(data, size + 1);
+
+  if (Bytes::crc8(data, size) != data[size]) {
+    return 0;
+  }
+
+  time_t savedAt = Bytes::getUint(data + 3, 4);
+  time_t now = SoftClock::now();
+
+  if (now < savedAt) {
+    return 0;
+  }
+
+  unsigned long gap = now - savedAt;
+
+  if (gap > MAX_RESUME_GAP) {
+    return 0;
+  }
+
+  byte resumed = 0;
+
+  for (byte i = 0; i < count; i++) {
+    const byte *p = data + HEADER_SIZE + i * DEVICE_SIZE;
+    DeviceCheckpoint cp;
+
+    cp.state = p[0];
+    cp.flags = p[1];
+    cp.stateAge = Bytes::getUint(p + 2, 4);
+    cp.heartbeatAge = Bytes::getUint(p + 6, 2);
+    cp.startDelay = Bytes::getUint(p + 8, 2);
+
+    if (devices[i].restoreCheckpoint(cp, gap)) {
+      resumed++;
+    }
+  }
+
+  return resumed;
+}
+
+void clear() {
+  if (!Wagman::getWireEnabled()) {
+    return;
+  }
+
+  Wagman::Clock.sramWrite(0, 0);
+}
+
+unsigned long getSaveCount() { return saveCount; }
+
+};  // namespace Checkpoint
@@ -0,0 +1,42 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_CHECKPOINT__
+#define __H_CHECKPOINT__
+
+#include <Arduino.h>
+#include "Device.h"
+
+// Checkpoint of each device's volatile state in the RTC's battery-backed SRAM.
+// The SRAM has no write endurance limit, so the checkpoint is rewritten on
+// every state change and refreshed periodically. At boot it lets a Wagman
+// reset resume supervising devices instead of restarting every timer.
+//
+// A checkpoint older than MAX_RESUME_GAP is ignored since the devices most
+// likely lost power along with the Wagman.
+namespace Checkpoint {
+const unsigned long SAVE_INTERVAL = 10000L;
+const unsigned long REFRESH_INTERVAL = 30000L;
+const unsigned long MAX_RESUME_GAP = 60;  // seconds
+
+// marks the checkpoint out of date. urgent changes are saved on the next
+// update, others within SAVE_INTERVAL. an unchanged checkpoint is rewritten
+// every REFRESH_INTERVAL so restore can tell how old it is.
+void markDirty(bool urgent);
+
+// saves the checkpoint if needed.
+void update(const Device *devices, byte count);
+
+// restores devices from the checkpoint. call right after the devices are
+// initialized. returns the number of devices resumed.
+byte restore(Device *devices, byte count);
+
+// invalidates the checkpoint. used before deliberately cutting power to all
+// devices.
+void clear();
+
+unsigned long getSaveCount();
+};  // namespace Checkpoint
+
+#endif
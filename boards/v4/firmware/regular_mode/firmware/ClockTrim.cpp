@@ -0,0 +1,185 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "ClockTrim.h"
+#include "MCP79412RTC.h"
+#include "Wagman.h"
+
+namespace ClockTrim {
+
+static const byte MAX_SYNCS = 8;
+
+static bool estimated = false;
+static long estimatePPB = 0;
+static unsigned long estimateBaseline = 0;
+static long estimateUncertainty = 0;
+static long lastOffset = 0;
+
+bool estimate(const ClockSync *syncs, byte count, long &ppb,
+              unsigned long &baseline, long &uncertainty) {
+  long long total = 0;
+  byte intervals = 0;
+  baseline = 0;
+
+  for (byte i = 1; i < count; i++) {
+    const ClockSync &prev = syncs[i - 1];
+    const ClockSync &cur = syncs[i];
+
+    if (cur.host <= prev.host) {
+      continue;
+    }
+
+    long long elapsed = cur.host - prev.host;
+
+    if (elapsed < MIN_INTERVAL) {
+      continue;
+    }
+
+    // error the RTC picked up over the interval. it starts from wherever the
+    // previous sync left it.
+    long prevOffset = prev.stepped ? 0 : (long)(prev.rtc - prev.host);
+    long error = (long)(cur.rtc - cur.host) - prevOffset;
+    long long residual = (long long)error * 1000000000LL / elapsed;
+
+    if (residual > MAX_RESIDUAL_PPB || residual < -MAX_RESIDUAL_PPB) {
+      continue;
+    }
+
+    // add back what the trim in effect was already correcting.
+    total += error * 1000000000LL +
+             (long long)cur.trim * TRIM_STEP_PPB * elapsed;
+    baseline += elapsed;
+    intervals++;
+  }
+
+  if (baseline == 0) {
+    return false;
+  }
+
+  ppb = total / (long long)baseline;
+
+  // each interval is only measured to within about a second. those errors
+  // are independent, so they add up as the square root of their number.
+  byte root = 1;
+
+  while ((root + 1) * (root + 1) <= intervals) {
+    root++;
+  }
+
+  uncertainty = 1000000000LL * root / baseline;
+  return true;
+}
+
+int trimForError(long ppb) {
+  long trim;
+
+  if (ppb >= 0) {
+    trim = (ppb + TRIM_STEP_PPB / 2) / TRIM_STEP_PPB;
+  } else {
+    trim = -((-ppb + TRIM_STEP_PPB / 2) / TRIM_STEP_PPB);
+  }
+
+  if (trim > MAX_TRIM) {
+    trim = MAX_TRIM;
+  }
+
+  if (trim < -MAX_TRIM) {
+    trim = -MAX_TRIM;
+  }
+
+  return trim;
+}
+
+static void update() {
+  ClockSync syncs[MAX_SYNCS];
+  byte count = min(Record::clockSyncLog.getCount(), MAX_SYNCS);
+
+  for (byte i = 0; i < count; i++) {
+    Record::clockSyncLog.getEntry(i, syncs[i]);
+  }
+
+  estimated = estimate(syncs, count, estimatePPB, estimateBaseline,
+                       estimateUncertainty);
+
+  if (!estimated) {
+    return;
+  }
+
+  // a large error is worth trimming coarsely early on. later syncs are then
+  // further apart and refine it.
+  bool precise = estimateBaseline >= MIN_TRIM_BASELINE ||
+                 estimateUncertainty * 2 <= abs(estimatePPB);
+
+  if (!precise) {
+    return;
+  }
+
+  int trim = trimForError(estimatePPB);
+
+  if (trim != Wagman::Clock.calibRead()) {
+    Wagman::Clock.calibWrite(trim);
+  }
+}
+
+void init() {
+  if (!Wagman::getWireEnabled()) {
+    return;
+  }
+
+  update();
+}
+
+void sync(time_t host) {
+  if (!Wagman::getWireEnabled()) {
+    Wagman::setTime(host);
+    return;
+  }
+
+  time_t rtc = Wagman::Clock.get();
+  lastOffset = (long)(rtc - host);
+
+  bool step = lastOffset > MAX_OFFSET || lastOffset < -MAX_OFFSET;
+
+  ClockSync last;
+  byte count = Record::clockSyncLog.getCount();
+  bool spaced = count == 0 ||
+                !Record::clockSyncLog.getEntry(count - 1, last) ||
+                host < last.host || host - last.host >= MIN_LOG_SPACING;
+
+  // an RTC step must always be logged, otherwise the next interval would
+  // include it.
+  if (step || spaced) {
+    ClockSync sync;
+    sync.host = host;
+    sync.rtc = rtc;
+    sync.trim = Wagman::Clock.calibRead();
+    sync.stepped = step;
+    Record::clockSyncLog.addEntry(sync);
+    update();
+  }
+
+  if (step) {
+    Wagman::setTime(host);
+  }
+}
+
+bool hasEstimate() { return estimated; }
+
+long getEstimate() { return estimatePPB; }
+
+unsigned long getBaseline() { return estimateBaseline; }
+
+long getUncertainty() { return estimateUncertainty; }
+
+long getLastOffset() { return lastOffset; }
+
+int getTrim() {
+  if (!Wagman::getWireEnabled()) {
+    return 0;
+  }
+
+  return Wagman::Clock.calibRead();
+}
+
+};  // namespace ClockTrim
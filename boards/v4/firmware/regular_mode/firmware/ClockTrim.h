@@ -0,0 +1,63 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_CLOCKTRIM__
+#define __H_CLOCKTRIM__
+
+#include <Arduino.h>
+#include "Record.h"
+#include "Time.h"
+
+// Trims the RTC oscillator using host time syncs.
+//
+// The RTC is only set when a sync finds it off by more than MAX_OFFSET, so it
+// otherwise free runs between syncs and its error can be measured over long
+// baselines. Syncs are logged at most every MIN_LOG_SPACING unless the RTC was
+// set. The oscillator error is estimated over all logged intervals and
+// programmed into the RTC's digital trim register once there's at least
+// MIN_TRIM_BASELINE of them, or sooner if the error is large compared to its
+// uncertainty.
+namespace ClockTrim {
+const long MAX_OFFSET = 1;                          // seconds
+const long MIN_LOG_SPACING = 86400L;                // 1 day
+const unsigned long MIN_TRIM_BASELINE = 259200L;    // 3 days
+const long MIN_INTERVAL = 60;                       // seconds
+const long MAX_RESIDUAL_PPB = 500000L;
+
+// each trim step adds or removes 2 cycles of the 32.768 kHz oscillator every
+// minute. positive trim slows the RTC down.
+const long TRIM_STEP_PPB = 1017;
+const int MAX_TRIM = 127;
+
+// estimates the oscillator error in ppb (positive means the RTC runs fast
+// without trim) from a log of syncs, oldest first. intervals shorter than
+// MIN_INTERVAL or with a residual error over MAX_RESIDUAL_PPB, for example
+// because the RTC was set some other way, are skipped. returns false if there
+// were no usable intervals. the baseline is the total length of the usable
+// intervals in seconds and the uncertainty is in ppb.
+bool estimate(const ClockSync *syncs, byte count, long &ppb,
+              unsigned long &baseline, long &uncertainty);
+
+// trim register value which cancels an oscillator error.
+int trimForError(long ppb);
+
+// loads the estimate from the sync log. call once the bus is up.
+void init();
+
+// handles a sync to the host time, setting the RTC if needed.
+void sync(time_t host);
+
+bool hasEstimate();
+long getEstimate();
+unsigned long getBaseline();
+long getUncertainty();
+
+// RTC offset from the host time seen at the last sync in seconds. positive
+// means the RTC was ahead.
+long getLastOffset();
+
+int getTrim();
+};  // namespace ClockTrim
+
+#endif
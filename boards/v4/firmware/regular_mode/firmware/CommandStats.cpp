@@ -0,0 +1,71 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "CommandStats.h"
+
+static CommandStat entries[CommandStats::MAX_ENTRIES];
+static byte entryCount = 0;
+static unsigned long dropped = 0;
+
+namespace CommandStats {
+
+static CommandStat *findEntry(byte link, unsigned int id) {
+  for (byte i = 0; i < entryCount; i++) {
+    if (entries[i].link == link && entries[i].id == id) {
+      return &entries[i];
+    }
+  }
+
+  if (entryCount == MAX_ENTRIES) {
+    return NULL;
+  }
+
+  CommandStat *entry = &entries[entryCount++];
+  entry->link = link;
+  entry->id = id;
+  entry->count = 0;
+  entry->errors = 0;
+  entry->minMicros = 0xffffffffUL;
+  entry->maxMicros = 0;
+  entry->totalMicros = 0;
+  return entry;
+}
+
+void record(byte link, unsigned int id, unsigned long micros, bool ok) {
+  CommandStat *entry = findEntry(link, id);
+
+  if (entry == NULL) {
+    dropped++;
+    return;
+  }
+
+  entry->count++;
+
+  if (!ok) {
+    entry->errors++;
+  }
+
+  if (micros < entry->minMicros) {
+    entry->minMicros = micros;
+  }
+
+  if (micros > entry->maxMicros) {
+    entry->maxMicros = micros;
+  }
+
+  entry->totalMicros += micros;
+}
+
+void reset() {
+  entryCount = 0;
+  dropped = 0;
+}
+
+byte getCount() { return entryCount; }
+
+const CommandStat &getEntry(byte i) { return entries[i]; }
+
+unsigned long getDropped() { return dropped; }
+
+};  // namespace CommandStats
@@ -0,0 +1,34 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_COMMANDSTATS__
+#define __H_COMMANDSTATS__
+
+#include <Arduino.h>
+
+// Execution stats for one command id received on one serial link.
+struct CommandStat {
+  byte link;
+  unsigned int id;
+  unsigned long count;
+  unsigned long errors;
+  unsigned long minMicros;
+  unsigned long maxMicros;
+  unsigned long long totalMicros;
+};
+
+namespace CommandStats {
+const byte MAX_ENTRIES = 64;
+
+void record(byte link, unsigned int id, unsigned long micros, bool ok);
+void reset();
+
+byte getCount();
+const CommandStat &getEntry(byte i);
+
+// number of calls which weren't recorded because the table was full.
+unsigned long getDropped();
+};  // namespace CommandStats
+
+#endif
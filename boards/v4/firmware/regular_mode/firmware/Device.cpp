@@ -4,6 +4,7 @@
 // http://www.wa8.gl
 #include "Device.h"
 
+#include "Checkpoint.h"
 #include "Error.h"
 #include "Logger.h"
 #include "Record.h"
@@ -15,21 +16,45 @@ const byte PORT_CORESENSE = 2;
 
 // const unsigned long HEARTBEAT_TIMEOUT = 300000L; // 5min
 const unsigned long HEARTBEAT_TIMEOUT = 3600000L;  // 1h
+
+const unsigned long MIN_LEARNED_BOOT_HEARTBEAT_TIMEOUT = 300000L;  // 5min
+const byte MIN_BOOT_DURATION_SAMPLES = 3;
 const unsigned long FAULT_TIMEOUT = 10000L;
 const unsigned long DETECT_CURRENT_TIMEOUT = 10000L;
 const unsigned long STOP_MESSAGE_TIMEOUT = 10000L;
 
+// a stopping device is considered halted once its current has dropped from
+// busy to idle for this long, or its heartbeat has been gone this long. a node
+// stops heartbeating as soon as it starts shutting down, which can take 25s,
+// so heartbeat loss has to outlast that.
+const unsigned long STOP_IDLE_TIME = 2000L;
+const unsigned long STOP_HEARTBEAT_LOSS = 40000L;
+
 const unsigned int FAIL_COUNT_THRESHHOLD = 1024;
 
+RecoveryPolicy recoveryPolicy = {30, 4};
+
+static void (*stopMessageSender)(Device &device) = NULL;
+
+void setStopMessageSender(void (*sender)(Device &device)) {
+  stopMessageSender = sender;
+}
+
 void Device::init() {
   shouldForceBootMedia = false;
   forceBootMedia = MEDIA_SD;
+  bootMedia = MEDIA_SD;
 
   currentLevel = CURRENT_LOW;
 
   startDelay = 0;
 
-  setStopTimeout(60000);
+  bootFailures = Record::getBootFailures(port);
+
+  setStopTimeout(Record::getStopTimeout(port));
+
+  seenHeartbeat = false;
+  updateHeartbeatTimeouts();
 
   if (Record::getDeviceEnabled(port)) {
     changeState(STATE_STOPPED);
@@ -50,13 +75,71 @@ unsigned long Device::lastHeartbeatTime() const {
   return heartbeatTimer.elapsed();
 }
 
+// Learns the boot heartbeat timeout from recent time-to-first-heartbeat
+// samples. With only a few samples, the largest one is our best estimate of the
+// tail, so we use it plus 50% margin. Falls back to the steady state timeout
+// until enough boots have been seen.
+static unsigned long learnBootHeartbeatTimeout(byte port,
+                                               unsigned long fallback) {
+  const Record::BootDurationLog &log = Record::bootDurationLogs[port];
+
+  if (log.getCount() < MIN_BOOT_DURATION_SAMPLES) {
+    return fallback;
+  }
+
+  unsigned long longest = 0;
+
+  for (byte i = 0; i < log.getCount(); i++) {
+    longest = max(longest, (unsigned long)log.getEntry(i));
+  }
+
+  unsigned long timeout = (longest + longest / 2) * 1000;
+
+  if (timeout < MIN_LEARNED_BOOT_HEARTBEAT_TIMEOUT) {
+    timeout = MIN_LEARNED_BOOT_HEARTBEAT_TIMEOUT;
+  }
+
+  if (timeout > fallback) {
+    timeout = fallback;
+  }
+
+  return timeout;
+}
+
+// overrides are validated by Record, so any nonzero timeout is usable.
+void Device::updateHeartbeatTimeouts() {
+  unsigned long timeout = Record::getHeartbeatTimeout(port);
+
+  if (timeout != 0) {
+    heartbeatTimeout = timeout;
+  } else {
+    heartbeatTimeout = HEARTBEAT_TIMEOUT;
+  }
+
+  timeout = Record::getBootHeartbeatTimeout(port);
+
+  if (timeout != 0) {
+    bootHeartbeatTimeout = timeout;
+  } else {
+    bootHeartbeatTimeout = learnBootHeartbeatTimeout(port, heartbeatTimeout);
+  }
+}
+
+unsigned long Device::getBootHeartbeatTimeout() const {
+  return bootHeartbeatTimeout;
+}
+
+unsigned long Device::getHeartbeatTimeout() const { return heartbeatTimeout; }
+
 byte Device::getNextBootMedia() const {
   if (shouldForceBootMedia) {
     return forceBootMedia;
   }
 
   if (managed) {
-    if (Record::getBootFailures(port) % 4 == 3) {
+    unsigned int every = recoveryPolicy.secondaryMediaEvery;
+
+    if (every != 0 && bootFailures % every == every - 1) {
       return secondaryMedia;
     } else {
       return primaryMedia;
@@ -76,6 +159,8 @@ void Device::setNextBootMedia(byte media) {
 
   // This will allow the device to reboot itself into another media.
   Wagman::setBootMedia(bootSelector, media);
+
+  Checkpoint::markDirty(false);
 }
 
 byte Device::start() {
@@ -83,10 +168,10 @@ byte Device::start() {
     return ERROR_INVALID_ACTION;
   }
 
-  managed = Record::getBootFailures(port) < 30;
+  managed = bootFailures < recoveryPolicy.unmanagedAfterFailures;
 
   /* note: depends on force boot media flag. don't change the order! */
-  byte bootMedia = getNextBootMedia();
+  bootMedia = getNextBootMedia();
 
   /* override boot media only applies to next boot! */
   shouldForceBootMedia = false;
@@ -185,17 +270,18 @@ void Device::updateHeartbeat() {
 }
 
 void Device::updateFault() {
-  unsigned int current = Wagman::getCurrent(port);
+  const PortConfig &config = Record::getPortConfig(port);
+  unsigned int current = Wagman::getSample().ports[port].current;
   byte newCurrentLevel;
 
   // current sensor error
   if (current == 0) return;
 
-  if (current < 120) {
+  if (current < config.currentLow) {
     newCurrentLevel = CURRENT_LOW;
-  } else if (current < 300) {
+  } else if (current < config.currentNormal) {
     newCurrentLevel = CURRENT_NORMAL;
-  } else if (current < 850) {
+  } else if (current < config.currentStressed) {
     newCurrentLevel = CURRENT_STRESSED;
   } else {
     newCurrentLevel = CURRENT_HIGH;
@@ -228,8 +314,9 @@ void Device::updateState() {
 }
 
 void Device::updateDisabled() {
-  // never allow node controller to remain in this state for more than a minute.
-  if (port == 0 && stateTimer.exceeds(60000)) {
+  // never allow devices like the node controller to remain in this state for
+  // more than a minute.
+  if (keepEnabled && stateTimer.exceeds(60000)) {
     enable();
   }
 }
@@ -245,34 +332,95 @@ void Device::updateStarted() {
 }
 
 void Device::updateStartedManaged() {
-  if (watchHeartbeat && heartbeatTimer.exceeds(HEARTBEAT_TIMEOUT)) {
+  unsigned long timeout =
+      seenHeartbeat ? heartbeatTimeout : bootHeartbeatTimeout;
+
+  if (watchHeartbeat && heartbeatTimer.exceeds(timeout)) {
     Record::incrementBootFailures(port);
+    bootFailures++;
     stop();
   }
 
-  if (watchCurrent && currentLevelTimer.exceeds(10000)) {
+  if (watchCurrent &&
+      currentLevelTimer.exceeds(Record::getFaultTimeout(port))) {
     currentLevelTimer.reset();
   }
 }
 
 void Device::updateStartedUnmanaged() {
-  if (stateTimer.exceeds(14400000L)) {
+  if (stateTimer.exceeds(Record::getUnmanagedChangeTime(port))) {
     setNextBootMedia((getNextBootMedia() == MEDIA_SD) ? MEDIA_EMMC : MEDIA_SD);
     stop();
   }
 }
 
+byte Device::acknowledgeStop(unsigned long wait) {
+  if (state != STATE_STOPPING) {
+    return ERROR_INVALID_ACTION;
+  }
+
+  stopAcknowledged = true;
+  stopAckDelay = wait;
+  stopAckTimer.reset();
+  return 0;
+}
+
 void Device::updateStopping() {
-  // periodically send a stop message to the device.
-  if (stopMessageTimer.exceeds(STOP_MESSAGE_TIMEOUT)) {
+  // periodically send a stop message to the device until it acknowledges.
+  if (!stopAcknowledged &&
+      (stopMessagesSent == 0 ||
+       stopMessageTimer.exceeds(STOP_MESSAGE_TIMEOUT))) {
     stopMessageTimer.reset();
+
+    if (stopMessageSender != NULL) {
+      stopMessageSender(*this);
+    }
+
+    if (stopMessagesSent < 255) {
+      stopMessagesSent++;
+    }
   }
 
-  // device had sufficient time to shutdown, so kill it.
-  if (stateTimer.exceeds(getStopTimeout())) {
-    setStopTimeout(60000);  // hack for now...
-    kill();
+  // a device which draws less than the powered level while running would
+  // look idle from the start, so idle only counts once it has been busy.
+  if (Wagman::portPowered(port)) {
+    stopSeenBusy = true;
+  }
+
+  if (!Wagman::portIdle(port)) {
+    busyTimer.reset();
+  }
+
+  // cut power as soon as the device is known to be done.
+  const char *reason = NULL;
+
+  if (stopAcknowledged && stopAckTimer.exceeds(stopAckDelay)) {
+    reason = "ack";
+  } else if (stopSeenBusy && busyTimer.exceeds(STOP_IDLE_TIME)) {
+    reason = "idle";
+  } else if (watchHeartbeat && seenHeartbeat &&
+             heartbeatTimer.exceeds(STOP_HEARTBEAT_LOSS)) {
+    reason = "heartbeat";
+  } else if (stateTimer.exceeds(getStopTimeout())) {
+    // device had sufficient time to shutdown, so kill it.
+    reason = "timeout";
   }
+
+  if (reason == NULL) {
+    return;
+  }
+
+  Logger::beginEvent("stop");
+  Logger::log(name);
+  Logger::log(" stopped after ");
+  Logger::log(stateTimer.elapsed() / 1000);
+  Logger::log("s (");
+  Logger::log(reason);
+  Logger::log(")");
+  Logger::end();
+
+  setStopTimeout(Record::getStopTimeout(port));  // hack for now...
+  kill();
 }
 
 void Device::changeState(int newState) {
@@ -282,17 +430,30 @@ void Device::changeState(int newState) {
   heartbeatTimer.reset();
   currentLevelTimer.reset();
 
+  seenHeartbeat = false;
+
+  stopMessagesSent = 0;
+  stopAcknowledged = false;
+  stopSeenBusy = false;
+  busyTimer.reset();
+
   state = newState;
+
+  Checkpoint::markDirty(true);
 }
 
 void Device::sendExternalHeartbeat() { onHeartbeat(); }
 
 unsigned long Device::getStartDelay() const { return startDelay; }
 
-void Device::setStartDelay(unsigned long t) { startDelay = t; }
+void Device::setStartDelay(unsigned long t) {
+  startDelay = t;
+  Checkpoint::markDirty(false);
+}
 
 void Device::onHeartbeat() {
   heartbeatTimer.reset();
+  Checkpoint::markDirty(false);
 
   switch (state) {
     case STATE_DISABLED:
@@ -302,6 +463,120 @@ void Device::onHeartbeat() {
     case STATE_STOPPED:
       changeState(STATE_STARTED);  // if device is heartbeat, assume it's
                                    // stated. need to decide how to handle this.
+      seenHeartbeat = true;
+      break;
+    case STATE_STARTED:
+      // first heartbeat since start. record how long the boot took.
+      if (!seenHeartbeat) {
+        seenHeartbeat = true;
+        Record::bootDurationLogs[port].addEntry(stateTimer.elapsed() / 1000);
+        updateHeartbeatTimeouts();
+      }
+      break;
+    case STATE_STOPPING:
+      // lets a lost heartbeat end the stop early.
+      seenHeartbeat = true;
       break;
   }
 }
+
+static unsigned int clampSeconds(unsigned long ms) {
+  return min(ms / 1000, 0xFFFFUL);
+}
+
+void Device::saveCheckpoint(DeviceCheckpoint &cp) const {
+  cp.state = state;
+  cp.flags = 0;
+
+  if (seenHeartbeat) cp.flags |= CHECKPOINT_SEEN_HEARTBEAT;
+  if (managed) cp.flags |= CHECKPOINT_MANAGED;
+  if (shouldForceBootMedia) cp.flags |= CHECKPOINT_FORCE_BOOT_MEDIA;
+  if (forceBootMedia == MEDIA_EMMC) cp.flags |= CHECKPOINT_FORCE_BOOT_EMMC;
+  if (bootMedia == MEDIA_EMMC) cp.flags |= CHECKPOINT_BOOT_EMMC;
+
+  cp.stateAge = stateTimer.elapsed() / 1000;
+  cp.heartbeatAge = clampSeconds(heartbeatTimer.elapsed());
+  cp.startDelay = clampSeconds(startDelay);
+}
+
+bool Device::adopt(bool powerFailed) {
+  if (state != STATE_STOPPED) {
+    return false;
+  }
+
+  // a relay which was being turned off may or may not have switched, so the
+  // device is only adopted if it was on or being turned on.
+  byte relayState = Record::getRelayState(port);
+
+  if (relayState != RELAY_ON && relayState != RELAY_TURNING_ON) {
+    return false;
+  }
+
+  if (!Wagman::portPowered(port)) {
+    return false;
+  }
+
+  if (relayState != RELAY_ON) {
+    Record::setRelayState(port, RELAY_ON);
+  }
+
+  managed = bootFailures < recoveryPolicy.unmanagedAfterFailures;
+  bootMedia = getNextBootMedia();
+  Wagman::setBootMedia(bootSelector, bootMedia);
+
+  changeState(STATE_STARTED);
+
+  // unless the power failed, it's been running for a while, so use the
+  // steady state heartbeat timeout and don't log a boot duration for it.
+  // after an outage it's booting again since the relay came back on.
+  seenHeartbeat = !powerFailed;
+
+  return true;
+}
+
+bool Device::restoreCheckpoint(const DeviceCheckpoint &cp,
+                               unsigned long gap) {
+  // enabled / disabled is owned by the EEPROM record.
+  if (state != STATE_STOPPED) {
+    return false;
+  }
+
+  switch (cp.state) {
+    case STATE_STOPPED:
+      break;
+    case STATE_STARTED:
+    case STATE_STOPPING:
+      // relays are latched, so a running device is only still running if the
+      // relay was left on and the port is actually drawing current.
+      if (Record::getRelayState(port) != RELAY_ON ||
+          !Wagman::portPowered(port)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+
+  state = cp.state;
+  seenHeartbeat = cp.flags & CHECKPOINT_SEEN_HEARTBEAT;
+  managed = cp.flags & CHECKPOINT_MANAGED;
+  shouldForceBootMedia = cp.flags & CHECKPOINT_FORCE_BOOT_MEDIA;
+  forceBootMedia =
+      (cp.flags & CHECKPOINT_FORCE_BOOT_EMMC) ? MEDIA_EMMC : MEDIA_SD;
+  bootMedia = (cp.flags & CHECKPOINT_BOOT_EMMC) ? MEDIA_EMMC : MEDIA_SD;
+  startDelay = (unsigned long)cp.startDelay * 1000;
+
+  stateTimer.resetAgo((cp.stateAge + gap) * 1000);
+  heartbeatTimer.resetAgo((cp.heartbeatAge + gap) * 1000);
+  stopMessageTimer.reset();
+  currentLevelTimer.reset();
+
+  // the selector pins came up low after reset, so restore the media the
+  // device was booted from in case it reboots itself.
+  if (state != STATE_STOPPED) {
+    Wagman::setBootMedia(bootSelector,
+                         shouldForceBootMedia ? forceBootMedia : bootMedia);
+  }
+
+  return true;
+}
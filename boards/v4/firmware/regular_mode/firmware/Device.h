@@ -22,6 +22,34 @@ const int STATE_STOPPED = 1;
 const int STATE_STARTED = 3;
 const int STATE_STOPPING = 4;
 
+// volatile device state kept in the RTC SRAM checkpoint. ages and delays are
+// in seconds.
+struct DeviceCheckpoint {
+  byte state;
+  byte flags;
+  unsigned long stateAge;
+  unsigned int heartbeatAge;
+  unsigned int startDelay;
+};
+
+const byte CHECKPOINT_SEEN_HEARTBEAT = 0x01;
+const byte CHECKPOINT_MANAGED = 0x02;
+const byte CHECKPOINT_FORCE_BOOT_MEDIA = 0x04;
+const byte CHECKPOINT_FORCE_BOOT_EMMC = 0x08;
+const byte CHECKPOINT_BOOT_EMMC = 0x10;
+
+// how managed devices recover from failed boots. the fleet simulator varies
+// these to compare recovery policies.
+struct RecoveryPolicy {
+  // a device with this many boot failures is left unmanaged.
+  unsigned int unmanagedAfterFailures;
+
+  // every nth boot after a failure uses the secondary media.
+  unsigned int secondaryMediaEvery;
+};
+
+extern RecoveryPolicy recoveryPolicy;
+
 class Device {
  public:
   void init();
@@ -34,6 +62,10 @@ class Device {
   byte enable();
   byte disable();
 
+  // device acknowledged a stop message and will be safe to power off after
+  // wait ms.
+  byte acknowledgeStop(unsigned long wait);
+
   bool canStart() const;
 
   bool warning() const;
@@ -49,6 +81,12 @@ class Device {
   unsigned long timeSinceHeartbeat() const;
   unsigned long lastHeartbeatTime() const;
 
+  // heartbeat timeouts before the first heartbeat after a start (boot phase)
+  // and afterwards (steady state).
+  unsigned long getBootHeartbeatTimeout() const;
+  unsigned long getHeartbeatTimeout() const;
+  void updateHeartbeatTimeouts();
+
   const char *name;
   byte port;
   byte bootSelector;
@@ -57,16 +95,37 @@ class Device {
 
   bool watchHeartbeat;
   bool watchCurrent;
+  bool keepEnabled;
 
   unsigned long getStartDelay() const;
   void setStartDelay(unsigned long t);
 
   int getState() const { return state; }
+  unsigned long timeInState() const { return stateTimer.elapsed(); }
+
+  unsigned int getBootFailures() const { return bootFailures; }
+
+  void saveCheckpoint(DeviceCheckpoint &cp) const;
+
+  // resumes from a checkpoint taken gap seconds ago. must be called right
+  // after init. returns false if the checkpoint doesn't agree with the
+  // relay journal and port current, in which case the device starts fresh.
+  bool restoreCheckpoint(const DeviceCheckpoint &cp, unsigned long gap);
+
+  // takes over a device which is still powered from before a Wagman reset
+  // without touching its relay. must be called right after init. returns
+  // false if the relay journal and port current don't both say it's on.
+  // powerFailed is set after a power outage, which the device went through
+  // too, so it's supervised as booting rather than as running.
+  bool adopt(bool powerFailed);
 
  private:
   bool shouldForceBootMedia;
   byte forceBootMedia;
 
+  // media selected at the last start.
+  byte bootMedia;
+
   int state;
 
   void changeState(int newState);
@@ -89,8 +148,15 @@ class Device {
 
   bool managed;
 
+  // cached copy of the boot failure count in EEPROM.
+  unsigned int bootFailures;
+
   byte repeatedResetCount;
 
+  bool seenHeartbeat;
+  unsigned long bootHeartbeatTimeout;
+  unsigned long heartbeatTimeout;
+
   bool shouldRestart;
 
   byte currentLevel;
@@ -103,6 +169,18 @@ class Device {
   unsigned long startDelay;
 
   unsigned long stopTimeout;
+
+  // stop handshake state while in STATE_STOPPING.
+  byte stopMessagesSent;
+  bool stopAcknowledged;
+  unsigned long stopAckDelay;
+  DurationTimer stopAckTimer;
+  bool stopSeenBusy;
+  DurationTimer busyTimer;
 };
 
+// sends a stopping device the message asking it to shut down. the firmware
+// sets this, since only it knows which serial link a device is on.
+void setStopMessageSender(void (*sender)(Device &device));
+
 #endif
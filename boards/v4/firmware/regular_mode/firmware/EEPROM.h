@@ -13,11 +13,23 @@ public:
     virtual byte read(int addr) = 0;
     virtual void write(int addr, byte value) = 0;
 
+    // writes data which must not cross a PAGE_SIZE boundary. parts with page
+    // writes do it in a single write cycle instead of one per byte.
+    virtual void writePage(int addr, const byte *data, byte size) {
+        for (byte i = 0; i < size; i++) {
+            write(addr + i, data[i]);
+        }
+    }
+
+    // smallest page of the 24xx parts used, which also fits in one Wire
+    // transaction with its address.
+    static const int PAGE_SIZE = 16;
+
     template <class T>
     void get(int addr, T &obj) {
         byte *objbytes = (byte *)&obj;
 
-        for (int i = 0; i < sizeof(obj); i++) {
+        for (unsigned int i = 0; i < sizeof(obj); i++) {
             objbytes[i] = read(addr + i);
         }
     }
@@ -26,10 +38,34 @@ public:
     void put(int addr, T obj) {
         byte *objbytes = (byte *)&obj;
 
-        for (int i = 0; i < sizeof(obj); i++) {
+        for (unsigned int i = 0; i < sizeof(obj); i++) {
             write(addr + i, objbytes[i]);
         }
     }
+
+#if __SIZEOF_LONG__ > 4
+    // longs (and time_t) are 32 bit in the EEPROM layout. keeps a 64 bit host
+    // build, like the fleet simulator, reading the same layout as the Due.
+    void get(int addr, unsigned long &obj) {
+        uint32_t value;
+        get(addr, value);
+        obj = value;
+    }
+
+    void get(int addr, long &obj) {
+        int32_t value;
+        get(addr, value);
+        obj = value;
+    }
+
+    void put(int addr, unsigned long obj) {
+        put(addr, (uint32_t)obj);
+    }
+
+    void put(int addr, long obj) {
+        put(addr, (int32_t)obj);
+    }
+#endif
 };
 
 template <int N>
@@ -104,6 +140,19 @@ public:
         Wire.endTransmission(); // TODO Add Error function for error handling.
     }
 
+    void writePage(int addr, const byte *data, byte size) {
+        waitForDevice();
+
+        Wire.beginTransmission(busaddr);
+        writeAddress(addr);
+
+        for (byte i = 0; i < size; i++) {
+            Wire.write(data[i]);
+        }
+
+        Wire.endTransmission();
+    }
+
 private:
 
     static const int busaddr = 0x50;
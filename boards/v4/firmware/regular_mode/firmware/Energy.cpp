@@ -0,0 +1,266 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Energy.h"
+
+#include "Bytes.h"
+#include "EEPROM.h"
+#include "Logger.h"
+#include "SoftClock.h"
+#include "Wagman.h"
+
+using Board::BOARD;
+
+namespace Energy {
+
+//
+// Slot layout (little endian):
+//
+// 0 magic byte
+// 1 version byte
+// 2 sequence uint32
+// 6 saved at uint32 (unix time)
+// 10 lifetime totals [CHANNEL_COUNT]{charge uint64 (uC), energy uint64 (uJ)}
+// 106 crc-8 byte
+//
+static const byte MAGIC = 0xE7;
+static const byte VERSION = 1;
+static const byte HEADER_SIZE = 10;
+static const byte TOTALS_SIZE = 16;
+static const byte DATA_SIZE = HEADER_SIZE + CHANNEL_COUNT * TOTALS_SIZE + 1;
+
+static_assert(DATA_SIZE <= SLOT_SIZE, "energy totals must fit in a slot");
+static_assert(SLOT_SIZE % EEPROMInterface::PAGE_SIZE == 0,
+              "slots must start on a page");
+
+// 1/2 nC per uC and 1/2 nJ per uJ.
+static const unsigned long RESIDUE_PER_UNIT = 2000;
+
+// uC per mAh and uJ per mWh.
+static const unsigned long long MICROS_PER_MILLI_HOUR = 3600000ULL;
+
+static Integrator integrators[CHANNEL_COUNT];
+
+// lifetime totals as of boot.
+static Totals saved[CHANNEL_COUNT];
+
+static unsigned long sequence = 0;
+static byte nextSlot = 0;
+static unsigned long firstSampleMillis = 0;
+static unsigned long lastSampleMillis = 0;
+static unsigned long lastSaveMillis = 0;
+
+static int slotAddress(byte slot) { return REGION_START + slot * SLOT_SIZE; }
+
+void Integrator::reset() {
+  started = false;
+  lastMillis = 0;
+  lastCurrent = 0;
+  lastPower = 0;
+  chargeResidue = 0;
+  energyResidue = 0;
+  totals.charge = 0;
+  totals.energy = 0;
+}
+
+void Integrator::add(unsigned long time, unsigned long current,
+                     unsigned long power) {
+  if (started) {
+    unsigned long long dt = time - lastMillis;
+
+    // each trapezoid is in 1/2 nC (uA ms) and 1/2 nJ (uW ms).
+    unsigned long long charge =
+        chargeResidue + ((unsigned long long)lastCurrent + current) * dt;
+    unsigned long long energy =
+        energyResidue + ((unsigned long long)lastPower + power) * dt;
+
+    totals.charge += charge / RESIDUE_PER_UNIT;
+    totals.energy += energy / RESIDUE_PER_UNIT;
+    chargeResidue = charge % RESIDUE_PER_UNIT;
+    energyResidue = energy % RESIDUE_PER_UNIT;
+  }
+
+  started = true;
+  lastMillis = time;
+  lastCurrent = current;
+  lastPower = power;
+}
+
+static unsigned long portCurrent(byte port, unsigned int counts) {
+  const Board::PortDescriptor &desc = BOARD.ports[port];
+
+  if (counts <= desc.currentZero) {
+    return 0;
+  }
+
+  return (unsigned long)(counts - desc.currentZero) * desc.currentScale;
+}
+
+static unsigned long portVoltage(byte port, unsigned int counts) {
+  return (unsigned long)counts * BOARD.ports[port].voltageScale;
+}
+
+// uW from uA and uV.
+static unsigned long power(unsigned long current, unsigned long voltage) {
+  return (unsigned long long)current * voltage / 1000000UL;
+}
+
+static bool readSlot(byte slot, byte *data) {
+  int addr = slotAddress(slot);
+
+  for (byte i = 0; i < DATA_SIZE; i++) {
+    data[i] = EEPROM.read(addr + i);
+  }
+
+  return data[0] == MAGIC && data[1] == VERSION &&
+         Bytes::crc8(data, DATA_SIZE - 1) == data[DATA_SIZE - 1];
+}
+
+void init() {
+  for (byte i = 0; i < CHANNEL_COUNT; i++) {
+    integrators[i].reset();
+    saved[i].charge = 0;
+    saved[i].energy = 0;
+  }
+
+  bool found = false;
+  byte data[DATA_SIZE];
+  byte newest = 0;
+
+  for (byte slot = 0; slot < SLOT_COUNT; slot++) {
+    if (!readSlot(slot, data)) {
+      continue;
+    }
+
+    unsigned long slotSequence = Bytes::getUint(data + 2, 4);
+
+    if (found && slotSequence <= sequence) {
+      continue;
+    }
+
+    found = true;
+    sequence = slotSequence;
+    newest = slot;
+
+    for (byte i = 0; i < CHANNEL_COUNT; i++) {
+      const byte *p = data + HEADER_SIZE + i * TOTALS_SIZE;
+      saved[i].charge = Bytes::getUint(p, 8);
+      saved[i].energy = Bytes::getUint(p + 8, 8);
+    }
+  }
+
+  if (found) {
+    sequence++;
+    nextSlot = (newest + 1) % SLOT_COUNT;
+  } else {
+    sequence = 0;
+    nextSlot = 0;
+  }
+
+  lastSaveMillis = millis();
+
+  Logger::begin("energy");
+
+  if (found) {
+    Logger::log("restored slot ");
+    Logger::log(newest);
+  } else {
+    Logger::log("no saved totals");
+  }
+
+  Logger::end();
+}
+
+void save() {
+  byte data[SLOT_SIZE];
+  memset(data, 0, sizeof(data));
+
+  data[0] = MAGIC;
+  data[1] = VERSION;
+  Bytes::putUint(data + 2, sequence, 4);
+  Bytes::putUint(data + 6, SoftClock::now(), 4);
+
+  for (byte i = 0; i < CHANNEL_COUNT; i++) {
+    Totals totals = getLifetimeTotals(i);
+    byte *p = data + HEADER_SIZE + i * TOTALS_SIZE;
+    Bytes::putUint(p, totals.charge, 8);
+    Bytes::putUint(p + 8, totals.energy, 8);
+  }
+
+  data[DATA_SIZE - 1] = Bytes::crc8(data, DATA_SIZE - 1);
+
+  // the newest slot stays valid until this one is complete, so an interrupted
+  // save only loses the totals since the previous one.
+  int addr = slotAddress(nextSlot);
+
+  for (byte offset = 0; offset < DATA_SIZE;
+       offset += EEPROMInterface::PAGE_SIZE) {
+    EEPROM.writePage(addr + offset, data + offset,
+                     EEPROMInterface::PAGE_SIZE);
+  }
+
+  sequence++;
+  nextSlot = (nextSlot + 1) % SLOT_COUNT;
+  lastSaveMillis = millis();
+}
+
+void update() {
+  const SensorSample &sample = Wagman::getSample();
+
+  if (!integrators[0].started) {
+    firstSampleMillis = sample.sampleMillis;
+  } else if (sample.sampleMillis == lastSampleMillis) {
+    return;
+  }
+
+  lastSampleMillis = sample.sampleMillis;
+
+  unsigned long current = sample.systemCurrent * 1000UL;
+  integrators[0].add(sample.sampleMillis, current,
+                     power(current, BOARD.supplyVoltage * 1000UL));
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    current = portCurrent(port, sample.ports[port].current);
+    unsigned long voltage = portVoltage(port, sample.ports[port].voltage);
+    integrators[1 + port].add(sample.sampleMillis, current,
+                              power(current, voltage));
+  }
+
+  if (millis() - lastSaveMillis >= SAVE_INTERVAL) {
+    save();
+  }
+}
+
+const Totals &getBootTotals(byte channel) {
+  return integrators[channel].totals;
+}
+
+Totals getLifetimeTotals(byte channel) {
+  Totals totals = saved[channel];
+  totals.charge += integrators[channel].totals.charge;
+  totals.energy += integrators[channel].totals.energy;
+  return totals;
+}
+
+unsigned long getBootSeconds() {
+  return (lastSampleMillis - firstSampleMillis) / 1000;
+}
+
+unsigned long getSecondsSinceSave() {
+  return (millis() - lastSaveMillis) / 1000;
+}
+
+static unsigned long toMilliHours(unsigned long long micros) {
+  unsigned long long value = micros / MICROS_PER_MILLI_HOUR;
+  return (value > 0xffffffffULL) ? 0xffffffffUL : value;
+}
+
+unsigned long toMilliampHours(unsigned long long charge) {
+  return toMilliHours(charge);
+}
+
+unsigned long toMilliwattHours(unsigned long long energy) {
+  return toMilliHours(energy);
+}
+};  // namespace Energy
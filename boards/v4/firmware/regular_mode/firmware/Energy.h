@@ -0,0 +1,77 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_ENERGY__
+#define __H_ENERGY__
+
+#include <Arduino.h>
+#include "Board.h"
+
+// Charge and energy used by the system and by each port, since boot and over
+// the Wagman's lifetime, for power budgets and sizing solar installs.
+//
+// Every sensor sample is calibrated with the board descriptor and integrated
+// with the trapezoidal rule in fixed point, so the only error is from the
+// readings changing between samples. The lifetime totals are saved every
+// SAVE_INTERVAL to a ring of EEPROM slots, so a power cut loses at most that
+// much and each slot is only written once every SLOT_COUNT saves.
+namespace Energy {
+// the system, then each port.
+const byte CHANNEL_COUNT = 1 + Board::PORT_COUNT;
+
+const unsigned long SAVE_INTERVAL = 600000L;
+
+// the EEPROM ring of saved lifetime totals. see eeprom_layout.md.
+const int REGION_START = 1024;
+const byte SLOT_COUNT = 8;
+const int SLOT_SIZE = 128;
+
+struct Totals {
+  unsigned long long charge;  // uC
+  unsigned long long energy;  // uJ
+};
+
+// trapezoidal integrator for one channel.
+struct Integrator {
+  bool started;
+  unsigned long lastMillis;
+  unsigned long lastCurrent;  // uA
+  unsigned long lastPower;    // uW
+
+  // parts of a uC and uJ not yet in the totals, in 1/2 nC and 1/2 nJ.
+  unsigned long chargeResidue;
+  unsigned long energyResidue;
+
+  Totals totals;
+
+  void reset();
+
+  // adds a reading taken at time ms. the first reading only starts the
+  // integration.
+  void add(unsigned long time, unsigned long current, unsigned long power);
+};
+
+// loads the newest valid lifetime totals from EEPROM. call once at boot.
+void init();
+
+// integrates the latest sensor sample and saves the lifetime totals when
+// they're due. call every loop, after the sensors are sampled.
+void update();
+
+// saves the lifetime totals now, like before a deliberate reset.
+void save();
+
+const Totals &getBootTotals(byte channel);
+Totals getLifetimeTotals(byte channel);
+
+// seconds integrated since boot and since the totals were last saved.
+unsigned long getBootSeconds();
+unsigned long getSecondsSinceSave();
+
+// conversions for reporting, saturating at the largest unsigned long.
+unsigned long toMilliampHours(unsigned long long charge);
+unsigned long toMilliwattHours(unsigned long long energy);
+};  // namespace Energy
+
+#endif
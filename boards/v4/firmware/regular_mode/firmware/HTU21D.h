@@ -36,6 +36,7 @@ public:
     bool readHumidity(unsigned int *rawout, float *hrfout);
     bool readTemperature(unsigned int *rawout, float *hrfout);
     void setResolution(byte resBits);
+    byte check_crc(uint16_t message_from_sensor, uint8_t check_value_from_sensor);
 
     //Public Variables
 
@@ -43,7 +44,6 @@ private:
     //Private Functions
 
     byte read_user_register(void);
-    byte check_crc(uint16_t message_from_sensor, uint8_t check_value_from_sensor);
 
     //Private Variables
 
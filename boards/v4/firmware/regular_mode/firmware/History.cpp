@@ -0,0 +1,311 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "History.h"
+
+#include "Bytes.h"
+#include "Wagman.h"
+
+namespace History {
+
+//
+// Block layout (little endian):
+//
+// 0 block number uint32
+// 4 time of first sample uint32 (unix time)
+// 8 sample count uint16
+// 10 used bytes uint16, including this header
+// 12 first sample [CHANNEL_COUNT]uint16
+// 64 later samples, bit packed msb first
+//
+static const unsigned int HEADER_SIZE = 12 + 2 * CHANNEL_COUNT;
+static const unsigned long DATA_BITS = 8UL * (BLOCK_SIZE - HEADER_SIZE);
+
+// a sample more than this many seconds after the last starts a new block.
+static const byte MAX_GAP = 65;
+
+// channels of each port, after the system current.
+static const byte PORT_CHANNELS = 5;
+static const byte CURRENT = 0;
+static const byte VOLTAGE = 1;
+static const byte THERMISTOR = 2;
+static const byte HEARTBEAT = 3;
+static const byte STATE = 4;
+
+static_assert(CHANNEL_COUNT == 1 + PORT_CHANNELS * Board::PORT_COUNT,
+              "channels don't match ports");
+static_assert(HEADER_SIZE == 64, "history header changed size");
+static_assert(BLOCK_SIZE % PART_SIZE == 0, "parts must divide blocks");
+
+static byte blocks[BLOCK_COUNT][BLOCK_SIZE];
+
+static bool started = false;
+static unsigned long newest = 0;
+static unsigned long bitCount = 0;
+static unsigned int sampleCount = 0;
+
+static long previous[CHANNEL_COUNT];
+static long previousDelta[CHANNEL_COUNT];
+
+// running sums of the analog channels since the last sample.
+static unsigned long sums[CHANNEL_COUNT];
+static unsigned long sumCount = 0;
+static unsigned long lastSampleMillis = 0;
+
+static byte *openBlock() { return blocks[newest % BLOCK_COUNT]; }
+
+static void writeBits(unsigned long value, byte count) {
+  byte *data = openBlock() + HEADER_SIZE;
+
+  while (count > 0) {
+    count--;
+
+    if ((value >> count) & 1) {
+      data[bitCount / 8] |= 0x80 >> (bitCount % 8);
+    }
+
+    bitCount++;
+  }
+}
+
+// bits used by a delta-of-delta code:
+//
+// 0                 0
+// 10 + 3 bits       -4 to 3
+// 110 + 6 bits      -32 to 31
+// 1110 + 10 bits    -512 to 511
+// 1111 + 18 bits    anything else
+static byte codeSize(long dod) {
+  if (dod == 0) {
+    return 1;
+  }
+  if (dod >= -4 && dod < 4) {
+    return 5;
+  }
+  if (dod >= -32 && dod < 32) {
+    return 9;
+  }
+  if (dod >= -512 && dod < 512) {
+    return 14;
+  }
+  return 22;
+}
+
+static void writeCode(long dod) {
+  unsigned long bits = (unsigned long)dod;
+
+  switch (codeSize(dod)) {
+    case 1:
+      writeBits(0, 1);
+      break;
+    case 5:
+      writeBits(0x2, 2);
+      writeBits(bits & 0x7, 3);
+      break;
+    case 9:
+      writeBits(0x6, 3);
+      writeBits(bits & 0x3f, 6);
+      break;
+    case 14:
+      writeBits(0xe, 4);
+      writeBits(bits & 0x3ff, 10);
+      break;
+    default:
+      writeBits(0xf, 4);
+      writeBits(bits & 0x3ffff, 18);
+      break;
+  }
+}
+
+static void updateHeader() {
+  byte *block = openBlock();
+  Bytes::putUint(block + 8, sampleCount, 2);
+  Bytes::putUint(block + 10, HEADER_SIZE + (bitCount + 7) / 8, 2);
+}
+
+static void startBlock(const unsigned int *values) {
+  if (started) {
+    newest++;
+  }
+
+  started = true;
+  bitCount = 0;
+  sampleCount = 1;
+
+  byte *block = openBlock();
+  memset(block, 0, BLOCK_SIZE);
+
+  time_t now;
+  Wagman::getTime(now);
+
+  Bytes::putUint(block, newest, 4);
+  Bytes::putUint(block + 4, now, 4);
+
+  for (byte i = 0; i < CHANNEL_COUNT; i++) {
+    Bytes::putUint(block + 12 + 2 * i, values[i], 2);
+    previous[i] = values[i];
+    previousDelta[i] = 0;
+  }
+
+  updateHeader();
+}
+
+static byte portChannel(byte port, byte channel) {
+  return 1 + PORT_CHANNELS * port + channel;
+}
+
+// each group of channels is 0 if none of their codes are, or 1 followed by the
+// codes. the system current is a group of its own and each port is another.
+static byte groupStart(byte group) {
+  return (group == 0) ? 0 : portChannel(group - 1, 0);
+}
+
+static byte groupEnd(byte group) {
+  return (group == 0) ? 1 : portChannel(group, 0);
+}
+
+static void addSample(const unsigned int *values, unsigned long gap) {
+  if (!started || gap > MAX_GAP) {
+    startBlock(values);
+    return;
+  }
+
+  long dods[CHANNEL_COUNT];
+
+  for (byte i = 0; i < CHANNEL_COUNT; i++) {
+    long delta = (long)values[i] - previous[i];
+    dods[i] = delta - previousDelta[i];
+    previousDelta[i] = delta;
+  }
+
+  bool changed[1 + Board::PORT_COUNT];
+  unsigned long size = (gap == 1) ? 1 : 7;
+
+  for (byte group = 0; group <= Board::PORT_COUNT; group++) {
+    changed[group] = false;
+    size++;
+
+    for (byte i = groupStart(group); i < groupEnd(group); i++) {
+      if (dods[i] != 0) {
+        changed[group] = true;
+      }
+    }
+
+    if (changed[group]) {
+      for (byte i = groupStart(group); i < groupEnd(group); i++) {
+        size += codeSize(dods[i]);
+      }
+    }
+  }
+
+  if (bitCount + size > DATA_BITS) {
+    startBlock(values);
+    return;
+  }
+
+  if (gap == 1) {
+    writeBits(0, 1);
+  } else {
+    writeBits(1, 1);
+    writeBits(gap - 2, 6);
+  }
+
+  for (byte group = 0; group <= Board::PORT_COUNT; group++) {
+    writeBits(changed[group], 1);
+
+    if (changed[group]) {
+      for (byte i = groupStart(group); i < groupEnd(group); i++) {
+        writeCode(dods[i]);
+      }
+    }
+  }
+
+  for (byte i = 0; i < CHANNEL_COUNT; i++) {
+    previous[i] = values[i];
+  }
+
+  sampleCount++;
+  updateHeader();
+}
+
+void update(const Device *devices, byte count) {
+  const SensorSample &sample = Wagman::getSample();
+
+  sums[0] += sample.systemCurrent;
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    sums[portChannel(port, CURRENT)] += sample.ports[port].current;
+    sums[portChannel(port, VOLTAGE)] += sample.ports[port].voltage;
+    sums[portChannel(port, THERMISTOR)] += sample.ports[port].thermistor;
+  }
+
+  sumCount++;
+
+  unsigned long elapsed = millis() - lastSampleMillis;
+
+  if (started && elapsed < SAMPLE_INTERVAL) {
+    return;
+  }
+
+  unsigned int values[CHANNEL_COUNT];
+
+  for (byte i = 0; i < CHANNEL_COUNT; i++) {
+    values[i] = (sums[i] + sumCount / 2) / sumCount;
+    sums[i] = 0;
+  }
+
+  sumCount = 0;
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    unsigned long heartbeat = 0xffff;
+    unsigned int state = STATE_DISABLED;
+
+    if (port < count) {
+      heartbeat = min(devices[port].timeSinceHeartbeat() / 1000, 0xffffUL);
+      state = devices[port].getState();
+    }
+
+    values[portChannel(port, HEARTBEAT)] = heartbeat;
+    values[portChannel(port, STATE)] = state;
+  }
+
+  unsigned long gap = elapsed / SAMPLE_INTERVAL;
+
+  if (started) {
+    lastSampleMillis += gap * SAMPLE_INTERVAL;
+  } else {
+    lastSampleMillis = millis();
+  }
+
+  addSample(values, gap);
+}
+
+bool getPart(unsigned long block, byte part, Part &result) {
+  if (!started || block > newest || part >= PART_COUNT) {
+    return false;
+  }
+
+  if (block < getOldestBlock()) {
+    block = getOldestBlock();
+    part = 0;
+  }
+
+  const byte *data = blocks[block % BLOCK_COUNT];
+  unsigned int used = Bytes::getUint(data + 10, 2);
+  unsigned int offset = part * PART_SIZE;
+
+  result.block = block;
+  result.part = part;
+  result.samples = Bytes::getUint(data + 8, 2);
+  result.data = data + offset;
+  result.size = (offset < used) ? min(PART_SIZE, used - offset) : 0;
+  return true;
+}
+
+unsigned long getOldestBlock() {
+  return (newest < BLOCK_COUNT) ? 0 : newest - (BLOCK_COUNT - 1);
+}
+
+unsigned long getNewestBlock() { return newest; }
+};  // namespace History
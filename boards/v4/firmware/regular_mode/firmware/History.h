@@ -0,0 +1,56 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_HISTORY__
+#define __H_HISTORY__
+
+#include <Arduino.h>
+#include "Board.h"
+#include "Device.h"
+
+// Keeps the last few hours of sensor readings in RAM, one sample a second, so
+// the node controller can backfill after it reboots or loses the link and so
+// the minutes before a device was killed can be looked at.
+//
+// Samples are packed into a ring of fixed size blocks. Each block holds its
+// first sample in full and the rest as delta-of-delta codes, so a block can be
+// decoded on its own. Blocks are numbered from boot and the number is the
+// export cursor. See history_layout.md for the format.
+namespace History {
+const unsigned int BLOCK_SIZE = 512;
+const byte BLOCK_COUNT = 64;
+
+// blocks are exported in parts small enough for a single response.
+const unsigned int PART_SIZE = 128;
+const byte PART_COUNT = BLOCK_SIZE / PART_SIZE;
+
+// system current, then current, voltage, thermistor, seconds since heartbeat
+// and state for each port.
+const byte CHANNEL_COUNT = 1 + 5 * Board::PORT_COUNT;
+
+const unsigned long SAMPLE_INTERVAL = 1000;
+
+// adds the current readings to the running averages and writes a sample once
+// a second. call every loop, after the sensors are sampled.
+void update(const Device *devices, byte count);
+
+struct Part {
+  unsigned long block;
+  byte part;
+  unsigned int samples;  // in the block so far
+  const byte *data;
+  unsigned int size;
+};
+
+// gets a part of a block. if the block has been overwritten, gets the first
+// part of the oldest block instead. returns false if block hasn't been
+// started yet.
+bool getPart(unsigned long block, byte part, Part &result);
+
+// numbers of the oldest block still held and of the block being written.
+unsigned long getOldestBlock();
+unsigned long getNewestBlock();
+};  // namespace History
+
+#endif
@@ -0,0 +1,342 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "LoadShed.h"
+
+#include "Logger.h"
+#include "Wagman.h"
+
+using Board::BOARD;
+using Board::NEVER_SHED;
+using Board::PORT_COUNT;
+
+namespace LoadShed {
+
+static Controller controller;
+
+// ports which read as powered at the last poll and haven't been shed.
+static byte powered = 0;
+
+// ports shed by poll() whose devices haven't been stopped yet.
+static byte pendingStops = 0;
+
+static bool started = false;
+static unsigned long lastPollMillis = 0;
+static unsigned long lastCurrentMillis = 0;
+static unsigned int supplyVoltage = 0;
+
+static unsigned long pollCount = 0;
+static unsigned long pollRate = 0;
+static unsigned long pollRateMillis = 0;
+
+// lowest priority port in ports which can be shed. ties go to the last port.
+static byte lowestPriority(byte ports) {
+  byte result = NO_PORT;
+
+  for (byte port = 0; port < PORT_COUNT; port++) {
+    byte priority = BOARD.ports[port].shedPriority;
+
+    if ((ports & (1 << port)) == 0 || priority == NEVER_SHED) {
+      continue;
+    }
+
+    if (result == NO_PORT || priority <= BOARD.ports[result].shedPriority) {
+      result = port;
+    }
+  }
+
+  return result;
+}
+
+// highest priority port in ports. ties go to the first port.
+static byte highestPriority(byte ports) {
+  byte result = NO_PORT;
+
+  for (byte port = 0; port < PORT_COUNT; port++) {
+    if ((ports & (1 << port)) == 0) {
+      continue;
+    }
+
+    if (result == NO_PORT ||
+        BOARD.ports[port].shedPriority > BOARD.ports[result].shedPriority) {
+      result = port;
+    }
+  }
+
+  return result;
+}
+
+void Controller::reset(unsigned long now) {
+  shed = 0;
+  below = 0;
+  lastShed = now - MAX_RESTORE_HOLD;
+  lastRestore = now - MAX_RESTORE_HOLD;
+  okSince = now;
+  hold = RESTORE_HOLD;
+  shedCount = 0;
+  restoreCount = 0;
+
+  for (byte port = 0; port < PORT_COUNT; port++) {
+    shedCurrents[port] = 0;
+  }
+}
+
+byte Controller::checkVoltage(unsigned long now, unsigned int voltage,
+                              byte powered) {
+  // without a powered port, there's nothing to measure or shed.
+  if (powered == 0) {
+    below = 0;
+    return NO_PORT;
+  }
+
+  if (voltage < RESTORE_VOLTAGE) {
+    okSince = now;
+  }
+
+  if (voltage >= SHED_VOLTAGE) {
+    below = 0;
+    return NO_PORT;
+  }
+
+  if (below < SHED_CONFIRM) {
+    below++;
+  }
+
+  if (below < SHED_CONFIRM || now - lastShed < SHED_SETTLE) {
+    return NO_PORT;
+  }
+
+  return lowestPriority(powered & ~shed);
+}
+
+byte Controller::checkCurrent(unsigned long now, unsigned int current,
+                              byte powered) {
+  if (current > RESTORE_CURRENT) {
+    okSince = now;
+  }
+
+  // a reading taken before the last shed settled may still have its load.
+  if (current <= SHED_CURRENT || (long)(now - lastShed) < (long)SHED_SETTLE) {
+    return NO_PORT;
+  }
+
+  return lowestPriority(powered & ~shed);
+}
+
+byte Controller::checkRestore(unsigned long now, unsigned int current) {
+  if (shed == 0) {
+    if (now - lastShed >= MAX_RESTORE_HOLD) {
+      hold = RESTORE_HOLD;
+    }
+
+    return NO_PORT;
+  }
+
+  if (now - okSince < hold || now - lastRestore < hold) {
+    return NO_PORT;
+  }
+
+  byte port = highestPriority(shed);
+
+  // the port's current when it was shed may have been a surge, so it's tried
+  // anyway once the supply has been fine for MAX_RESTORE_HOLD.
+  if ((unsigned long)current + shedCurrents[port] > RESTORE_CURRENT &&
+      now - okSince < MAX_RESTORE_HOLD) {
+    return NO_PORT;
+  }
+
+  return port;
+}
+
+void Controller::shedPort(byte port, unsigned long now, unsigned int current) {
+  // a restore which led to another shed needs a longer hold next time.
+  if (now - lastRestore < hold) {
+    hold = min(2 * hold, MAX_RESTORE_HOLD);
+  }
+
+  shed |= 1 << port;
+  shedCurrents[port] = current;
+  shedCount++;
+  lastShed = now;
+  okSince = now;
+  below = 0;
+}
+
+void Controller::restorePort(byte port, unsigned long now) {
+  shed &= ~(1 << port);
+  restoreCount++;
+  lastRestore = now;
+}
+
+// port current in mA from the last sample.
+static unsigned int portCurrent(byte port) {
+  const Board::PortDescriptor &desc = BOARD.ports[port];
+  unsigned int counts = Wagman::getSample().ports[port].current;
+
+  if (counts <= desc.currentZero) {
+    return 0;
+  }
+
+  return (unsigned long)(counts - desc.currentZero) * desc.currentScale / 1000;
+}
+
+// reads the port voltages, updating powered and supplyVoltage.
+static void readSupplyVoltage() {
+  unsigned long highest = 0;
+
+  powered = 0;
+
+  for (byte port = 0; port < PORT_COUNT; port++) {
+    if (controller.shed & (1 << port)) {
+      continue;
+    }
+
+    const Board::PortDescriptor &desc = BOARD.ports[port];
+    unsigned long voltage =
+        (unsigned long)analogRead(desc.voltagePin) * desc.voltageScale / 1000;
+
+    if (voltage >= MIN_VOLTAGE) {
+      powered |= 1 << port;
+      highest = max(highest, voltage);
+    }
+  }
+
+  supplyVoltage = highest;
+}
+
+static void shed(byte port, unsigned long now) {
+  Wagman::shedRelay(port);
+  controller.shedPort(port, now, portCurrent(port));
+  powered &= ~(1 << port);
+  pendingStops |= 1 << port;
+}
+
+void poll() {
+  unsigned long now = millis();
+
+  if (!started || now - lastPollMillis < POLL_INTERVAL) {
+    return;
+  }
+
+  lastPollMillis = now;
+  pollCount++;
+
+  if (now - pollRateMillis >= 1000) {
+    pollRate = pollCount;
+    pollCount = 0;
+    pollRateMillis = now;
+  }
+
+  readSupplyVoltage();
+
+  byte port = controller.checkVoltage(now, supplyVoltage, powered);
+  const SensorSample &sample = Wagman::getSample();
+
+  // each fast reading of the system current is checked once, unless the
+  // supply is already being shed for.
+  if (sample.fastCurrentMillis != lastCurrentMillis) {
+    lastCurrentMillis = sample.fastCurrentMillis;
+
+    if (port == NO_PORT) {
+      port = controller.checkCurrent(sample.fastCurrentMillis,
+                                     sample.fastCurrent, powered);
+    }
+  }
+
+  if (port != NO_PORT) {
+    shed(port, now);
+  }
+
+  // reading the current waits on the ADC, during which this polls again.
+  if (millis() - sample.fastCurrentMillis >= CURRENT_INTERVAL) {
+    Wagman::sampleFastCurrent();
+  }
+}
+
+static void logAction(const char *action, byte port) {
+  Logger::beginEvent("loadshed");
+  Logger::log(action);
+  Logger::log(" ");
+  Logger::log(BOARD.ports[port].name);
+  Logger::log(" at ");
+  Logger::log(supplyVoltage);
+  Logger::log(" mV ");
+  Logger::log(Wagman::getSample().fastCurrent);
+  Logger::log(" mA");
+  Logger::end();
+}
+
+// stops the devices on shed ports. stopping one waits on its relay, during
+// which poll() may shed more.
+static void stopShedDevices(Device *devices, byte count) {
+  while (pendingStops != 0) {
+    byte port = 0;
+
+    while ((pendingStops & (1 << port)) == 0) {
+      port++;
+    }
+
+    pendingStops &= ~(1 << port);
+
+    if (port < count && devices[port].getState() != STATE_DISABLED) {
+      devices[port].kill();
+    }
+
+    logAction("shed", port);
+  }
+}
+
+void update(Device *devices, byte count, bool restore) {
+  if (!started) {
+    controller.reset(millis());
+    pollRateMillis = millis();
+    started = true;
+  }
+
+  // stopping devices takes a while, during which poll() keeps checking.
+  stopShedDevices(devices, count);
+
+  if (!restore) {
+    return;
+  }
+
+  unsigned long now = millis();
+  byte port = controller.checkRestore(now, Wagman::getSample().systemCurrent);
+
+  if (port != NO_PORT) {
+    controller.restorePort(port, now);
+    logAction("restored", port);
+
+    if (port < count && devices[port].getState() == STATE_STOPPED) {
+      devices[port].start();
+    }
+  }
+}
+
+bool canStart(byte port) {
+  if (controller.shed & (1 << port)) {
+    return false;
+  }
+
+  return controller.shed == 0 || BOARD.ports[port].shedPriority == NEVER_SHED;
+}
+
+void release(byte port) {
+  if (controller.shed & (1 << port)) {
+    controller.restorePort(port, millis());
+  }
+}
+
+byte getShedPorts() { return controller.shed; }
+
+unsigned long getShedCount() { return controller.shedCount; }
+
+unsigned long getRestoreCount() { return controller.restoreCount; }
+
+unsigned long getRestoreHold() { return controller.hold; }
+
+unsigned int getSupplyVoltage() { return supplyVoltage; }
+
+unsigned long getPollRate() { return pollRate; }
+};  // namespace LoadShed
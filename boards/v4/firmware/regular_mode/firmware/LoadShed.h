@@ -0,0 +1,126 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_LOAD_SHED__
+#define __H_LOAD_SHED__
+
+#include <Arduino.h>
+#include "Board.h"
+#include "Device.h"
+
+// Sheds ports by priority when the supply sags or the system draws too much,
+// so the node controller and the Wagman itself stay up, and restores them
+// once the supply has recovered.
+//
+// The loop spends most of its time in delay(), waiting on ADC conversions and
+// relays, so the supply voltage is polled from yield() every POLL_INTERVAL and
+// a port is cut with a fast relay latch within milliseconds of a sag. The
+// system current is an MCP3428 reading, which can't be made during another
+// conversion, so it has 5 ms, 12 bit readings of its own: the loop takes one
+// around each of its 80 ms conversions, and polls take one every
+// CURRENT_INTERVAL while no conversion is under way, like during relay waits.
+// Each reading is checked by the next poll, so overcurrent is shed within
+// about one conversion rather than once a loop.
+//
+// The supply voltage is the highest of the port voltages, since the Wagman
+// doesn't measure it directly, and the ports reading a voltage are the ones
+// which can be shed. The port voltages are read after the relays, so with
+// every port which can be shed off, the reading is the rail under the node
+// controller's load alone. That's what restores wait on, so a supply which
+// only sags under the node controller's load holds restores back, and one with
+// no port powered isn't measured at all.
+namespace LoadShed {
+const byte NO_PORT = 255;
+
+const unsigned long POLL_INTERVAL = 1;
+const unsigned long CURRENT_INTERVAL = 10;
+
+// a port is shed once the supply has been under SHED_VOLTAGE for SHED_CONFIRM
+// polls in a row, so a single noisy reading doesn't shed anything, or when the
+// system current is over SHED_CURRENT. further sheds wait SHED_SETTLE for the
+// relay to open and the supply to recover.
+const unsigned int SHED_VOLTAGE = 4750;  // mV
+const byte SHED_CONFIRM = 2;
+const unsigned long SHED_SETTLE = 10;
+const unsigned int SHED_CURRENT = 7000;  // mA
+
+// ports reading under this are off, so they aren't a sag.
+const unsigned int MIN_VOLTAGE = 2500;  // mV
+
+// ports are restored one at a time, highest priority first, once the supply
+// has been at or above RESTORE_VOLTAGE and the system current at or under
+// RESTORE_CURRENT for the restore hold, and the port's current when it was
+// shed would keep the system under RESTORE_CURRENT, or the supply has been fine
+// for MAX_RESTORE_HOLD in case that was a surge. the hold doubles, up to
+// MAX_RESTORE_HOLD, each time a port is shed within a hold of a restore, and
+// goes back to RESTORE_HOLD after MAX_RESTORE_HOLD without sheds.
+const unsigned int RESTORE_VOLTAGE = 4900;  // mV
+const unsigned int RESTORE_CURRENT = 6000;  // mA
+const unsigned long RESTORE_HOLD = 30000L;
+const unsigned long MAX_RESTORE_HOLD = 960000L;
+
+// shedding decisions for the ports, a bit per port in each mask.
+struct Controller {
+  byte shed;
+  byte below;  // polls in a row under SHED_VOLTAGE
+
+  unsigned long lastShed;
+  unsigned long lastRestore;
+  unsigned long okSince;  // since the supply last wasn't fine
+  unsigned long hold;
+
+  unsigned int shedCurrents[Board::PORT_COUNT];  // mA when shed
+
+  unsigned long shedCount;
+  unsigned long restoreCount;
+
+  void reset(unsigned long now);
+
+  // checks the supply voltage in mV seen on the powered ports. returns the
+  // port to shed or NO_PORT.
+  byte checkVoltage(unsigned long now, unsigned int voltage, byte powered);
+
+  // checks the system current in mA read at now, which may be before the
+  // last shed. returns the port to shed or NO_PORT.
+  byte checkCurrent(unsigned long now, unsigned int current, byte powered);
+
+  // returns the shed port to restore or NO_PORT.
+  byte checkRestore(unsigned long now, unsigned int current);
+
+  void shedPort(byte port, unsigned long now, unsigned int current);
+  void restorePort(byte port, unsigned long now);
+};
+
+// checks the supply voltage and any new fast reading of the system current.
+// called from yield() and the loop, and does nothing until POLL_INTERVAL has
+// passed since the last check.
+void poll();
+
+// stops the devices on shed ports and restores ports. call every loop, after
+// the sensors are sampled and the devices are updated. restore is false while
+// the Wagman is about to reset, which keeps shed ports off rather than
+// starting devices which would be stopped again.
+void update(Device *devices, byte count, bool restore);
+
+// whether a port may be started automatically. shed ports wait to be restored
+// and, while any port is shed, only ports which are never shed are started.
+bool canStart(byte port);
+
+// stops treating a port as shed, like when it's started on request. it can be
+// shed again.
+void release(byte port);
+
+byte getShedPorts();
+unsigned long getShedCount();
+unsigned long getRestoreCount();
+unsigned long getRestoreHold();
+
+// supply voltage in mV at the last poll, 0 if no port was powered.
+unsigned int getSupplyVoltage();
+
+// polls in the last full second.
+unsigned long getPollRate();
+};  // namespace LoadShed
+
+#endif
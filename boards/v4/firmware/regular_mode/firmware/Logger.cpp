@@ -7,21 +7,71 @@
 namespace Logger
 {
 
-void begin(const char *name)
+Line line;
+bool building = false;
+
+static void (*output)(const byte *data, unsigned int length) = NULL;
+
+size_t Line::write(uint8_t c)
 {
-    if (logging) {
-        SerialUSB.print("log: ");
-        SerialUSB.print(name);
-        SerialUSB.print(' ');
+    if (length >= SIZE) {
+        return 0;
     }
+
+    data[length++] = c;
+    return 1;
+}
+
+void Line::finish()
+{
+    data[length++] = '\n';
+}
+
+void setOutput(void (*newOutput)(const byte *data, unsigned int length))
+{
+    output = newOutput;
+}
+
+static void start(const char *name, bool send)
+{
+    building = send;
+
+    if (building) {
+        line.clear();
+        line.print("log: ");
+        line.print(name);
+        line.print(' ');
+    }
+}
+
+void begin(const char *name)
+{
+    start(name, logging);
+}
+
+void beginEvent(const char *name)
+{
+    start(name, logging || logEvents);
 }
 
 void end()
 {
-    if (logging) {
-        SerialUSB.println();
+    if (!building) {
+        return;
+    }
+
+    building = false;
+    line.finish();
+
+    if (output != NULL) {
+        output(line.getData(), line.getLength());
+    } else {
+        for (unsigned int i = 0; i < line.getLength(); i++) {
+            SerialUSB.write(line.getData()[i]);
+        }
     }
+
+    line.clear();
 }
 
 };
-
@@ -2,25 +2,69 @@
 // LICENSE.waggle.txt for the legal details of the copyright and software
 // license.For more details on the Waggle project, visit:
 // http://www.wa8.gl
+#ifndef __H_LOGGER__
+#define __H_LOGGER__
+
 #include "Arduino.h"
 
 extern bool logging;
 
+// events are the lines a host acts on: sheds, anomalies, outages, reset all
+// progress and why devices were stopped. they're sent while this is set, even
+// with logging off.
+extern bool logEvents;
+
 namespace Logger {
+// a log line being built. it's sent whole by end(), so it can't land in the
+// middle of other output. text past SIZE is dropped.
+class Line : public Print {
+ public:
+  static const unsigned int SIZE = 160;
+
+  Line() : length(0) {}
+
+  size_t write(uint8_t c);
+  using Print::write;
+
+  void clear() { length = 0; }
+
+  // ends the line with a newline, which always fits.
+  void finish();
+
+  const byte *getData() const { return data; }
+  unsigned int getLength() const { return length; }
+
+ private:
+  byte data[SIZE + 1];
+  unsigned int length;
+};
+
+extern Line line;
+
+// whether the line being built will be sent by end().
+extern bool building;
+
+// sends each finished line. lines are printed to SerialUSB until it's set.
+void setOutput(void (*output)(const byte *data, unsigned int length));
+
 void begin(const char *name);
+
+// begins an event line, which looks like any other log line.
+void beginEvent(const char *name);
+
 void end();
 
 template <class T>
 void log(T value) {
-  if (logging) {
-    SerialUSB.print(value);
+  if (building) {
+    line.print(value);
   }
 }
 
 template <class T>
 void logHex(T value) {
-  if (logging) {
-    SerialUSB.print(value, HEX);
+  if (building) {
+    line.print(value, HEX);
   }
 }
 
@@ -30,3 +74,5 @@ void logCurrent();
 void logHeartbeat();
 void logThermistors();
 };  // namespace Logger
+
+#endif
@@ -20,12 +20,13 @@ void MCP342X::init(byte A0, byte A1)
 	else if (A0 == F && A1 == H) I2C_ADDRESS = B1101111;
 }
 
-void MCP342X::selectChannel(byte channel, byte gain)
+void MCP342X::selectChannel(byte channel, byte gain, byte rate)
 {
-    //configuration register, assuming 16 bit resolution
+    //configuration register
     // Initiate one shot conversion
     // 16 bits, 66.6 ms later the data should be available.
-	byte reg = (1 << BIT_RDY) | (channel << BIT_C0) | (0 << BIT_OC) | (1 << BIT_S1) | gain;
+    // 12 bits, 4.2 ms later.
+	byte reg = (1 << BIT_RDY) | (channel << BIT_C0) | (0 << BIT_OC) | (rate << BIT_S0) | gain;
 
     for (byte attempts = 0; attempts < 10; attempts++) {
 	    Wire.beginTransmission(I2C_ADDRESS);
@@ -36,9 +37,12 @@ void MCP342X::selectChannel(byte channel, byte gain)
     }
 }
 
-unsigned int MCP342X::readADC()
+unsigned int MCP342X::readADC(byte rate)
 {
-    delay(80);
+    // waits out the conversion started at rate, with some margin.
+    static const byte waits[] = {5, 20, 80};
+
+    delay(waits[rate]);
   	Wire.requestFrom(I2C_ADDRESS, 3);
 
 	byte attempts;
@@ -19,9 +19,14 @@ public:
 	static const byte GAIN_4 = 2;
 	static const byte GAIN_8 = 3;
 
+	// sample rates and the resolution each gives.
+	static const byte RATE_240SPS = 0; // 12 bits
+	static const byte RATE_60SPS = 1; // 14 bits
+	static const byte RATE_15SPS = 2; // 16 bits
+
 	void init(byte A0, byte A1);
-	void selectChannel(byte channel, byte gain = GAIN_1);
-	unsigned int readADC();
+	void selectChannel(byte channel, byte gain = GAIN_1, byte rate = RATE_15SPS);
+	unsigned int readADC(byte rate = RATE_15SPS);
 private:
 	//communication register
 	static const byte BIT_RDY = 7; //data ready
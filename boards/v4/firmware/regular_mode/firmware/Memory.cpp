@@ -0,0 +1,99 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Memory.h"
+
+#if defined(ARDUINO_ARCH_SAM)
+extern "C" char *sbrk(int incr);
+extern char _end;
+
+static char *heapStart() { return &_end; }
+static char *heapEnd() { return sbrk(0); }
+#elif defined(__AVR__)
+extern char __heap_start;
+extern char *__brkval;
+
+static char *heapStart() { return &__heap_start; }
+static char *heapEnd() { return __brkval != 0 ? __brkval : &__heap_start; }
+#endif
+
+// leave room for the frame of the function doing the painting.
+static const unsigned int PAINT_MARGIN = 64;
+
+#if defined(ARDUINO_ARCH_SAM) || defined(__AVR__)
+static char *paintEnd = 0;
+#endif
+static unsigned int minFreeStack = 0;
+static unsigned int heapUsed = 0;
+
+namespace Memory {
+
+static uintptr_t alignUp(uintptr_t addr) {
+  return (addr + sizeof(uint32_t) - 1) & ~(uintptr_t)(sizeof(uint32_t) - 1);
+}
+
+static uintptr_t alignDown(uintptr_t addr) {
+  return addr & ~(uintptr_t)(sizeof(uint32_t) - 1);
+}
+
+void paint(void *start, void *end) {
+  uint32_t *p = (uint32_t *)alignUp((uintptr_t)start);
+  uint32_t *last = (uint32_t *)alignDown((uintptr_t)end);
+
+  while (p < last) {
+    *p++ = PAINT;
+  }
+}
+
+unsigned int paintedBytes(const void *start, const void *end) {
+  const uint32_t *first = (const uint32_t *)alignUp((uintptr_t)start);
+  const uint32_t *last = (const uint32_t *)alignDown((uintptr_t)end);
+  const volatile uint32_t *p = first;
+
+  while (p < last && *p == PAINT) {
+    p++;
+  }
+
+  return (const char *)p - (const char *)first;
+}
+
+void paintStack() {
+#if defined(ARDUINO_ARCH_SAM) || defined(__AVR__)
+  char top;
+  paintEnd = &top - PAINT_MARGIN;
+
+  if (heapEnd() < paintEnd) {
+    paint(heapEnd(), paintEnd);
+  }
+
+  minFreeStack = paintEnd - heapEnd();
+  update();
+#endif
+}
+
+void update() {
+#if defined(ARDUINO_ARCH_SAM) || defined(__AVR__)
+  if (paintEnd == 0) {
+    return;
+  }
+
+  heapUsed = heapEnd() - heapStart();
+
+  unsigned int freeStack = 0;
+
+  if (heapEnd() < paintEnd) {
+    freeStack = paintedBytes(heapEnd(), paintEnd);
+  }
+
+  if (freeStack < minFreeStack) {
+    minFreeStack = freeStack;
+  }
+#endif
+}
+
+unsigned int getMinFreeStack() { return minFreeStack; }
+
+unsigned int getHeapUsed() { return heapUsed; }
+
+};  // namespace Memory
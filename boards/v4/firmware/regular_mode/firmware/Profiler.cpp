@@ -0,0 +1,122 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "Profiler.h"
+
+#ifdef PROFILER
+
+#ifdef ARDUINO_ARCH_SAM
+// Cortex-M3 debug registers used to enable and read the cycle counter.
+#define DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA (1UL << 24)
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA (1UL << 0)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+#else
+static const unsigned long SIMULATED_CYCLES_PER_MICRO = 84;
+#endif
+
+static Profiler::Histogram histograms[Profiler::SECTION_COUNT];
+static bool loopSeen = false;
+static unsigned long lastLoopCycles;
+
+namespace Profiler {
+
+void init() {
+#ifdef ARDUINO_ARCH_SAM
+  DEMCR |= DEMCR_TRCENA;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
+
+  reset();
+}
+
+void reset() {
+  for (byte i = 0; i < SECTION_COUNT; i++) {
+    Histogram &h = histograms[i];
+    h.count = 0;
+    h.minCycles = 0xffffffffUL;
+    h.maxCycles = 0;
+    h.totalCycles = 0;
+
+    for (byte j = 0; j < HISTOGRAM_BINS; j++) {
+      h.bins[j] = 0;
+    }
+  }
+
+  loopSeen = false;
+}
+
+unsigned long cycles() {
+#ifdef ARDUINO_ARCH_SAM
+  return DWT_CYCCNT;
+#else
+  return micros() * SIMULATED_CYCLES_PER_MICRO;
+#endif
+}
+
+static byte log2Bin(unsigned long n) {
+  byte bin = 0;
+
+  while (n != 0) {
+    bin++;
+    n >>= 1;
+  }
+
+  return bin;
+}
+
+void add(byte section, unsigned long cycles) {
+  Histogram &h = histograms[section];
+
+  h.count++;
+  h.totalCycles += cycles;
+  h.bins[log2Bin(cycles)]++;
+
+  if (cycles < h.minCycles) {
+    h.minCycles = cycles;
+  }
+
+  if (cycles > h.maxCycles) {
+    h.maxCycles = cycles;
+  }
+}
+
+void loopStarted() {
+  unsigned long now = cycles();
+
+  if (loopSeen) {
+    add(SECTION_LOOP, now - lastLoopCycles);
+  }
+
+  loopSeen = true;
+  lastLoopCycles = now;
+}
+
+const Histogram &getHistogram(byte section) { return histograms[section]; }
+
+byte getValues(byte section, unsigned long values[MAX_VALUES]) {
+  const Histogram &h = histograms[section];
+  byte bins = HISTOGRAM_BINS;
+
+  while (bins > 0 && h.bins[bins - 1] == 0) {
+    bins--;
+  }
+
+  values[0] = h.count;
+  values[1] = (h.count > 0) ? h.minCycles : 0;
+  values[2] = h.maxCycles;
+  values[3] = (h.count > 0) ? h.totalCycles / h.count : 0;
+
+  for (byte i = 0; i < bins; i++) {
+    values[4 + i] = h.bins[i];
+  }
+
+  return 4 + bins;
+}
+
+};  // namespace Profiler
+
+#endif
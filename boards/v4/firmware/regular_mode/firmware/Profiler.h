@@ -0,0 +1,79 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_PROFILER__
+#define __H_PROFILER__
+
+#include <Arduino.h>
+
+// define this to build in the loop profiler. when it's not defined, the
+// PROFILE_* macros compile to nothing and the profiler commands are removed.
+// #define PROFILER
+
+namespace Profiler {
+
+enum {
+  SECTION_LOOP,  // period between loop() calls
+  SECTION_START,
+  SECTION_SAMPLE,
+  SECTION_DEVICES,
+  SECTION_COMMANDS,
+  SECTION_PUSH,
+  SECTION_STATUS,
+  SECTION_LEDS,
+  SECTION_COUNT,
+};
+
+// bin i counts samples of [2^(i-1), 2^i) cycles. bin 0 counts 0 cycles.
+const byte HISTOGRAM_BINS = 33;
+
+struct Histogram {
+  unsigned long count;
+  unsigned long minCycles;
+  unsigned long maxCycles;
+  unsigned long long totalCycles;
+  unsigned long bins[HISTOGRAM_BINS];
+};
+
+void init();
+void reset();
+
+// current cycle count. on the Due this is the DWT cycle counter. in host
+// builds it's simulated from micros() at the Due's clock rate.
+unsigned long cycles();
+
+void add(byte section, unsigned long cycles);
+void loopStarted();
+
+const Histogram &getHistogram(byte section);
+
+// values the profile command sends for a section: count, min, max and mean
+// cycles, then the bins up to the last one which isn't empty. the cycles are
+// 0 for a section without samples. returns the number of values.
+const byte MAX_VALUES = 4 + HISTOGRAM_BINS;
+byte getValues(byte section, unsigned long values[MAX_VALUES]);
+
+class Scope {
+ public:
+  Scope(byte section) : section(section), start(cycles()) {}
+  ~Scope() { add(section, cycles() - start); }
+
+ private:
+  byte section;
+  unsigned long start;
+};
+
+};  // namespace Profiler
+
+#ifdef PROFILER
+#define PROFILE_INIT() Profiler::init()
+#define PROFILE_LOOP() Profiler::loopStarted()
+#define PROFILE_SECTION(section) Profiler::Scope profileScope(section)
+#else
+#define PROFILE_INIT()
+#define PROFILE_LOOP()
+#define PROFILE_SECTION(section)
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 // LICENSE.waggle.txt for the legal details of the copyright and software
 // license.For more details on the Waggle project, visit:
 // http://www.wa8.gl
+#include "Board.h"
+#include "Bytes.h"
 #include "EEPROM.h"
 #include "Record.h"
 #include "Wagman.h"
@@ -36,6 +38,15 @@ static const int WAGMAN_HIH4030_HEALTH = 9;
 static const int WAGMAN_HIH4030_RANGE = 10;
 static const int WAGMAN_CURRENT_HEALTH = 14;
 static const int WAGMAN_CURRENT_RANGE = 15;
+static const int WAGMAN_OUTAGE_LOG = 32;
+
+// times are stored as 32 bit seconds whatever the size of time_t, so the layout
+// is the same on the Due and on a host build.
+static const int EEPROM_TIME_SIZE = 4;
+
+static const int EEPROM_CLOCK_REGION_START = 896;
+static const int CLOCK_SYNC_LOG = 0;
+static const int CLOCK_SYNC_SIZE = 10;
 
 // Device EEPROM Spec
 
@@ -68,7 +79,12 @@ static const int
 
     EEPROM_PORT_RELAY_HEALTH = 37,
     EEPROM_PORT_RELAY_JOURNAL = 38,
-    EEPROM_PORT_BOOT_LOG = 64;
+    EEPROM_PORT_BOOT_HEARTBEAT_TIMEOUT = 39,
+    EEPROM_PORT_UNMANAGED_CHANGE_TIME = 43,
+    EEPROM_PORT_STOP_TIMEOUT = 47,
+    EEPROM_PORT_CONFIG_CHECKSUM = 51,
+    EEPROM_PORT_BOOT_LOG = 64,
+    EEPROM_PORT_BOOT_DURATION_LOG = 98;
 
 namespace Record
 {
@@ -81,6 +97,18 @@ BootLog bootLogs[5] = {
     BootLog(256 + 4 * 128 + 64),
 };
 
+BootDurationLog bootDurationLogs[5] = {
+    BootDurationLog(256 + 0 * 128 + 98),
+    BootDurationLog(256 + 1 * 128 + 98),
+    BootDurationLog(256 + 2 * 128 + 98),
+    BootDurationLog(256 + 3 * 128 + 98),
+    BootDurationLog(256 + 4 * 128 + 98),
+};
+
+OutageLog outageLog(WAGMAN_REGION_START + WAGMAN_OUTAGE_LOG);
+
+ClockSyncLog clockSyncLog(EEPROM_CLOCK_REGION_START + CLOCK_SYNC_LOG);
+
 int deviceRegion(byte device)
 {
     return EEPROM_PORT_REGIONS_START + device * EEPROM_PORT_REGIONS_SIZE;
@@ -122,15 +150,20 @@ void init()
         setPortCurrentSensorHealth(i, 0);
         setThermistorSensorHealth(i, 0);
 
+        PortConfig config;
+        getDefaultPortConfig(i, config);
+        setPortConfig(i, config);
+
         bootLogs[i].init();
+        bootDurationLogs[i].init();
     }
 
-    // default setup is just node controller and single guest node.
-    setDeviceEnabled(0, true);
-    setDeviceEnabled(1, true);
-    setDeviceEnabled(2, true);
-    setDeviceEnabled(3, false);
-    setDeviceEnabled(4, false);
+    for (byte i = 0; i < Board::PORT_COUNT; i++) {
+        setDeviceEnabled(i, Board::BOARD.ports[i].enabledByDefault);
+    }
+
+    outageLog.init();
+    clockSyncLog.init();
 
     setBootloaderNodeController(0);
 
@@ -307,40 +340,189 @@ void setThermistorSensorHealth(byte port, byte health)
     EEPROM.write(deviceRegion(port) + EEPROM_PORT_THERMISTOR_HEALTH, health);
 }
 
+static PortConfig portConfigs[DEVICE_COUNT];
+
+void getDefaultPortConfig(byte port, PortConfig &config)
+{
+    const Board::PortDescriptor &desc = Board::BOARD.ports[port];
+
+    // these are "sensible" levels for the devices we ship with.
+    config.currentLow = desc.currentLow;
+    config.currentNormal = desc.currentNormal;
+    config.currentStressed = desc.currentStressed;
+    config.faultCurrent = desc.faultCurrent;
+
+    config.faultTimeout = 15000L;           // 15 seconds
+    config.heartbeatTimeout = 0;            // use default
+    config.bootHeartbeatTimeout = 0;        // learn from boot durations
+    config.unmanagedChangeTime = 14400000L; // 4 hours
+    config.stopTimeout = 60000L;            // 60 seconds
+}
+
+static bool validTimeout(unsigned long timeout, unsigned long lo, unsigned long hi)
+{
+    return lo <= timeout && timeout <= hi;
+}
+
+static bool validHeartbeatTimeout(unsigned long timeout)
+{
+    // 0 means no override
+    return timeout == 0 || validTimeout(timeout, 60000L, 86400000L);
+}
+
+bool validPortConfig(const PortConfig &config)
+{
+    return 0 < config.currentLow &&
+           config.currentLow < config.currentNormal &&
+           config.currentNormal < config.currentStressed &&
+           0 < config.faultCurrent &&
+           validTimeout(config.faultTimeout, 1000L, 3600000L) &&
+           validHeartbeatTimeout(config.heartbeatTimeout) &&
+           validHeartbeatTimeout(config.bootHeartbeatTimeout) &&
+           validTimeout(config.unmanagedChangeTime, 600000L, 604800000L) &&
+           validTimeout(config.stopTimeout, 1000L, 600000L);
+}
+
+static byte portConfigChecksum(const PortConfig &config)
+{
+    return Bytes::crc8(&config, sizeof(config));
+}
+
+static void readPortConfig(byte port, PortConfig &config)
+{
+    int region = deviceRegion(port);
+    EEPROM.get(region + EEPROM_PORT_CURRENT_LEVEL_LOW, config.currentLow);
+    EEPROM.get(region + EEPROM_PORT_CURRENT_LEVEL_NORMAL, config.currentNormal);
+    EEPROM.get(region + EEPROM_PORT_CURRENT_LEVEL_STRESSED, config.currentStressed);
+    EEPROM.get(region + EEPROM_PORT_CURRENT_LEVEL_HIGH, config.faultCurrent);
+    EEPROM.get(region + EEPROM_PORT_CURRENT_FAULT_TIMEOUT, config.faultTimeout);
+    EEPROM.get(region + EEPROM_PORT_CURRENT_HEARTBEAT_TIMEOUT, config.heartbeatTimeout);
+    EEPROM.get(region + EEPROM_PORT_BOOT_HEARTBEAT_TIMEOUT, config.bootHeartbeatTimeout);
+    EEPROM.get(region + EEPROM_PORT_UNMANAGED_CHANGE_TIME, config.unmanagedChangeTime);
+    EEPROM.get(region + EEPROM_PORT_STOP_TIMEOUT, config.stopTimeout);
+}
+
+static void writePortConfig(byte port, const PortConfig &config)
+{
+    int region = deviceRegion(port);
+
+    // invalidate checksum first, so a partial write is never loaded.
+    EEPROM.write(region + EEPROM_PORT_CONFIG_CHECKSUM, ~portConfigChecksum(config));
+
+    EEPROM.put(region + EEPROM_PORT_CURRENT_LEVEL_LOW, config.currentLow);
+    EEPROM.put(region + EEPROM_PORT_CURRENT_LEVEL_NORMAL, config.currentNormal);
+    EEPROM.put(region + EEPROM_PORT_CURRENT_LEVEL_STRESSED, config.currentStressed);
+    EEPROM.put(region + EEPROM_PORT_CURRENT_LEVEL_HIGH, config.faultCurrent);
+    EEPROM.put(region + EEPROM_PORT_CURRENT_FAULT_TIMEOUT, config.faultTimeout);
+    EEPROM.put(region + EEPROM_PORT_CURRENT_HEARTBEAT_TIMEOUT, config.heartbeatTimeout);
+    EEPROM.put(region + EEPROM_PORT_BOOT_HEARTBEAT_TIMEOUT, config.bootHeartbeatTimeout);
+    EEPROM.put(region + EEPROM_PORT_UNMANAGED_CHANGE_TIME, config.unmanagedChangeTime);
+    EEPROM.put(region + EEPROM_PORT_STOP_TIMEOUT, config.stopTimeout);
+
+    EEPROM.write(region + EEPROM_PORT_CONFIG_CHECKSUM, portConfigChecksum(config));
+}
+
+bool loadPortConfigs()
+{
+    bool ok = true;
+
+    for (byte port = 0; port < DEVICE_COUNT; port++) {
+        PortConfig config;
+        readPortConfig(port, config);
+
+        byte checksum = EEPROM.read(deviceRegion(port) + EEPROM_PORT_CONFIG_CHECKSUM);
+
+        if (checksum == portConfigChecksum(config) && validPortConfig(config)) {
+            portConfigs[port] = config;
+        } else {
+            // save the defaults, so a board from before the checksum, or with
+            // a corrupt config, only falls back to them once.
+            getDefaultPortConfig(port, portConfigs[port]);
+            writePortConfig(port, portConfigs[port]);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+const PortConfig &getPortConfig(byte port)
+{
+    return portConfigs[port];
+}
+
+bool setPortConfig(byte port, const PortConfig &config)
+{
+    if (!Wagman::validPort(port) || !validPortConfig(config)) {
+        return false;
+    }
+
+    writePortConfig(port, config);
+    portConfigs[port] = config;
+    return true;
+}
+
 int getFaultCurrent(byte port)
 {
-    // these are hardcoded for now to be "sensible" levels.
-    if (port == 0)
-        return 122;
-    if (port == 1)
-        return 122;
-    if (port == 2)
-        return 112;
-    return 10000;
+    return portConfigs[port].faultCurrent;
 }
 
-void setFaultCurrent(byte port, int current)
+bool setFaultCurrent(byte port, int current)
 {
+    if (!Wagman::validPort(port)) {
+        return false;
+    }
+
+    PortConfig config = portConfigs[port];
+    config.faultCurrent = current;
+    return setPortConfig(port, config);
 }
 
 unsigned long getFaultTimeout(byte device)
 {
-    return 15000L; // 15 seconds
+    return portConfigs[device].faultTimeout;
 }
 
 unsigned long getHeartbeatTimeout(byte device)
 {
-    return 60000L; // 60 seconds
+    return portConfigs[device].heartbeatTimeout;
+}
+
+bool setHeartbeatTimeout(byte device, unsigned long timeout)
+{
+    if (!Wagman::validPort(device)) {
+        return false;
+    }
+
+    PortConfig config = portConfigs[device];
+    config.heartbeatTimeout = timeout;
+    return setPortConfig(device, config);
+}
+
+unsigned long getBootHeartbeatTimeout(byte device)
+{
+    return portConfigs[device].bootHeartbeatTimeout;
+}
+
+bool setBootHeartbeatTimeout(byte device, unsigned long timeout)
+{
+    if (!Wagman::validPort(device)) {
+        return false;
+    }
+
+    PortConfig config = portConfigs[device];
+    config.bootHeartbeatTimeout = timeout;
+    return setPortConfig(device, config);
 }
 
 unsigned long getUnmanagedChangeTime(byte device)
 {
-    return 28800000L; // 8 hours
+    return portConfigs[device].unmanagedChangeTime;
 }
 
 unsigned long getStopTimeout(byte device)
 {
-    return 60000L; // 60 seconds
+    return portConfigs[device].stopTimeout;
 }
 
 BootLog::BootLog(unsigned int addr)
@@ -360,7 +542,7 @@ void BootLog::addEntry(time_t time)
     byte count = getCount();
     byte index = (start + count) % capacity;
 
-    EEPROM.put(address + 2 + sizeof(time_t) * index, time);
+    EEPROM.put(address + 2 + EEPROM_TIME_SIZE * index, time);
 
     // if there's no more space, overwrite the oldest entry
     if (count == capacity) {
@@ -382,7 +564,7 @@ time_t BootLog::getEntry(byte i) const
     byte index = (start + i) % capacity;
 
     time_t time;
-    EEPROM.get(address + 2 + sizeof(time_t) * index, time);
+    EEPROM.get(address + 2 + EEPROM_TIME_SIZE * index, time);
     return time;
 }
 
@@ -411,4 +593,241 @@ byte BootLog::getCapacity() const
     return capacity;
 }
 
+BootDurationLog::BootDurationLog(unsigned int addr)
+{
+    address = addr;
+}
+
+void BootDurationLog::init()
+{
+    setStart(0);
+    setCount(0);
+}
+
+void BootDurationLog::addEntry(unsigned int duration)
+{
+    byte start = getStart();
+    byte count = getCount();
+    byte index = (start + count) % capacity;
+
+    if (duration > 65535) {
+        duration = 65535;
+    }
+
+    EEPROM.put(address + 2 + sizeof(uint16_t) * index, (uint16_t)duration);
+
+    // if there's no more space, overwrite the oldest entry
+    if (count == capacity) {
+        setStart((start + 1) % capacity);
+    } else {
+        setCount(count + 1);
+    }
+}
+
+unsigned int BootDurationLog::getEntry(byte i) const
+{
+    byte start = getStart();
+    byte count = getCount();
+
+    if (i >= count) {
+        return 0;
+    }
+
+    byte index = (start + i) % capacity;
+
+    uint16_t duration;
+    EEPROM.get(address + 2 + sizeof(uint16_t) * index, duration);
+    return duration;
+}
+
+byte BootDurationLog::getStart() const
+{
+    return EEPROM.read(address + 0) % capacity;
+}
+
+void BootDurationLog::setStart(byte start)
+{
+    EEPROM.write(address + 0, start);
+}
+
+byte BootDurationLog::getCount() const
+{
+    byte count = EEPROM.read(address + 1);
+
+    // this region was unused before, so treat garbage as an empty log.
+    if (count > capacity) {
+        return 0;
+    }
+
+    return count;
+}
+
+void BootDurationLog::setCount(byte count)
+{
+    EEPROM.write(address + 1, count);
+}
+
+byte BootDurationLog::getCapacity() const
+{
+    return capacity;
+}
+
+OutageLog::OutageLog(unsigned int addr)
+{
+    address = addr;
+}
+
+void OutageLog::init()
+{
+    setStart(0);
+    setCount(0);
+}
+
+void OutageLog::addEntry(time_t start, time_t end)
+{
+    byte head = getStart();
+    byte count = getCount();
+    byte index = (head + count) % capacity;
+
+    EEPROM.put(address + 2 + 2 * EEPROM_TIME_SIZE * index, start);
+    EEPROM.put(address + 2 + 2 * EEPROM_TIME_SIZE * index + EEPROM_TIME_SIZE, end);
+
+    // if there's no more space, overwrite the oldest entry
+    if (count == capacity) {
+        setStart((head + 1) % capacity);
+    } else {
+        setCount(count + 1);
+    }
+}
+
+bool OutageLog::getEntry(byte i, time_t &start, time_t &end) const
+{
+    byte head = getStart();
+    byte count = getCount();
+
+    if (i >= count) {
+        return false;
+    }
+
+    byte index = (head + i) % capacity;
+
+    EEPROM.get(address + 2 + 2 * EEPROM_TIME_SIZE * index, start);
+    EEPROM.get(address + 2 + 2 * EEPROM_TIME_SIZE * index + EEPROM_TIME_SIZE, end);
+    return true;
+}
+
+byte OutageLog::getStart() const
+{
+    return EEPROM.read(address + 0) % capacity;
+}
+
+void OutageLog::setStart(byte start)
+{
+    EEPROM.write(address + 0, start);
+}
+
+byte OutageLog::getCount() const
+{
+    byte count = EEPROM.read(address + 1);
+
+    // this region was unused before, so treat garbage as an empty log.
+    if (count > capacity) {
+        return 0;
+    }
+
+    return count;
+}
+
+void OutageLog::setCount(byte count)
+{
+    EEPROM.write(address + 1, count);
+}
+
+byte OutageLog::getCapacity() const
+{
+    return capacity;
+}
+
+ClockSyncLog::ClockSyncLog(unsigned int addr)
+{
+    address = addr;
+}
+
+void ClockSyncLog::init()
+{
+    setStart(0);
+    setCount(0);
+}
+
+void ClockSyncLog::addEntry(const ClockSync &sync)
+{
+    byte head = getStart();
+    byte count = getCount();
+    byte index = (head + count) % capacity;
+    int addr = address + 2 + CLOCK_SYNC_SIZE * index;
+
+    EEPROM.put(addr + 0, sync.host);
+    EEPROM.put(addr + 4, sync.rtc);
+    EEPROM.write(addr + 8, (byte)sync.trim);
+    EEPROM.write(addr + 9, sync.stepped);
+
+    // if there's no more space, overwrite the oldest entry
+    if (count == capacity) {
+        setStart((head + 1) % capacity);
+    } else {
+        setCount(count + 1);
+    }
+}
+
+bool ClockSyncLog::getEntry(byte i, ClockSync &sync) const
+{
+    byte head = getStart();
+    byte count = getCount();
+
+    if (i >= count) {
+        return false;
+    }
+
+    byte index = (head + i) % capacity;
+    int addr = address + 2 + CLOCK_SYNC_SIZE * index;
+
+    EEPROM.get(addr + 0, sync.host);
+    EEPROM.get(addr + 4, sync.rtc);
+    sync.trim = (int8_t)EEPROM.read(addr + 8);
+    sync.stepped = EEPROM.read(addr + 9) != 0;
+    return true;
+}
+
+byte ClockSyncLog::getStart() const
+{
+    return EEPROM.read(address + 0) % capacity;
+}
+
+void ClockSyncLog::setStart(byte start)
+{
+    EEPROM.write(address + 0, start);
+}
+
+byte ClockSyncLog::getCount() const
+{
+    byte count = EEPROM.read(address + 1);
+
+    // this region was unused before, so treat garbage as an empty log.
+    if (count > capacity) {
+        return 0;
+    }
+
+    return count;
+}
+
+void ClockSyncLog::setCount(byte count)
+{
+    EEPROM.write(address + 1, count);
+}
+
+byte ClockSyncLog::getCapacity() const
+{
+    return capacity;
+}
+
 };
@@ -28,6 +28,32 @@ struct SensorStatus
     Range range;
 };
 
+// Per-port policy parameters. Loaded from EEPROM once at boot, so reading them
+// on the hot path never touches the bus. Timeouts are in ms.
+struct PortConfig
+{
+    // upper bounds of the low, normal and stressed current levels.
+    uint16_t currentLow;
+    uint16_t currentNormal;
+    uint16_t currentStressed;
+    uint16_t faultCurrent;
+
+    unsigned long faultTimeout;
+    unsigned long heartbeatTimeout;
+    unsigned long bootHeartbeatTimeout;
+    unsigned long unmanagedChangeTime;
+    unsigned long stopTimeout;
+};
+
+// A host time sync as seen by the RTC. Used to estimate the RTC drift.
+struct ClockSync
+{
+    time_t host;
+    time_t rtc;     // RTC time when the sync arrived
+    int8_t trim;    // RTC trim in effect since the previous sync
+    bool stepped;   // RTC was set to the host time afterwards
+};
+
 namespace Record
 {
     class BootLog
@@ -55,6 +81,86 @@ namespace Record
 
     extern BootLog bootLogs[5];
 
+    // Ring buffer of the last few times (in seconds) a device took from being
+    // powered on to sending its first heartbeat.
+    class BootDurationLog
+    {
+    public:
+
+        BootDurationLog(unsigned int addr);
+        void init();
+
+        void addEntry(unsigned int duration);
+        unsigned int getEntry(byte i) const;
+
+        byte getCount() const;
+        byte getCapacity() const;
+
+    private:
+
+        byte getStart() const;
+        void setStart(byte start);
+        void setCount(byte count);
+
+        unsigned int address;
+        const byte capacity = 8;
+    };
+
+    extern BootDurationLog bootDurationLogs[5];
+
+    // Ring buffer of the last few power outages latched by the RTC. Times are
+    // only to the minute since that's all the RTC keeps.
+    class OutageLog
+    {
+    public:
+
+        OutageLog(unsigned int addr);
+        void init();
+
+        void addEntry(time_t start, time_t end);
+        bool getEntry(byte i, time_t &start, time_t &end) const;
+
+        byte getCount() const;
+        byte getCapacity() const;
+
+    private:
+
+        byte getStart() const;
+        void setStart(byte start);
+        void setCount(byte count);
+
+        unsigned int address;
+        const byte capacity = 8;
+    };
+
+    extern OutageLog outageLog;
+
+    // Ring buffer of the last few host time syncs.
+    class ClockSyncLog
+    {
+    public:
+
+        ClockSyncLog(unsigned int addr);
+        void init();
+
+        void addEntry(const ClockSync &sync);
+        bool getEntry(byte i, ClockSync &sync) const;
+
+        byte getCount() const;
+        byte getCapacity() const;
+
+    private:
+
+        byte getStart() const;
+        void setStart(byte start);
+        void setCount(byte count);
+
+        unsigned int address;
+        const byte capacity = 8;
+    };
+
+    extern ClockSyncLog clockSyncLog;
+
     bool initialized();
 
     void init();
@@ -97,11 +203,31 @@ namespace Record
     void setBootFailures(byte device, unsigned int failures);
     void incrementBootFailures(byte device);
 
+    // loads all port configs into RAM, falling back to defaults for any which
+    // are missing or invalid and saving them. returns false if any defaults
+    // were used.
+    bool loadPortConfigs();
+
+    void getDefaultPortConfig(byte port, PortConfig &config);
+    bool validPortConfig(const PortConfig &config);
+
+    const PortConfig &getPortConfig(byte port);
+
+    // the setters return false, leaving the config alone, if the port or the
+    // resulting config isn't valid.
+    bool setPortConfig(byte port, const PortConfig &config);
+
     int getFaultCurrent(byte device);
-    void setFaultCurrent(byte device, int current);
+    bool setFaultCurrent(byte device, int current);
 
     unsigned long getFaultTimeout(byte device);
+
+    // operator heartbeat timeout overrides in ms. 0 means learn / use default.
     unsigned long getHeartbeatTimeout(byte device);
+    bool setHeartbeatTimeout(byte device, unsigned long timeout);
+    unsigned long getBootHeartbeatTimeout(byte device);
+    bool setBootHeartbeatTimeout(byte device, unsigned long timeout);
+
     unsigned long getUnmanagedChangeTime(byte device);
     unsigned long getStopTimeout(byte device);
 
@@ -0,0 +1,136 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "ResetAll.h"
+#include "Logger.h"
+#include "Timer.h"
+#include "Wagman.h"
+
+namespace ResetAll {
+
+static byte stage = STAGE_IDLE;
+static byte portsOff = 0;
+static DurationTimer timer;
+static DurationTimer stageTimer;
+
+static void portOff(const Device &device, const char *reason) {
+  portsOff |= (1 << device.port);
+
+  Logger::beginEvent("resetall");
+  Logger::log(device.name);
+  Logger::log(" off after ");
+  Logger::log(timer.elapsed() / 1000);
+  Logger::log("s (");
+  Logger::log(reason);
+  Logger::log(")");
+  Logger::end();
+}
+
+bool start(Device *devices, byte count) {
+  if (stage != STAGE_IDLE) {
+    return false;
+  }
+
+  stage = STAGE_STOPPING;
+  portsOff = 0;
+  timer.reset();
+  stageTimer.reset();
+
+  Logger::beginEvent("resetall");
+  Logger::log("stopping devices");
+  Logger::end();
+
+  for (byte port = 0; port < count; port++) {
+    if (devices[port].getState() == STATE_STARTED) {
+      devices[port].stop();
+    }
+  }
+
+  return true;
+}
+
+bool abort() {
+  if (stage == STAGE_IDLE) {
+    return false;
+  }
+
+  stage = STAGE_IDLE;
+
+  Logger::beginEvent("resetall");
+  Logger::log("aborted");
+  Logger::end();
+  return true;
+}
+
+static void updateStopping(Device *devices, byte count) {
+  bool timedOut = stageTimer.exceeds(STOP_TIMEOUT);
+
+  // at most one relay is switched per pass, since switching one waits on it.
+  for (byte port = 0; port < count; port++) {
+    Device &device = devices[port];
+
+    if (portsOff & (1 << port)) {
+      continue;
+    }
+
+    switch (device.getState()) {
+      case STATE_DISABLED:
+        Wagman::setRelay(port, false);
+        portOff(device, "disabled");
+        return;
+      case STATE_STOPPED:
+        // the device's stop cut its relay, or it was never on.
+        portOff(device, "stopped");
+        break;
+      case STATE_STARTED:
+        // started by a heartbeat since the reset all began.
+        device.stop();
+        break;
+      case STATE_STOPPING:
+        if (timedOut) {
+          device.kill();
+          portOff(device, "timeout");
+          return;
+        }
+        break;
+    }
+  }
+
+  if (portsOff == (1 << count) - 1) {
+    stage = STAGE_SETTLING;
+    stageTimer.reset();
+  }
+}
+
+bool update(Device *devices, byte count) {
+  switch (stage) {
+    case STAGE_STOPPING:
+      updateStopping(devices, count);
+      break;
+    case STAGE_SETTLING:
+      if (stageTimer.exceeds(SETTLE_TIME)) {
+        Logger::beginEvent("resetall");
+        Logger::log("resetting after ");
+        Logger::log(timer.elapsed() / 1000);
+        Logger::log("s");
+        Logger::end();
+        return true;
+      }
+      break;
+  }
+
+  return false;
+}
+
+bool active() { return stage != STAGE_IDLE; }
+
+byte getStage() { return stage; }
+
+unsigned long getElapsed() {
+  return stage != STAGE_IDLE ? timer.elapsed() : 0;
+}
+
+byte getPortsOff() { return portsOff; }
+
+};  // namespace ResetAll
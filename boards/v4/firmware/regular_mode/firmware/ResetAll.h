@@ -0,0 +1,48 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_RESET_ALL__
+#define __H_RESET_ALL__
+
+#include <Arduino.h>
+#include "Device.h"
+
+// Shuts every device down and then resets the whole system, from loop() so
+// commands, heartbeats and telemetry keep being served until the final reset.
+//
+// Each running device is stopped through its usual stop handshake. A port is
+// only cut once its device has finished stopping, or right away if it's
+// disabled, or once STOP_TIMEOUT has passed.
+namespace ResetAll {
+enum {
+  STAGE_IDLE,
+  STAGE_STOPPING,  // waiting for devices to stop
+  STAGE_SETTLING,  // all ports off, waiting before the master reset
+};
+
+const unsigned long STOP_TIMEOUT = 60000L;
+const unsigned long SETTLE_TIME = 20000L;
+
+// stops the running devices. returns false if a reset all is already running.
+bool start(Device *devices, byte count);
+
+// returns false if no reset all is running. devices which were asked to stop
+// still finish stopping.
+bool abort();
+
+// cuts ports whose devices are done. returns true once the system should be
+// reset.
+bool update(Device *devices, byte count);
+
+bool active();
+byte getStage();
+
+// ms since the reset all started.
+unsigned long getElapsed();
+
+// mask of ports turned off so far.
+byte getPortsOff();
+};  // namespace ResetAll
+
+#endif
@@ -0,0 +1,195 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "SoftClock.h"
+#include "MCP79412RTC.h"
+#include "Timer.h"
+#include "Wagman.h"
+
+// drift is only estimated once the RTC and millis() have been compared over
+// at least this long, since the RTC only has one second resolution.
+static const unsigned long MIN_DRIFT_BASELINE = 21600000L;  // 6 hours
+static const unsigned long MAX_DRIFT_BASELINE = 86400000L;  // 1 day
+static const long MAX_DRIFT_PPM = 1000;
+
+// the clock is epoch milliseconds at baseMillis plus the elapsed millis()
+// corrected by the drift and slew rates.
+static unsigned long long baseEpochMillis = 0;
+static unsigned long baseMillis = 0;
+static long driftPPM = 0;
+static bool driftEstimated = false;
+static long slewPPM = 0;
+
+// RTC reading and millis() at the start of the drift baseline.
+static time_t anchorTime = 0;
+static unsigned long anchorMillis = 0;
+
+static bool isSynced = false;
+static unsigned long syncInterval = SoftClock::DEFAULT_SYNC_INTERVAL;
+static DurationTimer syncTimer;
+static long lastOffset = 0;
+static unsigned long syncCount = 0;
+static unsigned long stepCount = 0;
+
+namespace SoftClock {
+
+unsigned long long nowMillis() {
+  unsigned long elapsed = millis() - baseMillis;
+  long long correction = (long long)elapsed * (slewPPM - driftPPM) / 1000000;
+  return baseEpochMillis + elapsed + correction;
+}
+
+time_t now() {
+  if (!isSynced) {
+    return 0;
+  }
+
+  return nowMillis() / 1000;
+}
+
+// moves the base to now so rate changes only apply from now on. this also
+// keeps the elapsed time small so the correction can't overflow.
+static void rebase() {
+  baseEpochMillis = nowMillis();
+  baseMillis = millis();
+}
+
+static void step(time_t time) {
+  // the RTC only counts whole seconds, so the true time is on average half a
+  // second past what it reads.
+  baseEpochMillis = (unsigned long long)time * 1000 + 500;
+  baseMillis = millis();
+  slewPPM = 0;
+  anchorTime = time;
+  anchorMillis = baseMillis;
+}
+
+static void estimateDrift(time_t time, unsigned long ms) {
+  unsigned long baseline = ms - anchorMillis;
+
+  if (baseline < MIN_DRIFT_BASELINE) {
+    return;
+  }
+
+  long long rtcElapsed = ((long long)time - (long long)anchorTime) * 1000;
+  long long ppm = ((long long)baseline - rtcElapsed) * 1000000 / baseline;
+
+  if (ppm > MAX_DRIFT_PPM) {
+    ppm = MAX_DRIFT_PPM;
+  } else if (ppm < -MAX_DRIFT_PPM) {
+    ppm = -MAX_DRIFT_PPM;
+  }
+
+  // the first estimate is taken as is. later ones are smoothed.
+  if (!driftEstimated) {
+    driftPPM = ppm;
+    driftEstimated = true;
+  } else {
+    driftPPM = (3 * driftPPM + ppm) / 4;
+  }
+
+  // restart the baseline before millis() can wrap around.
+  if (baseline > MAX_DRIFT_BASELINE) {
+    anchorTime = time;
+    anchorMillis = ms;
+  }
+}
+
+void sync() {
+  syncTimer.reset();
+  rebase();
+
+  if (!Wagman::getWireEnabled()) {
+    return;
+  }
+
+  // get() returns 0 when the I2C read fails, which would step the clock back
+  // to 1970. on a failed read the clock keeps free running and the drift
+  // baseline is left alone until the next sync.
+  tmElements_t tm;
+
+  if (!Wagman::Clock.read(tm)) {
+    return;
+  }
+
+  time_t time = makeTime(tm);
+  unsigned long ms = millis();
+  syncCount++;
+
+  if (!isSynced) {
+    step(time);
+    isSynced = true;
+    lastOffset = 0;
+    return;
+  }
+
+  long long offset = (long long)time * 1000 + 500 - (long long)nowMillis();
+  lastOffset = offset;
+
+  if (offset > (long long)STEP_THRESHOLD ||
+      offset < -(long long)STEP_THRESHOLD) {
+    step(time);
+    stepCount++;
+    return;
+  }
+
+  estimateDrift(time, ms);
+
+  // within the RTC's resolution there's nothing to correct.
+  if (offset > -500 && offset < 500) {
+    slewPPM = 0;
+    return;
+  }
+
+  long long slew = offset * 1000000 / (long long)syncInterval;
+
+  if (slew > MAX_SLEW_PPM) {
+    slew = MAX_SLEW_PPM;
+  } else if (slew < -MAX_SLEW_PPM) {
+    slew = -MAX_SLEW_PPM;
+  }
+
+  slewPPM = slew;
+}
+
+void init() {
+  isSynced = false;
+  sync();
+}
+
+void update() {
+  if (syncTimer.exceeds(syncInterval)) {
+    sync();
+  }
+}
+
+void set(time_t time) {
+  isSynced = true;
+  step(time);
+  stepCount++;
+  syncTimer.reset();
+}
+
+bool synced() { return isSynced; }
+
+unsigned long getSyncInterval() { return syncInterval; }
+
+bool setSyncInterval(unsigned long interval) {
+  if (interval < MIN_SYNC_INTERVAL || interval > MAX_SYNC_INTERVAL) {
+    return false;
+  }
+
+  syncInterval = interval;
+  return true;
+}
+
+long getDriftPPM() { return driftPPM; }
+
+long getLastOffset() { return lastOffset; }
+
+unsigned long getSyncCount() { return syncCount; }
+
+unsigned long getStepCount() { return stepCount; }
+
+};  // namespace SoftClock
@@ -0,0 +1,59 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_SOFTCLOCK__
+#define __H_SOFTCLOCK__
+
+#include <Arduino.h>
+#include "Time.h"
+
+// Software clock which runs off millis() and is periodically disciplined
+// against the RTC. Reading the time never touches the I2C bus.
+//
+// On each sync the clock estimates the drift of the local oscillator relative
+// to the RTC and corrects for it. Small offsets are slewed out over the next
+// sync interval so time never jumps. Offsets larger than STEP_THRESHOLD, for
+// example after the RTC is set, are stepped.
+namespace SoftClock {
+const unsigned long DEFAULT_SYNC_INTERVAL = 600000L;  // 10 minutes
+const unsigned long MIN_SYNC_INTERVAL = 10000L;
+const unsigned long MAX_SYNC_INTERVAL = 86400000L;
+const unsigned long STEP_THRESHOLD = 2000L;
+const long MAX_SLEW_PPM = 500;
+
+// reads the RTC and starts the clock from it. call once the bus is up.
+void init();
+
+// syncs against the RTC if the sync interval has passed.
+void update();
+
+// forces a sync against the RTC now. if the RTC can't be read the clock keeps
+// free running, and it isn't counted as a sync.
+void sync();
+
+// steps the clock to the given time. used after the RTC itself was set.
+void set(time_t time);
+
+// true once the clock has been synced to the RTC at least once.
+bool synced();
+
+time_t now();
+unsigned long long nowMillis();
+
+unsigned long getSyncInterval();
+bool setSyncInterval(unsigned long interval);
+
+// estimated drift of the local oscillator relative to the RTC. positive means
+// millis() runs fast.
+long getDriftPPM();
+
+// offset from the RTC seen at the last sync in ms. positive means the RTC was
+// ahead.
+long getLastOffset();
+
+unsigned long getSyncCount();
+unsigned long getStepCount();
+};  // namespace SoftClock
+
+#endif
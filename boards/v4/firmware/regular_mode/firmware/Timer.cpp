@@ -9,6 +9,10 @@ void DurationTimer::reset() {
     start = millis();
 }
 
+void DurationTimer::resetAgo(unsigned long elapsed) {
+    start = millis() - elapsed;
+}
+
 unsigned long DurationTimer::elapsed() const {
     return millis() - start;
 }
@@ -16,6 +16,8 @@ class DurationTimer
     public:
 
         void reset();
+        // restarts the timer as if it was reset elapsed ms ago.
+        void resetAgo(unsigned long elapsed);
         unsigned long elapsed() const;
         bool exceeds(unsigned long time) const;
 
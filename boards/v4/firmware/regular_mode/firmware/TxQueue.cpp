@@ -0,0 +1,69 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include "TxQueue.h"
+
+TxQueue::TxQueue()
+    : readPos(0),
+      commitPos(0),
+      writePos(0),
+      overflow(false),
+      highWater(0),
+      droppedFrames(0) {}
+
+int TxQueue::write(const byte *s, int n) {
+  for (int i = 0; i < n; i++) {
+    byte c = s[i];
+
+    if (!overflow) {
+      if (writePos - readPos < CAPACITY) {
+        buffer[writePos % CAPACITY] = c;
+        writePos++;
+      } else {
+        // discard the partial frame and skip the rest of it.
+        writePos = commitPos;
+        overflow = true;
+      }
+    }
+
+    if (c == '\n') {
+      if (overflow) {
+        overflow = false;
+        droppedFrames++;
+      } else {
+        commitPos = writePos;
+
+        if (commitPos - readPos > highWater) {
+          highWater = commitPos - readPos;
+        }
+      }
+    }
+  }
+
+  // report everything as written so encoders don't treat a drop as an error.
+  return n;
+}
+
+void TxQueue::writeFrame(const byte *s, unsigned int n) {
+  if (writePos - readPos + n > CAPACITY) {
+    droppedFrames++;
+    return;
+  }
+
+  // move the frame being written up to make room.
+  for (unsigned int pos = writePos; pos != commitPos; pos--) {
+    buffer[(pos - 1 + n) % CAPACITY] = buffer[(pos - 1) % CAPACITY];
+  }
+
+  for (unsigned int i = 0; i < n; i++) {
+    buffer[(commitPos + i) % CAPACITY] = s[i];
+  }
+
+  commitPos += n;
+  writePos += n;
+
+  if (commitPos - readPos > highWater) {
+    highWater = commitPos - readPos;
+  }
+}
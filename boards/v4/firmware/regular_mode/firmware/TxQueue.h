@@ -0,0 +1,76 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_TXQUEUE__
+#define __H_TXQUEUE__
+
+#include <Arduino.h>
+#include "waggle.h"
+
+// TxQueue buffers newline terminated frames going out a serial port and hands
+// them to the port as it frees space. Frames are only queued whole: if one
+// doesn't fit, all of it is dropped and counted instead of being cut off.
+class TxQueue : public writer {
+ public:
+  static const unsigned int CAPACITY = 1024;  // must be a power of 2
+
+  TxQueue();
+
+  int write(const byte *s, int n);
+
+  // queues a complete, newline terminated frame ahead of any frame still
+  // being written, so it can be sent from the middle of another one.
+  void writeFrame(const byte *s, unsigned int n);
+
+  // writes as many queued bytes as the stream can currently accept.
+  template <class streamT>
+  void drain(streamT &stream) {
+    while (readPos != commitPos) {
+      int room = stream.availableForWrite();
+
+      if (room <= 0) {
+        return;
+      }
+
+      unsigned int start = readPos % CAPACITY;
+      unsigned int n = commitPos - readPos;
+
+      // only write up to the end of the ring in one go.
+      if (n > CAPACITY - start) {
+        n = CAPACITY - start;
+      }
+
+      if (n > (unsigned int)room) {
+        n = room;
+      }
+
+      int sent = stream.write(buffer + start, n);
+
+      if (sent <= 0) {
+        return;
+      }
+
+      readPos += sent;
+    }
+  }
+
+  unsigned int pending() const { return writePos - readPos; }
+  unsigned int getHighWater() const { return highWater; }
+  unsigned long getDroppedFrames() const { return droppedFrames; }
+
+ private:
+  byte buffer[CAPACITY];
+
+  // free running positions. only their differences and values mod CAPACITY
+  // are meaningful.
+  unsigned int readPos;    // next byte to send
+  unsigned int commitPos;  // end of last complete frame
+  unsigned int writePos;   // end of frame being written
+
+  bool overflow;  // frame being written didn't fit and is being discarded
+  unsigned int highWater;
+  unsigned long droppedFrames;
+};
+
+#endif
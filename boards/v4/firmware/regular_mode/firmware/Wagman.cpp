@@ -21,46 +21,15 @@ o o o o o o
 #include <Arduino.h>
 #include <Wire.h>
 
-#include <array>
-
+#include "Board.h"
 #include "HTU21D.h"
 #include "MCP342X.h"
 #include "MCP79412RTC.h"
 #include "Record.h"
+#include "SoftClock.h"
 
-static const byte PORT_COUNT = 5;
-static const byte BOOT_SELECTOR_COUNT = 2;
-std::array<byte, 9> LED_PINS = {12, 11, 2, 3, 5, 6, 7, 8, 9};
-
-struct RelayConfig {
-  int clk;
-  int d;
-};
-
-const RelayConfig relayConfigs[PORT_COUNT] = {
-    {.clk = 33, .d = 34}, {.clk = 35, .d = 36}, {.clk = 37, .d = 38},
-    {.clk = 39, .d = 40}, {.clk = 45, .d = 46},
-};
-
-static const byte THERMISTOR_0_PIN = A0;
-static const byte THERMISTOR_CHANNELS[] = {
-    0,
-    MCP342X::CHANNEL_0,
-    MCP342X::CHANNEL_1,
-    MCP342X::CHANNEL_2,
-    MCP342X::CHANNEL_3,
-};
-
-const int voltagePins[5] = {A1, A3, A5, A7, A9};
-const int thermistorPins[5] = {A0, A2, A4, A6, A8};
-const int photoresistorPin = A10;
-
-static const byte SYSTEM_CURRENT_ADDRESS = 0x60;
-
-static const byte PORT_CURRENT_ADDRESS[PORT_COUNT] = {0x62, 0x68, 0x6A, 0x63,
-                                                      0x6B};
-
-static const byte BOOT_SELECTOR_PINS[BOOT_SELECTOR_COUNT] = {41, 47};
+using Board::BOARD;
+using Board::PORT_COUNT;
 
 static HTU21D htu21d;
 static MCP342X mcp3428[2];
@@ -69,6 +38,11 @@ static bool wireEnabled = true;
 
 unsigned int heartbeatCounters[5] = {0, 0, 0, 0, 0};
 
+static const unsigned long ENVIRONMENT_SAMPLE_INTERVAL = 10000L;
+
+static SensorSample sample;
+static bool environmentSampled = false;
+
 namespace Wagman {
 
 unsigned int getVoltage(int port) {
@@ -76,7 +50,7 @@ unsigned int getVoltage(int port) {
     return 0;
   }
 
-  return analogRead(voltagePins[port]);
+  return analogRead(BOARD.ports[port].voltagePin);
 }
 
 unsigned int getThermistor(int port) {
@@ -84,16 +58,16 @@ unsigned int getThermistor(int port) {
     return 0;
   }
 
-  return analogRead(thermistorPins[port]);
+  return analogRead(BOARD.ports[port].thermistorPin);
 }
 
 bool getLight(unsigned int *raw) {
-  *raw = analogRead(photoresistorPin);
+  *raw = analogRead(BOARD.photoresistorPin);
   return true;
 }
 
 void setLEDs(int mode) {
-  for (auto pin : LED_PINS) {
+  for (auto pin : BOARD.ledPins) {
     pinMode(pin, OUTPUT);
     digitalWrite(pin, mode);
   }
@@ -112,8 +86,8 @@ void setLEDAnalog(byte led, int level) {
     level = 255;
   }
 
-  pinMode(LED_PINS[led], OUTPUT);
-  analogWrite(LED_PINS[led], level);
+  pinMode(BOARD.ledPins[led], OUTPUT);
+  analogWrite(BOARD.ledPins[led], level);
 }
 
 void setLED(byte led, bool on) {
@@ -121,40 +95,38 @@ void setLED(byte led, bool on) {
     return;
   }
 
-  pinMode(LED_PINS[led], OUTPUT);
-  digitalWrite(LED_PINS[led], on ? HIGH : LOW);
+  pinMode(BOARD.ledPins[led], OUTPUT);
+  digitalWrite(BOARD.ledPins[led], on ? HIGH : LOW);
 }
 
 bool getLED(byte led) {
   if (!validLED(led)) return false;
 
-  return digitalRead(LED_PINS[led]) == HIGH;
+  return digitalRead(BOARD.ledPins[led]) == HIGH;
 }
 
 void toggleLED(byte led) { setLED(led, !getLED(led)); }
 
-#define NC_AUTO_DISABLE 48
-
 void init() {
   // TODO Confirm this is what we want. Maybe only set this once we're toggling
   // NC relay?
-  pinMode(NC_AUTO_DISABLE, OUTPUT);
-  digitalWrite(NC_AUTO_DISABLE, LOW);
+  pinMode(BOARD.ncAutoDisablePin, OUTPUT);
+  digitalWrite(BOARD.ncAutoDisablePin, LOW);
 
   analogReadResolution(12);
 
-  for (auto pin : LED_PINS) {
+  for (auto pin : BOARD.ledPins) {
     pinMode(pin, OUTPUT);
   }
 
   for (int i = 0; i < PORT_COUNT; i++) {
-    pinMode(relayConfigs[i].clk, OUTPUT);
-    pinMode(relayConfigs[i].d, OUTPUT);
+    pinMode(BOARD.ports[i].relayClk, OUTPUT);
+    pinMode(BOARD.ports[i].relayData, OUTPUT);
     heartbeatCounters[i] = 0;
   }
 
-  for (int i = 0; i < BOOT_SELECTOR_COUNT; i++) {
-    pinMode(BOOT_SELECTOR_PINS[i], OUTPUT);
+  for (auto pin : BOARD.bootSelectorPins) {
+    pinMode(pin, OUTPUT);
   }
 
   wireEnabled = Record::getWireEnabled();
@@ -206,31 +178,72 @@ void setRelay(int port, int mode) {
     return;
   }
 
-  setLatchedRelay(relayConfigs[port].clk, relayConfigs[port].d, mode);
+  setLatchedRelay(BOARD.ports[port].relayClk, BOARD.ports[port].relayData,
+                  mode);
+}
+
+// the relay latch only needs its data set up before the clock edge. the long
+// delays in setLatchedRelay are margin which shedding can't afford.
+void shedRelay(int port) {
+  if (!validPort(port)) {
+    return;
+  }
+
+  const Board::PortDescriptor &desc = BOARD.ports[port];
+
+  pinMode(desc.relayClk, OUTPUT);
+  pinMode(desc.relayData, OUTPUT);
+
+  digitalWrite(desc.relayClk, LOW);
+  digitalWrite(desc.relayData, LOW);
+  delayMicroseconds(50);
+  digitalWrite(desc.relayClk, HIGH);
+  delayMicroseconds(50);
+  digitalWrite(desc.relayClk, LOW);
+}
+
+// whether an ADC conversion or a transfer which waits in delay() is under way.
+// a fast reading of the system current from yield() would cut it short, so it
+// waits until it's done.
+static bool wireBusy = false;
+
+static unsigned int convert(MCP342X &adc, byte channel, byte gain,
+                            byte rate = MCP342X::RATE_15SPS) {
+  wireBusy = true;
+  adc.selectChannel(channel, gain, rate);
+  unsigned int counts = adc.readADC(rate);
+  wireBusy = false;
+  return counts;
 }
 
 //
 // Gets the current drawn by the entire system.
 //
 unsigned int getCurrent() {
-  mcp3428[0].selectChannel(MCP342X::CHANNEL_0, MCP342X::GAIN_1);
   // return mcp3428[0].readADC() >> 5;
-  return mcp3428[0].readADC();
+  return convert(mcp3428[0], MCP342X::CHANNEL_0, MCP342X::GAIN_1);
 }
 
-struct CurrentADCConfig {
-  int device;
-  int channel;
-  int gain;
-};
+// reads the system current at 12 bits, which takes about 5 ms instead of 80,
+// scaled to the counts of the 16 bit reading. negative readings are sign
+// extended, so they're taken as none.
+bool sampleFastCurrent() {
+  if (wireBusy) {
+    return false;
+  }
+
+  unsigned int counts = convert(mcp3428[0], MCP342X::CHANNEL_0,
+                                MCP342X::GAIN_1, MCP342X::RATE_240SPS);
 
-CurrentADCConfig currentADCConfigs[] = {
-    {0, MCP342X::CHANNEL_3, MCP342X::GAIN_1},
-    {0, MCP342X::CHANNEL_1, MCP342X::GAIN_1},
-    {0, MCP342X::CHANNEL_2, MCP342X::GAIN_1},
-    {1, MCP342X::CHANNEL_0, MCP342X::GAIN_1},
-    {1, MCP342X::CHANNEL_3, MCP342X::GAIN_1},
-};
+  sample.fastCurrent = (counts <= 0x7ff) ? counts << 4 : 0;
+  sample.fastCurrentMillis = millis();
+  return true;
+}
+
+static unsigned int readPortCurrent(const Board::PortDescriptor &desc) {
+  return convert(mcp3428[desc.currentADC], desc.currentChannel,
+                 desc.currentGain);
+}
 
 //
 // Gets the current drawn by a particular port.
@@ -240,12 +253,7 @@ unsigned int getCurrent(byte port) {
     return 0;
   }
 
-  int device = currentADCConfigs[port].device;
-  int channel = currentADCConfigs[port].channel;
-  int gain = currentADCConfigs[port].gain;
-
-  mcp3428[device].selectChannel(channel, gain);
-  return mcp3428[device].readADC();
+  return readPortCurrent(BOARD.ports[port]);
 }
 
 bool getHumidity(unsigned int *raw, float *hrf) {
@@ -253,7 +261,10 @@ bool getHumidity(unsigned int *raw, float *hrf) {
     return false;
   }
 
-  return htu21d.readHumidity(raw, hrf);
+  wireBusy = true;
+  bool ok = htu21d.readHumidity(raw, hrf);
+  wireBusy = false;
+  return ok;
 }
 
 bool getTemperature(unsigned int *raw, float *hrf) {
@@ -261,13 +272,16 @@ bool getTemperature(unsigned int *raw, float *hrf) {
     return false;
   }
 
-  return htu21d.readTemperature(raw, hrf);
+  wireBusy = true;
+  bool ok = htu21d.readTemperature(raw, hrf);
+  wireBusy = false;
+  return ok;
 }
 
 byte getBootMedia(byte selector) {
   if (!validBootSelector(selector)) return MEDIA_INVALID;
 
-  switch (digitalRead(BOOT_SELECTOR_PINS[selector])) {
+  switch (digitalRead(BOARD.bootSelectorPins[selector])) {
     case LOW:
       return MEDIA_SD;
     case HIGH:
@@ -282,10 +296,10 @@ void setBootMedia(byte selector, byte media) {
 
   switch (media) {
     case MEDIA_SD:
-      digitalWrite(BOOT_SELECTOR_PINS[selector], LOW);
+      digitalWrite(BOARD.bootSelectorPins[selector], LOW);
       break;
     case MEDIA_EMMC:
-      digitalWrite(BOOT_SELECTOR_PINS[selector], HIGH);
+      digitalWrite(BOARD.bootSelectorPins[selector], HIGH);
       break;
   }
 }
@@ -300,20 +314,18 @@ void toggleBootMedia(byte selector) {
 
 bool validPort(byte port) { return port < PORT_COUNT; }
 
-bool validLED(byte led) { return led < LED_PINS.size(); }
+bool validLED(byte led) { return led < Board::LED_COUNT; }
 
-bool validBootSelector(byte selector) { return selector < BOOT_SELECTOR_COUNT; }
+bool validBootSelector(byte selector) {
+  return selector < Board::BOOT_SELECTOR_COUNT;
+}
 
-unsigned int getAddressCurrent(byte addr) {
+static unsigned int readAddressCurrent(byte addr) {
   static const unsigned int MILLIAMPS_PER_STEP = 16;
   byte csb, lsb;
   byte attempts;
   byte timeout;
 
-  if (!getWireEnabled()) {
-    return 0;
-  }
-
   for (attempts = 0; attempts < 10; attempts++) {
     /* request data from sensor */
     Wire.beginTransmission(addr);
@@ -354,25 +366,94 @@ unsigned int getAddressCurrent(byte addr) {
   return 0; /* return error value */
 }
 
-void getTime(time_t &time) {
-  if (getWireEnabled()) {
-    time = Wagman::Clock.get();
-  } else {
-    time = 0;
+unsigned int getAddressCurrent(byte addr) {
+  if (!getWireEnabled()) {
+    return 0;
+  }
+
+  wireBusy = true;
+  unsigned int current = readAddressCurrent(addr);
+  wireBusy = false;
+  return current;
+}
+
+static void sampleEnvironment() {
+  float hrf;
+
+  sample.environmentOK = getTemperature(&sample.temperature, &hrf) &&
+                         getHumidity(&sample.humidity, &hrf);
+
+  sample.environmentMillis = millis();
+}
+
+// samples ports [port, PORT_COUNT). unrolled at compile time so each port's
+// ADC channel and analog pins are constants.
+template <byte port>
+static void samplePorts() {
+  constexpr const Board::PortDescriptor &desc = Board::portDescriptor<port>();
+
+  sample.ports[port].current = readPortCurrent(desc);
+  sampleFastCurrent();
+  sample.ports[port].voltage = analogRead(desc.voltagePin);
+  sample.ports[port].thermistor = analogRead(desc.thermistorPin);
+  samplePorts<port + 1>();
+}
+
+template <>
+void samplePorts<PORT_COUNT>() {}
+
+void sampleSensors() {
+  sampleFastCurrent();
+  sample.systemCurrent = getCurrent();
+  sampleFastCurrent();
+  samplePorts<0>();
+
+  sample.sampleMillis = millis();
+
+  if (!environmentSampled ||
+      sample.sampleMillis - sample.environmentMillis >
+          ENVIRONMENT_SAMPLE_INTERVAL) {
+    sampleEnvironment();
+    environmentSampled = true;
   }
 }
 
+const SensorSample &getSample() { return sample; }
+
+bool portIdle(byte port) {
+  if (!validPort(port)) {
+    return false;
+  }
+
+  unsigned int current = sample.ports[port].current;
+  return current != 0 && current < BOARD.ports[port].poweredCurrent;
+}
+
+bool portPowered(byte port) {
+  if (!validPort(port)) {
+    return false;
+  }
+
+  return sample.ports[port].current >= BOARD.ports[port].poweredCurrent;
+}
+
+// Gets the time from the software clock, which is disciplined against the RTC
+// but doesn't read it. 0 if the RTC has never been read.
+void getTime(time_t &time) { time = SoftClock::now(); }
+
 void setTime(const time_t &time) {
   if (getWireEnabled()) {
     Wagman::Clock.set(time);
   }
+
+  SoftClock::set(time);
 }
 
 void getDateTime(DateTime &dt) {
-  if (getWireEnabled()) {
+  if (SoftClock::synced()) {
     tmElements_t tm;
 
-    Wagman::Clock.read(tm);
+    breakTime(SoftClock::now(), tm);
 
     dt.year = tm.Year + 1970;
     dt.month = tm.Month;
@@ -391,18 +472,16 @@ void getDateTime(DateTime &dt) {
 }
 
 void setDateTime(const DateTime &dt) {
-  if (getWireEnabled()) {
-    tmElements_t tm;
+  tmElements_t tm;
 
-    tm.Year = dt.year - 1970;
-    tm.Month = dt.month;
-    tm.Day = dt.day;
-    tm.Hour = dt.hour;
-    tm.Minute = dt.minute;
-    tm.Second = dt.second;
+  tm.Year = dt.year - 1970;
+  tm.Month = dt.month;
+  tm.Day = dt.day;
+  tm.Hour = dt.hour;
+  tm.Minute = dt.minute;
+  tm.Second = dt.second;
 
-    Wagman::Clock.set(makeTime(tm));
-  }
+  setTime(makeTime(tm));
 }
 
 void setWireEnabled(bool enabled) {
@@ -422,4 +501,12 @@ void getID(byte id[8]) {
   }
 }
 
+bool getPowerFail(time_t &powerDown, time_t &powerUp) {
+  if (!getWireEnabled()) {
+    return false;
+  }
+
+  return Wagman::Clock.powerFail(&powerDown, &powerUp);
+}
+
 };  // namespace Wagman
@@ -20,6 +20,30 @@ const byte RELAY_TURNING_OFF = 3;
 extern unsigned int heartbeatCounters[5];
 extern DurationTimer startTimer;
 
+struct PortSample {
+  unsigned int current;
+  unsigned int voltage;
+  unsigned int thermistor;
+};
+
+// Most recent sensor readings. Ports are sampled every loop and the slower I2C
+// environment sensor is sampled every few seconds.
+struct SensorSample {
+  unsigned long sampleMillis;
+  unsigned int systemCurrent;
+  PortSample ports[5];
+
+  // 12 bit readings of the system current in the same counts, taken around
+  // each of the loop's ADC conversions and by load shedding between them.
+  unsigned int fastCurrent;
+  unsigned long fastCurrentMillis;
+
+  bool environmentOK;
+  unsigned int temperature;
+  unsigned int humidity;
+  unsigned long environmentMillis;
+};
+
 struct DateTime {
   uint16_t year;
   uint8_t month;
@@ -34,6 +58,10 @@ void init();
 
 void setRelay(int port, int mode);
 
+// latches a port's relay off in well under a millisecond, for shedding load.
+// unlike setRelay it never calls delay(), so it's safe to call from yield().
+void shedRelay(int port);
+
 unsigned int getCurrent();
 unsigned int getCurrent(byte port);
 unsigned int getAddressCurrent(byte addr);
@@ -57,10 +85,21 @@ void toggleBootMedia(byte selector);
 
 void getID(byte id[8]);
 
+// reads and clears the power outage latched by the RTC. returns false if there
+// wasn't one.
+bool getPowerFail(time_t &powerDown, time_t &powerUp);
+
 bool validPort(byte port);
 bool validLED(byte led);
 bool validBootSelector(byte selector);
 
+void sampleSensors();
+const SensorSample &getSample();
+
+// takes a fast reading of the system current into the sample, unless an ADC
+// conversion is under way. returns whether it did.
+bool sampleFastCurrent();
+
 void getTime(time_t &time);
 void setTime(const time_t &time);
 
@@ -69,6 +108,13 @@ void setDateTime(const DateTime &dt);
 
 void deviceKilled(Device &device);
 
+// true once a port's current is below the powered level. a reading of 0 is a
+// sensor error, so it doesn't count.
+bool portIdle(byte port);
+
+// true while a port's current is at or above the powered level.
+bool portPowered(byte port);
+
 void setWireEnabled(bool enabled);
 bool getWireEnabled();
 };  // namespace Wagman
@@ -5,14 +5,27 @@
 #include <SD.h>
 #include <SPI.h>
 
+#include "Anomaly.h"
+#include "Board.h"
+#include "Checkpoint.h"
+#include "ClockTrim.h"
+#include "CommandStats.h"
 #include "Device.h"
 #include "DueTimer.h"
 #include "EEPROM.h"
+#include "Energy.h"
 #include "Error.h"
+#include "History.h"
+#include "LoadShed.h"
 #include "Logger.h"
 #include "MCP79412RTC.h"
+#include "Memory.h"
+#include "Profiler.h"
 #include "Record.h"
+#include "ResetAll.h"
+#include "SoftClock.h"
 #include "Timer.h"
+#include "TxQueue.h"
 #include "Wagman.h"
 #include "buildinfo.cpp"
 #include "commands.h"
@@ -45,12 +58,16 @@ void watchdogSetup() {
 // bus. write small test case for this.
 
 void setupDevices();
+void adoptRunningDevices(bool powerFailed);
+void staggerDeviceStarts();
 void checkSensors();
 void checkCurrentSensors();
 void checkThermistors();
 unsigned long meanBootDelta(const Record::BootLog &bootLog, byte maxSamples);
 
-static const byte DEVICE_COUNT = 5;
+using Board::BOARD;
+
+static const byte DEVICE_COUNT = Board::PORT_COUNT;
 static const byte BUFFER_SIZE = 80;
 static const byte MAX_ARGC = 8;
 
@@ -59,6 +76,7 @@ bool shouldResetSystem = false;
 unsigned long shouldResetTimeout = 0;
 DurationTimer shouldResetTimer;
 bool logging = false;
+bool logEvents = true;
 byte deviceWantsStart = 255;
 
 Device devices[DEVICE_COUNT];
@@ -68,23 +86,84 @@ static DurationTimer statusTimer;
 
 static time_t setupTime;
 
-template <class streamT>
-struct stream_writer : public writer {
-  streamT &stream;
+// outages shorter than this (in seconds) are treated as brownouts, so the power
+// on self test is skipped.
+static const unsigned long BROWNOUT_DURATION = 300;
+
+// after outages longer than this (in seconds), devices other than the node
+// controller are held back by up to MAX_OUTAGE_STAGGER ms so the nodes at a
+// site don't all power up together.
+static const unsigned long LONG_OUTAGE_DURATION = 3600;
+static const unsigned long MAX_OUTAGE_STAGGER = 600000L;
+
+// serial links which can receive pushed telemetry. indexed in the order
+// they're polled in loop().
+enum {
+  LINK_SERIALUSB,
+  LINK_SERIAL1,
+  LINK_SERIAL2,
+  LINK_SERIAL3,
+  LINK_SERIAL,
+  LINK_COUNT,
+};
 
-  stream_writer(streamT &stream) : stream(stream) {}
+// metric groups which can be subscribed to. a subscription mask uses bit
+// (1 << group).
+enum {
+  GROUP_CURRENT,
+  GROUP_VOLTAGE,
+  GROUP_THERMISTOR,
+  GROUP_HEARTBEAT,
+  GROUP_STATE,
+  GROUP_ENVIRONMENT,
+  GROUP_ANOMALY,
+  GROUP_COUNT,
+};
 
-  int write(const byte *s, int n) {
-    int maxn = stream.availableForWrite();
+static const byte GROUP_MAX_VALUES = 6;
 
-    if (n > maxn) {
-      n = maxn;
-    }
+// lower bound on how often a single link may be pushed to.
+static const unsigned long SUBSCRIPTION_MIN_INTERVAL = 100;
 
-    return stream.write(s, n);
-  }
+struct Subscription {
+  unsigned long period;    // push every period ms. 0 disables.
+  unsigned int threshold;  // push when a value moves by threshold. 0 disables.
+  DurationTimer timer;
+  byte count;  // number of values last pushed. 0 until first push.
+  unsigned int values[GROUP_MAX_VALUES];
+};
+
+struct LinkSubscriptions {
+  unsigned long minInterval;
+  DurationTimer timer;
+  Subscription groups[GROUP_COUNT];
+};
+
+static LinkSubscriptions subscriptions[LINK_COUNT];
+
+static const byte NO_LINK = 255;
+
+// serial link each device is on, or NO_LINK. matches the ports given to
+// processCommands() in loop().
+static const byte DEVICE_LINKS[DEVICE_COUNT] = {
+    LINK_SERIAL1, LINK_SERIAL2, LINK_SERIAL3, NO_LINK, NO_LINK,
 };
 
+// all output to a link goes through its queue and is sent out by
+// drainTxQueues().
+static TxQueue txQueues[LINK_COUNT];
+
+// log lines go out the USB link as whole frames, even when one is logged while
+// a response is being written.
+void queueLogLine(const byte *data, unsigned int length) {
+  txQueues[LINK_SERIALUSB].writeFrame(data, length);
+}
+
+// inst of the request being handled. responses echo it, so a host can pipeline
+// requests and tell the responses apart from subscription pushes, which always
+// use inst 0.
+static byte responseInst = 0;
+
 #define SENSOR_ID_HTU21D 0x0002
 
 #define REQ_WAGMAN_ID 0xc000
@@ -102,9 +181,33 @@ struct stream_writer : public writer {
 #define REQ_WAGMAN_DEVICE_ENABLE 0xc00c
 #define REQ_WAGMAN_GET_MEDIA_SELECT 0xc00d
 #define REQ_WAGMAN_SET_MEDIA_SELECT 0xc00e
+#define REQ_WAGMAN_GET_HB_TIMEOUT 0xc00f
+#define REQ_WAGMAN_SET_HB_TIMEOUT 0xc010
+#define REQ_WAGMAN_GET_PORT_CONFIG 0xc011
+#define REQ_WAGMAN_SET_PORT_CONFIG 0xc012
+#define REQ_WAGMAN_SNAPSHOT 0xc013
+#define REQ_WAGMAN_SUBSCRIBE 0xc014
+#define REQ_WAGMAN_TX_STATS 0xc015
+#define REQ_WAGMAN_COMMAND_STATS 0xc016
+#define REQ_WAGMAN_RESET_COMMAND_STATS 0xc017
+#define REQ_WAGMAN_PROFILE 0xc018
+#define REQ_WAGMAN_RESET_PROFILE 0xc019
+#define REQ_WAGMAN_MEMORY 0xc01a
+#define REQ_WAGMAN_CLOCK 0xc01b
+#define REQ_WAGMAN_SET_CLOCK_SYNC 0xc01c
+#define REQ_WAGMAN_OUTAGES 0xc01d
+#define REQ_WAGMAN_RTC_TRIM 0xc01e
+#define REQ_WAGMAN_RESET_ALL 0xc01f
+#define REQ_WAGMAN_ABORT_RESET_ALL 0xc020
+#define REQ_WAGMAN_RESET_ALL_STATUS 0xc021
+#define REQ_WAGMAN_STOP_ACK 0xc022
 #define REQ_WAGMAN_GET_DATETIME 0xc023
 #define REQ_WAGMAN_SET_DATETIME 0xc024
 #define REQ_WAGMAN_DEVICE_DISABLE 0xc025
+#define REQ_WAGMAN_HISTORY 0xc026
+#define REQ_WAGMAN_ANOMALY 0xc027
+#define REQ_WAGMAN_ENERGY 0xc028
+#define REQ_WAGMAN_LOAD_SHED 0xc029
 
 #define PUB_WAGMAN_ID 0xff1a
 #define PUB_WAGMAN_CU 0xff06
@@ -126,13 +229,48 @@ struct stream_writer : public writer {
 #define PUB_WAGMAN_GET_DATETIME 0xff23
 #define PUB_WAGMAN_SET_DATETIME 0xff24
 #define PUB_WAGMAN_DEVICE_DISABLE 0xff25
+#define PUB_WAGMAN_GET_HB_TIMEOUT 0xff26
+#define PUB_WAGMAN_SET_HB_TIMEOUT 0xff27
+#define PUB_WAGMAN_GET_PORT_CONFIG 0xff28
+#define PUB_WAGMAN_SET_PORT_CONFIG 0xff29
+#define PUB_WAGMAN_SNAPSHOT 0xff2a
+#define PUB_WAGMAN_SUBSCRIBE 0xff2b
+#define PUB_WAGMAN_TX_STATS 0xff2c
+#define PUB_WAGMAN_COMMAND_STATS 0xff2d
+#define PUB_WAGMAN_RESET_COMMAND_STATS 0xff2e
+#define PUB_WAGMAN_PROFILE 0xff2f
+#define PUB_WAGMAN_RESET_PROFILE 0xff30
+#define PUB_WAGMAN_MEMORY 0xff31
+#define PUB_WAGMAN_CLOCK 0xff32
+#define PUB_WAGMAN_SET_CLOCK_SYNC 0xff33
+#define PUB_WAGMAN_OUTAGES 0xff34
+#define PUB_WAGMAN_RTC_TRIM 0xff35
+#define PUB_WAGMAN_RESET_ALL 0xff36
+#define PUB_WAGMAN_ABORT_RESET_ALL 0xff37
+#define PUB_WAGMAN_RESET_ALL_STATUS 0xff38
+#define PUB_WAGMAN_STOPPING 0xff39
+#define PUB_WAGMAN_STOP_ACK 0xff3a
+#define PUB_WAGMAN_HISTORY 0xff3b
+#define PUB_WAGMAN_ANOMALY 0xff3c
+#define PUB_WAGMAN_ENERGY 0xff3d
+#define PUB_WAGMAN_LOAD_SHED 0xff3e
+
+// converts a timeout from a request in seconds to ms. values which would
+// overflow saturate, so they fail validation instead of wrapping around.
+unsigned long secondsToMillis(unsigned long seconds) {
+  if (seconds > 0xffffffffUL / 1000) {
+    return 0xffffffffUL;
+  }
+
+  return seconds * 1000;
+}
 
 template <class T>
 void basicResp(writer &w, int id, int sub_id, T value) {
   sensorgram_encoder<64> e(w);
   e.info.id = id;
   e.info.sub_id = sub_id;
-  e.info.inst = 0;
+  e.info.inst = responseInst;
   e.info.source_id = 1;
   e.info.source_inst = 0;
   e.encode_uint(value);
@@ -143,7 +281,7 @@ void basicResp(writer &w, int id, int sub_id, const byte *value, int n) {
   sensorgram_encoder<64> e(w);
   e.info.id = id;
   e.info.sub_id = sub_id;
-  e.info.inst = 0;
+  e.info.inst = responseInst;
   e.info.source_id = 1;
   e.info.source_inst = 0;
   e.encode_bytes(value, n);
@@ -183,7 +321,8 @@ Command:
 Start Device
 
 Description:
-Starts a device.
+Starts a device. A device on a port shed for a sagging supply or overcurrent is
+started anyway, but may be shed again.
 
 Examples:
 # start the node controller
@@ -213,6 +352,13 @@ Stop Device
 Description:
 Stops a device with an optional delay.
 
+The device is sent a stopping sensorgram (0xff39) on its serial port every 10
+seconds with the seconds left before it's powered off. It can answer with a
+stop acknowledgement (0xc022) giving the seconds until it's safe to power off.
+Power is cut once that has passed, the port current has dropped from busy to
+idle for 2 seconds, the device's heartbeat has been gone for 40 seconds or the
+delay runs out, whichever comes first.
+
 Examples:
 # stop guest node after 30 seconds
 $ wagman-client stop 1 30
@@ -235,6 +381,51 @@ void commandStop(writer &w, int sub_id, int after) {
   basicResp(w, PUB_WAGMAN_STOP, sub_id, commandStopMain(sub_id - 1, after));
 }
 
+// asks a stopping device to shut down, over the serial link it's on. devices
+// call it through setStopMessageSender.
+static void sendStopMessage(Device &device) {
+  byte link = DEVICE_LINKS[device.port];
+
+  if (link == NO_LINK) {
+    return;
+  }
+
+  unsigned long elapsed = device.timeInState();
+  unsigned long timeout = device.getStopTimeout();
+
+  base64_encoder b64e(txQueues[link]);
+  sensorgram_encoder<64> e(b64e);
+  e.info.id = PUB_WAGMAN_STOPPING;
+  e.info.sub_id = device.port + 1;
+  e.info.inst = 0;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(elapsed < timeout ? (timeout - elapsed) / 1000 : 0);
+  e.encode();
+  b64e.close();
+  txQueues[link].writebyte('\n');
+}
+
+/*
+Command:
+Acknowledge Stop
+
+Description:
+Sent by a stopping device to acknowledge a stopping sensorgram. The argument is
+the number of seconds until the device is safe to power off. A device may only
+acknowledge for itself unless the port is an admin port.
+
+Examples:
+# node controller will be halted in 10 seconds
+$ wagman-client stopack 1 10
+*/
+void commandStopAck(writer &w, int sub_id, unsigned long wait) {
+  int ok = Wagman::validPort(sub_id - 1) &&
+           devices[sub_id - 1].acknowledgeStop(secondsToMillis(wait)) == 0;
+
+  basicResp(w, PUB_WAGMAN_STOP_ACK, sub_id, ok);
+}
+
 /*
 Command:
 Reset Wagman
@@ -256,6 +447,54 @@ void commandReset(writer &w) {
   basicResp(w, PUB_WAGMAN_RESET, 1, 1);
 }
 
+/*
+Command:
+Reset All / Abort Reset All / Reset All Status
+
+Description:
+Reset all shuts down every device and then resets the whole system. Running
+devices are asked to stop, the same as with the stop command, and each port is
+turned off once its device has stopped, or after 60 seconds. Disabled ports
+are turned off right away. Once all ports are off, the system is reset 20
+seconds later. Commands are still served while this runs.
+
+Abort stops a reset all which hasn't reached the final reset. Devices which
+were asked to stop still stop, and ports which were turned off stay off until
+they're started again as usual.
+
+Status returns the stage (0 idle, 1 stopping, 2 settling), seconds since the
+reset all started and the mask of ports turned off so far.
+
+Examples:
+$ wagman-client resetall
+
+$ wagman-client resetall abort
+
+$ wagman-client resetall status
+*/
+void commandResetAll(writer &w) {
+  bool ok = ResetAll::start(devices, DEVICE_COUNT);
+  basicResp(w, PUB_WAGMAN_RESET_ALL, 1, ok);
+}
+
+void commandAbortResetAll(writer &w) {
+  bool ok = ResetAll::abort();
+  basicResp(w, PUB_WAGMAN_ABORT_RESET_ALL, 1, ok);
+}
+
+void commandResetAllStatus(writer &w) {
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_RESET_ALL_STATUS;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(ResetAll::getStage());
+  e.encode_uint(ResetAll::getElapsed() / 1000);
+  e.encode_uint(ResetAll::getPortsOff());
+  e.encode();
+}
+
 /*
 Command:
 Get Wagman ID
@@ -277,7 +516,11 @@ Command:
 Get / Set Date
 
 Description:
-Gets / sets the RTC date.
+Gets / sets the date as year, month, day, hour, minute and second in UTC.
+
+Setting the date is treated as a sync to the host time. The RTC is only set
+when it's off by more than a second. Otherwise it's left running so its drift
+can be measured between syncs and trimmed out. See the RTC trim command.
 
 Examples:
 # gets the date
@@ -286,29 +529,43 @@ $ wagman-client date
 # sets the date
 $ wagman-client date 2016 03 15 13 00 00
 */
-// void commandDate(byte argc, const char **argv) {
-//   if (argc != 1 && argc != 7) return ERROR_INVALID_ARGC;
-
-//   if (argc == 1) {
-//     DateTime dt;
-//     Wagman::getDateTime(dt);
-//     // printDate(dt);
-//     SerialUSB.println();
-//   } else if (argc == 7) {
-//     DateTime dt;
-
-//     dt.year = atoi(argv[1]);
-//     dt.month = atoi(argv[2]);
-//     dt.day = atoi(argv[3]);
-//     dt.hour = atoi(argv[4]);
-//     dt.minute = atoi(argv[5]);
-//     dt.second = atoi(argv[6]);
-
-//     Wagman::setDateTime(dt);
-//   }
+void commandGetDate(writer &w) {
+  DateTime dt;
+  Wagman::getDateTime(dt);
 
-//   return 0;
-// }
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_GET_DATETIME;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(dt.year);
+  e.encode_uint(dt.month);
+  e.encode_uint(dt.day);
+  e.encode_uint(dt.hour);
+  e.encode_uint(dt.minute);
+  e.encode_uint(dt.second);
+  e.encode();
+}
+
+void commandSetDate(writer &w, const unsigned long *fields) {
+  bool ok = 1970 <= fields[0] && fields[0] <= 2105 && 1 <= fields[1] &&
+            fields[1] <= 12 && 1 <= fields[2] && fields[2] <= 31 &&
+            fields[3] < 24 && fields[4] < 60 && fields[5] < 60;
+
+  if (ok) {
+    tmElements_t tm;
+    tm.Year = fields[0] - 1970;
+    tm.Month = fields[1];
+    tm.Day = fields[2];
+    tm.Hour = fields[3];
+    tm.Minute = fields[4];
+    tm.Second = fields[5];
+    ClockTrim::sync(makeTime(tm));
+  }
+
+  basicResp(w, PUB_WAGMAN_SET_DATETIME, 1, ok);
+}
 
 /*
 Command:
@@ -362,19 +619,724 @@ formatted as: Device0 Device1
 Device4
 
 Examples:
-$ wagman-client hb
+$ wagman-client hb
+*/
+unsigned int commandHeartbeatMain(int port) {
+  if (Wagman::validPort(port)) {
+    return devices[port].timeSinceHeartbeat();
+  }
+
+  return 0;
+}
+
+void commandHeartbeat(writer &w, int sub_id) {
+  basicResp(w, PUB_WAGMAN_HB, sub_id, commandHeartbeatMain(sub_id - 1));
+}
+
+/*
+Command:
+Get / Set Heartbeat Timeouts
+
+Description:
+Gets / sets the heartbeat timeouts in seconds for a device. The boot timeout
+applies until the first heartbeat after the device is started and the steady
+timeout applies afterwards. Setting a timeout to 0 clears the override, in which
+case the boot timeout is learned from recent boot durations and the steady
+timeout is the default of one hour.
+
+Examples:
+# gets the boot and steady heartbeat timeouts for the guest node
+$ wagman-client hbt 1
+
+# boot timeout of 10 minutes and the default steady timeout for the guest node
+$ wagman-client hbt 1 600 0
+
+# learned boot timeout and a steady timeout of 2 hours for the guest node
+$ wagman-client hbt 1 0 7200
+*/
+void commandGetHeartbeatTimeout(writer &w, int sub_id) {
+  int port = sub_id - 1;
+  unsigned long bootTimeout = 0;
+  unsigned long timeout = 0;
+
+  if (Wagman::validPort(port)) {
+    bootTimeout = devices[port].getBootHeartbeatTimeout() / 1000;
+    timeout = devices[port].getHeartbeatTimeout() / 1000;
+  }
+
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_GET_HB_TIMEOUT;
+  e.info.sub_id = sub_id;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(bootTimeout);
+  e.encode_uint(timeout);
+  e.encode();
+}
+
+int commandSetHeartbeatTimeoutMain(int port, unsigned long bootTimeout,
+                                   unsigned long timeout) {
+  if (!Wagman::validPort(port)) {
+    return 0;
+  }
+
+  PortConfig config = Record::getPortConfig(port);
+  config.bootHeartbeatTimeout = secondsToMillis(bootTimeout);
+  config.heartbeatTimeout = secondsToMillis(timeout);
+
+  if (!Record::setPortConfig(port, config)) {
+    return 0;
+  }
+
+  devices[port].updateHeartbeatTimeouts();
+  return 1;
+}
+
+void commandSetHeartbeatTimeout(writer &w, int sub_id,
+                                unsigned long bootTimeout,
+                                unsigned long timeout) {
+  basicResp(w, PUB_WAGMAN_SET_HB_TIMEOUT, sub_id,
+            commandSetHeartbeatTimeoutMain(sub_id - 1, bootTimeout, timeout));
+}
+
+/*
+Command:
+Get / Set Port Config
+
+Description:
+Gets / sets the policy parameters for a device port. The values are, in order:
+low, normal and stressed current level bounds, fault current, fault timeout,
+steady heartbeat timeout, boot heartbeat timeout, unmanaged media change time
+and stop timeout. Timeouts are in seconds. A heartbeat timeout of 0 means the
+default is used. The config is only applied if every value is valid and takes
+effect without a reboot.
+
+Examples:
+# gets the port config for the guest node
+$ wagman-client config 1
+
+# sets the port config for the guest node
+$ wagman-client config 1 120 300 850 122 15 3600 0 14400 60
+*/
+void commandGetPortConfig(writer &w, int sub_id) {
+  int port = sub_id - 1;
+
+  if (!Wagman::validPort(port)) {
+    basicResp(w, PUB_WAGMAN_GET_PORT_CONFIG, sub_id, 0);
+    return;
+  }
+
+  const PortConfig &config = Record::getPortConfig(port);
+
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_GET_PORT_CONFIG;
+  e.info.sub_id = sub_id;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(config.currentLow);
+  e.encode_uint(config.currentNormal);
+  e.encode_uint(config.currentStressed);
+  e.encode_uint(config.faultCurrent);
+  e.encode_uint(config.faultTimeout / 1000);
+  e.encode_uint(config.heartbeatTimeout / 1000);
+  e.encode_uint(config.bootHeartbeatTimeout / 1000);
+  e.encode_uint(config.unmanagedChangeTime / 1000);
+  e.encode_uint(config.stopTimeout / 1000);
+  e.encode();
+}
+
+int commandSetPortConfigMain(int port, const PortConfig &config) {
+  if (!Record::setPortConfig(port, config)) {
+    return 0;
+  }
+
+  devices[port].updateHeartbeatTimeouts();
+
+  // a stop in progress keeps its timeout, which may have come from the stop
+  // request. the device reloads the config's timeout once it's stopped.
+  if (devices[port].getState() != STATE_STOPPING) {
+    devices[port].setStopTimeout(config.stopTimeout);
+  }
+
+  return 1;
+}
+
+void commandSetPortConfig(writer &w, int sub_id, const PortConfig &config) {
+  basicResp(w, PUB_WAGMAN_SET_PORT_CONFIG, sub_id,
+            commandSetPortConfigMain(sub_id - 1, config));
+}
+
+/*
+Command:
+Get Snapshot
+
+Description:
+Gets the state of the whole system in a single response, served from the most
+recent sensor samples. The values are, in order: time, milliseconds since the
+ports were sampled, system current, then for each of the 5 ports its current,
+voltage, thermistor, seconds since last heartbeat, fail count, state, selected
+boot media and enabled flag, then temperature and humidity.
+
+Examples:
+$ wagman-client snapshot
+*/
+void commandSnapshot(writer &w) {
+  const SensorSample &sample = Wagman::getSample();
+
+  sensorgram_encoder<256> e(w);
+  e.info.id = PUB_WAGMAN_SNAPSHOT;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+
+  time_t now;
+  Wagman::getTime(now);
+
+  e.encode_uint(now);
+  e.encode_uint(millis() - sample.sampleMillis);
+  e.encode_uint(sample.systemCurrent);
+
+  for (byte port = 0; port < DEVICE_COUNT; port++) {
+    const Device &device = devices[port];
+
+    e.encode_uint(sample.ports[port].current);
+    e.encode_uint(sample.ports[port].voltage);
+    e.encode_uint(sample.ports[port].thermistor);
+    e.encode_uint(device.timeSinceHeartbeat() / 1000);
+    e.encode_uint(device.getBootFailures());
+    e.encode_uint(device.getState());
+    e.encode_uint(Wagman::getBootMedia(device.bootSelector));  // 255 if none
+    e.encode_uint(device.getState() != STATE_DISABLED);
+  }
+
+  // environment sensor failures are reported as max values.
+  if (sample.environmentOK) {
+    e.encode_uint(sample.temperature);
+    e.encode_uint(sample.humidity);
+  } else {
+    e.encode_uint(0xffff);
+    e.encode_uint(0xffff);
+  }
+
+  e.encode();
+}
+
+/*
+Command:
+Subscribe
+
+Description:
+Subscribes the serial port the request arrives on to pushed updates for a set
+of metric groups, given as a bitmask: 1 current, 2 voltage, 4 thermistor,
+8 heartbeat, 16 state, 32 environment, 64 anomaly. A group is pushed every
+period ms and whenever any of its values moves by at least threshold since the
+last push. Either may be 0 to disable it and setting both to 0 unsubscribes.
+Pushes to a port are batched and sent at most once every min interval ms, which
+applies to all of that port's groups. Subscriptions are not saved across
+resets.
+
+Each group is pushed as a single sensorgram using the same id as the
+corresponding request with sub_id 0 and one value per port. Current also
+includes the system current first and heartbeat is in seconds. Anomaly is the
+number of current changes found on each port, so a threshold of 1 pushes on
+every change.
+
+Examples:
+# push currents every 10s or when they change by 50mA, at most every 100ms
+$ wagman-client subscribe 1 10000 50 100
+
+# push as soon as a current change is found
+$ wagman-client subscribe 64 0 1 100
+
+# unsubscribe from everything
+$ wagman-client subscribe 127 0 0 100
+*/
+bool commandSubscribeMain(byte link, unsigned int groups, unsigned long period,
+                          unsigned int threshold, unsigned long minInterval) {
+  if (groups == 0 || groups >= (1 << GROUP_COUNT)) {
+    return false;
+  }
+
+  if (period != 0 && (period < SUBSCRIPTION_MIN_INTERVAL || period > DAYS)) {
+    return false;
+  }
+
+  if (minInterval < SUBSCRIPTION_MIN_INTERVAL || minInterval > DAYS) {
+    return false;
+  }
+
+  LinkSubscriptions &subs = subscriptions[link];
+  subs.minInterval = minInterval;
+
+  for (byte group = 0; group < GROUP_COUNT; group++) {
+    if (groups & (1 << group)) {
+      Subscription &sub = subs.groups[group];
+      sub.period = period;
+      sub.threshold = threshold;
+      sub.count = 0;  // push on next opportunity
+      sub.timer.reset();
+    }
+  }
+
+  return true;
+}
+
+void commandSubscribe(writer &w, byte link, unsigned int groups,
+                      unsigned long period, unsigned int threshold,
+                      unsigned long minInterval) {
+  basicResp(w, PUB_WAGMAN_SUBSCRIBE, 1,
+            commandSubscribeMain(link, groups, period, threshold, minInterval));
+}
+
+/*
+Command:
+Get Transmit Stats
+
+Description:
+Gets the state of the transmit queue of each serial port. Responses which
+don't fit in a port's queue are dropped whole instead of being truncated. The
+values are, for each of SerialUSB, Serial1, Serial2, Serial3 and Serial in
+order: bytes pending, high-water mark in bytes and number of dropped frames.
+
+Examples:
+$ wagman-client txstats
+*/
+void commandTxStats(writer &w) {
+  sensorgram_encoder<128> e(w);
+  e.info.id = PUB_WAGMAN_TX_STATS;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+
+  for (byte link = 0; link < LINK_COUNT; link++) {
+    e.encode_uint(txQueues[link].pending());
+    e.encode_uint(txQueues[link].getHighWater());
+    e.encode_uint(txQueues[link].getDroppedFrames());
+  }
+
+  e.encode();
+}
+
+/*
+Command:
+Get / Reset Command Stats
+
+Description:
+Gets execution stats for the commands received on a serial port, selected by
+sub_id 1 to 5 for SerialUSB, Serial1, Serial2, Serial3 and Serial. Returns up to
+8 commands starting at the given offset, one sensorgram each, with values: id,
+calls, errors, min, max and mean execution time in microseconds. Fewer than 8
+means there are no more. A missing offset returns a single value of 0.
+Errors are calls with bad arguments or which weren't allowed on that port.
+Unknown commands are counted under id 0.
+
+Reset clears the stats for all ports.
+
+Examples:
+# first page of stats for SerialUSB
+$ wagman-client cmdstats 1 0
+
+$ wagman-client cmdstats reset
+*/
+static const byte COMMAND_STATS_PAGE_SIZE = 8;
+
+void commandCommandStats(writer &w, int sub_id, unsigned int offset) {
+  byte link = sub_id - 1;
+  unsigned int index = 0;
+  byte sent = 0;
+
+  for (byte i = 0; i < CommandStats::getCount(); i++) {
+    const CommandStat &stat = CommandStats::getEntry(i);
+
+    if (stat.link != link) {
+      continue;
+    }
+
+    if (index++ < offset) {
+      continue;
+    }
+
+    sensorgram_encoder<64> e(w);
+    e.info.id = PUB_WAGMAN_COMMAND_STATS;
+    e.info.sub_id = sub_id;
+    e.info.inst = responseInst;
+    e.info.source_id = 1;
+    e.info.source_inst = 0;
+    e.encode_uint(stat.id);
+    e.encode_uint(stat.count);
+    e.encode_uint(stat.errors);
+    e.encode_uint(stat.minMicros);
+    e.encode_uint(stat.maxMicros);
+    e.encode_uint(stat.totalMicros / stat.count);
+    e.encode();
+
+    if (++sent == COMMAND_STATS_PAGE_SIZE) {
+      break;
+    }
+  }
+}
+
+void commandResetCommandStats(writer &w) {
+  CommandStats::reset();
+  basicResp(w, PUB_WAGMAN_RESET_COMMAND_STATS, 1, 1);
+}
+
+/*
+Command:
+Get RTC Trim
+
+Description:
+Gets the state of the RTC trimming. The values are: whether there's an
+estimate, estimated RTC oscillator error without trim in ppb, its uncertainty
+in ppb, length of the sync history it was estimated over in seconds, RTC trim
+register value and RTC offset from the host time seen at the last date sync in
+seconds. The error, trim and offset are signed and encoded as 32-bit two's
+complement.
+
+The trim is programmed once the history covers at least 3 days, or sooner if
+the error is large. Each trim step is about 1 ppm and positive values slow the
+RTC down.
+
+Examples:
+$ wagman-client rtctrim
+*/
+void commandRTCTrim(writer &w) {
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_RTC_TRIM;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(ClockTrim::hasEstimate());
+  e.encode_uint((unsigned long)ClockTrim::getEstimate());
+  e.encode_uint(ClockTrim::getUncertainty());
+  e.encode_uint(ClockTrim::getBaseline());
+  e.encode_uint((unsigned long)ClockTrim::getTrim());
+  e.encode_uint((unsigned long)ClockTrim::getLastOffset());
+  e.encode();
+}
+
+/*
+Command:
+Get Outages
+
+Description:
+Gets the last 8 power outages latched by the RTC, oldest first, one sensorgram
+each with values: start time, end time and duration in seconds. Times are only
+accurate to the minute.
+
+Examples:
+$ wagman-client outages
+*/
+void commandOutages(writer &w) {
+  for (byte i = 0; i < Record::outageLog.getCount(); i++) {
+    time_t start, end;
+
+    if (!Record::outageLog.getEntry(i, start, end)) {
+      break;
+    }
+
+    sensorgram_encoder<64> e(w);
+    e.info.id = PUB_WAGMAN_OUTAGES;
+    e.info.sub_id = i + 1;
+    e.info.inst = responseInst;
+    e.info.source_id = 1;
+    e.info.source_inst = 0;
+    e.encode_uint(start);
+    e.encode_uint(end);
+    e.encode_uint(end - start);
+    e.encode();
+  }
+}
+
+/*
+Command:
+Get Memory Usage
+
+Description:
+Gets the smallest amount of free RAM ever seen between the heap and the stack
+and the number of bytes used by the heap, both in bytes. Also included in the
+periodic status report.
+
+Examples:
+$ wagman-client mem
+*/
+void commandMemory(writer &w) {
+  Memory::update();
+
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_MEMORY;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(Memory::getMinFreeStack());
+  e.encode_uint(Memory::getHeapUsed());
+  e.encode();
+}
+
+/*
+Command:
+Get History
+
+Description:
+Gets part of a block of the sensor history, which keeps the last few hours of
+sensor readings, device states and heartbeat ages at one sample a second.
+Blocks are numbered from boot and each is sent in 4 parts of up to 128 bytes,
+selected by block number and part. The values are: block number, part, samples
+in the block, newest block number and the part's bytes. The newest block is
+still being written, so its sample count and last part grow.
+
+A block which has already been overwritten gets the first part of the oldest
+block instead, so a reader can see what was lost. A block which hasn't been
+started or a bad part gets a response with just 0. See history_layout.md for
+the block format.
+
+Examples:
+# first part of block 120
+$ wagman-client history 120 0
+*/
+void commandHistory(writer &w, unsigned long block, byte part) {
+  History::Part result;
+
+  if (!History::getPart(block, part, result)) {
+    basicResp(w, PUB_WAGMAN_HISTORY, 1, 0);
+    return;
+  }
+
+  sensorgram_encoder<256> e(w);
+  e.info.id = PUB_WAGMAN_HISTORY;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(result.block);
+  e.encode_uint(result.part);
+  e.encode_uint(result.samples);
+  e.encode_uint(History::getNewestBlock());
+  e.encode_bytes(result.data, result.size);
+  e.encode();
+}
+
+/*
+Command:
+Get Current Anomalies
+
+Description:
+Gets the state of a port's current change detector, which looks for lasting
+changes in the device's current like a failing fan, while ignoring short load
+bursts and the first 5 minutes after a start. The values are: whether the
+baseline has been learned, baseline and usual deviation in mA, rise and drop
+sums as percents of the threshold, number of changes found since boot, last
+change as 0 none, 1 rise or 2 drop, baseline and current in mA when it was
+found and seconds since it was found. Changes are also logged and can be
+subscribed to.
+
+Examples:
+# anomaly detector for the node controller
+$ wagman-client anomaly 0
+*/
+void commandAnomaly(writer &w, int sub_id) {
+  int port = sub_id - 1;
+
+  if (!Wagman::validPort(port)) {
+    basicResp(w, PUB_WAGMAN_ANOMALY, sub_id, 0);
+    return;
+  }
+
+  const Anomaly::Change &change = Anomaly::getLastChange(port);
+
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_ANOMALY;
+  e.info.sub_id = sub_id;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(Anomaly::isWatching(port));
+  e.encode_uint(Anomaly::getBaseline(port));
+  e.encode_uint(Anomaly::getDeviation(port));
+  e.encode_uint(Anomaly::getRiseSum(port) * 100 / Anomaly::THRESHOLD);
+  e.encode_uint(Anomaly::getDropSum(port) * 100 / Anomaly::THRESHOLD);
+  e.encode_uint(Anomaly::getChangeCount(port));
+  e.encode_uint(change.direction);
+  e.encode_uint(change.before);
+  e.encode_uint(change.after);
+  e.encode_uint(change.direction == Anomaly::CHANGE_NONE
+                    ? 0
+                    : (millis() - change.millis) / 1000);
+  e.encode();
+}
+
+/*
+Command:
+Get Energy
+
+Description:
+Gets the charge and energy used by the system and by each port, since boot and
+over the Wagman's lifetime. The values are: seconds integrated since boot,
+seconds since the lifetime totals were last saved to EEPROM and then, for the
+system followed by each port, mAh and mWh since boot and mAh and mWh over the
+lifetime.
+
+Readings are integrated with the board's nominal calibration. The system's
+supply voltage isn't measured, so its mWh assume a nominal 5 V. Lifetime totals
+are saved every 10 minutes and before a reset, so a power cut loses at most 10
+minutes of them.
+
+Examples:
+$ wagman-client energy
+*/
+void commandEnergy(writer &w) {
+  sensorgram_encoder<256> e(w);
+  e.info.id = PUB_WAGMAN_ENERGY;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(Energy::getBootSeconds());
+  e.encode_uint(Energy::getSecondsSinceSave());
+
+  for (byte i = 0; i < Energy::CHANNEL_COUNT; i++) {
+    const Energy::Totals &boot = Energy::getBootTotals(i);
+    Energy::Totals lifetime = Energy::getLifetimeTotals(i);
+    e.encode_uint(Energy::toMilliampHours(boot.charge));
+    e.encode_uint(Energy::toMilliwattHours(boot.energy));
+    e.encode_uint(Energy::toMilliampHours(lifetime.charge));
+    e.encode_uint(Energy::toMilliwattHours(lifetime.energy));
+  }
+
+  e.encode();
+}
+
+/*
+Command:
+Get Load Shedding
+
+Description:
+Gets the state of load shedding, which turns off ports by priority when the
+supply sags under 4.75 V or the system draws over 7 A, and turns them back on
+one at a time once the supply has been over 4.9 V and under 6 A for the
+restore hold. The node controller is never shed and x1 and x2 are shed first.
+The values are: supply voltage in mV, system current in mA, shed ports as a
+bit per port, number of sheds and restores since boot, restore hold in
+seconds and supply checks in the last second.
+
+Examples:
+$ wagman-client loadshed
+*/
+void commandLoadShed(writer &w) {
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_LOAD_SHED;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(LoadShed::getSupplyVoltage());
+  e.encode_uint(Wagman::getSample().systemCurrent);
+  e.encode_uint(LoadShed::getShedPorts());
+  e.encode_uint(LoadShed::getShedCount());
+  e.encode_uint(LoadShed::getRestoreCount());
+  e.encode_uint(LoadShed::getRestoreHold() / 1000);
+  e.encode_uint(LoadShed::getPollRate());
+  e.encode();
+}
+
+/*
+Command:
+Get Clock / Set Clock Sync Interval
+
+Description:
+Gets the state of the software clock, which keeps time from millis() and is
+synced against the RTC every sync interval. The values are: time, estimated
+drift of the local oscillator relative to the RTC in ppm, RTC offset seen at
+the last sync in ms, sync interval in seconds, number of syncs and number of
+steps. Drift and offset are signed and encoded as 32-bit two's complement.
+
+Set changes the sync interval in seconds. It must be between 10 seconds and
+1 day and isn't saved across resets.
+
+Examples:
+$ wagman-client clock
+
+# sync every 5 minutes
+$ wagman-client clock sync 300
+*/
+void commandClock(writer &w) {
+  sensorgram_encoder<64> e(w);
+  e.info.id = PUB_WAGMAN_CLOCK;
+  e.info.sub_id = 1;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+  e.encode_uint(SoftClock::now());
+  e.encode_uint((unsigned long)SoftClock::getDriftPPM());
+  e.encode_uint((unsigned long)SoftClock::getLastOffset());
+  e.encode_uint(SoftClock::getSyncInterval() / 1000);
+  e.encode_uint(SoftClock::getSyncCount());
+  e.encode_uint(SoftClock::getStepCount());
+  e.encode();
+}
+
+void commandSetClockSync(writer &w, unsigned long interval) {
+  basicResp(w, PUB_WAGMAN_SET_CLOCK_SYNC, 1,
+            SoftClock::setSyncInterval(secondsToMillis(interval)));
+}
+
+#ifdef PROFILER
+/*
+Command:
+Get / Reset Profile
+
+Description:
+Gets the loop profiler histogram for one section, selected by sub_id: 1 loop
+period, 2 start devices, 3 sample sensors, 4 update devices, 5 process
+commands, 6 push subscriptions, 7 log status, 8 LEDs. The values are: count,
+min, max and mean in CPU cycles, followed by log2 histogram bins. Bin i counts
+times of at least 2^(i-1) and less than 2^i cycles and trailing empty bins are
+omitted. Only available when built with PROFILER defined.
+
+Reset clears all histograms.
+
+Examples:
+# loop period histogram
+$ wagman-client profile 1
+
+$ wagman-client profile reset
 */
-unsigned int commandHeartbeatMain(int port) {
-  if (Wagman::validPort(port)) {
-    return devices[port].timeSinceHeartbeat();
+void commandProfile(writer &w, int sub_id) {
+  byte section = sub_id - 1;
+
+  if (section >= Profiler::SECTION_COUNT) {
+    basicResp(w, PUB_WAGMAN_PROFILE, sub_id, 0);
+    return;
   }
 
-  return 0;
+  unsigned long values[Profiler::MAX_VALUES];
+  byte count = Profiler::getValues(section, values);
+
+  sensorgram_encoder<256> e(w);
+  e.info.id = PUB_WAGMAN_PROFILE;
+  e.info.sub_id = sub_id;
+  e.info.inst = responseInst;
+  e.info.source_id = 1;
+  e.info.source_inst = 0;
+
+  for (byte i = 0; i < count; i++) {
+    e.encode_uint(values[i]);
+  }
+
+  e.encode();
 }
 
-void commandHeartbeat(writer &w, int sub_id) {
-  basicResp(w, PUB_WAGMAN_HB, sub_id, commandHeartbeatMain(sub_id - 1));
+void commandResetProfile(writer &w) {
+  Profiler::reset();
+  basicResp(w, PUB_WAGMAN_RESET_PROFILE, 1, 1);
 }
+#endif
 
 /*
 Command:
@@ -772,17 +1734,6 @@ byte commandSDInfo(byte argc, const char **argv) {
   return 0;
 }
 
-const int NC_AUTO_DISABLE = 48;
-const int MR1 = 30;
-const int MR2 = 32;
-
-bool shouldResetAll = false;
-
-byte commandResetAll(byte argc, const char **argv) {
-  shouldResetAll = true;
-  return 0;
-}
-
 bytebuffer<128> msgbuf;
 bytebuffer<128> msgbuf0;
 bytebuffer<128> msgbuf1;
@@ -790,12 +1741,17 @@ bytebuffer<128> msgbuf2;
 bytebuffer<128> msgbuf3;
 
 template <class bufferT, class writerT>
-void processCommand(bufferT &buffer, writerT &wout, bool isadmin, int port) {
+void processCommand(bufferT &buffer, writerT &wout, bool isadmin, int port,
+                    byte link) {
   base64_decoder b64d(buffer);
   sensorgram_decoder<64> d(b64d);
 
   while (d.decode()) {
     base64_encoder b64e(wout);
+    unsigned long startMicros = micros();
+    responseInst = d.info.inst;
+    bool denied = false;
+    bool unknown = false;
 
     switch (d.info.id) {
       case REQ_WAGMAN_ID: {
@@ -819,6 +1775,8 @@ void processCommand(bufferT &buffer, writerT &wout, bool isadmin, int port) {
       case REQ_WAGMAN_START: {
         if (isadmin) {
           commandStart(b64e, d.info.sub_id);
+        } else {
+          denied = true;
         }
       } break;
       case REQ_WAGMAN_STOP: {
@@ -830,11 +1788,15 @@ void processCommand(bufferT &buffer, writerT &wout, bool isadmin, int port) {
           } else {
             basicResp(b64e, PUB_WAGMAN_STOP, d.info.sub_id, 0);
           }
+        } else {
+          denied = true;
         }
       } break;
       case REQ_WAGMAN_DEVICE_ENABLE: {
         if (isadmin) {
           commandEnable(b64e, d.info.sub_id);
+        } else {
+          denied = true;
         }
       } break;
       case REQ_WAGMAN_DEVICE_STATE: {
@@ -852,44 +1814,254 @@ void processCommand(bufferT &buffer, writerT &wout, bool isadmin, int port) {
           } else {
             basicResp(b64e, PUB_WAGMAN_SET_MEDIA_SELECT, d.info.sub_id, 0);
           }
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_GET_HB_TIMEOUT: {
+        commandGetHeartbeatTimeout(b64e, d.info.sub_id);
+      } break;
+      case REQ_WAGMAN_SET_HB_TIMEOUT: {
+        if (isadmin) {
+          unsigned long bootTimeout = d.decode_uint();
+          unsigned long timeout = d.decode_uint();
+
+          if (!d.err) {
+            commandSetHeartbeatTimeout(b64e, d.info.sub_id, bootTimeout,
+                                       timeout);
+          } else {
+            basicResp(b64e, PUB_WAGMAN_SET_HB_TIMEOUT, d.info.sub_id, 0);
+          }
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_GET_PORT_CONFIG: {
+        commandGetPortConfig(b64e, d.info.sub_id);
+      } break;
+      case REQ_WAGMAN_SET_PORT_CONFIG: {
+        if (isadmin) {
+          // currents are 16 bit, so larger values are rejected rather than
+          // truncated into valid ones.
+          unsigned long currents[4];
+          bool valid = true;
+
+          for (byte i = 0; i < 4; i++) {
+            currents[i] = d.decode_uint();
+            valid = valid && currents[i] <= 0xffff;
+          }
+
+          PortConfig config;
+          config.currentLow = currents[0];
+          config.currentNormal = currents[1];
+          config.currentStressed = currents[2];
+          config.faultCurrent = currents[3];
+          config.faultTimeout = secondsToMillis(d.decode_uint());
+          config.heartbeatTimeout = secondsToMillis(d.decode_uint());
+          config.bootHeartbeatTimeout = secondsToMillis(d.decode_uint());
+          config.unmanagedChangeTime = secondsToMillis(d.decode_uint());
+          config.stopTimeout = secondsToMillis(d.decode_uint());
+
+          if (!d.err && valid) {
+            commandSetPortConfig(b64e, d.info.sub_id, config);
+          } else {
+            basicResp(b64e, PUB_WAGMAN_SET_PORT_CONFIG, d.info.sub_id, 0);
+          }
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_SNAPSHOT: {
+        commandSnapshot(b64e);
+      } break;
+      case REQ_WAGMAN_SUBSCRIBE: {
+        unsigned int groups = d.decode_uint();
+        unsigned long period = d.decode_uint();
+        unsigned int threshold = d.decode_uint();
+        unsigned long minInterval = d.decode_uint();
+
+        if (!d.err) {
+          commandSubscribe(b64e, link, groups, period, threshold, minInterval);
+        } else {
+          basicResp(b64e, PUB_WAGMAN_SUBSCRIBE, 1, 0);
+        }
+      } break;
+      case REQ_WAGMAN_TX_STATS: {
+        commandTxStats(b64e);
+      } break;
+      case REQ_WAGMAN_COMMAND_STATS: {
+        unsigned int offset = d.decode_uint();
+
+        if (!d.err) {
+          commandCommandStats(b64e, d.info.sub_id, offset);
+        } else {
+          basicResp(b64e, PUB_WAGMAN_COMMAND_STATS, d.info.sub_id, 0);
+        }
+      } break;
+      case REQ_WAGMAN_RESET_COMMAND_STATS: {
+        if (isadmin) {
+          commandResetCommandStats(b64e);
+        } else {
+          denied = true;
+        }
+      } break;
+#ifdef PROFILER
+      case REQ_WAGMAN_PROFILE: {
+        commandProfile(b64e, d.info.sub_id);
+      } break;
+      case REQ_WAGMAN_RESET_PROFILE: {
+        if (isadmin) {
+          commandResetProfile(b64e);
+        } else {
+          denied = true;
+        }
+      } break;
+#endif
+      case REQ_WAGMAN_CLOCK: {
+        commandClock(b64e);
+      } break;
+      case REQ_WAGMAN_SET_CLOCK_SYNC: {
+        if (isadmin) {
+          unsigned long interval = d.decode_uint();
+
+          if (!d.err) {
+            commandSetClockSync(b64e, interval);
+          } else {
+            basicResp(b64e, PUB_WAGMAN_SET_CLOCK_SYNC, 1, 0);
+          }
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_GET_DATETIME: {
+        commandGetDate(b64e);
+      } break;
+      case REQ_WAGMAN_SET_DATETIME: {
+        if (isadmin) {
+          // year, month, day, hour, minute, second
+          unsigned long fields[6];
+
+          for (byte i = 0; i < 6; i++) {
+            fields[i] = d.decode_uint();
+          }
+
+          if (!d.err) {
+            commandSetDate(b64e, fields);
+          } else {
+            basicResp(b64e, PUB_WAGMAN_SET_DATETIME, 1, 0);
+          }
+        } else {
+          denied = true;
         }
       } break;
+      case REQ_WAGMAN_RTC_TRIM: {
+        commandRTCTrim(b64e);
+      } break;
+      case REQ_WAGMAN_OUTAGES: {
+        commandOutages(b64e);
+      } break;
+      case REQ_WAGMAN_HISTORY: {
+        unsigned long block = d.decode_uint();
+        unsigned long part = d.decode_uint();
+
+        if (!d.err && part < History::PART_COUNT) {
+          commandHistory(b64e, block, part);
+        } else {
+          basicResp(b64e, PUB_WAGMAN_HISTORY, 1, 0);
+        }
+      } break;
+      case REQ_WAGMAN_ANOMALY: {
+        commandAnomaly(b64e, d.info.sub_id);
+      } break;
+      case REQ_WAGMAN_ENERGY: {
+        commandEnergy(b64e);
+      } break;
+      case REQ_WAGMAN_LOAD_SHED: {
+        commandLoadShed(b64e);
+      } break;
+      case REQ_WAGMAN_MEMORY: {
+        commandMemory(b64e);
+      } break;
       case REQ_WAGMAN_UPTIME: {
         commandUptime(b64e);
       } break;
       case REQ_WAGMAN_EERESET: {
         if (isadmin) {
           commandResetEEPROM(b64e);
+        } else {
+          denied = true;
         }
       } break;
       case REQ_WAGMAN_RESET: {
         if (isadmin) {
           commandReset(b64e);
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_RESET_ALL: {
+        if (isadmin) {
+          commandResetAll(b64e);
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_ABORT_RESET_ALL: {
+        if (isadmin) {
+          commandAbortResetAll(b64e);
+        } else {
+          denied = true;
+        }
+      } break;
+      case REQ_WAGMAN_RESET_ALL_STATUS: {
+        commandResetAllStatus(b64e);
+      } break;
+      case REQ_WAGMAN_STOP_ACK: {
+        if (isadmin || (port == (d.info.sub_id - 1))) {
+          unsigned long wait = d.decode_uint();
+
+          if (!d.err) {
+            commandStopAck(b64e, d.info.sub_id, wait);
+          } else {
+            basicResp(b64e, PUB_WAGMAN_STOP_ACK, d.info.sub_id, 0);
+          }
+        } else {
+          denied = true;
         }
       } break;
       case PUB_WAGMAN_PING: {
         // if isadmin or ping is for incoming port
         if (isadmin || (port == (d.info.sub_id - 1))) {
           commandPing(b64e, d.info.sub_id);
+        } else {
+          denied = true;
         }
       } break;
+      default: {
+        unknown = true;
+      } break;
     }
 
+    // unknown ids are all counted under id 0 so they can't fill the table.
+    CommandStats::record(link, unknown ? 0 : d.info.id, micros() - startMicros,
+                         !(denied || unknown || d.err));
+
     b64e.close();
     wout.writebyte('\n');
+    responseInst = 0;
   }
 }
 
 template <class streamT, class bufferT>
-void processCommands(streamT &stream, bufferT &buffer, bool isadmin, int port) {
+void processCommands(streamT &stream, bufferT &buffer, bool isadmin, int port,
+                     byte link) {
   int n = stream.available();
 
   for (int i = 0; i < n; i++) {
     int c = stream.read();
 
     if (c == '\n') {
-      stream_writer<streamT> sw(stream);
-      processCommand(buffer, sw, isadmin, port);
+      processCommand(buffer, txQueues[link], isadmin, port, link);
       buffer.reset();
     } else {
       buffer.writebyte(c);
@@ -897,6 +2069,181 @@ void processCommands(streamT &stream, bufferT &buffer, bool isadmin, int port) {
   }
 }
 
+void drainTxQueues() {
+  txQueues[LINK_SERIALUSB].drain(SerialUSB);
+  txQueues[LINK_SERIAL1].drain(Serial1);
+  txQueues[LINK_SERIAL2].drain(Serial2);
+  txQueues[LINK_SERIAL3].drain(Serial3);
+  txQueues[LINK_SERIAL].drain(Serial);
+}
+
+void setupSubscriptions() {
+  for (byte link = 0; link < LINK_COUNT; link++) {
+    LinkSubscriptions &subs = subscriptions[link];
+    subs.minInterval = SUBSCRIPTION_MIN_INTERVAL;
+    subs.timer.reset();
+
+    for (byte group = 0; group < GROUP_COUNT; group++) {
+      subs.groups[group].period = 0;
+      subs.groups[group].threshold = 0;
+      subs.groups[group].count = 0;
+    }
+  }
+}
+
+// reads the cached values for a metric group. returns the number of values
+// read or 0 if the group currently has nothing to report.
+byte readGroup(byte group, unsigned int *values) {
+  const SensorSample &sample = Wagman::getSample();
+
+  switch (group) {
+    case GROUP_CURRENT:
+      values[0] = sample.systemCurrent;
+
+      for (byte port = 0; port < DEVICE_COUNT; port++) {
+        values[port + 1] = sample.ports[port].current;
+      }
+
+      return DEVICE_COUNT + 1;
+    case GROUP_VOLTAGE:
+      for (byte port = 0; port < DEVICE_COUNT; port++) {
+        values[port] = sample.ports[port].voltage;
+      }
+
+      return DEVICE_COUNT;
+    case GROUP_THERMISTOR:
+      for (byte port = 0; port < DEVICE_COUNT; port++) {
+        values[port] = sample.ports[port].thermistor;
+      }
+
+      return DEVICE_COUNT;
+    case GROUP_HEARTBEAT:
+      for (byte port = 0; port < DEVICE_COUNT; port++) {
+        values[port] = devices[port].timeSinceHeartbeat() / 1000;
+      }
+
+      return DEVICE_COUNT;
+    case GROUP_STATE:
+      for (byte port = 0; port < DEVICE_COUNT; port++) {
+        values[port] = devices[port].getState();
+      }
+
+      return DEVICE_COUNT;
+    case GROUP_ENVIRONMENT:
+      if (!sample.environmentOK) {
+        return 0;
+      }
+
+      values[0] = sample.temperature;
+      values[1] = sample.humidity;
+      return 2;
+    case GROUP_ANOMALY:
+      for (byte port = 0; port < DEVICE_COUNT; port++) {
+        values[port] = Anomaly::getChangeCount(port);
+      }
+
+      return DEVICE_COUNT;
+  }
+
+  return 0;
+}
+
+const int GROUP_IDS[GROUP_COUNT] = {
+    PUB_WAGMAN_CU,          PUB_WAGMAN_VOLTAGE,      PUB_WAGMAN_TH,
+    PUB_WAGMAN_HB,          PUB_WAGMAN_DEVICE_STATE, SENSOR_ID_HTU21D,
+    PUB_WAGMAN_ANOMALY,
+};
+
+bool subscriptionDue(const Subscription &sub, const unsigned int *values,
+                     byte count) {
+  if (sub.count != count) {
+    return true;
+  }
+
+  if (sub.period != 0 && sub.timer.exceeds(sub.period)) {
+    return true;
+  }
+
+  if (sub.threshold != 0) {
+    for (byte i = 0; i < count; i++) {
+      unsigned int delta = values[i] > sub.values[i]
+                               ? values[i] - sub.values[i]
+                               : sub.values[i] - values[i];
+
+      if (delta >= sub.threshold) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// pushes all due subscriptions for a link as a single batch.
+void pushSubscriptions(byte link) {
+  LinkSubscriptions &subs = subscriptions[link];
+
+  if (!subs.timer.exceeds(subs.minInterval)) {
+    return;
+  }
+
+  unsigned int values[GROUP_COUNT][GROUP_MAX_VALUES];
+  byte counts[GROUP_COUNT];
+  bool anyDue = false;
+
+  for (byte group = 0; group < GROUP_COUNT; group++) {
+    const Subscription &sub = subs.groups[group];
+    counts[group] = 0;
+
+    if (sub.period == 0 && sub.threshold == 0) {
+      continue;
+    }
+
+    byte count = readGroup(group, values[group]);
+
+    if (count > 0 && subscriptionDue(sub, values[group], count)) {
+      counts[group] = count;
+      anyDue = true;
+    }
+  }
+
+  if (!anyDue) {
+    return;
+  }
+
+  TxQueue &queue = txQueues[link];
+  base64_encoder b64e(queue);
+
+  for (byte group = 0; group < GROUP_COUNT; group++) {
+    if (counts[group] == 0) {
+      continue;
+    }
+
+    Subscription &sub = subs.groups[group];
+
+    sensorgram_encoder<64> e(b64e);
+    e.info.id = GROUP_IDS[group];
+    e.info.sub_id = 0;
+    e.info.inst = 0;
+    e.info.source_id = 1;
+    e.info.source_inst = 0;
+
+    for (byte i = 0; i < counts[group]; i++) {
+      e.encode_uint(values[group][i]);
+      sub.values[i] = values[group][i];
+    }
+
+    e.encode();
+
+    sub.count = counts[group];
+    sub.timer.reset();
+  }
+
+  b64e.close();
+  queue.writebyte('\n');
+  subs.timer.reset();
+}
+
 void deviceKilled(Device &device) {
   if (meanBootDelta(Record::bootLogs[device.port], 3) < 240) {
     device.setStartDelay(300000);
@@ -924,7 +2271,16 @@ void checkPinHB() {
 
 extern ExternalEEPROM EEPROM;
 
+// the core's delay() calls yield() while it waits, as does the LED wait in
+// updateLEDs(). that's most of each loop, so the supply is checked every
+// millisecond or so.
+void yield() { LoadShed::poll(); }
+
 void setup() {
+  Memory::paintStack();
+  Logger::setOutput(queueLogLine);
+  setStopMessageSender(sendStopMessage);
+
   watchdogReset();
   watchdogEnable(16000);
   watchdogReset();
@@ -964,22 +2320,67 @@ void setup() {
     Wagman::init();
   }
 
+  if (!Record::loadPortConfigs()) {
+    Logger::begin("config");
+    Logger::log("invalid port config. saved defaults.");
+    Logger::end();
+  }
+
+  SoftClock::init();
+  ClockTrim::init();
+  Energy::init();
+
   Wagman::getTime(setupTime);
   Record::setLastBootTime(setupTime);
   Record::incrementBootCount();
 
+  time_t outageStart, outageEnd;
+  bool outage = Wagman::getPowerFail(outageStart, outageEnd);
+  unsigned long outageDuration = 0;
+
+  if (outage) {
+    if (outageEnd > outageStart) {
+      outageDuration = outageEnd - outageStart;
+    }
+
+    Record::outageLog.addEntry(outageStart, outageEnd);
+
+    Logger::beginEvent("outage");
+    Logger::log("power was out for ");
+    Logger::log(outageDuration);
+    Logger::log("s");
+    Logger::end();
+  }
+
+  watchdogReset();
+  Wagman::sampleSensors();
+
+  // only run the self test on a cold start, not after a brownout or reset.
+  if (outage && outageDuration >= BROWNOUT_DURATION) {
+    watchdogReset();
+    checkSensors();
+  }
+
   watchdogReset();
   setupDevices();
   deviceWantsStart = 0;
 
+  if (outage && outageDuration >= LONG_OUTAGE_DURATION) {
+    staggerDeviceStarts();
+  }
+
+  adoptRunningDevices(outage);
+
   startTimer.reset();
   statusTimer.reset();
+  setupSubscriptions();
+  PROFILE_INIT();
 
   shouldResetSystem = false;
   shouldResetTimeout = 0;
 
-  if (Wagman::Clock.get() < BUILD_TIME) {
-    Wagman::Clock.set(BUILD_TIME);
+  if (setupTime < BUILD_TIME) {
+    Wagman::setTime(BUILD_TIME);
   }
 
   watchdogReset();
@@ -987,48 +2388,87 @@ void setup() {
   pinMode(CS_HB_PIN, INPUT_PULLUP);
   Timer3.attachInterrupt(checkPinHB).setFrequency(10).start();
 
-  devices[0].start();
+  // keep supervising the node controller if it was resumed or adopted.
+  if (devices[0].getState() != STATE_STARTED &&
+      devices[0].getState() != STATE_STOPPING) {
+    devices[0].start();
+  }
 }
 
-void setupDevices() {
-  devices[0].name = "nc";
-  devices[0].port = 0;
-  devices[0].bootSelector = 0;
-  devices[0].primaryMedia = MEDIA_EMMC;
-  devices[0].secondaryMedia = MEDIA_SD;
-  devices[0].watchHeartbeat = true;
-  devices[0].watchCurrent = false;
-
-  devices[1].name = "gn";
-  devices[1].port = 1;
-  devices[1].bootSelector = 1;
-  devices[1].primaryMedia = MEDIA_EMMC;
-  devices[1].secondaryMedia = MEDIA_SD;
-  devices[1].watchHeartbeat = true;
-  devices[1].watchCurrent = false;
-
-  devices[2].name = "cs";
-  devices[2].port = 2;
-  devices[2].primaryMedia = MEDIA_EMMC;
-  devices[2].secondaryMedia = MEDIA_SD;
-  devices[2].watchHeartbeat = true;
-  devices[2].watchCurrent = false;
-
-  devices[3].name = "x1";
-  devices[3].port = 3;
-  devices[3].watchHeartbeat = false;
-  devices[3].watchCurrent = false;
-
-  devices[4].name = "x2";
-  devices[4].port = 4;
-  devices[4].watchHeartbeat = false;
-  devices[4].watchCurrent = false;
+// reconciles devices with what's actually powered after a Wagman reset, so
+// running devices are supervised instead of being started again. the RTC
+// checkpoint is used where it's available. otherwise devices whose relay
+// journal and port current both say they're on are adopted. after a power
+// outage those are booting again, so they're adopted as booting.
+void adoptRunningDevices(bool powerFailed) {
+  byte resumed = Checkpoint::restore(devices, DEVICE_COUNT);
+  byte adopted = 0;
+
+  for (byte i = 0; i < DEVICE_COUNT; i++) {
+    if (devices[i].adopt(powerFailed)) {
+      adopted++;
+    }
+  }
+
+  if (resumed > 0 || adopted > 0) {
+    Logger::begin("reconcile");
+    Logger::log("resumed ");
+    Logger::log(resumed);
+    Logger::log(" adopted ");
+    Logger::log(adopted);
+    Logger::log(" devices");
+    Logger::end();
+  }
+}
 
+void setupDevices() {
   for (byte i = 0; i < DEVICE_COUNT; i++) {
+    const Board::PortDescriptor &desc = BOARD.ports[i];
+
+    devices[i].name = desc.name;
+    devices[i].port = i;
+    devices[i].bootSelector = desc.bootSelector;
+    devices[i].primaryMedia = desc.primaryMedia;
+    devices[i].secondaryMedia = desc.secondaryMedia;
+    devices[i].watchHeartbeat = desc.watchHeartbeat;
+    devices[i].watchCurrent = desc.watchCurrent;
+    devices[i].keepEnabled = desc.keepEnabled;
     devices[i].init();
   }
 }
 
+// holds back every device but the node controller by a delay derived from the
+// Wagman ID, so the nodes at a site are spread out coming back from an outage.
+// the relays are latched, so devices which were on came back on with the
+// Wagman. those are cut, rather than adopted, so they wait out the delay too.
+void staggerDeviceStarts() {
+  byte id[8];
+  Wagman::getID(id);
+
+  unsigned long hash = 5381;
+
+  for (byte i = 0; i < 8; i++) {
+    hash = (hash * 33) ^ id[i];
+  }
+
+  unsigned long stagger = hash % MAX_OUTAGE_STAGGER;
+
+  for (byte i = 1; i < DEVICE_COUNT; i++) {
+    devices[i].setStartDelay(stagger);
+
+    if (Record::getRelayState(i) != RELAY_OFF) {
+      watchdogReset();
+      devices[i].kill();
+    }
+  }
+
+  Logger::beginEvent("outage");
+  Logger::log("staggering start by ");
+  Logger::log(stagger / 1000);
+  Logger::log("s");
+  Logger::end();
+}
+
 void checkSensors() {
   checkCurrentSensors();
   checkThermistors();
@@ -1149,6 +2589,7 @@ void startNextDevice() {
   // if we've asked for a specific device, start that device.
   if (Wagman::validPort(deviceWantsStart)) {
     startTimer.reset();
+    LoadShed::release(deviceWantsStart);
     devices[deviceWantsStart].start();
     deviceWantsStart = 255;
     return;
@@ -1158,7 +2599,7 @@ void startNextDevice() {
   // case, we do it again here.
   if (startTimer.exceeds(60000)) {
     for (byte i = 0; i < DEVICE_COUNT; i++) {
-      if (devices[i].canStart()) {  // include !started in canStart() call.
+      if (devices[i].canStart() && LoadShed::canStart(i)) {
         startTimer.reset();
         devices[i].start();
         // showBootLog(Record::bootLogs[i]);
@@ -1195,73 +2636,89 @@ void doResetBlink() {
   delay(200);
 }
 
-void doResetAll() {
-  for (int i = 0; i < 6; i++) {
-    watchdogReset();
-
-    Logger::begin("nc");
-    Logger::log("stopping");
-    Logger::end();
-
-    Logger::begin("gn");
-    Logger::log("stopping");
-    Logger::end();
-
-    doResetBlink();
-
-    delay(10000);
+void updateResetAll() {
+  if (!ResetAll::update(devices, DEVICE_COUNT)) {
+    return;
   }
 
-  pinMode(NC_AUTO_DISABLE, OUTPUT);
+  drainTxQueues();
+  delay(100);
 
-  for (int i = 0; i < 5; i++) {
-    watchdogReset();
-    Wagman::setRelay(i, false);
-    doResetBlink();
-    delay(5000);
-  }
+  // everything is about to lose power, so nothing should be resumed.
+  Checkpoint::clear();
+  Energy::save();
+  pinMode(BOARD.ncAutoDisablePin, OUTPUT);
 
-  for (int i = 0; i < 20; i++) {
-    watchdogReset();
-    doResetBlink();
-    delay(1000);
+  for (auto pin : BOARD.masterResetPins) {
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
   }
 
-  pinMode(MR1, OUTPUT);
-  pinMode(MR2, OUTPUT);
-  digitalWrite(MR1, LOW);
-  digitalWrite(MR2, LOW);
-
   for (;;) {
     doResetBlink();
   }
 }
 
 void loop() {
+  PROFILE_LOOP();
   watchdogReset();
 
   // don't bother starting any new devices once we've decided to reset
-  if (!shouldResetSystem) {
+  if (!shouldResetSystem && !ResetAll::active()) {
+    PROFILE_SECTION(Profiler::SECTION_START);
     startNextDevice();
   }
 
   watchdogReset();
 
-  for (byte i = 0; i < DEVICE_COUNT; i++) {
-    devices[i].update();
+  {
+    PROFILE_SECTION(Profiler::SECTION_SAMPLE);
+    Wagman::sampleSensors();
+    SoftClock::update();
+  }
+
+  watchdogReset();
+
+  {
+    PROFILE_SECTION(Profiler::SECTION_DEVICES);
+
+    for (byte i = 0; i < DEVICE_COUNT; i++) {
+      devices[i].update();
+    }
+
+    Checkpoint::update(devices, DEVICE_COUNT);
+    History::update(devices, DEVICE_COUNT);
+    Anomaly::update(devices, DEVICE_COUNT);
+    Energy::update();
+
+    // shed ports stay off once a reset is pending.
+    LoadShed::update(devices, DEVICE_COUNT,
+                     !shouldResetSystem && !ResetAll::active());
+  }
+
+  {
+    PROFILE_SECTION(Profiler::SECTION_COMMANDS);
+    processCommands(SerialUSB, msgbuf, true, 0, LINK_SERIALUSB);
+    processCommands(Serial1, msgbuf1, true, 0, LINK_SERIAL1);
+    processCommands(Serial2, msgbuf2, false, 1, LINK_SERIAL2);
+    processCommands(Serial3, msgbuf3, false, 2, LINK_SERIAL3);
+    processCommands(Serial, msgbuf0, false, 0, LINK_SERIAL);
   }
 
-  processCommands(SerialUSB, msgbuf, true, 0);
-  processCommands(Serial1, msgbuf1, true, 0);
-  processCommands(Serial2, msgbuf2, false, 1);
-  processCommands(Serial3, msgbuf3, false, 2);
-  processCommands(Serial, msgbuf0, false, 0);
+  {
+    PROFILE_SECTION(Profiler::SECTION_PUSH);
+
+    for (byte link = 0; link < LINK_COUNT; link++) {
+      pushSubscriptions(link);
+    }
 
-  if (shouldResetAll) {
-    doResetAll();
+    drainTxQueues();
   }
 
+  updateResetAll();
+
   if (statusTimer.exceeds(60000)) {
+    PROFILE_SECTION(Profiler::SECTION_STATUS);
     statusTimer.reset();
     watchdogReset();
     logStatus();
@@ -1274,17 +2731,18 @@ void loop() {
   watchdogReset();
   watchdogReset();
 
-  bool devicePowered[5];
-
-  unsigned int currentLevel[5];
-  const unsigned int currentBaseline[5] = {200, 200, 150, 200, 200};
-
-  for (int i = 0; i < 5; i++) {
-    currentLevel[i] = Wagman::getCurrent(i);
+  {
+    PROFILE_SECTION(Profiler::SECTION_LEDS);
+    updateLEDs();
   }
+}
 
+void updateLEDs() {
+  bool devicePowered[5];
+
+  const SensorSample &sample = Wagman::getSample();
   for (int i = 0; i < 5; i++) {
-    devicePowered[i] = currentLevel[i] >= currentBaseline[i];
+    devicePowered[i] = sample.ports[i].current >= BOARD.ports[i].poweredCurrent;
   }
 
   bool shouldBlink[5] = {false, false, false, false, false};
@@ -1305,7 +2763,15 @@ void loop() {
     }
   }
 
-  delay(50);
+  // keep the serial ports busy while the LEDs are blinking. this wait doesn't
+  // go through delay(), so it yields itself to keep polling the supply.
+  DurationTimer blinkTimer;
+  blinkTimer.reset();
+
+  while (!blinkTimer.exceeds(50)) {
+    drainTxQueues();
+    yield();
+  }
 
   Wagman::setLED(0, HIGH);
 
@@ -1322,6 +2788,7 @@ void loop() {
 
 void resetSystem() {
   watchdogReset();
+  Energy::save();
 
   for (;;) {
     for (byte i = 0; i < 5; i++) {
@@ -1340,7 +2807,7 @@ void resetSystem() {
 
 void logStatus() {
   // send batched status sensorgrams
-  stream_writer<typeof(SerialUSB)> w(SerialUSB);
+  TxQueue &w = txQueues[LINK_SERIALUSB];
   base64_encoder b64e(w);
   commandID(b64e);
 
@@ -1361,6 +2828,7 @@ void logStatus() {
   }
 
   commandEnvironment(b64e);
+  commandMemory(b64e);
 
   b64e.close();
   w.writebyte('\n');
@@ -0,0 +1,479 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "Bytes.h"
+#include "Device.h"
+#include "History.h"
+#include "Wagman.h"
+
+// historytest - round trips sensor readings through the history blocks.
+//
+// Synthetic series for every channel are fed to the firmware's History module
+// a sample at a time, the way the loop does. Every block still held is then
+// read back through the export cursor, a part at a time as the history
+// command sends it, and decoded by an independent decoder written from
+// history_layout.md. The decoded samples must be exactly the most recent ones
+// fed in. With -c it exits non-zero if any of that fails.
+
+bool logging = false;
+
+static const time_t EPOCH = 1767225600;
+
+// History only needs these outside of itself.
+static SensorSample sample;
+static unsigned long heartbeatAge[Board::PORT_COUNT];
+
+namespace Wagman {
+const SensorSample &getSample() { return sample; }
+
+void getTime(time_t &time) { time = EPOCH + simMillis / 1000; }
+};  // namespace Wagman
+
+unsigned long Device::timeSinceHeartbeat() const { return heartbeatAge[port]; }
+
+static Device devices[Board::PORT_COUNT];
+
+typedef std::mt19937 Random;
+
+static const byte CHANNELS = History::CHANNEL_COUNT;
+
+// a sample as fed in, or as decoded.
+struct Sample {
+  time_t time;
+  unsigned int values[CHANNELS];
+
+  bool operator==(const Sample &other) const {
+    return time == other.time &&
+           memcmp(values, other.values, sizeof(values)) == 0;
+  }
+};
+
+// every sample fed in so far, across scenarios.
+static std::vector<Sample> fed;
+
+// sets the next readings and runs History's update gap seconds later.
+static void feed(const unsigned int *values, unsigned long gap) {
+  simMillis += gap * History::SAMPLE_INTERVAL;
+
+  sample.systemCurrent = values[0];
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    sample.ports[port].current = values[1 + 5 * port];
+    sample.ports[port].voltage = values[2 + 5 * port];
+    sample.ports[port].thermistor = values[3 + 5 * port];
+    heartbeatAge[port] = values[4 + 5 * port] * 1000UL;
+  }
+
+  History::update(devices, Board::PORT_COUNT);
+
+  Sample s;
+  s.time = EPOCH + simMillis / 1000;
+  memcpy(s.values, values, sizeof(s.values));
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    s.values[5 + 5 * port] = devices[port].getState();
+  }
+
+  fed.push_back(s);
+}
+
+// reads bits msb first, like the firmware writes them.
+class BitReader {
+ public:
+  BitReader(const byte *data, unsigned int size)
+      : data(data), size(size), bit(0), overrun(false) {}
+
+  unsigned long read(byte count) {
+    unsigned long value = 0;
+
+    while (count > 0) {
+      count--;
+
+      if (bit / 8 >= size) {
+        overrun = true;
+        return 0;
+      }
+
+      value = (value << 1) | ((data[bit / 8] >> (7 - bit % 8)) & 1);
+      bit++;
+    }
+
+    return value;
+  }
+
+  // a signed code of count bits.
+  long readSigned(byte count) {
+    unsigned long value = read(count);
+
+    if (value & (1UL << (count - 1))) {
+      return (long)value - (1L << count);
+    }
+
+    return value;
+  }
+
+  const byte *data;
+  unsigned int size;
+  unsigned long bit;
+  bool overrun;
+};
+
+// delta-of-delta codes, from history_layout.md.
+static long readCode(BitReader &r) {
+  if (r.read(1) == 0) {
+    return 0;
+  }
+  if (r.read(1) == 0) {
+    return r.readSigned(3);
+  }
+  if (r.read(1) == 0) {
+    return r.readSigned(6);
+  }
+  if (r.read(1) == 0) {
+    return r.readSigned(10);
+  }
+  return r.readSigned(18);
+}
+
+// channel groups: the system current, then the 5 channels of each port.
+static byte groupStart(byte group) {
+  return group == 0 ? 0 : 1 + 5 * (group - 1);
+}
+
+static byte groupEnd(byte group) { return group == 0 ? 1 : 1 + 5 * group; }
+
+// decodes a whole block. returns false if it's malformed.
+static bool decodeBlock(const byte *block, unsigned int used,
+                        unsigned long number, std::vector<Sample> &samples) {
+  const unsigned int HEADER_SIZE = 12 + 2 * CHANNELS;
+
+  if (used < HEADER_SIZE || Bytes::getUint(block, 4) != number ||
+      Bytes::getUint(block + 10, 2) != used) {
+    return false;
+  }
+
+  unsigned int count = Bytes::getUint(block + 8, 2);
+  Sample s;
+  long deltas[CHANNELS];
+
+  s.time = Bytes::getUint(block + 4, 4);
+
+  for (byte i = 0; i < CHANNELS; i++) {
+    s.values[i] = Bytes::getUint(block + 12 + 2 * i, 2);
+    deltas[i] = 0;
+  }
+
+  samples.push_back(s);
+
+  BitReader r(block + HEADER_SIZE, used - HEADER_SIZE);
+
+  for (unsigned int n = 1; n < count; n++) {
+    s.time += r.read(1) == 0 ? 1 : r.read(6) + 2;
+
+    for (byte group = 0; group <= Board::PORT_COUNT; group++) {
+      bool changed = r.read(1);
+
+      for (byte i = groupStart(group); i < groupEnd(group); i++) {
+        deltas[i] += changed ? readCode(r) : 0;
+        s.values[i] += deltas[i];
+      }
+    }
+
+    samples.push_back(s);
+  }
+
+  // only the padding of the last byte may be left over.
+  return !r.overrun && (r.bit + 7) / 8 == r.size;
+}
+
+// reads one block back a part at a time through the export cursor.
+static bool exportBlock(unsigned long number, std::vector<byte> &block,
+                        unsigned long &got) {
+  block.clear();
+
+  for (byte part = 0; part < History::PART_COUNT; part++) {
+    History::Part p;
+
+    if (!History::getPart(number, part, p)) {
+      return false;
+    }
+
+    // the cursor moves to the oldest block when the asked for one is gone.
+    if (part == 0) {
+      got = p.block;
+      number = p.block;
+    }
+
+    if (p.block != number || p.part != part) {
+      return false;
+    }
+
+    block.insert(block.end(), p.data, p.data + p.size);
+  }
+
+  return true;
+}
+
+struct Result {
+  unsigned long blocks;
+  unsigned long decoded;
+  double hours;
+  bool ok;
+};
+
+// decodes every block held and compares them to the latest samples fed in.
+static Result roundTrip() {
+  Result result = {0, 0, 0, true};
+  std::vector<Sample> decoded;
+  std::vector<byte> block;
+
+  unsigned long oldest = History::getOldestBlock();
+  unsigned long newest = History::getNewestBlock();
+
+  for (unsigned long number = oldest; number <= newest; number++) {
+    unsigned long got;
+
+    if (!exportBlock(number, block, got) || got != number ||
+        !decodeBlock(block.data(), block.size(), number, decoded)) {
+      result.ok = false;
+      return result;
+    }
+
+    result.blocks++;
+  }
+
+  result.decoded = decoded.size();
+
+  if (decoded.empty() || decoded.size() > fed.size() ||
+      !std::equal(decoded.begin(), decoded.end(), fed.end() - decoded.size())) {
+    result.ok = false;
+    return result;
+  }
+
+  result.hours = (decoded.back().time - decoded.front().time) / 3600.0;
+  return result;
+}
+
+// a scenario sets every channel of the next sample and the gap before it.
+struct Scenario {
+  const char *name;
+  double hours;
+  void (*next)(Random &random, unsigned int *values, unsigned long &gap);
+  double minHours;  // history held at the end, checked by -c
+};
+
+static unsigned long tick = 0;
+
+static unsigned int clamp(long value) {
+  return value < 0 ? 0 : value > 0xffff ? 0xffff : value;
+}
+
+// readings holding steady at typical levels.
+static void steady(Random &random, unsigned int *values, unsigned long &gap) {
+  values[0] = 2400;
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    values[1 + 5 * port] = 300 + 100 * port;
+    values[2 + 5 * port] = 5000;
+    values[3 + 5 * port] = 520;
+    values[4 + 5 * port] = 3;
+  }
+
+  gap = 1;
+}
+
+// readings drifting smoothly, with the heartbeat ages counting up.
+static void drifting(Random &random, unsigned int *values,
+                     unsigned long &gap) {
+  tick++;
+  values[0] = 2400 + tick / 30;
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    values[1 + 5 * port] = 300 + 100 * port + tick / 60;
+    values[2 + 5 * port] = 5000 - tick / 600;
+    values[3 + 5 * port] = 520 + tick / 120;
+    values[4 + 5 * port] = tick % 30;
+  }
+
+  gap = 1;
+}
+
+// every active reading, the system's and those of the nc, gn and cs ports,
+// flickering by a count from second to second.
+static const byte ACTIVE_PORTS = 3;
+
+static void flickering(Random &random, unsigned int *values,
+                       unsigned long &gap) {
+  std::uniform_int_distribution<int> flicker(-1, 1);
+
+  steady(random, values, gap);
+  values[0] += flicker(random);
+
+  for (byte port = 0; port < ACTIVE_PORTS; port++) {
+    values[1 + 5 * port] += flicker(random);
+    values[2 + 5 * port] += flicker(random);
+    values[3 + 5 * port] += flicker(random);
+  }
+}
+
+// random walks with jumps of every code size, and gaps of 1 to 80 seconds.
+// the gaps over a minute start new blocks.
+static void jumping(Random &random, unsigned int *values,
+                    unsigned long &gap) {
+  static unsigned int last[CHANNELS];
+  static const long STEPS[] = {0, 3, 30, 500, 20000, 65535};
+  std::uniform_int_distribution<int> size(0, 5);
+  std::uniform_int_distribution<int> sign(0, 1);
+  std::uniform_int_distribution<int> gaps(1, 80);
+  std::uniform_real_distribution<double> chance(0, 1);
+
+  for (byte i = 0; i < CHANNELS; i++) {
+    long step = STEPS[size(random)];
+    std::uniform_int_distribution<long> change(0, step);
+    long value = sign(random) ? last[i] + change(random)
+                              : (long)last[i] - change(random);
+
+    last[i] = values[i] = clamp(value);
+  }
+
+  gap = chance(random) < 0.9 ? 1 : gaps(random);
+}
+
+// every other channel swinging between 0 and 65535 every sample, so their
+// changes take the largest code, with the rest holding steady. the states
+// come from the devices whatever the scenario sets.
+static void extremes(Random &random, unsigned int *values,
+                     unsigned long &gap) {
+  tick++;
+  steady(random, values, gap);
+
+  for (byte i = 0; i < CHANNELS; i += 2) {
+    values[i] = (tick % 2) ? 0xffff : 0;
+  }
+}
+
+static const Scenario SCENARIOS[] = {
+    {"steady", 12, steady, 8.5},
+    {"drifting", 12, drifting, 4.5},
+    {"flicker", 6, flickering, 1},
+    {"jumping", 6, jumping, 0},
+    {"extremes", 2, extremes, 0},
+};
+
+static const unsigned int SCENARIO_COUNT =
+    sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+
+// the cursor after the ring has wrapped: blocks which are gone give the
+// oldest block, blocks and parts which don't exist yet give nothing.
+static bool checkCursor() {
+  History::Part p;
+  unsigned long oldest = History::getOldestBlock();
+  unsigned long newest = History::getNewestBlock();
+
+  if (newest - oldest != History::BLOCK_COUNT - 1) {
+    return false;
+  }
+
+  if (!History::getPart(0, 2, p) || p.block != oldest || p.part != 0) {
+    return false;
+  }
+
+  if (!History::getPart(oldest - 1, 3, p) || p.block != oldest ||
+      p.part != 0) {
+    return false;
+  }
+
+  if (History::getPart(newest + 1, 0, p) ||
+      History::getPart(newest, History::PART_COUNT, p)) {
+    return false;
+  }
+
+  // the block being written is exported as far as it goes.
+  if (!History::getPart(newest, 0, p) || p.block != newest || p.size == 0) {
+    return false;
+  }
+
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: historytest [options]\n"
+          "  -s seed       random seed (1)\n"
+          "  -c            exit non-zero if a round trip fails\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  unsigned long seed = 1;
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:c")) != -1) {
+    switch (opt) {
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        check = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  Random random(seed);
+  bool ok = true;
+
+  for (byte port = 0; port < Board::PORT_COUNT; port++) {
+    devices[port].port = port;
+  }
+
+  printf("%-9s %8s %7s %7s %8s %6s\n", "scenario", "samples", "blocks",
+         "held", "hours", "");
+
+  for (unsigned int i = 0; i < SCENARIO_COUNT; i++) {
+    const Scenario &scenario = SCENARIOS[i];
+    unsigned long samples = scenario.hours * 3600;
+    unsigned long first = History::getNewestBlock();
+    unsigned int values[CHANNELS];
+    unsigned long gap;
+
+    // start each scenario in a block of its own.
+    simMillis += 600000;
+    tick = 0;
+
+    for (unsigned long n = 0; n < samples; n++) {
+      scenario.next(random, values, gap);
+      feed(values, gap);
+    }
+
+    Result result = roundTrip();
+    bool passed = result.ok && result.hours >= scenario.minHours;
+
+    printf("%-9s %8lu %7lu %7lu %8.2f %6s\n", scenario.name, samples,
+           History::getNewestBlock() - first, result.blocks, result.hours,
+           result.ok ? (passed ? "ok" : "SHORT") : "CORRUPT");
+
+    ok = passed && ok;
+  }
+
+  bool cursor = checkCursor();
+  printf("\ncursor after wrapping: %s\n", cursor ? "ok" : "FAIL");
+  ok = cursor && ok;
+
+  if (check) {
+    printf("\n%s\n", ok ? "ok" : "FAIL");
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Profiler.h"
+
+#ifndef PROFILER
+#error "profilertest must be built with PROFILER defined"
+#endif
+
+// profilertest - checks the firmware's loop profiler on the host.
+//
+// Profiler.cpp is built with PROFILER defined, as it would be on the board,
+// against the simulator's HAL. There the cycle counter is simulated from
+// micros() at 84 cycles a microsecond, so sections are timed by moving the
+// simulated clock. Each case checks which log2 bin samples land in and the
+// values the profile command sends. With -c it exits non-zero if any case
+// fails.
+
+using Profiler::HISTOGRAM_BINS;
+using Profiler::MAX_VALUES;
+
+static const unsigned long CYCLES_PER_MILLI = 84000;
+
+static unsigned int failures = 0;
+
+static void expect(bool ok, const char *name) {
+  printf("%-44s %s\n", name, ok ? "ok" : "FAIL");
+
+  if (!ok) {
+    failures++;
+  }
+}
+
+// the only nonempty bin of a section, or HISTOGRAM_BINS if there isn't
+// exactly one.
+static byte onlyBin(byte section) {
+  const Profiler::Histogram &h = Profiler::getHistogram(section);
+  byte result = HISTOGRAM_BINS;
+
+  for (byte i = 0; i < HISTOGRAM_BINS; i++) {
+    if (h.bins[i] != 0) {
+      if (result != HISTOGRAM_BINS) {
+        return HISTOGRAM_BINS;
+      }
+
+      result = i;
+    }
+  }
+
+  return result;
+}
+
+// bin i holds [2^(i-1), 2^i) cycles, so both ends of each bin are checked.
+static void testBins() {
+  static const struct {
+    unsigned long cycles;
+    byte bin;
+  } CASES[] = {
+      {0, 0},     {1, 1},     {2, 2},     {3, 2},
+      {4, 3},     {7, 3},     {8, 4},     {1000, 10},
+      {1023, 10}, {1024, 11}, {0x7fffffffUL, 31},
+      {0x80000000UL, 32},     {0xffffffffUL, 32},
+  };
+
+  bool ok = true;
+
+  for (auto c : CASES) {
+    Profiler::reset();
+    Profiler::add(Profiler::SECTION_SAMPLE, c.cycles);
+
+    if (onlyBin(Profiler::SECTION_SAMPLE) != c.bin) {
+      printf("  %lu cycles: bin %u, expected %u\n", c.cycles,
+             onlyBin(Profiler::SECTION_SAMPLE), c.bin);
+      ok = false;
+    }
+  }
+
+  expect(ok, "samples land in their log2 bins");
+
+  Profiler::reset();
+  Profiler::add(Profiler::SECTION_SAMPLE, 100);
+  Profiler::add(Profiler::SECTION_SAMPLE, 300);
+  Profiler::add(Profiler::SECTION_SAMPLE, 200);
+
+  const Profiler::Histogram &h =
+      Profiler::getHistogram(Profiler::SECTION_SAMPLE);
+
+  expect(h.count == 3 && h.minCycles == 100 && h.maxCycles == 300 &&
+             h.totalCycles == 600,
+         "count, min, max and total are kept");
+  expect(h.bins[7] == 1 && h.bins[8] == 1 && h.bins[9] == 1,
+         "each sample counts in its own bin");
+  expect(Profiler::getHistogram(Profiler::SECTION_DEVICES).count == 0,
+         "other sections are untouched");
+}
+
+static void testScope() {
+  Profiler::reset();
+
+  {
+    PROFILE_SECTION(Profiler::SECTION_COMMANDS);
+    simMillis += 5;
+  }
+
+  const Profiler::Histogram &h =
+      Profiler::getHistogram(Profiler::SECTION_COMMANDS);
+
+  // 420000 cycles is in [2^18, 2^19).
+  expect(h.count == 1 && h.totalCycles == 5 * CYCLES_PER_MILLI &&
+             onlyBin(Profiler::SECTION_COMMANDS) == 19,
+         "a section is timed at 84 cycles a us");
+}
+
+static void testLoop() {
+  Profiler::reset();
+
+  PROFILE_LOOP();
+  simMillis += 2;
+  PROFILE_LOOP();
+  simMillis += 3;
+  PROFILE_LOOP();
+
+  const Profiler::Histogram &h = Profiler::getHistogram(Profiler::SECTION_LOOP);
+
+  expect(h.count == 2 && h.minCycles == 2 * CYCLES_PER_MILLI &&
+             h.maxCycles == 3 * CYCLES_PER_MILLI,
+         "loop periods start from the second loop");
+
+  Profiler::reset();
+  PROFILE_LOOP();
+
+  expect(Profiler::getHistogram(Profiler::SECTION_LOOP).count == 0,
+         "reset forgets the last loop");
+}
+
+static void testValues() {
+  unsigned long values[MAX_VALUES];
+
+  Profiler::reset();
+
+  byte count = Profiler::getValues(Profiler::SECTION_LEDS, values);
+
+  expect(count == 4 && values[0] == 0 && values[1] == 0 && values[2] == 0 &&
+             values[3] == 0,
+         "an empty section sends four zeros");
+
+  Profiler::add(Profiler::SECTION_LEDS, 0);
+  Profiler::add(Profiler::SECTION_LEDS, 5);
+  Profiler::add(Profiler::SECTION_LEDS, 6);
+  Profiler::add(Profiler::SECTION_LEDS, 20);
+
+  count = Profiler::getValues(Profiler::SECTION_LEDS, values);
+
+  // 0 is bin 0, 5 and 6 are bin 3 and 20 is bin 5, the last sent.
+  static const unsigned long EXPECTED[] = {4, 0, 20, 7, 1, 0, 0, 2, 0, 1};
+  bool same = count == sizeof(EXPECTED) / sizeof(EXPECTED[0]);
+
+  for (byte i = 0; same && i < count; i++) {
+    same = values[i] == EXPECTED[i];
+  }
+
+  expect(same, "values are stats then bins to the last used");
+
+  Profiler::add(Profiler::SECTION_LEDS, 0xffffffffUL);
+  count = Profiler::getValues(Profiler::SECTION_LEDS, values);
+
+  expect(count == MAX_VALUES && values[MAX_VALUES - 1] == 1 &&
+             values[3] == (20 + 0xffffffffULL + 11) / 5,
+         "a full histogram sends every bin");
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: profilertest [options]\n"
+          "  -c            exit non-zero if any case fails\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c")) != -1) {
+    switch (opt) {
+      case 'c':
+        check = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  PROFILE_INIT();
+
+  testBins();
+  testScope();
+  testLoop();
+  testValues();
+
+  if (check) {
+    printf("\n%s\n", failures == 0 ? "ok" : "FAIL");
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,567 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <random>
+
+#include "Board.h"
+#include "Checkpoint.h"
+#include "Device.h"
+#include "LoadShed.h"
+#include "Logger.h"
+#include "Record.h"
+#include "Wagman.h"
+
+// shedsim - runs the load shedding controller through supply sags.
+//
+// The firmware's Device and LoadShed code run against a model of the supply:
+// a source voltage behind a series resistance feeding the Wagman and a
+// constant current load on each port, switched by relays which take a few ms
+// to move. The loop is modelled as the firmware's ADC waits, so the supply is
+// polled from yield() like on the board. Each scenario reports how long the
+// rail was low, how quickly ports were shed and whether they all came back.
+// With -c it exits non-zero if the targets below are missed.
+
+using Board::BOARD;
+using Board::PORT_COUNT;
+
+bool logging = false;
+bool logEvents = false;
+unsigned int heartbeatCounters[5];
+DurationTimer startTimer;
+
+namespace Checkpoint {
+void markDirty(bool urgent) {}
+};  // namespace Checkpoint
+
+static const unsigned long MINUTE = 60000L;
+static const unsigned long HOUR = 60 * MINUTE;
+
+// the Wagman is assumed to brown out once the rail has been under this for
+// longer than its hold up capacitance lasts.
+static const double BROWNOUT_VOLTAGE = 4500;  // mV
+static const unsigned long BROWNOUT_TIME = 5;
+
+static const double WAGMAN_CURRENT = 150;  // mA
+static const double LOAD_CURRENTS[PORT_COUNT] = {1200, 800, 300, 1500, 1500};
+
+static const unsigned long RELAY_OPERATE_TIME = 10;
+static const unsigned long RELAY_RELEASE_TIME = 5;
+
+static const double NOISE = 5;  // mV
+
+// shed delays are timed from when the rail is clearly under SHED_VOLTAGE, past
+// what the noise on the readings could hide.
+static const double LOW_MARGIN = 3 * NOISE;  // mV
+
+// targets checked by -c.
+static const unsigned long MAX_VOLTAGE_SHED_DELAY = 10;
+static const unsigned long MAX_CURRENT_SHED_DELAY = 100;
+static const unsigned long MAX_FLAP_RESTORES = 12;
+
+typedef std::mt19937 Random;
+
+struct Scenario {
+  const char *name;
+  const char *description;
+  unsigned long duration;
+  double resistance;  // ohms
+
+  // source voltage in mV and extra load on a port in mA at a time in ms.
+  double (*source)(unsigned long t);
+  double (*surge)(byte port, unsigned long t);
+
+  bool expectSheds;
+  bool expectRestored;  // every port is back on at the end
+};
+
+static double noSurge(byte port, unsigned long t) { return 0; }
+
+static double steadySource(unsigned long t) { return 5700; }
+
+// 1 ms dips of a volt every 10 s, like a motor starting elsewhere.
+static double dipSource(unsigned long t) {
+  return (t % 10000 == 5000) ? 4700 : 5700;
+}
+
+static double ramp(unsigned long t, unsigned long start, unsigned long length,
+                   double from, double to) {
+  if (t <= start) {
+    return from;
+  }
+  if (t >= start + length) {
+    return to;
+  }
+  return from + (to - from) * (t - start) / length;
+}
+
+// falls 600 mV in 100 ms for 20 minutes, like a battery taking a heavy load.
+static double sagSource(unsigned long t) {
+  if (t < 25 * MINUTE) {
+    return ramp(t, 5 * MINUTE, 100, 5700, 5100);
+  }
+  return ramp(t, 25 * MINUTE, 1000, 5100, 5700);
+}
+
+// a discharging battery falling 700 mV over 30 minutes, then charged again.
+static double slowSagSource(unsigned long t) {
+  if (t < 45 * MINUTE) {
+    return ramp(t, 5 * MINUTE, 30 * MINUTE, 5700, 5000);
+  }
+  return ramp(t, 45 * MINUTE, 5 * MINUTE, 5000, 5700);
+}
+
+// a supply which can only just run everything but the expansion ports.
+static double marginalSource(unsigned long t) { return 5220; }
+
+// x1 stalls and draws 5 A for 2 minutes.
+static double overloadSurge(byte port, unsigned long t) {
+  return (port == 3 && t >= 5 * MINUTE && t < 7 * MINUTE) ? 3500 : 0;
+}
+
+static const Scenario SCENARIOS[] = {
+    {"steady", "5.7 V source", HOUR, 0.12, steadySource, noSurge, false,
+     true},
+    {"dips", "1 ms dips to 4.7 V every 10 s", HOUR, 0.12, dipSource, noSurge,
+     false, true},
+    {"sag", "5.7 V to 5.1 V in 100 ms for 20 minutes", HOUR, 0.12, sagSource,
+     noSurge, true, true},
+    {"slow-sag", "5.7 V to 5.0 V over 30 minutes and back", 2 * HOUR, 0.12,
+     slowSagSource, noSurge, true, true},
+    {"overload", "x1 draws 5 A for 2 minutes on a stiff supply", HOUR, 0.02,
+     steadySource, overloadSurge, true, true},
+    {"marginal", "5.22 V source, too weak for every port", 2 * HOUR, 0.12,
+     marginalSource, noSurge, true, false},
+};
+
+static const unsigned int SCENARIO_COUNT =
+    sizeof(SCENARIOS) / sizeof(SCENARIOS[0]);
+
+// the supply and loads, stepped a ms at a time.
+struct Model {
+  const Scenario *scenario;
+  Random random;
+  std::normal_distribution<double> normal;
+
+  unsigned long now;  // next ms to step
+  bool closed[PORT_COUNT];
+  bool target[PORT_COUNT];
+  unsigned long moveAt[PORT_COUNT];
+
+  double voltage;  // mV
+  double current;  // mA
+
+  // results
+  double lowest;
+  unsigned long lowTime;  // ms under SHED_VOLTAGE
+  unsigned long brownouts;
+  unsigned long brownoutRun;
+  unsigned long lowSince;  // start of the current dip under the margin
+  bool lowPending;         // no shed yet in the current dip
+  unsigned long worstVoltageDelay;
+  unsigned long overSince;
+  bool overPending;
+  unsigned long worstCurrentDelay;
+  unsigned long sheds;
+  unsigned long restores;
+  byte everShed;
+
+  void reset(const Scenario &s, unsigned long seed) {
+    scenario = &s;
+    random.seed(seed);
+    now = simMillis;
+    voltage = 0;
+    current = 0;
+    lowest = 1e9;
+    lowTime = 0;
+    brownouts = 0;
+    brownoutRun = 0;
+    lowPending = false;
+    worstVoltageDelay = 0;
+    overPending = false;
+    worstCurrentDelay = 0;
+    sheds = 0;
+    restores = 0;
+    everShed = 0;
+
+    for (byte port = 0; port < PORT_COUNT; port++) {
+      closed[port] = false;
+      target[port] = false;
+    }
+  }
+
+  void setRelay(byte port, bool on) {
+    if (target[port] == on) {
+      return;
+    }
+
+    target[port] = on;
+    moveAt[port] = simMillis + (on ? RELAY_OPERATE_TIME : RELAY_RELEASE_TIME);
+  }
+
+  void step() {
+    unsigned long t = now - start;
+
+    for (byte port = 0; port < PORT_COUNT; port++) {
+      if (closed[port] != target[port] && now >= moveAt[port]) {
+        closed[port] = target[port];
+      }
+    }
+
+    current = WAGMAN_CURRENT;
+
+    for (byte port = 0; port < PORT_COUNT; port++) {
+      if (closed[port]) {
+        current += LOAD_CURRENTS[port] + scenario->surge(port, t);
+      }
+    }
+
+    voltage = scenario->source(t) - scenario->resistance * current;
+    lowest = min(lowest, voltage);
+
+    if (voltage < BROWNOUT_VOLTAGE) {
+      brownoutRun++;
+
+      if (brownoutRun == BROWNOUT_TIME + 1) {
+        brownouts++;
+      }
+    } else {
+      brownoutRun = 0;
+    }
+
+    if (voltage < LoadShed::SHED_VOLTAGE) {
+      lowTime++;
+    } else {
+      lowPending = false;
+    }
+
+    if (voltage < LoadShed::SHED_VOLTAGE - LOW_MARGIN && !lowPending &&
+        sheddable()) {
+      lowPending = true;
+      lowSince = now;
+    }
+
+    if (current > LoadShed::SHED_CURRENT) {
+      if (!overPending && sheddable()) {
+        overPending = true;
+        overSince = now;
+      }
+    } else {
+      overPending = false;
+    }
+
+    // what the port voltage pins read.
+    for (byte port = 0; port < PORT_COUNT; port++) {
+      double reading = closed[port] ? voltage + NOISE * normal(random) : 0;
+      simAnalog[BOARD.ports[port].voltagePin] =
+          max(0L, lround(reading * 1000 / BOARD.ports[port].voltageScale));
+    }
+
+    now++;
+  }
+
+  // whether any powered port could be shed.
+  bool sheddable() const {
+    for (byte port = 0; port < PORT_COUNT; port++) {
+      if (closed[port] && BOARD.ports[port].shedPriority != Board::NEVER_SHED) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void onShed(byte port) {
+    sheds++;
+    everShed |= 1 << port;
+
+    if (lowPending) {
+      worstVoltageDelay = max(worstVoltageDelay, simMillis - lowSince);
+      lowPending = false;
+    }
+
+    if (overPending) {
+      worstCurrentDelay = max(worstCurrentDelay, simMillis - overSince);
+      overPending = false;
+    }
+  }
+
+  void advance() {
+    while (now <= simMillis) {
+      step();
+    }
+  }
+
+  unsigned long start;
+};
+
+static Model model;
+static Device devices[PORT_COUNT];
+static SensorSample sample;
+static bool shedding = true;
+
+void yield() {
+  model.advance();
+
+  if (shedding) {
+    LoadShed::poll();
+  }
+}
+
+namespace Wagman {
+
+void setRelay(int port, int mode) {
+  model.setRelay(port, mode);
+}
+
+void shedRelay(int port) {
+  model.onShed(port);
+  model.setRelay(port, false);
+}
+
+byte getBootMedia(byte selector) { return MEDIA_SD; }
+
+void setBootMedia(byte selector, byte media) {}
+
+bool validPort(byte port) { return port < PORT_COUNT; }
+
+bool validBootSelector(byte selector) {
+  return selector < Board::BOOT_SELECTOR_COUNT;
+}
+
+static bool converting = false;
+
+// each MCP3428 conversion waits 80 ms in delay() and then reads the result
+// over I2C for about 2 ms without yielding.
+static unsigned int readADC(double value) {
+  converting = true;
+  delay(80);
+  simMillis += 2;
+  model.advance();
+  converting = false;
+  return lround(value);
+}
+
+// the 12 bit system current readings wait 5 ms, and read 16 count steps.
+bool sampleFastCurrent() {
+  if (converting) {
+    return false;
+  }
+
+  converting = true;
+  delay(5);
+  simMillis += 1;
+  model.advance();
+  converting = false;
+
+  sample.fastCurrent = lround(model.current / 16) * 16;
+  sample.fastCurrentMillis = millis();
+  return true;
+}
+
+void sampleSensors() {
+  sampleFastCurrent();
+  sample.systemCurrent = readADC(model.current / 16) * 16;
+  sampleFastCurrent();
+
+  for (byte port = 0; port < PORT_COUNT; port++) {
+    double current = 0;
+
+    if (model.closed[port]) {
+      current = LOAD_CURRENTS[port] +
+                model.scenario->surge(port, simMillis - model.start);
+    }
+
+    sample.ports[port].current = readADC(max(current, 10.0));
+    sampleFastCurrent();
+    sample.ports[port].voltage = simAnalog[BOARD.ports[port].voltagePin];
+  }
+
+  sample.sampleMillis = millis();
+}
+
+const SensorSample &getSample() { return sample; }
+
+bool portIdle(byte port) {
+  return sample.ports[port].current < BOARD.ports[port].poweredCurrent;
+}
+
+bool portPowered(byte port) {
+  return sample.ports[port].current >= BOARD.ports[port].poweredCurrent;
+}
+
+void getTime(time_t &time) { time = 1767225600 + simMillis / 1000; }
+
+};  // namespace Wagman
+
+static void setupDevices() {
+  if (!Record::initialized()) {
+    Record::init();
+  }
+
+  Record::loadPortConfigs();
+
+  for (byte i = 0; i < PORT_COUNT; i++) {
+    const Board::PortDescriptor &desc = BOARD.ports[i];
+
+    devices[i].name = desc.name;
+    devices[i].port = i;
+    devices[i].bootSelector = desc.bootSelector;
+    devices[i].primaryMedia = desc.primaryMedia;
+    devices[i].secondaryMedia = desc.secondaryMedia;
+
+    // the devices are just loads here, so nothing but shedding stops them.
+    devices[i].watchHeartbeat = false;
+    devices[i].watchCurrent = false;
+    devices[i].keepEnabled = desc.keepEnabled;
+    devices[i].init();
+    devices[i].enable();
+    devices[i].start();
+  }
+}
+
+// the parts of the firmware's loop which matter to shedding. restores are
+// started by LoadShed itself, so the start queue isn't modelled.
+static void loop() {
+  if (shedding) {
+    LoadShed::poll();
+  }
+
+  Wagman::sampleSensors();
+
+  for (byte i = 0; i < PORT_COUNT; i++) {
+    devices[i].update();
+  }
+
+  if (shedding) {
+    LoadShed::update(devices, PORT_COUNT, true);
+  }
+
+  // commands and status, with a few ms of I2C between yields.
+  delay(10);
+  simMillis += 3;
+  model.advance();
+}
+
+struct Result {
+  bool ok;
+  unsigned long brownouts;
+};
+
+static Result run(const Scenario &scenario, bool check) {
+  simMillis += HOUR;
+  model.reset(scenario, 1);
+  model.start = simMillis;
+
+  // the firmware starts devices from the loop, after LoadShed's first update.
+  if (shedding) {
+    LoadShed::update(devices, PORT_COUNT, true);
+  }
+
+  setupDevices();
+
+  unsigned long restoresBefore = LoadShed::getRestoreCount();
+  unsigned long shedsBefore = LoadShed::getShedCount();
+
+  while (simMillis - model.start < scenario.duration) {
+    loop();
+  }
+
+  unsigned long restores = LoadShed::getRestoreCount() - restoresBefore;
+  unsigned long sheds = LoadShed::getShedCount() - shedsBefore;
+  byte shed = shedding ? LoadShed::getShedPorts() : 0;
+
+  printf("%-9s %7.0f %7lu %5lu %6lu %5lu %6lu %6lu  %02x %02x\n",
+         scenario.name, model.lowest, model.lowTime, model.brownouts, sheds,
+         restores, model.worstVoltageDelay, model.worstCurrentDelay,
+         model.everShed, shed);
+
+  Result result = {true, model.brownouts};
+
+  if (!check || !shedding) {
+    return result;
+  }
+
+  if (model.brownouts > 0 || (model.everShed & 1) ||
+      model.worstVoltageDelay > MAX_VOLTAGE_SHED_DELAY ||
+      model.worstCurrentDelay > MAX_CURRENT_SHED_DELAY ||
+      (scenario.expectSheds != (sheds > 0)) ||
+      (scenario.expectRestored && shed != 0) ||
+      restores > MAX_FLAP_RESTORES) {
+    result.ok = false;
+  }
+
+  return result;
+}
+
+static void releaseAll() {
+  for (byte port = 0; port < PORT_COUNT; port++) {
+    LoadShed::release(port);
+    devices[port].kill();
+  }
+
+  // let the relays settle before the next scenario.
+  delay(1000);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: shedsim [options] [scenario ...]\n"
+          "  -n            run without load shedding, for comparison\n"
+          "  -c            exit non-zero if the targets are missed\n"
+          "  -v            show the firmware's logs\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ncv")) != -1) {
+    switch (opt) {
+      case 'n':
+        shedding = false;
+        break;
+      case 'c':
+        check = true;
+        break;
+      case 'v':
+        logging = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  printf("%-9s %7s %7s %5s %6s %5s %6s %6s  %s\n", "scenario", "min mV",
+         "low ms", "brown", "sheds", "rest", "v (ms)", "i (ms)", "shed/end");
+
+  bool ok = true;
+
+  for (unsigned int i = 0; i < SCENARIO_COUNT; i++) {
+    const Scenario &scenario = SCENARIOS[i];
+    bool selected = optind == argc;
+
+    for (int j = optind; j < argc; j++) {
+      selected = selected || strcmp(argv[j], scenario.name) == 0;
+    }
+
+    if (!selected) {
+      continue;
+    }
+
+    ok = run(scenario, check).ok && ok;
+    releaseAll();
+  }
+
+  if (check) {
+    printf("\n%s\n", ok ? "ok" : "FAIL: targets missed");
+  }
+
+  return ok ? 0 : 1;
+}
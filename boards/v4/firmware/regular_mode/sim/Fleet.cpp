@@ -0,0 +1,729 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <math.h>
+
+#include "Fleet.h"
+
+#include <Wire.h>
+
+#include "Board.h"
+#include "Checkpoint.h"
+#include "Logger.h"
+#include "Record.h"
+#include "ResetAll.h"
+#include "Wagman.h"
+
+using Board::BOARD;
+
+static const byte DEVICE_COUNT = Board::PORT_COUNT;
+
+// simulated wall clock starts at 2026-01-01.
+static const time_t SIM_EPOCH = 1767225600;
+
+// the firmware loop is run at least this often, and every second while a
+// device is stopping or booting, when its timers are short.
+static const double MAX_STEP = 30;
+static const double MIN_STEP = 1;
+
+// matches the firmware.
+static const unsigned long START_INTERVAL = 60000L;
+static const unsigned long LONG_OUTAGE_DURATION = 3600;
+static const unsigned long MAX_OUTAGE_STAGGER = 600000L;
+
+// port current seen with the relay off. nonzero, since a zero reading is
+// treated as a current sensor error.
+static const unsigned int OFF_CURRENT = 10;
+
+bool logging = false;
+bool logEvents = false;
+unsigned int heartbeatCounters[5];
+DurationTimer startTimer;
+
+// the RTC SRAM checkpoint isn't modelled, so a reset reconciles devices by
+// adoption alone.
+namespace Checkpoint {
+void markDirty(bool urgent) {}
+};  // namespace Checkpoint
+
+// splitmix64. unlike <random>'s distributions it gives the same fleet on every
+// host.
+class Random {
+ public:
+  void seed(uint64_t s) { state = s; }
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+  double uniform(double lo, double hi) { return lo + (hi - lo) * uniform(); }
+  bool chance(double p) { return uniform() < p; }
+  double exponential(double mean) { return -mean * log(1.0 - uniform()); }
+
+ private:
+  uint64_t state;
+};
+
+enum NodeState {
+  NODE_OFF,
+  NODE_BOOTING,
+  NODE_RUNNING,
+  NODE_HUNG,
+  NODE_HALTING,
+  NODE_HALTED,
+};
+
+// the computer on a port, as the Wagman sees it through the relay, current
+// sensor and heartbeat line.
+struct Node {
+  byte state;
+  bool relay;  // latched, so it keeps its position through power losses
+  bool mediaBad[2];
+  byte bootMedia;
+  double event;  // end of boot or halt. negative if nothing is pending
+  double poweredAt;  // start of the current or last boot
+  double hangAt;
+  double downSince;
+  DeviceResult result;
+};
+
+static const Policy *policy;
+static const FailureModel *model;
+
+static Random environment;
+static Random events;
+
+static Node nodes[SIM_DEVICES];
+static byte selectorMedia[Board::BOOT_SELECTOR_COUNT];
+static SensorSample sample;
+
+static Device devices[DEVICE_COUNT];
+static byte deviceWantsStart;
+
+// set once a reset all reaches the master reset.
+static bool resetAllDone;
+
+// relays cut during a reset all while their node was still running or
+// halting.
+static unsigned int earlyCuts;
+
+// seconds from each reset all stop to its relay being cut.
+static byte stops;
+static double stopDurations[SIM_DEVICES];
+static double stopTimeout;
+
+static bool powered;
+static double powerLoss;
+static double powerReturn;
+static unsigned long brownouts;
+
+static double simTime() { return simMillis / 1000.0; }
+
+static bool hasBootSelector(byte port) {
+  return BOARD.ports[port].bootSelector != Board::NO_BOOT_SELECTOR;
+}
+
+static void markUp(Node &node, double t) {
+  if (node.downSince >= 0) {
+    node.result.downTime += t - node.downSince;
+    node.result.repairs++;
+    node.downSince = -1;
+  }
+}
+
+static void markDown(Node &node, double t) {
+  if (node.downSince < 0) {
+    node.downSince = t;
+  }
+}
+
+static double bootDuration(byte port) {
+  // the single board computers take a couple of minutes. coresense is quick.
+  return hasBootSelector(port) ? events.uniform(60, 180)
+                               : events.uniform(10, 30);
+}
+
+static void powerOn(byte port) {
+  Node &node = nodes[port];
+
+  node.state = NODE_BOOTING;
+  node.poweredAt = simTime();
+  node.event = simTime() + bootDuration(port);
+  node.bootMedia = hasBootSelector(port)
+                       ? selectorMedia[BOARD.ports[port].bootSelector]
+                       : BOARD.ports[port].primaryMedia;
+}
+
+static void powerOff(byte port) {
+  Node &node = nodes[port];
+
+  // the firmware's delays run the clock on without updating the nodes, so a
+  // halting node may have finished by now.
+  bool halting = node.state == NODE_HALTING && node.event > simTime();
+
+  if (ResetAll::active() && (node.state == NODE_RUNNING || halting)) {
+    earlyCuts++;
+  }
+
+  // a stopping device's relay is cut before it leaves STATE_STOPPING.
+  if (ResetAll::active() && devices[port].getState() == STATE_STOPPING &&
+      stops < SIM_DEVICES) {
+    stopDurations[stops++] = devices[port].timeInState() / 1000.0;
+    stopTimeout = devices[port].getStopTimeout() / 1000.0;
+  }
+
+  if (node.state == NODE_RUNNING) {
+    markDown(node, simTime());
+  }
+
+  node.state = NODE_OFF;
+  node.event = -1;
+}
+
+static void finishBoot(byte port, double t) {
+  Node &node = nodes[port];
+  bool bad = hasBootSelector(port) && node.mediaBad[node.bootMedia];
+
+  node.event = -1;
+
+  if (bad || events.chance(model->flakyBoot)) {
+    node.state = NODE_HUNG;
+    return;
+  }
+
+  node.state = NODE_RUNNING;
+  node.hangAt = t + events.exponential(model->hangMean);
+  markUp(node, t);
+}
+
+static void updateNode(byte port, double t) {
+  Node &node = nodes[port];
+
+  if (node.event >= 0 && node.event <= t) {
+    if (node.state == NODE_BOOTING) {
+      finishBoot(port, node.event);
+    } else if (node.state == NODE_HALTING) {
+      node.state = NODE_HALTED;
+      node.event = -1;
+    }
+  }
+
+  if (node.state == NODE_RUNNING && node.hangAt <= t) {
+    node.state = NODE_HUNG;
+    markDown(node, node.hangAt);
+  }
+
+  // heartbeats are frequent compared to any timeout, so a running node is
+  // simply given one every loop.
+  if (node.state == NODE_RUNNING) {
+    heartbeatCounters[port] = 4;
+  }
+}
+
+static unsigned int nodeCurrent(byte port) {
+  unsigned int powered = BOARD.ports[port].poweredCurrent;
+
+  if (port >= SIM_DEVICES) {
+    return OFF_CURRENT;
+  }
+
+  switch (nodes[port].state) {
+    case NODE_OFF:
+      return OFF_CURRENT;
+    case NODE_HALTED:
+      return powered / 4;
+    default:
+      return powered * 2;
+  }
+}
+
+namespace Wagman {
+
+void setRelay(int port, int mode) {
+  if (port >= SIM_DEVICES) {
+    return;
+  }
+
+  Node &node = nodes[port];
+
+  if (mode && !node.relay) {
+    node.relay = true;
+    node.result.relayCycles++;
+
+    if (powered) {
+      powerOn(port);
+    }
+  } else if (!mode && node.relay) {
+    node.relay = false;
+    powerOff(port);
+  }
+}
+
+byte getBootMedia(byte selector) { return selectorMedia[selector]; }
+
+void setBootMedia(byte selector, byte media) {
+  if (validBootSelector(selector)) {
+    selectorMedia[selector] = media;
+  }
+}
+
+bool validPort(byte port) { return port < Board::PORT_COUNT; }
+
+bool validBootSelector(byte selector) {
+  return selector < Board::BOOT_SELECTOR_COUNT;
+}
+
+void sampleSensors() {
+  for (byte port = 0; port < DEVICE_COUNT; port++) {
+    sample.ports[port].current = nodeCurrent(port);
+  }
+
+  sample.sampleMillis = millis();
+}
+
+const SensorSample &getSample() { return sample; }
+
+bool portIdle(byte port) {
+  unsigned int current = sample.ports[port].current;
+  return current != 0 && current < BOARD.ports[port].poweredCurrent;
+}
+
+bool portPowered(byte port) {
+  return sample.ports[port].current >= BOARD.ports[port].poweredCurrent;
+}
+
+void getTime(time_t &time) { time = SIM_EPOCH + simMillis / 1000; }
+
+};  // namespace Wagman
+
+// same as the firmware, including dividing by the number of entries.
+static unsigned long meanBootDelta(const Record::BootLog &bootLog,
+                                   byte maxSamples) {
+  byte count = min(maxSamples, bootLog.getCount());
+  unsigned long total = 0;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  for (byte i = 1; i < count; i++) {
+    total += bootLog.getEntry(i) - bootLog.getEntry(i - 1);
+  }
+
+  return total / count;
+}
+
+static void deviceKilled(Device &device) {
+  if (meanBootDelta(Record::bootLogs[device.port], 3) < 240) {
+    device.setStartDelay(300000);
+  }
+}
+
+// a running node shuts down and may acknowledge. a hung one ignores it.
+static void sendStopMessage(Device &device) {
+  if (device.port >= SIM_DEVICES) {
+    return;
+  }
+
+  Node &node = nodes[device.port];
+
+  if (node.state != NODE_RUNNING) {
+    return;
+  }
+
+  double halt = events.uniform(10, 25);
+
+  node.state = NODE_HALTING;
+  node.event = simTime() + halt;
+  markDown(node, simTime());
+
+  if (events.chance(model->stopAck)) {
+    device.acknowledgeStop(halt * 1000);
+  }
+}
+
+static void setupDevices() {
+  for (byte i = 0; i < DEVICE_COUNT; i++) {
+    const Board::PortDescriptor &desc = BOARD.ports[i];
+
+    devices[i].name = desc.name;
+    devices[i].port = i;
+    devices[i].bootSelector = desc.bootSelector;
+    devices[i].primaryMedia = desc.primaryMedia;
+    devices[i].secondaryMedia = desc.secondaryMedia;
+    devices[i].watchHeartbeat = desc.watchHeartbeat;
+    devices[i].watchCurrent = desc.watchCurrent;
+    devices[i].keepEnabled = desc.keepEnabled;
+    devices[i].init();
+  }
+
+  setStopMessageSender(sendStopMessage);
+}
+
+static void applyPolicy() {
+  for (byte port = 0; port < DEVICE_COUNT; port++) {
+    PortConfig config = Record::getPortConfig(port);
+    config.bootHeartbeatTimeout = policy->bootHeartbeatTimeout;
+    config.unmanagedChangeTime = policy->unmanagedChangeTime;
+    Record::setPortConfig(port, config);
+  }
+}
+
+// the parts of the firmware's setup which matter to the devices. powerFailed
+// is set after a power loss, and outage is how long it was, in seconds.
+static void setup(unsigned int wagman, bool powerFailed,
+                  unsigned long outage) {
+  if (!Record::initialized()) {
+    Record::init();
+    Record::loadPortConfigs();
+    applyPolicy();
+  }
+
+  Record::loadPortConfigs();
+
+  for (byte i = 0; i < DEVICE_COUNT; i++) {
+    heartbeatCounters[i] = 0;
+  }
+
+  // the selector pins come up low.
+  for (byte i = 0; i < Board::BOOT_SELECTOR_COUNT; i++) {
+    selectorMedia[i] = MEDIA_SD;
+  }
+
+  Wagman::sampleSensors();
+  setupDevices();
+  deviceWantsStart = 0;
+
+  if (outage >= LONG_OUTAGE_DURATION) {
+    unsigned long hash = 5381;
+
+    for (byte i = 0; i < 4; i++) {
+      hash = (hash * 33) ^ ((wagman >> (8 * i)) & 0xff);
+    }
+
+    // devices which came back on with the Wagman are cut, as in
+    // staggerDeviceStarts.
+    for (byte i = 1; i < DEVICE_COUNT; i++) {
+      devices[i].setStartDelay(hash % MAX_OUTAGE_STAGGER);
+
+      if (Record::getRelayState(i) != RELAY_OFF) {
+        devices[i].kill();
+      }
+    }
+  }
+
+  for (byte i = 0; i < DEVICE_COUNT; i++) {
+    devices[i].adopt(powerFailed);
+  }
+
+  startTimer.reset();
+
+  if (devices[0].getState() != STATE_STARTED &&
+      devices[0].getState() != STATE_STOPPING) {
+    devices[0].start();
+  }
+}
+
+static void startNextDevice() {
+  if (Wagman::validPort(deviceWantsStart)) {
+    startTimer.reset();
+    devices[deviceWantsStart].start();
+    deviceWantsStart = 255;
+    return;
+  }
+
+  if (startTimer.exceeds(START_INTERVAL)) {
+    for (byte i = 0; i < DEVICE_COUNT; i++) {
+      if (devices[i].canStart()) {
+        startTimer.reset();
+        devices[i].start();
+        break;
+      }
+    }
+  }
+}
+
+static void loop() {
+  if (!ResetAll::active()) {
+    startNextDevice();
+  }
+
+  Wagman::sampleSensors();
+
+  for (byte i = 0; i < DEVICE_COUNT; i++) {
+    int state = devices[i].getState();
+
+    devices[i].update();
+
+    if (policy->backoff && state == STATE_STOPPING &&
+        devices[i].getState() == STATE_STOPPED) {
+      deviceKilled(devices[i]);
+    }
+  }
+
+  if (ResetAll::update(devices, DEVICE_COUNT)) {
+    resetAllDone = true;
+  }
+}
+
+static void schedulePowerLoss(double after) {
+  powerLoss = after + environment.exponential(model->brownoutMean);
+
+  double duration = environment.chance(model->longOutage)
+                        ? environment.uniform(600, 10800)
+                        : environment.uniform(1, 60);
+
+  powerReturn = powerLoss + duration;
+}
+
+static void losePower() {
+  powered = false;
+  brownouts++;
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    Node &node = nodes[port];
+
+    if (node.state == NODE_RUNNING) {
+      markDown(node, simTime());
+    }
+
+    node.state = NODE_OFF;
+    node.event = -1;
+  }
+}
+
+static void restorePower(unsigned int wagman) {
+  unsigned long outage = (unsigned long)(powerReturn - powerLoss);
+
+  powered = true;
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    if (nodes[port].relay) {
+      powerOn(port);
+    }
+  }
+
+  setup(wagman, true, outage);
+  schedulePowerLoss(powerReturn);
+}
+
+// time of the next thing the firmware has to see.
+static double nextWakeup() {
+  double t = simTime();
+  double next = t + MAX_STEP;
+
+  if (!powered) {
+    return powerReturn;
+  }
+
+  if (ResetAll::active()) {
+    next = t + MIN_STEP;
+  }
+
+  for (byte i = 0; i < SIM_DEVICES; i++) {
+    const Node &node = nodes[i];
+
+    if (devices[i].getState() == STATE_STOPPING) {
+      next = min(next, t + MIN_STEP);
+    }
+
+    if (node.event >= 0) {
+      next = min(next, max(node.event, t + MIN_STEP));
+    }
+
+    if (node.state == NODE_RUNNING) {
+      next = min(next, max(node.hangAt, t + MIN_STEP));
+    }
+  }
+
+  return min(next, powerLoss);
+}
+
+static uint64_t mix(uint64_t seed, uint64_t wagman, uint64_t stream) {
+  Random r;
+  r.seed(seed ^ (wagman << 20) ^ (stream << 52));
+  return r.next();
+}
+
+// sets up a fresh Wagman and its fleet of devices, and runs its setup.
+static void initWagman(const Policy &p, const FailureModel &m,
+                       unsigned long seed, unsigned int wagman) {
+  policy = &p;
+  model = &m;
+  recoveryPolicy = p.recovery;
+
+  environment.seed(mix(seed, wagman, 1));
+  events.seed(mix(seed, wagman, 2));
+
+  memset(simEEPROM, 0xff, sizeof(simEEPROM));
+  simMillis = 0;
+  brownouts = 0;
+  resetAllDone = false;
+  earlyCuts = 0;
+  stops = 0;
+  stopTimeout = 0;
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    Node &node = nodes[port];
+
+    memset(&node, 0, sizeof(node));
+    node.state = NODE_OFF;
+    node.relay = false;
+    node.mediaBad[MEDIA_EMMC] = environment.chance(model->badEMMC);
+    node.mediaBad[MEDIA_SD] = environment.chance(model->badSD);
+    node.event = -1;
+    node.downSince = 0;
+  }
+
+  powered = true;
+  schedulePowerLoss(0);
+  setup(wagman, false, 0);
+}
+
+// runs the nodes and the firmware loop once, and advances to the next time
+// the firmware has to see.
+static void step(unsigned int wagman) {
+  double t = simTime();
+
+  if (powered && powerLoss <= t) {
+    losePower();
+  } else if (!powered && powerReturn <= t) {
+    restorePower(wagman);
+  }
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    updateNode(port, t);
+  }
+
+  if (powered) {
+    loop();
+  }
+
+  double next = nextWakeup();
+
+  // rounded up, so an event is never left just ahead of the clock.
+  unsigned long nextMillis = (unsigned long)ceil(next * 1000);
+
+  if (nextMillis > simMillis) {
+    simMillis = nextMillis;
+  }
+}
+
+void simulateWagman(const Policy &p, const FailureModel &m,
+                    unsigned long seed, unsigned int wagman, double days,
+                    WagmanResult &result) {
+  initWagman(p, m, seed, wagman);
+
+  double end = days * 86400;
+
+  while (simTime() < end) {
+    step(wagman);
+  }
+
+  result.policy = 0;
+  result.wagman = wagman;
+  result.brownouts = brownouts;
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    DeviceResult &r = result.devices[port];
+    Node &node = nodes[port];
+
+    r = node.result;
+    r.upTime = end - r.downTime;
+
+    // an outage still going at the end is downtime, but not a repair.
+    if (node.downSince >= 0) {
+      r.upTime -= end - node.downSince;
+    }
+
+    r.bootFailures = Record::getBootFailures(port);
+    r.unmanaged = r.bootFailures >= p.recovery.unmanagedAfterFailures;
+  }
+}
+
+static bool allRunning() {
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    if (nodes[port].state != NODE_RUNNING) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void simulateResetAll(const Policy &p, const FailureModel &m,
+                      unsigned long seed, unsigned int wagman,
+                      ResetAllResult &result) {
+  initWagman(p, m, seed, wagman);
+
+  // give the devices up to an hour to come up.
+  while (simTime() < 3600 && !allRunning()) {
+    step(wagman);
+  }
+
+  result.running = 0;
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    result.running += nodes[port].state == NODE_RUNNING;
+  }
+
+  double start = simTime();
+  result.stopSeconds = -1;
+  ResetAll::start(devices, DEVICE_COUNT);
+
+  while (!resetAllDone && simTime() < start + 3600) {
+    step(wagman);
+
+    if (result.stopSeconds < 0 &&
+        ResetAll::getStage() == ResetAll::STAGE_SETTLING) {
+      result.stopSeconds = simTime() - start;
+    }
+  }
+
+  result.seconds = resetAllDone ? simTime() - start : -1;
+  result.earlyCuts = earlyCuts;
+  result.stops = stops;
+  result.stopTimeout = stopTimeout;
+
+  for (byte i = 0; i < stops; i++) {
+    result.stopDurations[i] = stopDurations[i];
+  }
+
+  // the Wagman would reset here, so leave the next run a clean start.
+  ResetAll::abort();
+}
+
+void simulateOutage(const Policy &p, const FailureModel &m,
+                    unsigned long seed, unsigned int wagman,
+                    double outage, OutageResult &result) {
+  initWagman(p, m, seed, wagman);
+
+  // give the devices up to an hour to come up.
+  while (simTime() < 3600 && !allRunning()) {
+    step(wagman);
+  }
+
+  // the next power loss is scheduled once power returns, so keep this one. it
+  // is on a whole ms, the same as the clock, so the clock can reach it.
+  double back = (simMillis + (unsigned long)(outage * 1000)) / 1000.0;
+
+  powerLoss = simTime();
+  powerReturn = back;
+
+  // runs past the power loss, then for up to an hour after power returns.
+  while (simTime() <= back || (simTime() < back + 3600 && !allRunning())) {
+    step(wagman);
+  }
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    const Node &node = nodes[port];
+
+    result.powerUp[port] =
+        node.state == NODE_RUNNING ? node.poweredAt - back : -1;
+  }
+}
@@ -0,0 +1,96 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_SIM_FLEET__
+#define __H_SIM_FLEET__
+
+#include <Arduino.h>
+#include "Device.h"
+
+// Discrete-event simulation of a single Wagman and the devices on its first
+// three ports, running the real Device and Record code against virtual time.
+
+// nc, gn and cs. the extra ports are disabled by default.
+const byte SIM_DEVICES = 3;
+
+// a recovery policy to evaluate. timeouts are in ms and go through the port
+// config, the same as an operator would set them.
+struct Policy {
+  const char *name;
+  RecoveryPolicy recovery;
+  unsigned long bootHeartbeatTimeout;  // 0 learns from boot durations
+  unsigned long unmanagedChangeTime;
+
+  // back off restarting a device which keeps failing quickly, as
+  // deviceKilled in the firmware would.
+  bool backoff;
+};
+
+// failure model. probabilities are per device or per boot, mean times are in
+// seconds.
+struct FailureModel {
+  double badEMMC;       // eMMC never boots
+  double badSD;         // SD card never boots
+  double flakyBoot;     // a boot hangs
+  double hangMean;      // mean running time before a device hangs
+  double brownoutMean;  // mean time between Wagman power losses
+  double longOutage;    // share of power losses which last 10 min to 3 h
+  double stopAck;       // a running device acknowledges the stop message
+};
+
+struct DeviceResult {
+  double upTime;          // seconds running with a heartbeat
+  double downTime;        // seconds spent in outages which ended
+  unsigned long repairs;  // outages which ended
+  unsigned long relayCycles;
+  unsigned long bootFailures;
+  bool unmanaged;
+};
+
+struct WagmanResult {
+  unsigned int policy;
+  unsigned int wagman;
+  unsigned long brownouts;
+  DeviceResult devices[SIM_DEVICES];
+};
+
+struct ResetAllResult {
+  byte running;            // devices running when the reset all was requested
+  double stopSeconds;      // until every port was off
+  double seconds;          // until the master reset. negative if it never came
+  unsigned int earlyCuts;  // relays cut before their device had halted
+
+  // each stop the reset all made, from the stop to its relay being cut, and
+  // the stop timeout it would have waited out without the stop handshake.
+  byte stops;
+  double stopDurations[SIM_DEVICES];
+  double stopTimeout;
+};
+
+struct OutageResult {
+  // seconds from power returning to the power on of the boot which brought
+  // each device up. negative if it didn't come up.
+  double powerUp[SIM_DEVICES];
+};
+
+// simulates one Wagman for the given number of days. the environment (bad
+// media and power losses) depends only on seed and wagman, so every policy
+// sees the same fleet.
+void simulateWagman(const Policy &policy, const FailureModel &model,
+                    unsigned long seed, unsigned int wagman, double days,
+                    WagmanResult &result);
+
+// brings one Wagman's devices up, for up to an hour, then runs a reset all on
+// it until the master reset.
+void simulateResetAll(const Policy &policy, const FailureModel &model,
+                      unsigned long seed, unsigned int wagman,
+                      ResetAllResult &result);
+
+// brings one Wagman's devices up, for up to an hour, then cuts its power for
+// outage seconds and follows the devices coming back.
+void simulateOutage(const Policy &policy, const FailureModel &model,
+                    unsigned long seed, unsigned int wagman, double outage,
+                    OutageResult &result);
+
+#endif
@@ -0,0 +1,133 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_SIM_ARDUINO__
+#define __H_SIM_ARDUINO__
+
+// Just enough of the Arduino core for the firmware's Device and Record code to
+// run on a host against virtual time. Pins do nothing and analog reads return
+// simAnalog, which is 0 unless a harness sets it; the simulator provides the
+// Wagman namespace instead of the real board.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+
+// the binary constants the firmware uses, from the core's binary.h.
+#define B01111110 126
+#define B10000001 129
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+enum {
+  A0 = 54,
+  A1,
+  A2,
+  A3,
+  A4,
+  A5,
+  A6,
+  A7,
+  A8,
+  A9,
+  A10,
+  A11,
+};
+
+// virtual time in ms. delay advances it, since nothing else can while the
+// firmware is blocked.
+extern unsigned long simMillis;
+
+extern unsigned int simAnalog[A11 + 1];
+
+// called by delay() every ms, like the SAM core. the default does nothing and
+// a harness may replace it.
+void yield();
+
+inline unsigned long millis() { return simMillis; }
+inline unsigned long micros() { return simMillis * 1000; }
+
+inline void delay(unsigned long ms) {
+  for (unsigned long i = 0; i < ms; i++) {
+    yield();
+    simMillis++;
+  }
+}
+inline void delayMicroseconds(unsigned int) {}
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return LOW; }
+inline int analogRead(int pin) { return simAnalog[pin]; }
+inline void analogWrite(int, int) {}
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// formats values like the core's Print, one byte at a time through write.
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+
+  size_t print(const char *s) {
+    size_t n = 0;
+
+    while (*s != '\0') {
+      n += write(*s++);
+    }
+
+    return n;
+  }
+
+  size_t print(char c) { return write(c); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) {
+    return print((unsigned long)n, base);
+  }
+  size_t print(long n, int base = DEC) {
+    char text[24];
+    snprintf(text, sizeof(text), base == HEX ? "%lx" : "%ld", n);
+    return print(text);
+  }
+  size_t print(unsigned long n, int base = DEC) {
+    char text[24];
+    snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", n);
+    return print(text);
+  }
+  size_t print(double x) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", x);
+    return print(text);
+  }
+  size_t println() { return write('\n'); }
+};
+
+// prints to stdout so firmware logs can be followed with -v.
+class SimSerial : public Print {
+ public:
+  size_t write(uint8_t c) {
+    fputc(c, stdout);
+    return 1;
+  }
+};
+
+extern SimSerial SerialUSB;
+
+#endif
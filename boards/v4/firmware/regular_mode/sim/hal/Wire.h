@@ -0,0 +1,78 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_SIM_WIRE__
+#define __H_SIM_WIRE__
+
+#include <Arduino.h>
+
+// I2C bus with only the 24xx config EEPROM at 0x50 on it. Writes take a two
+// byte address followed by data; reads continue from the last address, the
+// same as the real part.
+const unsigned int SIM_EEPROM_SIZE = 4096;
+
+extern byte simEEPROM[SIM_EEPROM_SIZE];
+
+class TwoWire {
+ public:
+  // bus transactions so far, each costing an address byte on the real bus.
+  unsigned long transfers;
+
+  void begin() {}
+
+  void beginTransmission(int addr) {
+    device = addr;
+    txCount = 0;
+  }
+
+  size_t write(byte value) {
+    if (device == EEPROM_ADDR) {
+      if (txCount == 0) {
+        pointer = value << 8;
+      } else if (txCount == 1) {
+        pointer |= value;
+      } else {
+        simEEPROM[pointer % SIM_EEPROM_SIZE] = value;
+        pointer++;
+      }
+    }
+
+    txCount++;
+    return 1;
+  }
+
+  byte endTransmission(int stop = 1) {
+    transfers++;
+    return device == EEPROM_ADDR ? 0 : 2;
+  }
+
+  byte requestFrom(int addr, int count) {
+    transfers++;
+    rxCount = (addr == EEPROM_ADDR) ? count : 0;
+    return rxCount;
+  }
+
+  int available() { return rxCount; }
+
+  int read() {
+    if (rxCount == 0) {
+      return -1;
+    }
+
+    rxCount--;
+    return simEEPROM[pointer++ % SIM_EEPROM_SIZE];
+  }
+
+ private:
+  static const int EEPROM_ADDR = 0x50;
+
+  int device;
+  unsigned int txCount;
+  unsigned int pointer;
+  int rxCount;
+};
+
+extern TwoWire Wire;
+
+#endif
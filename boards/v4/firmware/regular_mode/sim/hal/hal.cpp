@@ -0,0 +1,18 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <Arduino.h>
+#include <Wire.h>
+
+unsigned long simMillis = 0;
+
+unsigned int simAnalog[A11 + 1];
+
+__attribute__((weak)) void yield() {}
+
+byte simEEPROM[SIM_EEPROM_SIZE];
+
+TwoWire Wire;
+
+SimSerial SerialUSB;
@@ -0,0 +1,459 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <algorithm>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Fleet.h"
+
+// fleetsim - compares device recovery policies across a simulated fleet.
+//
+// Every policy runs against the same fleet: each Wagman's bad media and power
+// losses are drawn from the seed, so differences come from the policy. The
+// firmware keeps its state in globals, so Wagmans are split across worker
+// processes rather than threads.
+
+static const Policy POLICIES[] = {
+    {"default", {30, 4}, 0, 14400000L, false},
+    {"sd-every-2", {30, 2}, 0, 14400000L, false},
+    {"boot-10m", {30, 4}, 600000L, 14400000L, false},
+    {"boot-1h", {30, 4}, 3600000L, 14400000L, false},
+    {"backoff", {30, 4}, 0, 14400000L, true},
+    {"unmanaged-8", {8, 4}, 0, 3600000L, false},
+};
+
+static const unsigned int POLICY_COUNT = sizeof(POLICIES) / sizeof(POLICIES[0]);
+
+static const char *DEVICE_NAMES[SIM_DEVICES] = {"nc", "gn", "cs"};
+
+extern bool logging;
+
+static void usage() {
+  fprintf(stderr,
+          "usage: fleetsim [options]\n"
+          "  -n wagmans    fleet size (200)\n"
+          "  -d days       simulated time per wagman (30)\n"
+          "  -j workers    worker processes (number of cpus)\n"
+          "  -s seed       fleet seed (1)\n"
+          "  -p policy     only run this policy\n"
+          "  -e p          chance a device's eMMC is bad (0.10)\n"
+          "  -f p          chance a boot hangs (0.05)\n"
+          "  -h days       mean time before a running device hangs (7)\n"
+          "  -b days       mean time between power losses (5)\n"
+          "  -r            measure a reset all on each wagman instead\n"
+          "  -o            measure power up after a 2 h outage instead\n"
+          "  -v            log the firmware for wagman 0, first policy\n");
+  exit(1);
+}
+
+static double seconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+
+    if (n <= 0) {
+      return false;
+    }
+
+    p += n;
+    size -= n;
+  }
+
+  return true;
+}
+
+static void runWorker(int fd, unsigned int worker, unsigned int workers,
+                      const std::vector<unsigned int> &policies,
+                      const FailureModel &model, unsigned long seed,
+                      unsigned int wagmans, double days) {
+  for (unsigned int w = worker; w < wagmans; w += workers) {
+    for (unsigned int p : policies) {
+      WagmanResult result;
+      simulateWagman(POLICIES[p], model, seed, w, days, result);
+      result.policy = p;
+
+      if (!writeAll(fd, &result, sizeof(result))) {
+        _exit(1);
+      }
+    }
+  }
+
+  _exit(0);
+}
+
+static double percentile(std::vector<double> values, double q) {
+  if (values.empty()) {
+    return 0;
+  }
+
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(q * (values.size() - 1) + 0.5)];
+}
+
+static void report(const std::vector<WagmanResult> &results,
+                   const std::vector<unsigned int> &policies, double days) {
+  printf("%-12s %-3s %8s %9s %10s %6s %6s %9s\n", "policy", "dev", "avail%",
+         "mttr-min", "cycles/day", "p95", "max", "unmanaged");
+
+  for (unsigned int p : policies) {
+    for (byte d = 0; d < SIM_DEVICES; d++) {
+      double up = 0;
+      double down = 0;
+      unsigned long repairs = 0;
+      unsigned int unmanaged = 0;
+      std::vector<double> cycles;
+
+      for (const WagmanResult &r : results) {
+        if (r.policy != p) {
+          continue;
+        }
+
+        const DeviceResult &dr = r.devices[d];
+        up += dr.upTime;
+        down += dr.downTime;
+        repairs += dr.repairs;
+        unmanaged += dr.unmanaged;
+        cycles.push_back(dr.relayCycles / days);
+      }
+
+      double total = 0;
+
+      for (double c : cycles) {
+        total += c;
+      }
+
+      double mean = cycles.empty() ? 0 : total / cycles.size();
+      double max = percentile(cycles, 1);
+
+      printf("%-12s %-3s %8.3f %9.1f %10.2f %6.2f %6.2f %8.1f%%\n",
+             POLICIES[p].name, DEVICE_NAMES[d],
+             100 * up / (days * 86400 * cycles.size()),
+             repairs ? down / repairs / 60 : 0, mean,
+             percentile(cycles, 0.95), max,
+             cycles.empty() ? 0 : 100.0 * unmanaged / cycles.size());
+    }
+  }
+}
+
+static void printStat(const char *name, std::vector<double> values) {
+  double total = 0;
+
+  for (double v : values) {
+    total += v;
+  }
+
+  printf("%-16s %8.1f %8.1f %8.1f %8.1f\n", name,
+         values.empty() ? 0 : total / values.size(), percentile(values, 0.5),
+         percentile(values, 0.95), percentile(values, 1));
+}
+
+// runs a reset all on each wagman once its devices are up. the runs are short,
+// so they're done in this process.
+static int reportResetAll(const Policy &policy, const FailureModel &model,
+                          unsigned long seed, unsigned int wagmans) {
+  std::vector<double> stops;
+  std::vector<double> totals;
+  std::vector<double> deviceStops;
+  double stopTimeout = 0;
+  unsigned int allRunning = 0;
+  unsigned int neverReset = 0;
+  unsigned int earlyCuts = 0;
+
+  for (unsigned int w = 0; w < wagmans; w++) {
+    ResetAllResult result;
+    simulateResetAll(policy, model, seed, w, result);
+
+    allRunning += result.running == SIM_DEVICES;
+    earlyCuts += result.earlyCuts;
+
+    for (byte i = 0; i < result.stops; i++) {
+      deviceStops.push_back(result.stopDurations[i]);
+      stopTimeout = result.stopTimeout;
+    }
+
+    if (result.seconds < 0) {
+      neverReset++;
+      continue;
+    }
+
+    stops.push_back(result.stopSeconds);
+    totals.push_back(result.seconds);
+  }
+
+  printf("reset all on %u wagmans, %s policy. all devices running on %u.\n\n",
+         wagmans, policy.name, allRunning);
+  printf("%-16s %8s %8s %8s %8s\n", "seconds", "mean", "p50", "p95", "max");
+  printStat("all ports off", stops);
+  printStat("master reset", totals);
+  printStat("device stop", deviceStops);
+
+  // without the stop handshake every stop waited out the stop timeout.
+  if (!deviceStops.empty()) {
+    double total = 0;
+
+    for (double v : deviceStops) {
+      total += v;
+    }
+
+    double mean = total / deviceStops.size();
+
+    printf("\nstop handshake: %zu stops, %.1f s saved each against the %.0f s "
+           "stop timeout\n",
+           deviceStops.size(), stopTimeout - mean, stopTimeout);
+  }
+
+  printf("\nnever reset: %u, relays cut before a device halted: %u\n",
+         neverReset, earlyCuts);
+
+  return neverReset == 0 && earlyCuts == 0 ? 0 : 1;
+}
+
+// held back devices powering up this soon after power returns count as coming
+// up together with the Wagman.
+static const double TOGETHER_SECONDS = 10;
+
+// cuts each wagman's power for two hours once its devices are up, and reports
+// when each device powered up for the boot which brought it back. the devices
+// but nc should be spread over the outage stagger.
+static int reportOutage(const Policy &policy, const FailureModel &model,
+                        unsigned long seed, unsigned int wagmans) {
+  std::vector<double> powerUps[SIM_DEVICES];
+  unsigned int heldBack = 0;
+  unsigned int together = 0;
+
+  for (unsigned int w = 0; w < wagmans; w++) {
+    OutageResult result;
+    simulateOutage(policy, model, seed, w, 7200, result);
+
+    for (byte port = 0; port < SIM_DEVICES; port++) {
+      double t = result.powerUp[port];
+
+      if (t < 0) {
+        continue;
+      }
+
+      powerUps[port].push_back(t);
+
+      if (port != 0) {
+        heldBack++;
+        together += t < TOGETHER_SECONDS;
+      }
+    }
+  }
+
+  printf("2 h outage on %u wagmans, %s policy.\n\n", wagmans, policy.name);
+  printf("%-16s %8s %8s %8s %8s\n", "power up (s)", "mean", "p50", "p95",
+         "max");
+
+  for (byte port = 0; port < SIM_DEVICES; port++) {
+    printStat(DEVICE_NAMES[port], powerUps[port]);
+  }
+
+  printf("\nheld back devices powered up within %.0f s: %u of %u\n",
+         TOGETHER_SECONDS, together, heldBack);
+
+  // the stagger is spread over 10 minutes, so only a few wagmans should draw
+  // one under TOGETHER_SECONDS.
+  return together * 20 <= heldBack ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  FailureModel model = {
+      0.10,          // badEMMC
+      0.02,          // badSD
+      0.05,          // flakyBoot
+      7 * 86400.0,   // hangMean
+      5 * 86400.0,   // brownoutMean
+      0.3,           // longOutage
+      0.5,           // stopAck
+  };
+
+  unsigned int wagmans = 200;
+  double days = 30;
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned long seed = 1;
+  const char *only = NULL;
+  bool verbose = false;
+  bool resetAll = false;
+  bool outage = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:d:j:s:p:e:f:h:b:rov")) != -1) {
+    switch (opt) {
+      case 'n':
+        wagmans = strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        days = atof(optarg);
+        break;
+      case 'j':
+        workers = strtol(optarg, NULL, 0);
+        break;
+      case 's':
+        seed = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        only = optarg;
+        break;
+      case 'e':
+        model.badEMMC = atof(optarg);
+        break;
+      case 'f':
+        model.flakyBoot = atof(optarg);
+        break;
+      case 'h':
+        model.hangMean = atof(optarg) * 86400;
+        break;
+      case 'b':
+        model.brownoutMean = atof(optarg) * 86400;
+        break;
+      case 'r':
+        resetAll = true;
+        break;
+      case 'o':
+        outage = true;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  std::vector<unsigned int> policies;
+
+  for (unsigned int p = 0; p < POLICY_COUNT; p++) {
+    if (only == NULL || strcmp(only, POLICIES[p].name) == 0) {
+      policies.push_back(p);
+    }
+  }
+
+  if (policies.empty() || wagmans == 0 || days <= 0) {
+    usage();
+  }
+
+  if (resetAll) {
+    logging = verbose;
+    return reportResetAll(POLICIES[policies[0]], model, seed,
+                          verbose ? 1 : wagmans);
+  }
+
+  if (outage) {
+    logging = verbose;
+    return reportOutage(POLICIES[policies[0]], model, seed,
+                        verbose ? 1 : wagmans);
+  }
+
+  if (verbose) {
+    WagmanResult result;
+    logging = true;
+    simulateWagman(POLICIES[policies[0]], model, seed, 0, days, result);
+    return 0;
+  }
+
+  if (workers < 1) {
+    workers = 1;
+  }
+
+  if ((unsigned long)workers > wagmans) {
+    workers = wagmans;
+  }
+
+  double start = seconds();
+  std::vector<int> fds;
+  std::vector<pid_t> pids;
+
+  fflush(stdout);
+
+  for (long i = 0; i < workers; i++) {
+    int fd[2];
+
+    if (pipe(fd) != 0) {
+      perror("pipe");
+      return 1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+
+    if (pid == 0) {
+      close(fd[0]);
+      runWorker(fd[1], i, workers, policies, model, seed, wagmans, days);
+    }
+
+    close(fd[1]);
+    fds.push_back(fd[0]);
+    pids.push_back(pid);
+  }
+
+  // a worker blocked on a full pipe is simply drained in its turn.
+  std::vector<WagmanResult> results;
+  bool failed = false;
+
+  for (int fd : fds) {
+    WagmanResult result;
+    size_t got = 0;
+    ssize_t n;
+
+    while ((n = read(fd, (char *)&result + got, sizeof(result) - got)) > 0) {
+      got += n;
+
+      if (got == sizeof(result)) {
+        results.push_back(result);
+        got = 0;
+      }
+    }
+
+    close(fd);
+  }
+
+  for (pid_t pid : pids) {
+    int status;
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      failed = true;
+    }
+  }
+
+  if (failed || results.size() != wagmans * policies.size()) {
+    fprintf(stderr, "fleetsim: a worker failed\n");
+    return 1;
+  }
+
+  double elapsed = seconds() - start;
+  unsigned long brownouts = 0;
+
+  for (const WagmanResult &r : results) {
+    brownouts += r.brownouts;
+  }
+
+  printf("%u wagmans x %g days, %zu policies, %ld workers, %.1fs (%.0f "
+         "wagman-days/s)\n",
+         wagmans, days, policies.size(), workers, elapsed,
+         wagmans * days * policies.size() / elapsed);
+  printf("power losses per wagman: %.1f\n\n",
+         (double)brownouts / results.size());
+
+  report(results, policies, days);
+  return 0;
+}
@@ -0,0 +1,217 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Logger.h"
+#include "TxQueue.h"
+
+// txqueuetest - checks that serial output is only ever sent in whole frames.
+//
+// Random frames are written into the firmware's TxQueue a chunk at a time, the
+// way the base64 encoder writes a response, and log lines are logged through
+// the firmware's Logger in between chunks. The queue is drained into a fake
+// stream which accepts a random number of bytes each time, like a congested
+// port. Every line the stream receives must be a whole frame, in the order
+// the frames were completed, and every frame must either arrive or be counted
+// as dropped. With -c it exits non-zero if any of that fails.
+
+bool logging = true;
+bool logEvents = false;
+
+typedef std::mt19937 Random;
+
+// a serial port which accepts up to a random number of bytes per drain.
+class FakeStream {
+ public:
+  FakeStream(Random &random, unsigned int maxWindow)
+      : random(random), window(0, maxWindow), room(0) {}
+
+  int availableForWrite() { return room; }
+
+  int write(const byte *s, int n) {
+    n = min(n, room);
+    received.append((const char *)s, n);
+    room -= n;
+    return n;
+  }
+
+  // opens a new write window before each drain.
+  void open() { room = window(random); }
+  void openAll() { room = TxQueue::CAPACITY; }
+
+  std::string received;
+
+ private:
+  Random &random;
+  std::uniform_int_distribution<int> window;
+  int room;
+};
+
+static TxQueue queue;
+
+static void queueLogLine(const byte *data, unsigned int length) {
+  queue.writeFrame(data, length);
+}
+
+struct Result {
+  unsigned long frames;
+  unsigned long logs;
+  unsigned long dropped;
+  unsigned long bytes;
+  bool ok;
+};
+
+static std::string randomText(Random &random, unsigned int length) {
+  static const char LETTERS[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::uniform_int_distribution<int> letter(0, sizeof(LETTERS) - 2);
+  std::string text;
+
+  for (unsigned int i = 0; i < length; i++) {
+    text += LETTERS[letter(random)];
+  }
+
+  return text;
+}
+
+static Result run(unsigned int maxWindow, unsigned long frames,
+                  unsigned long seed) {
+  Random random(seed);
+  FakeStream stream(random, maxWindow);
+  std::uniform_int_distribution<unsigned int> frameLength(8, 300);
+  std::uniform_int_distribution<unsigned int> chunkLength(1, 40);
+  std::uniform_int_distribution<unsigned int> logLength(0, 200);
+  std::uniform_real_distribution<double> chance(0, 1);
+
+  queue = TxQueue();
+
+  // frames in the order they were completed, which is the order they're sent.
+  std::vector<std::string> expected;
+  Result result = {0, 0, 0, 0, true};
+
+  for (unsigned long i = 0; i < frames; i++) {
+    char id[24];
+    snprintf(id, sizeof(id), "F%lu ", i);
+    std::string frame = id + randomText(random, frameLength(random)) + "\n";
+
+    for (size_t start = 0; start < frame.size();) {
+      size_t n = chunkLength(random);
+      n = min(n, frame.size() - start);
+      unsigned long dropped = queue.getDroppedFrames();
+
+      queue.write((const byte *)frame.data() + start, n);
+      start += n;
+
+      if (start == frame.size() && queue.getDroppedFrames() == dropped) {
+        expected.push_back(frame);
+      }
+
+      // a log line from the middle of a response, like a device stopping
+      // while a command is handled.
+      if (chance(random) < 0.05) {
+        char name[24];
+        snprintf(name, sizeof(name), "L%lu", result.logs++);
+        std::string text = randomText(random, logLength(random));
+
+        dropped = queue.getDroppedFrames();
+
+        Logger::begin("test");
+        Logger::log(name);
+        Logger::log(' ');
+        Logger::log(text.c_str());
+        Logger::end();
+
+        std::string line = std::string("log: test ") + name + " " + text;
+        line = line.substr(0, Logger::Line::SIZE) + "\n";
+
+        if (queue.getDroppedFrames() == dropped) {
+          expected.push_back(line);
+        }
+      }
+
+      stream.open();
+      queue.drain(stream);
+    }
+  }
+
+  while (queue.pending() > 0) {
+    stream.openAll();
+    queue.drain(stream);
+  }
+
+  result.frames = frames;
+  result.dropped = queue.getDroppedFrames();
+  result.bytes = stream.received.size();
+
+  // the stream must have received exactly the expected frames, in order.
+  std::vector<std::string> lines;
+  size_t start = 0;
+  size_t end;
+
+  while ((end = stream.received.find('\n', start)) != std::string::npos) {
+    lines.push_back(stream.received.substr(start, end - start + 1));
+    start = end + 1;
+  }
+
+  if (start != stream.received.size() || lines != expected ||
+      expected.size() + result.dropped != frames + result.logs) {
+    result.ok = false;
+  }
+
+  printf("%6u %8lu %7lu %8lu %10lu %10u  %s\n", maxWindow, result.frames,
+         result.logs, result.dropped, result.bytes, queue.getHighWater(),
+         result.ok ? "ok" : "CORRUPT");
+
+  return result;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: txqueuetest [options]\n"
+          "  -n frames     frames per run (200000)\n"
+          "  -c            exit non-zero if any output is corrupt\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  unsigned long frames = 200000;
+  bool check = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c")) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        check = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  Logger::setOutput(queueLogLine);
+
+  printf("%6s %8s %7s %8s %10s %10s\n", "window", "frames", "logs",
+         "dropped", "bytes", "high water");
+
+  // a port which keeps up, one which mostly does, and a congested one which
+  // has to drop frames.
+  bool ok = run(64, frames, 1).ok;
+  ok = run(32, frames, 2).ok && ok;
+  ok = run(8, frames, 3).ok && ok;
+
+  if (check) {
+    printf("\n%s\n", ok ? "ok" : "FAIL: corrupt output");
+  }
+
+  return ok ? 0 : 1;
+}
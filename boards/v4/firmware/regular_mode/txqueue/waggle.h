@@ -0,0 +1,19 @@
+// This file is part of the Waggle Platform.Please see the file
+// LICENSE.waggle.txt for the legal details of the copyright and software
+// license.For more details on the Waggle project, visit:
+// http://www.wa8.gl
+#ifndef __H_TXQUEUE_WAGGLE__
+#define __H_TXQUEUE_WAGGLE__
+
+#include <Arduino.h>
+
+// The writer interface from the waggle Arduino library, which isn't part of
+// this repo. TxQueue only needs this much of it.
+class writer {
+ public:
+  virtual int write(const byte *s, int n) = 0;
+
+  int writebyte(byte b) { return write(&b, 1); }
+};
+
+#endif
@@ -13,3 +13,57 @@
 // bool isgraph(char c) {
 //     return '!' <= c && c <= '~';
 // }
+
+static bool isNumber(const char *s) {
+    if (*s == '\0') {
+        return false;
+    }
+
+    for (; *s != '\0'; s++) {
+        if (!isdigit(*s)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool validCommandArgs(const Command &command, byte argc, const char **argv) {
+    byte nargs = argc - 1;
+
+    if (nargs < command.minArgs || nargs > command.maxArgs) {
+        return false;
+    }
+
+    for (byte i = 0; i < nargs && i < 8; i++) {
+        if ((command.numericArgs & (1 << i)) && !isNumber(argv[i + 1])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#define COMMAND_ENTRY(name, ...) {#name, __VA_ARGS__},
+#define COMMAND_CASE(name, ...) \
+    case commandHash(#name):    \
+        return COMMAND_##name;
+
+const Command commands[COMMAND_COUNT] PROGMEM = {COMMANDS(COMMAND_ENTRY)};
+
+byte commandIndex(const char *name) {
+    switch (commandHash(name)) { COMMANDS(COMMAND_CASE) }
+
+    return COMMAND_COUNT;
+}
+
+bool findCommand(const char *name, Command &command) {
+    byte index = commandIndex(name);
+
+    if (index == COMMAND_COUNT) {
+        return false;
+    }
+
+    memcpy_P(&command, &commands[index], sizeof(Command));
+    return strcmp(command.name, name) == 0;
+}
@@ -70,34 +70,6 @@ static byte bufferSize = 0;
 
 static time_t setupTime;
 
-Command commands[] = {
-    { "rtc", commandRTC },
-    { "ping", commandPing },
-    { "start", commandStart },
-    { "stop", commandStop },
-    { "reset", commandReset },
-    { "id", commandID },
-    { "cu", commandCurrent },
-    { "hb", commandHeartbeat },
-    { "env", commandEnvironment},
-    { "bs", commandBootMedia },
-    { "th", commandThermistor },
-    { "date", commandDate },
-    { "bf", commandBootFlags },
-    { "fc", commandFailCount },
-    { "up", commandUptime },
-    { "enable", commandEnable },
-    { "disable", commandDisable },
-    { "watch", commandWatch },
-    { "log", commandLog },
-    { "eereset", commandResetEEPROM },
-    { "boots", commandBoots },
-    { "ver", commandVersion },
-    { "blf", commandBLFlag },
-    { "sdinfo", commandSDInfo },
-    { NULL, NULL },
-};
-
 void printDate(const DateTime &dt)
 {
     SerialUSB.print(dt.year);
@@ -799,15 +771,8 @@ byte commandSDInfo(byte argc, const char **argv) {
 
 void executeCommand(const char *sid, byte argc, const char **argv)
 {
-    byte (*func)(byte, const char **) = NULL;
-
-    // search for command and execute if found
-    for (byte i = 0; commands[i].name != NULL; i++) {
-        if (strcmp(commands[i].name, argv[0]) == 0) {
-            func = commands[i].func;
-            break;
-        }
-    }
+    Command command;
+    bool found = findCommand(argv[0], command);
 
     // marks the beginning of a response packet.
     SerialUSB.print("<<<- sid=");
@@ -815,10 +780,12 @@ void executeCommand(const char *sid, byte argc, const char **argv)
     SerialUSB.print(' ');
     SerialUSB.println(argv[0]);
 
-    if (func != NULL) {
-        func(argc, argv);
-    } else {
+    if (!found) {
         SerialUSB.println("invalid command");
+    } else if (!validCommandArgs(command, argc, argv)) {
+        SerialUSB.println("invalid args");
+    } else if (command.func(argc, argv) == ERROR_INVALID_ARGC) {
+        SerialUSB.println("invalid args");
     }
 
     // marks the end of a response packet.